@@ -45,6 +45,14 @@ class UdisksBaseTest(udiskstestcase.UdisksTestCase):
         self.assertEqual({str(s) for s in fss.value},
                          {'nilfs2', 'btrfs', 'swap', 'ext3', 'udf', 'xfs', 'minix', 'ext2', 'ext4', 'f2fs', 'reiserfs', 'ntfs', 'vfat', 'exfat'})
 
+    def test_40_probe_statistics(self):
+        stats = self.get_property(self.manager_obj, '.Manager', 'ProbeStatistics')
+        self.assertEqual(set(stats.value.keys()),
+                         {'probes', 'probes-timed-out', 'probes-pending', 'probe-time-max'})
+        # none of the test devices should hang
+        self.assertEqual(stats.value['probes-pending'], 0)
+        self.assertGreaterEqual(stats.value['probes'], stats.value['probes-timed-out'])
+
     def test_80_device_presence(self):
         '''Test the debug devices are present on the bus'''
         for d in self.vdevs:
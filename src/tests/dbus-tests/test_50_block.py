@@ -48,6 +48,104 @@ class UdisksBlockTest(udiskstestcase.UdisksTestCase):
         _ret, sys_fstype = self.run_command('lsblk -d -no FSTYPE %s' % self.vdevs[0])
         self.assertEqual(sys_fstype, '')
 
+    def test_format_many(self):
+
+        disks = [self.get_object('/block_devices/' + os.path.basename(dev)) for dev in self.vdevs[:3]]
+        for disk in disks:
+            self.assertIsNotNone(disk)
+
+        manager = self.get_interface('/Manager', '.Manager')
+        devices = dbus.Array([(disk.object_path, 'ext4', self.no_options) for disk in disks],
+                             signature='(osa{sv})')
+        d = dbus.Dictionary(signature='sv')
+        d['max-concurrent'] = dbus.UInt32(2)
+        results = manager.FormatMany(devices, d)
+        for disk in disks:
+            self.addCleanup(self._clean_format, disk)
+
+        # results come back in the same order as the devices
+        self.assertEqual(len(results), len(disks))
+        for disk, (path, job, success, message) in zip(disks, results):
+            self.assertEqual(path, disk.object_path)
+            self.assertTrue(job.startswith(self.path_prefix + '/jobs/'))
+            self.assertTrue(success)
+            self.assertEqual(message, '')
+
+            fstype = self.get_property(disk, '.Block', 'IdType')
+            fstype.assertEqual('ext4')
+
+        # listing a device twice is rejected before anything is formatted
+        devices = dbus.Array([(disks[0].object_path, 'xfs', self.no_options)] * 2,
+                             signature='(osa{sv})')
+        msg = 'org.freedesktop.UDisks2.Error.Failed: Block device .* is listed more than once'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            manager.FormatMany(devices, self.no_options)
+
+        fstype = self.get_property(disks[0], '.Block', 'IdType')
+        fstype.assertEqual('ext4')
+
+    def test_format_many_config_items(self):
+
+        # this test will change /etc/fstab, revert the changes when it finishes
+        fstab = self.read_file('/etc/fstab')
+        self.addCleanup(self.write_file, '/etc/fstab', fstab)
+
+        disks = [self.get_object('/block_devices/' + os.path.basename(dev)) for dev in self.vdevs[:3]]
+        manager = self.get_interface('/Manager', '.Manager')
+
+        # the workers run concurrently, none of the entries may get lost
+        devices = dbus.Array(signature='(osa{sv})')
+        for n, disk in enumerate(disks):
+            conf = dbus.Dictionary({'dir': self.str_to_ay('/mnt/test%d' % n), 'type': self.str_to_ay('auto'),
+                                    'opts': self.str_to_ay('defaults'), 'freq': 0, 'passno': 0},
+                                   signature=dbus.Signature('sv'))
+            d = dbus.Dictionary({'config-items': dbus.Array([('fstab', conf)], signature='(sa{sv})')},
+                                signature='sv')
+            devices.append((disk.object_path, 'ext4', d))
+        d = dbus.Dictionary(signature='sv')
+        d['max-concurrent'] = dbus.UInt32(len(disks))
+        results = manager.FormatMany(devices, d)
+        for disk in disks:
+            self.addCleanup(self._clean_format, disk)
+
+        for (path, job, success, message) in results:
+            self.assertTrue(success)
+
+        new_fstab = self.read_file('/etc/fstab')
+        for n, disk in enumerate(disks):
+            self.assertIn('/mnt/test%d' % n, new_fstab)
+            conf = self.get_property(disk, '.Block', 'Configuration')
+            conf.assertTrue()
+
+    def test_format_discard(self):
+
+        disk = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
+        self.assertIsNotNone(disk)
+
+        # discard cannot be combined with erase
+        d = dbus.Dictionary(signature='sv')
+        d['discard'] = True
+        d['erase'] = 'zero'
+        msg = 'org.freedesktop.UDisks2.Error.Failed: The discard and erase options cannot be used together'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            disk.Format('ext4', d, dbus_interface=self.iface_prefix + '.Block')
+
+        d = dbus.Dictionary(signature='sv')
+        d['discard'] = True
+        d['label'] = 'DISCARDED'
+        try:
+            disk.Format('ext4', d, dbus_interface=self.iface_prefix + '.Block')
+        except dbus.exceptions.DBusException as e:
+            if 'org.freedesktop.UDisks2.Error.NotSupported' in str(e):
+                self.skipTest('Discard not supported on %s' % self.vdevs[0])
+            raise
+        self.addCleanup(self._clean_format, disk)
+
+        fstype = self.get_property(disk, '.Block', 'IdType')
+        fstype.assertEqual('ext4')
+        label = self.get_property(disk, '.Block', 'IdLabel')
+        label.assertEqual('DISCARDED')
+
     def test_format_parttype(self):
 
         disk = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
@@ -113,6 +211,65 @@ class UdisksBlockTest(udiskstestcase.UdisksTestCase):
         self.assertTrue(bool(mode & os.O_SYNC))
         os.close(fd)
 
+    def test_benchmark(self):
+
+        disk = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
+        self.assertIsNotNone(disk)
+
+        d = dbus.Dictionary(signature='sv')
+        d['write'] = True
+        d['sample-size'] = dbus.UInt64(16 * 1024**2)
+        d['random-duration'] = dbus.Double(0.5)
+        d['queue-depths'] = dbus.Array([1, 8], signature='u')
+        results = disk.Benchmark(d, dbus_interface=self.iface_prefix + '.Block')
+
+        self.assertGreater(results['sequential-read-rate'], 0)
+        self.assertGreater(results['sequential-write-rate'], 0)
+        self.assertEqual([r['queue-depth'] for r in results['random-read']], [1, 8])
+        for r in results['random-read']:
+            self.assertGreater(r['iops'], 0)
+            self.assertLessEqual(r['latency-p50'], r['latency-p99'])
+            self.assertLessEqual(r['latency-p99'], r['latency-max'])
+
+        # results are cached on the block object
+        cached = self.get_property(disk, '.Block', 'BenchmarkResults')
+        cached.assertEqual(results)
+
+        # write tests are refused on devices in use
+        disk.Format('xfs', self.no_options, dbus_interface=self.iface_prefix + '.Block')
+        self.addCleanup(self._clean_format, disk)
+        mnt_path = disk.Mount(self.no_options, dbus_interface=self.iface_prefix + '.Filesystem')
+        self.addCleanup(self.run_command, 'umount %s' % mnt_path)
+
+        msg = 'org.freedesktop.UDisks2.Error.DeviceBusy'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            disk.Benchmark(d, dbus_interface=self.iface_prefix + '.Block')
+
+    def test_copy_to(self):
+
+        source = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
+        self.assertIsNotNone(source)
+        target = self.get_object('/block_devices/' + os.path.basename(self.vdevs[1]))
+        self.assertIsNotNone(target)
+
+        # some data with a zeroed range in between, the target starts out dirty
+        self.run_command('dd if=/dev/zero of=%s bs=1M count=8 oflag=direct' % self.vdevs[0])
+        self.run_command('dd if=/dev/urandom of=%s bs=1M count=2 oflag=direct' % self.vdevs[0])
+        self.run_command('dd if=/dev/urandom of=%s bs=1M count=2 seek=6 oflag=direct' % self.vdevs[0])
+        self.run_command('dd if=/dev/urandom of=%s bs=1M count=8 oflag=direct' % self.vdevs[1])
+
+        for sparse in (True, False):
+            d = dbus.Dictionary({'sparse': sparse}, signature='sv')
+            source.CopyTo(target.object_path, d, dbus_interface=self.iface_prefix + '.Block')
+
+            ret, out = self.run_command('cmp -n %d %s %s' % (8 * 1024**2, self.vdevs[0], self.vdevs[1]))
+            self.assertEqual(ret, 0, out)
+
+        # copying a device onto itself makes no sense
+        msg = 'org.freedesktop.UDisks2.Error.Failed: Cannot copy a device onto itself'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            source.CopyTo(source.object_path, self.no_options, dbus_interface=self.iface_prefix + '.Block')
+
     def test_configuration_fstab(self):
 
         # this test will change /etc/fstab, we might want to revert the changes when it finishes
@@ -221,6 +378,104 @@ class UdisksBlockTest(udiskstestcase.UdisksTestCase):
         upd_conf = self.get_property(disk, '.Block', 'Configuration')
         upd_conf.assertFalse()
 
+    def test_configuration_batch(self):
+
+        # this test will change /etc/fstab, we might want to revert the changes when it finishes
+        fstab = self.read_file('/etc/fstab')
+        self.addCleanup(self.write_file, '/etc/fstab', fstab)
+
+        disks = [self.get_object('/block_devices/' + os.path.basename(dev)) for dev in self.vdevs[:2]]
+        for disk in disks:
+            disk.Format('xfs', self.no_options, dbus_interface=self.iface_prefix + '.Block')
+            self.addCleanup(self._clean_format, disk)
+
+        manager = self.get_interface('/Manager', '.Manager')
+        fstype = self.str_to_ay('xfs')
+        opts = self.str_to_ay('defaults')
+
+        # add one entry for each disk in a single call
+        changes = dbus.Array(signature='(osa(sa{sv}))')
+        for n, disk in enumerate(disks):
+            conf = dbus.Dictionary({'dir': self.str_to_ay('/mnt/test%d' % n), 'type': fstype,
+                                    'opts': opts, 'freq': 0, 'passno': 0},
+                                   signature=dbus.Signature('sv'))
+            changes.append((disk.object_path, 'add', [('fstab', conf)]))
+        manager.ChangeConfigurationItems(changes, self.no_options)
+
+        confs = []
+        for n, disk in enumerate(disks):
+            conf = self.get_property(disk, '.Block', 'Configuration')
+            conf.assertTrue()
+            self.assertEqual(conf.value[0][1]['dir'], self.str_to_ay('/mnt/test%d' % n))
+            confs.append(conf.value[0])
+        fstab_after_add = self.read_file('/etc/fstab')
+
+        # nothing is written if any of the changes fails
+        bogus = copy.deepcopy(confs[1])
+        bogus[1]['dir'] = self.str_to_ay('/mnt/nonexistent')
+        changes = dbus.Array([(disks[0].object_path, 'remove', [confs[0]]),
+                              ('/', 'remove', [bogus])],
+                             signature='(osa(sa{sv}))')
+        msg = "org.freedesktop.UDisks2.Error.Failed: Change 1: Didn't find entry to remove"
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            manager.ChangeConfigurationItems(changes, self.no_options)
+        self.assertEqual(self.read_file('/etc/fstab'), fstab_after_add)
+
+        # remove both entries again
+        changes = dbus.Array([('/', 'remove', [conf]) for conf in confs],
+                             signature='(osa(sa{sv}))')
+        manager.ChangeConfigurationItems(changes, self.no_options)
+        for disk in disks:
+            conf = self.get_property(disk, '.Block', 'Configuration')
+            conf.assertFalse()
+
+    def test_configuration_batch_write_failure(self):
+
+        # this test will change /etc/fstab and /etc/crypttab, revert the changes when it finishes
+        fstab = self.read_file('/etc/fstab')
+        self.addCleanup(self.write_file, '/etc/fstab', fstab)
+        if not os.path.exists('/etc/crypttab'):
+            self.write_file('/etc/crypttab', '')
+            self.addCleanup(os.remove, '/etc/crypttab')
+        crypttab = self.read_file('/etc/crypttab')
+        self.addCleanup(self.write_file, '/etc/crypttab', crypttab)
+
+        disks = [self.get_object('/block_devices/' + os.path.basename(dev)) for dev in self.vdevs[:2]]
+        disks[0].Format('xfs', {'encrypt.passphrase': 'test'}, dbus_interface=self.iface_prefix + '.Block')
+        self.addCleanup(self._clean_format, disks[0])
+        self.addCleanup(self._close_luks, disks[0])
+        disks[1].Format('xfs', self.no_options, dbus_interface=self.iface_prefix + '.Block')
+        self.addCleanup(self._clean_format, disks[1])
+
+        # make replacing /etc/crypttab fail after the passphrase file has been written
+        ret, _ = self.run_command('chattr +i /etc/crypttab')
+        if ret != 0:
+            self.skipTest('Cannot make /etc/crypttab immutable')
+        self.addCleanup(self.run_command, 'chattr -i /etc/crypttab')
+
+        keys_before = set(os.listdir('/etc/luks-keys')) if os.path.exists('/etc/luks-keys') else set()
+        etc_before = set(os.listdir('/etc')) - {'luks-keys'}
+
+        crypttab_conf = dbus.Dictionary({'passphrase-contents': self.str_to_ay('test'),
+                                         'options': self.str_to_ay('verify')},
+                                        signature=dbus.Signature('sv'))
+        fstab_conf = dbus.Dictionary({'dir': self.str_to_ay('/mnt/test'), 'type': self.str_to_ay('xfs'),
+                                      'opts': self.str_to_ay('defaults'), 'freq': 0, 'passno': 0},
+                                     signature=dbus.Signature('sv'))
+        changes = dbus.Array([(disks[1].object_path, 'add', [('fstab', fstab_conf)]),
+                              (disks[0].object_path, 'add', [('crypttab', crypttab_conf)])],
+                             signature='(osa(sa{sv}))')
+        manager = self.get_interface('/Manager', '.Manager')
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, 'Error renaming temp file'):
+            manager.ChangeConfigurationItems(changes, self.no_options)
+
+        # neither file was changed, the new passphrase file and the temporary files are gone
+        self.assertEqual(self.read_file('/etc/fstab'), fstab)
+        self.assertEqual(self.read_file('/etc/crypttab'), crypttab)
+        keys_after = set(os.listdir('/etc/luks-keys')) if os.path.exists('/etc/luks-keys') else set()
+        self.assertEqual(keys_after, keys_before)
+        self.assertEqual(set(os.listdir('/etc')) - {'luks-keys'}, etc_before)
+
     def test_rescan(self):
 
         disk = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
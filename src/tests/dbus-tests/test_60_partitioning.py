@@ -1,4 +1,5 @@
 import dbus
+import glob
 import os
 import time
 
@@ -245,6 +246,117 @@ class UdisksPartitionTableTest(udiskstestcase.UdisksTestCase):
         _ret, sys_fstype = self.run_command('lsblk -d -no FSTYPE /dev/%s' % part_name)
         self.assertEqual(sys_fstype, 'xfs')
 
+    def test_create_partitions(self):
+        disk = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
+        self.assertIsNotNone(disk)
+
+        # create gpt partition table
+        self._create_format(disk, 'gpt')
+        self.addCleanup(self._remove_format, disk)
+
+        gpt_type = '933ac7e1-2eb4-4f13-b844-0e14e2aef915'
+        specs = dbus.Array([dbus.Struct((dbus.UInt64((1 + 10 * i) * 1024**2), dbus.UInt64(10 * 1024**2),
+                                         gpt_type, 'part%d' % i), signature='ttss')
+                            for i in range(4)], signature='(ttss)')
+
+        # create all partitions at once
+        paths = disk.CreatePartitions(specs, self.no_options,
+                                      dbus_interface=self.iface_prefix + '.PartitionTable')
+        self.assertEqual(len(paths), 4)
+
+        self.udev_settle()
+        for i, path in enumerate(paths):
+            part = self.bus.get_object(self.iface_prefix, path)
+            self.assertIsNotNone(part)
+
+            # check dbus properties
+            size = self.get_property(part, '.Partition', 'Size')
+            size.assertEqual(10 * 1024**2)
+
+            offset = self.get_property(part, '.Partition', 'Offset')
+            offset.assertEqual((1 + 10 * i) * 1024**2)
+
+            dbus_name = self.get_property(part, '.Partition', 'Name')
+            dbus_name.assertEqual('part%d' % i)
+
+        # with one of the partitions in use, the new partitions must still show up
+        with open('/dev/' + paths[0].split('/')[-1], 'rb'):
+            spec = dbus.Array([dbus.Struct((dbus.UInt64(41 * 1024**2), dbus.UInt64(10 * 1024**2),
+                                            gpt_type, 'busy'), signature='ttss')], signature='(ttss)')
+            busy_paths = disk.CreatePartitions(spec, self.no_options,
+                                               dbus_interface=self.iface_prefix + '.PartitionTable')
+            self.assertEqual(len(busy_paths), 1)
+            part = self.bus.get_object(self.iface_prefix, busy_paths[0])
+            offset = self.get_property(part, '.Partition', 'Offset')
+            offset.assertEqual(41 * 1024**2)
+
+        # names are not supported on MBR
+        self._create_format(disk, 'dos')
+        spec = dbus.Array([dbus.Struct((dbus.UInt64(1024**2), dbus.UInt64(10 * 1024**2), '', 'name'),
+                                       signature='ttss')], signature='(ttss)')
+        msg = 'MBR partition table does not support names'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            disk.CreatePartitions(spec, self.no_options,
+                                  dbus_interface=self.iface_prefix + '.PartitionTable')
+
+
+    def test_create_aligned_partition(self):
+        disk = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
+        self.assertIsNotNone(disk)
+
+        self._create_format(disk, 'gpt')
+        self.addCleanup(self._remove_format, disk)
+
+        # unaligned start and end are moved to the requested alignment
+        d = dbus.Dictionary(signature='sv')
+        d['alignment'] = dbus.UInt64(4 * 1024**2)
+        path = disk.CreatePartition(dbus.UInt64(1024**2 + 512), dbus.UInt64(20 * 1024**2),
+                                    '', '', d, dbus_interface=self.iface_prefix + '.PartitionTable')
+        self.udev_settle()
+        part = self.bus.get_object(self.iface_prefix, path)
+        self.assertIsNotNone(part)
+
+        offset = self.get_property(part, '.Partition', 'Offset')
+        offset.assertEqual(4 * 1024**2)
+
+        size = self.get_property(part, '.Partition', 'Size')
+        size.assertEqual(16 * 1024**2)
+
+        # the alignment must be a multiple of the logical block size
+        d['alignment'] = dbus.UInt64(1000)
+        msg = 'is not a multiple of the logical block size'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            disk.CreatePartition(dbus.UInt64(40 * 1024**2), dbus.UInt64(10 * 1024**2),
+                                 '', '', d, dbus_interface=self.iface_prefix + '.PartitionTable')
+
+    def test_create_partition_bogus_io_size(self):
+        # some USB bridges report 0xFFFF sectors as the optimal I/O size
+        res, _ = self.run_command('modprobe scsi_debug dev_size_mb=64 opt_blks=65535')
+        if res != 0:
+            self.skipTest('scsi_debug not available')
+        self.addCleanup(self.run_command, 'modprobe -r scsi_debug')
+        self.udev_settle()
+
+        dirs = []
+        while len(dirs) < 1:
+            dirs = glob.glob('/sys/bus/pseudo/drivers/scsi_debug/adapter*/host*/target*/*:*/block')
+            time.sleep(0.1)
+        dev = os.listdir(dirs[0])[0]
+        self.assertEqual(self.read_file('/sys/block/%s/queue/optimal_io_size' % dev).strip(), '33553920')
+
+        disk = self.get_object('/block_devices/' + dev)
+        self.assertIsNotNone(disk)
+        self._create_format(disk, 'gpt')
+
+        # the bogus value is ignored and the default 1 MiB alignment used
+        path = disk.CreatePartition(dbus.UInt64(0), dbus.UInt64(10 * 1024**2), '', '',
+                                    self.no_options, dbus_interface=self.iface_prefix + '.PartitionTable')
+        self.udev_settle()
+        part = self.bus.get_object(self.iface_prefix, path)
+        self.assertIsNotNone(part)
+
+        offset = self.get_property(part, '.Partition', 'Offset')
+        offset.assertEqual(1024**2)
 
 class UdisksPartitionTest(udiskstestcase.UdisksTestCase):
     '''This is a basic partition test suite'''
@@ -143,6 +143,42 @@ class UdisksFSTestCase(udiskstestcase.UdisksTestCase):
         disk.Unmount(self.no_options, dbus_interface=self.iface_prefix + '.Filesystem')
         self.assertFalse(os.path.ismount(mnt_path))
 
+    def test_trim(self):
+        if not self._can_create:
+            self.skipTest('Cannot create %s filesystem' % self._fs_name)
+
+        if not self._can_mount:
+            self.skipTest('Cannot mount %s filesystem' % self._fs_name)
+
+        disk = self.get_object('/block_devices/' + os.path.basename(self.vdevs[0]))
+        self.assertIsNotNone(disk)
+
+        disk.Format(self._fs_name, self.no_options, dbus_interface=self.iface_prefix + '.Block')
+        self.addCleanup(self._clean_format, disk)
+
+        # only mounted filesystems can be trimmed
+        msg = 'org.freedesktop.UDisks2.Error.NotMounted'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            disk.Trim(self.no_options, dbus_interface=self.iface_prefix + '.Filesystem')
+
+        d = dbus.Dictionary(signature='sv')
+        d['fstype'] = self._fs_name
+        disk.Mount(d, dbus_interface=self.iface_prefix + '.Filesystem')
+        self.addCleanup(self._unmount, self.vdevs[0])
+
+        # trim in small ranges to exercise the range loop
+        d = dbus.Dictionary(signature='sv')
+        d['range-size'] = dbus.UInt64(16 * 1024**2)
+        try:
+            trimmed = disk.Trim(d, dbus_interface=self.iface_prefix + '.Filesystem')
+        except dbus.exceptions.DBusException as e:
+            if 'org.freedesktop.UDisks2.Error.NotSupported' in str(e):
+                self.skipTest('Trim not supported for %s on %s' % (self._fs_name, self.vdevs[0]))
+            raise
+        self.assertGreaterEqual(trimmed, 0)
+
+        disk.Unmount(self.no_options, dbus_interface=self.iface_prefix + '.Filesystem')
+
     def test_mount_fstab(self):
         if not self._can_create:
             self.skipTest('Cannot create %s filesystem' % self._fs_name)
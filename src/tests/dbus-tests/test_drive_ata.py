@@ -180,3 +180,31 @@ class UdisksDriveAtaTest(UdisksTestCase):
             updated = self.get_property(drive_obj, ".Drive.Ata", "SmartUpdated")
             updated.assertTrue()
             self.assertGreater(int(updated.value), orig)
+
+    @unittest.skipUnless(smart_supported, "No disks supporting S.M.A.R.T. available")
+    def test_smart_attribute_history(self):
+        for disk in smart_supported:
+            drive_name = self.get_drive_name(self.get_device(disk))
+            drive_obj = self.get_object("/drives/%s" % drive_name)
+            drive_ata = self.get_interface(drive_obj, ".Drive.Ata")
+
+            start = int(time.time())
+            time.sleep(1)
+            drive_ata.SmartUpdate(self.no_options)
+            time.sleep(1)
+            drive_ata.SmartUpdate(self.no_options)
+
+            history = drive_ata.SmartGetAttributeHistory(dbus.UInt64(start), self.no_options)
+            self.assertEqual(len(history), 2)
+            self.assertLess(history[0][0], history[1][0])
+
+            # the newest sample matches the current attributes
+            updated = self.get_property(drive_obj, ".Drive.Ata", "SmartUpdated")
+            updated.assertEqual(history[-1][0])
+            attrs = drive_ata.SmartGetAttributes(self.no_options)
+            self.assertEqual(sorted((a[0], a[3], a[4], a[6]) for a in attrs),
+                             sorted(tuple(a) for a in history[-1][1]))
+
+            # nothing is returned for the future
+            history = drive_ata.SmartGetAttributeHistory(dbus.UInt64(int(time.time()) + 3600), self.no_options)
+            self.assertEqual(len(history), 0)
@@ -0,0 +1,88 @@
+import os
+import dbus
+import re
+import struct
+import tempfile
+import unittest
+
+from udiskstestcase import UdisksTestCase
+
+nvme_disks = set(dev for dev in os.listdir("/dev") if re.match(r'nvme[0-9]+n[0-9]+$', dev))
+
+class UdisksDriveNVMeTest(UdisksTestCase):
+    '''Noninvasive tests for the Drive.NVMe interface'''
+
+    def _make_blob(self, critical_warning, temperature, spare, spare_thresh, used,
+                   power_on_hours, media_errors, error_entries=()):
+        '''Build a SMART / Health Information log page followed by Error Information log entries'''
+        log = bytearray(512)
+        struct.pack_into("<BHBBB", log, 0, critical_warning, temperature, spare, spare_thresh, used)
+        struct.pack_into("<Q", log, 128, power_on_hours)
+        struct.pack_into("<Q", log, 160, media_errors)
+        struct.pack_into("<Q", log, 176, len(error_entries))
+        for count, lba in error_entries:
+            entry = bytearray(64)
+            struct.pack_into("<QHHHHQI", entry, 0, count, 1, 0x10, 0x4004, 0, lba, 1)
+            log += entry
+        return bytes(log)
+
+    def _simulate(self, drive_nvme, blob):
+        with tempfile.NamedTemporaryFile(suffix=".blob") as f:
+            f.write(blob)
+            f.flush()
+            drive_nvme.SmartUpdate(dbus.Dictionary({"nvme_smart_blob": f.name}, signature="sv"))
+
+    @unittest.skipUnless(nvme_disks, "No NVMe disks available")
+    def test_iface_present(self):
+        for disk in nvme_disks:
+            drive_name = self.get_drive_name(self.get_device(disk))
+            drive_obj = self.get_object("/drives/%s" % drive_name)
+            drive_intro = dbus.Interface(drive_obj, "org.freedesktop.DBus.Introspectable")
+            intro_data = drive_intro.Introspect()
+            self.assertIn('interface name="org.freedesktop.UDisks2.Drive.NVMe"', intro_data)
+            self.assertNotIn('interface name="org.freedesktop.UDisks2.Drive.Ata"', intro_data)
+
+    @unittest.skipUnless(nvme_disks, "No NVMe disks available")
+    def test_smart_simulate(self):
+        for disk in nvme_disks:
+            drive_name = self.get_drive_name(self.get_device(disk))
+            drive_obj = self.get_object("/drives/%s" % drive_name)
+            drive_nvme = self.get_interface(drive_obj, ".Drive.NVMe")
+
+            # spare below threshold and media in read-only mode
+            blob = self._make_blob(0x09, 318, 5, 10, 104, 1000, 3,
+                                   error_entries=((7, 1234), (6, 5678)))
+            self._simulate(drive_nvme, blob)
+
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartFailing").assertTrue()
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartCriticalWarning").assertEqual(["spare", "readonly"])
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartTemperature").assertEqual(318.0)
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartAvailableSpare").assertEqual(5)
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartSpareThreshold").assertEqual(10)
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartPercentUsed").assertEqual(104)
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartPowerOnSeconds").assertEqual(1000 * 3600)
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartMediaErrors").assertEqual(3)
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartNumErrorLogEntries").assertEqual(2)
+
+            attrs = drive_nvme.SmartGetAttributes(self.no_options)
+            self.assertEqual(attrs["percent_used"], 104)
+            self.assertEqual(attrs["power_on_hours"], 1000)
+
+            entries = drive_nvme.SmartGetErrorLog(self.no_options)
+            self.assertEqual(len(entries), 2)
+            self.assertEqual(entries[0]["error_count"], 7)
+            self.assertEqual(entries[0]["lba"], 1234)
+
+            # and back to the real data
+            drive_nvme.SmartUpdate(self.no_options)
+            self.get_property(drive_obj, ".Drive.NVMe", "SmartUpdated").assertTrue()
+
+    @unittest.skipUnless(nvme_disks, "No NVMe disks available")
+    def test_smart_simulate_short_blob(self):
+        for disk in nvme_disks:
+            drive_name = self.get_drive_name(self.get_device(disk))
+            drive_nvme = self.get_interface("/drives/%s" % drive_name, ".Drive.NVMe")
+
+            msg = 'too short'
+            with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+                self._simulate(drive_nvme, bytes(100))
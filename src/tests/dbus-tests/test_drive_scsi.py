@@ -0,0 +1,83 @@
+import dbus
+import glob
+import os
+import struct
+import tempfile
+import time
+
+import udiskstestcase
+
+
+class UdisksDriveScsiTest(udiskstestcase.UdisksTestCase):
+    '''Tests for the Drive.Scsi interface using a scsi_debug disk'''
+
+    def setUp(self):
+        # ptype=0 - created device will be a disk, one new target and host
+        res, _ = self.run_command('modprobe scsi_debug ptype=0 num_tgts=1 add_host=1')
+        self.assertEqual(res, 0)
+        self.udev_settle()
+        dirs = []
+        # wait until directory appears
+        while len(dirs) < 1:
+            dirs = glob.glob('/sys/bus/pseudo/drivers/scsi_debug/adapter*/host*/target*/*:*/block')
+            time.sleep(0.1)
+
+        devs = os.listdir(dirs[0])
+        self.assertEqual(len(devs), 1)
+        self.dev = '/dev/' + devs[0]
+        self.assertTrue(os.path.exists(self.dev))
+
+        drive_name = self.get_drive_name(self.get_device(self.dev))
+        self.drive_obj = self.get_object('/drives/' + os.path.basename(drive_name))
+        self.drive_scsi = self.get_interface(self.drive_obj, '.Drive.Scsi')
+
+    def tearDown(self):
+        device = self.dev.split('/')[-1]
+        if os.path.exists('/sys/block/' + device):
+            self.write_file('/sys/block/%s/device/delete' % device, '1')
+            while os.path.exists(self.dev):
+                time.sleep(0.1)
+            self.udev_settle()
+            self.run_command('modprobe -r scsi_debug')
+
+    def _log_page(self, page_code, params):
+        '''Build a log page from a list of (parameter code, value bytes)'''
+        data = b''.join(struct.pack('>HBB', code, 0, len(value)) + value for code, value in params)
+        return struct.pack('>BBH', page_code, 0, len(data)) + data
+
+    def test_10_smart_update(self):
+        # scsi_debug reports 38 C with a reference temperature of 65 C
+        self.drive_scsi.SmartUpdate(self.no_options)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartUpdated').assertTrue()
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartTemperature').assertEqual(38 + 273.15)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartTripTemperature').assertEqual(65 + 273.15)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartFailing').assertFalse()
+
+    def test_20_smart_replay(self):
+        blob = self._log_page(0x0d, [(0x0000, b'\x00\x2a'), (0x0001, b'\x00\x46')])
+        blob += self._log_page(0x03, [(0x0003, struct.pack('>I', 1234)), (0x0006, struct.pack('>Q', 5))])
+        blob += self._log_page(0x0e, [(0x0003, struct.pack('>I', 50000)), (0x0004, struct.pack('>I', 321))])
+        # FAILURE PREDICTION THRESHOLD EXCEEDED (FALSE)
+        blob += self._log_page(0x2f, [(0x0000, b'\x5d\xff\x2a')])
+
+        with tempfile.NamedTemporaryFile(suffix='.blob') as f:
+            f.write(blob)
+            f.flush()
+            self.drive_scsi.SmartUpdate(dbus.Dictionary({'scsi_log_blob': f.name}, signature='sv'))
+
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartFailing').assertTrue()
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartInformationalException').assertEqual(0x5dff)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartTemperature').assertEqual(42 + 273.15)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartTripTemperature').assertEqual(70 + 273.15)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartReadErrorsCorrected').assertEqual(1234)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartReadErrorsUncorrected').assertEqual(5)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartWriteErrorsUncorrected').assertEqual(0)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartStartStopCyclesSpecified').assertEqual(50000)
+        self.get_property(self.drive_obj, '.Drive.Scsi', 'SmartStartStopCycles').assertEqual(321)
+
+        # a truncated page is rejected
+        with tempfile.NamedTemporaryFile(suffix='.blob') as f:
+            f.write(blob[:-1])
+            f.flush()
+            with self.assertRaisesRegex(dbus.exceptions.DBusException, 'Truncated log page'):
+                self.drive_scsi.SmartUpdate(dbus.Dictionary({'scsi_log_blob': f.name}, signature='sv'))
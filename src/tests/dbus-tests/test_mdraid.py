@@ -376,6 +376,39 @@ class RAID1TestCase(RAIDLevel):
         sys_action = self.read_file('/sys/block/%s/md/last_sync_action' % md_name).strip()
         self.assertEqual(sys_action, 'check')
 
+        # and the result of the check should be recorded
+        self.get_property(array, '.MDRaid', 'ScrubState').assertEqual('idle')
+        self.get_property(array, '.MDRaid', 'ScrubLastMismatchCount').assertEqual(0)
+        last_completed = self.get_property_raw(array, '.MDRaid', 'ScrubLastCompleted')
+        self.assertAlmostEqual(last_completed, time.time(), delta=60)
+        self.addCleanup(self.run_command, 'rm -f /var/lib/udisks2/mdraid-scrub-%s' %
+                        self.get_property_raw(array, '.MDRaid', 'UUID'))
+
+    def test_format_stripe_alignment(self):
+        if self.level is None:
+            self.skipTest('Abstract class for RAID tests.')
+
+        array_name = 'udisks_test_stripe'
+        self._array_create(array_name)
+
+        md_name = os.path.realpath('/dev/md/%s' % array_name).split('/')[-1]
+        md_block = self.get_object('/block_devices/' + md_name)
+        self.assertIsNotNone(md_block)
+
+        md_block.Format('ext4', self.no_options, dbus_interface=self.iface_prefix + '.Block')
+
+        if self.level == 'raid10':
+            data_disks = len(self.members) // 2
+        else:
+            data_disks = len(self.members) - {'raid4': 1, 'raid5': 1, 'raid6': 2}[self.level]
+        stride = self.chunk_size // 4096
+
+        _ret, out = self.run_command('dumpe2fs -h /dev/%s' % md_name)
+        # the stride is given in 4 KiB blocks, even on small arrays
+        self.assertIn('Block size:               4096', out)
+        self.assertIn('RAID stride:              %d' % stride, out)
+        self.assertIn('RAID stripe width:        %d' % (stride * data_disks), out)
+
 
 class RAID4TestCase(RAIDLevel):
     level = 'raid4'
@@ -396,6 +429,33 @@ class RAID5TestCase(RAIDLevel):
     def size(self):
         return self.smallest_member.size * (len(self.members) - 1)
 
+    def test_configuration(self):
+        array_name = 'udisks_test_conf'
+        array = self._array_create(array_name)
+
+        # get md_name ('/dev/md12X')
+        md_name = os.path.realpath('/dev/md/%s' % array_name).split('/')[-1]
+
+        uuid = self.get_property_raw(array, '.MDRaid', 'UUID')
+        conf_path = '/etc/udisks2/mdraid-%s.conf' % uuid
+        self.addCleanup(self.run_command, 'rm -f %s' % conf_path)
+
+        conf = dbus.Dictionary({'md-stripe-cache-size': dbus.Int32(1024),
+                                'md-sync-speed-max': dbus.Int32(50000)}, signature='sv')
+        array.SetConfiguration(conf, self.no_options, dbus_interface=self.iface_prefix + '.MDRaid')
+
+        self.assertTrue(os.path.exists(conf_path))
+        self.get_property(array, '.MDRaid', 'StripeCacheSize').assertEqual(1024)
+        self.get_property(array, '.MDRaid', 'SyncSpeedMax').assertEqual(50000)
+        sys_cache = self.read_file('/sys/block/%s/md/stripe_cache_size' % md_name).strip()
+        self.assertEqual(sys_cache, '1024')
+
+        # invalid bitmap chunk size is rejected
+        conf = dbus.Dictionary({'md-bitmap-chunk-size': dbus.Int32(1000)}, signature='sv')
+        msg = 'Invalid value 1000 for md-bitmap-chunk-size'
+        with self.assertRaisesRegex(dbus.exceptions.DBusException, msg):
+            array.SetConfiguration(conf, self.no_options, dbus_interface=self.iface_prefix + '.MDRaid')
+
 
 class RAID6TestCase(RAIDLevel):
     level = 'raid6'
@@ -30,6 +30,7 @@
 #include <udisksdaemon.h>
 #include <udisksspawnedjob.h>
 #include <udisksthreadedjob.h>
+#include <udiskslinuxdevice.h>
 
 #include "testutil.h"
 
@@ -597,6 +598,115 @@ test_threaded_job_override_signal_handler (void)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Any device will do as long as it is always present */
+#define SYSFS_TEST_DEVICE "/sys/devices/virtual/mem/null"
+
+static UDisksLinuxDevice *
+get_sysfs_test_device (void)
+{
+  GUdevClient *client;
+  GUdevDevice *udev_device;
+  UDisksLinuxDevice *device;
+
+  client = g_udev_client_new (NULL);
+  udev_device = g_udev_client_query_by_sysfs_path (client, SYSFS_TEST_DEVICE);
+  g_assert (udev_device != NULL);
+  device = udisks_linux_device_new_with_ata_identify (udev_device, NULL, NULL);
+  g_object_unref (udev_device);
+  g_object_unref (client);
+
+  return device;
+}
+
+static void
+test_linux_device_read_sysfs_attr (void)
+{
+  UDisksLinuxDevice *device;
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gchar buf[64];
+  gchar small_buf[2];
+
+  device = get_sysfs_test_device ();
+
+  g_assert (g_file_get_contents (SYSFS_TEST_DEVICE "/dev", &contents, NULL, NULL));
+  g_strchomp (contents);
+
+  g_assert (udisks_linux_device_read_sysfs_attr (device, "dev", buf, sizeof (buf), &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (buf, ==, contents);
+  g_assert_cmpint (device->sysfs_dirfd, !=, -1);
+
+  /* the directory is kept open */
+  g_assert (udisks_linux_device_read_sysfs_attr (device, "dev", buf, sizeof (buf), &error));
+  g_assert_cmpstr (buf, ==, contents);
+
+  /* values are truncated to fit */
+  g_assert (udisks_linux_device_read_sysfs_attr (device, "dev", small_buf, sizeof (small_buf), &error));
+  g_assert_cmpint (small_buf[0], ==, contents[0]);
+  g_assert_cmpint (small_buf[1], ==, '\0');
+
+  g_assert_cmpint (udisks_linux_device_read_sysfs_attr_as_int (device, "dev", &error), ==, atoi (contents));
+  g_assert_no_error (error);
+
+  g_assert (!udisks_linux_device_read_sysfs_attr (device, "no-such-attr", buf, sizeof (buf), &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_cmpstr (buf, ==, "");
+  g_clear_error (&error);
+
+  g_free (contents);
+  g_object_unref (device);
+}
+
+static void
+test_linux_device_read_sysfs_attr_perf (void)
+{
+  UDisksLinuxDevice *device;
+  GTimer *timer;
+  gdouble elapsed_get_contents;
+  gdouble elapsed_read_sysfs_attr;
+  gchar buf[64];
+  guint n;
+  const guint iterations = 100000;
+
+  if (!g_test_perf ())
+    return;
+
+  device = get_sysfs_test_device ();
+  timer = g_timer_new ();
+
+  /* what udisks_linux_mdraid_update() used to do for every attribute */
+  g_timer_start (timer);
+  for (n = 0; n < iterations; n++)
+    {
+      gchar *path;
+      gchar *contents;
+
+      path = g_strdup_printf ("%s/%s", g_udev_device_get_sysfs_path (device->udev_device), "dev");
+      g_assert (g_file_get_contents (path, &contents, NULL, NULL));
+      g_strstrip (contents);
+      g_free (contents);
+      g_free (path);
+    }
+  elapsed_get_contents = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (n = 0; n < iterations; n++)
+    g_assert (udisks_linux_device_read_sysfs_attr (device, "dev", buf, sizeof (buf), NULL));
+  elapsed_read_sysfs_attr = g_timer_elapsed (timer, NULL);
+
+  g_test_minimized_result (elapsed_read_sysfs_attr * G_USEC_PER_SEC / iterations,
+                           "udisks_linux_device_read_sysfs_attr(): %.3f usec per read",
+                           elapsed_read_sysfs_attr * G_USEC_PER_SEC / iterations);
+  g_test_message ("g_file_get_contents(): %.3f usec per read",
+                  elapsed_get_contents * G_USEC_PER_SEC / iterations);
+
+  g_timer_destroy (timer);
+  g_object_unref (device);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 int
 main (int    argc,
       char **argv)
@@ -634,6 +744,8 @@ main (int    argc,
   g_test_add_func ("/udisks/daemon/threaded_job/cancelled_at_start", test_threaded_job_cancelled_at_start);
   g_test_add_func ("/udisks/daemon/threaded_job/cancelled_midway", test_threaded_job_cancelled_midway);
   g_test_add_func ("/udisks/daemon/threaded_job/override_signal_handler", test_threaded_job_override_signal_handler);
+  g_test_add_func ("/udisks/daemon/linux_device/read_sysfs_attr", test_linux_device_read_sysfs_attr);
+  g_test_add_func ("/udisks/daemon/linux_device/read_sysfs_attr_perf", test_linux_device_read_sysfs_attr_perf);
 
   ret = g_test_run();
 
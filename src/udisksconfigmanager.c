@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 
@@ -34,6 +35,16 @@ struct _UDisksConfigManager {
 
   UDisksModuleLoadPreference load_preference;
   GList *modules;
+
+  guint trim_interval;
+  gboolean persist_smart_history;
+  guint mdraid_sync_progress_interval;
+
+  guint mdraid_scrub_interval;
+  guint mdraid_scrub_window_start;
+  guint mdraid_scrub_window_end;
+  guint mdraid_scrub_speed_max;
+  guint mdraid_scrub_max_per_drive;
 };
 
 struct _UDisksConfigManagerClass {
@@ -53,6 +64,16 @@ enum
 static const gchar *modules_group_name = PACKAGE_NAME_UDISKS2;
 static const gchar *modules_key = "modules";
 static const gchar *modules_load_preference_key = "modules_load_preference";
+static const gchar *trim_interval_key = "trim_interval";
+static const gchar *persist_smart_history_key = "persist_smart_history";
+static const gchar *mdraid_sync_progress_interval_key = "mdraid_sync_progress_interval";
+static const gchar *mdraid_scrub_interval_key = "mdraid_scrub_interval";
+static const gchar *mdraid_scrub_window_key = "mdraid_scrub_window";
+static const gchar *mdraid_scrub_speed_max_key = "mdraid_scrub_speed_max";
+static const gchar *mdraid_scrub_max_per_drive_key = "mdraid_scrub_max_per_drive";
+
+#define MDRAID_SYNC_PROGRESS_INTERVAL_DEFAULT 10
+#define MDRAID_SCRUB_MAX_PER_DRIVE_DEFAULT 1
 
 static void
 udisks_config_manager_get_property (GObject    *object,
@@ -102,6 +123,27 @@ udisks_config_manager_set_property (GObject      *object,
     }
 }
 
+/* Parses a "HH:MM-HH:MM" time window into minutes since midnight */
+static gboolean
+parse_time_window (const gchar *window,
+                   guint       *out_start,
+                   guint       *out_end)
+{
+  guint start_hour, start_minute, end_hour, end_minute;
+  gchar tail;
+
+  if (sscanf (window, "%u:%u-%u:%u%c",
+              &start_hour, &start_minute, &end_hour, &end_minute, &tail) != 4)
+    return FALSE;
+
+  if (start_hour > 23 || start_minute > 59 || end_hour > 23 || end_minute > 59)
+    return FALSE;
+
+  *out_start = start_hour * 60 + start_minute;
+  *out_end = end_hour * 60 + end_minute;
+  return TRUE;
+}
+
 /* TODO: move to util */
 static gchar *
 strtrim (const gchar *s)
@@ -142,6 +184,13 @@ udisks_config_manager_constructed (GObject *object)
   gchar **modules;
   gchar **modules_tmp;
   gsize length;
+  gint trim_interval;
+  gint mdraid_sync_progress_interval;
+  gint mdraid_scrub_value;
+  gchar *mdraid_scrub_window;
+
+  manager->mdraid_sync_progress_interval = MDRAID_SYNC_PROGRESS_INTERVAL_DEFAULT;
+  manager->mdraid_scrub_max_per_drive = MDRAID_SCRUB_MAX_PER_DRIVE_DEFAULT;
 
   config_file = g_key_file_new ();
   g_key_file_set_list_separator (config_file, ',');
@@ -226,6 +275,89 @@ udisks_config_manager_constructed (GObject *object)
           manager->load_preference = UDISKS_MODULE_LOAD_ONDEMAND;
         }
 
+      /* Read the interval of scheduled trims, 0 (the default) disables them. */
+      trim_interval = g_key_file_get_integer (config_file,
+                                              modules_group_name,
+                                              trim_interval_key,
+                                              &error);
+      if (error == NULL && trim_interval > 0)
+        {
+          manager->trim_interval = trim_interval;
+        }
+      else
+        {
+          g_clear_error (&error);
+          manager->trim_interval = 0;
+        }
+
+      /* Read whether SMART attribute history should survive daemon restarts. */
+      manager->persist_smart_history = g_key_file_get_boolean (config_file,
+                                                               modules_group_name,
+                                                               persist_smart_history_key,
+                                                               &error);
+      g_clear_error (&error);
+
+      /* Read how often the progress of running md RAID syncs is sampled, 0 disables sampling. */
+      mdraid_sync_progress_interval = g_key_file_get_integer (config_file,
+                                                              modules_group_name,
+                                                              mdraid_sync_progress_interval_key,
+                                                              &error);
+      if (error == NULL && mdraid_sync_progress_interval >= 0)
+        {
+          manager->mdraid_sync_progress_interval = mdraid_sync_progress_interval;
+        }
+      else
+        {
+          g_clear_error (&error);
+          manager->mdraid_sync_progress_interval = MDRAID_SYNC_PROGRESS_INTERVAL_DEFAULT;
+        }
+
+      /* Read the interval of scheduled md RAID scrubs in days, 0 (the default) disables them. */
+      mdraid_scrub_value = g_key_file_get_integer (config_file,
+                                                   modules_group_name,
+                                                   mdraid_scrub_interval_key,
+                                                   &error);
+      if (error == NULL && mdraid_scrub_value > 0)
+        manager->mdraid_scrub_interval = mdraid_scrub_value;
+      g_clear_error (&error);
+
+      /* Read the time of day scheduled scrubs may run in, unset means any time. */
+      mdraid_scrub_window = g_key_file_get_string (config_file,
+                                                   modules_group_name,
+                                                   mdraid_scrub_window_key,
+                                                   &error);
+      if (mdraid_scrub_window != NULL && strlen (g_strstrip (mdraid_scrub_window)) > 0)
+        {
+          if (!parse_time_window (mdraid_scrub_window,
+                                  &manager->mdraid_scrub_window_start,
+                                  &manager->mdraid_scrub_window_end))
+            {
+              udisks_warning ("Invalid value used for '%s': %s; scrubs may run at any time",
+                              mdraid_scrub_window_key, mdraid_scrub_window);
+              manager->mdraid_scrub_window_start = 0;
+              manager->mdraid_scrub_window_end = 0;
+            }
+        }
+      g_free (mdraid_scrub_window);
+      g_clear_error (&error);
+
+      /* Read the sync_speed_max (KiB/s) used while a check runs, 0 (the default) doesn't throttle. */
+      mdraid_scrub_value = g_key_file_get_integer (config_file,
+                                                   modules_group_name,
+                                                   mdraid_scrub_speed_max_key,
+                                                   &error);
+      if (error == NULL && mdraid_scrub_value > 0)
+        manager->mdraid_scrub_speed_max = mdraid_scrub_value;
+      g_clear_error (&error);
+
+      /* Read how many scheduled scrubs may read from the same drive at once. */
+      mdraid_scrub_value = g_key_file_get_integer (config_file,
+                                                   modules_group_name,
+                                                   mdraid_scrub_max_per_drive_key,
+                                                   &error);
+      if (error == NULL && mdraid_scrub_value > 0)
+        manager->mdraid_scrub_max_per_drive = mdraid_scrub_value;
+      g_clear_error (&error);
     }
   else
     {
@@ -363,3 +495,57 @@ udisks_config_manager_get_load_preference (UDisksConfigManager *manager)
                         UDISKS_MODULE_LOAD_ONDEMAND);
   return manager->load_preference;
 }
+
+guint
+udisks_config_manager_get_trim_interval (UDisksConfigManager *manager)
+{
+  g_return_val_if_fail (UDISKS_IS_CONFIG_MANAGER (manager), 0);
+  return manager->trim_interval;
+}
+
+gboolean
+udisks_config_manager_get_persist_smart_history (UDisksConfigManager *manager)
+{
+  g_return_val_if_fail (UDISKS_IS_CONFIG_MANAGER (manager), FALSE);
+  return manager->persist_smart_history;
+}
+
+guint
+udisks_config_manager_get_mdraid_sync_progress_interval (UDisksConfigManager *manager)
+{
+  g_return_val_if_fail (UDISKS_IS_CONFIG_MANAGER (manager), MDRAID_SYNC_PROGRESS_INTERVAL_DEFAULT);
+  return manager->mdraid_sync_progress_interval;
+}
+
+guint
+udisks_config_manager_get_mdraid_scrub_interval (UDisksConfigManager *manager)
+{
+  g_return_val_if_fail (UDISKS_IS_CONFIG_MANAGER (manager), 0);
+  return manager->mdraid_scrub_interval;
+}
+
+/* returns FALSE if scrubs may run at any time, the window wraps around midnight if end < start */
+gboolean
+udisks_config_manager_get_mdraid_scrub_window (UDisksConfigManager *manager,
+                                               guint               *out_start,
+                                               guint               *out_end)
+{
+  g_return_val_if_fail (UDISKS_IS_CONFIG_MANAGER (manager), FALSE);
+  *out_start = manager->mdraid_scrub_window_start;
+  *out_end = manager->mdraid_scrub_window_end;
+  return manager->mdraid_scrub_window_start != manager->mdraid_scrub_window_end;
+}
+
+guint
+udisks_config_manager_get_mdraid_scrub_speed_max (UDisksConfigManager *manager)
+{
+  g_return_val_if_fail (UDISKS_IS_CONFIG_MANAGER (manager), 0);
+  return manager->mdraid_scrub_speed_max;
+}
+
+guint
+udisks_config_manager_get_mdraid_scrub_max_per_drive (UDisksConfigManager *manager)
+{
+  g_return_val_if_fail (UDISKS_IS_CONFIG_MANAGER (manager), MDRAID_SCRUB_MAX_PER_DRIVE_DEFAULT);
+  return manager->mdraid_scrub_max_per_drive;
+}
@@ -56,6 +56,16 @@ gboolean              udisks_config_manager_get_modules_all (UDisksConfigManager
 UDisksModuleLoadPreference
                       udisks_config_manager_get_load_preference (UDisksConfigManager *manager);
 
+guint                 udisks_config_manager_get_trim_interval (UDisksConfigManager *manager);
+gboolean              udisks_config_manager_get_persist_smart_history (UDisksConfigManager *manager);
+guint                 udisks_config_manager_get_mdraid_sync_progress_interval (UDisksConfigManager *manager);
+guint                 udisks_config_manager_get_mdraid_scrub_interval (UDisksConfigManager *manager);
+gboolean              udisks_config_manager_get_mdraid_scrub_window (UDisksConfigManager *manager,
+                                                                     guint               *out_start,
+                                                                     guint               *out_end);
+guint                 udisks_config_manager_get_mdraid_scrub_speed_max (UDisksConfigManager *manager);
+guint                 udisks_config_manager_get_mdraid_scrub_max_per_drive (UDisksConfigManager *manager);
+
 G_END_DECLS
 
 #endif /* __UDISKS_CONFIG_MANAGER_H__ */
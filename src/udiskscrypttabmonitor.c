@@ -56,9 +56,19 @@ struct _UDisksCrypttabMonitor
 {
   GObject parent_instance;
 
+  /* protects have_data, generation, crypttab_entries and the indexes */
+  GMutex lock;
+
   gboolean have_data;
+  /* incremented whenever the entries are reloaded */
+  guint64 generation;
   GList *crypttab_entries;
 
+  /* device -> GList of entries in file order, not referenced */
+  GHashTable *entries_by_spec;
+  /* entry -> its position in the file, for ordering lookup results */
+  GHashTable *entry_positions;
+
   GFileMonitor *file_monitor;
 };
 
@@ -98,9 +108,14 @@ udisks_crypttab_monitor_finalize (GObject *object)
 
   g_object_unref (monitor->file_monitor);
 
+  g_hash_table_unref (monitor->entries_by_spec);
+  g_hash_table_unref (monitor->entry_positions);
+
   g_list_foreach (monitor->crypttab_entries, (GFunc) g_object_unref, NULL);
   g_list_free (monitor->crypttab_entries);
 
+  g_mutex_clear (&monitor->lock);
+
   if (G_OBJECT_CLASS (udisks_crypttab_monitor_parent_class)->finalize != NULL)
     G_OBJECT_CLASS (udisks_crypttab_monitor_parent_class)->finalize (object);
 }
@@ -108,7 +123,13 @@ udisks_crypttab_monitor_finalize (GObject *object)
 static void
 udisks_crypttab_monitor_init (UDisksCrypttabMonitor *monitor)
 {
+  g_mutex_init (&monitor->lock);
   monitor->crypttab_entries = NULL;
+  monitor->entries_by_spec = g_hash_table_new_full (g_str_hash,
+                                                    g_str_equal,
+                                                    NULL,
+                                                    (GDestroyNotify) g_list_free);
+  monitor->entry_positions = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -216,6 +237,8 @@ reload_crypttab_entries (UDisksCrypttabMonitor *monitor)
   GList *removed;
   GList *l;
 
+  g_mutex_lock (&monitor->lock);
+
   udisks_crypttab_monitor_ensure (monitor);
 
   old_crypttab_entries = g_list_copy (monitor->crypttab_entries);
@@ -226,6 +249,8 @@ reload_crypttab_entries (UDisksCrypttabMonitor *monitor)
 
   cur_crypttab_entries = g_list_copy (monitor->crypttab_entries);
 
+  g_mutex_unlock (&monitor->lock);
+
   old_crypttab_entries = g_list_sort (old_crypttab_entries, (GCompareFunc) udisks_crypttab_entry_compare);
   cur_crypttab_entries = g_list_sort (cur_crypttab_entries, (GCompareFunc) udisks_crypttab_entry_compare);
   diff_sorted_lists (old_crypttab_entries, cur_crypttab_entries, (GCompareFunc) udisks_crypttab_entry_compare, &added, &removed);
@@ -319,6 +344,10 @@ static void
 udisks_crypttab_monitor_invalidate (UDisksCrypttabMonitor *monitor)
 {
   monitor->have_data = FALSE;
+  monitor->generation++;
+
+  g_hash_table_remove_all (monitor->entries_by_spec);
+  g_hash_table_remove_all (monitor->entry_positions);
 
   g_list_foreach (monitor->crypttab_entries, (GFunc) g_object_unref, NULL);
   g_list_free (monitor->crypttab_entries);
@@ -333,20 +362,31 @@ have_entry (UDisksCrypttabMonitor *monitor,
             UDisksCrypttabEntry   *entry)
 {
   GList *l;
-  gboolean ret;
 
-  ret = FALSE;
-  for (l = monitor->crypttab_entries; l != NULL; l = l->next)
+  /* only entries for the same device can be equal */
+  for (l = g_hash_table_lookup (monitor->entries_by_spec, udisks_crypttab_entry_get_device (entry)); l != NULL; l = l->next)
     {
-      UDisksCrypttabEntry *other_entry = UDISKS_CRYPTTAB_ENTRY (l->data);
-      if (udisks_crypttab_entry_compare (entry, other_entry) == 0)
-        {
-          ret = TRUE;
-          goto out;
-        }
+      if (udisks_crypttab_entry_compare (entry, UDISKS_CRYPTTAB_ENTRY (l->data)) == 0)
+        return TRUE;
     }
- out:
-  return ret;
+  return FALSE;
+}
+
+static void
+add_entry (UDisksCrypttabMonitor *monitor,
+           UDisksCrypttabEntry   *entry)
+{
+  const gchar *spec = udisks_crypttab_entry_get_device (entry);
+  GList *entries;
+
+  monitor->crypttab_entries = g_list_prepend (monitor->crypttab_entries, entry);
+
+  /* entries are added in file order so appending keeps the lists sorted */
+  entries = g_hash_table_lookup (monitor->entries_by_spec, spec);
+  g_hash_table_steal (monitor->entries_by_spec, spec);
+  g_hash_table_insert (monitor->entries_by_spec, (gpointer) spec, g_list_append (entries, entry));
+  g_hash_table_insert (monitor->entry_positions, entry,
+                       GUINT_TO_POINTER (g_hash_table_size (monitor->entry_positions)));
 }
 
 static void
@@ -406,7 +446,7 @@ udisks_crypttab_monitor_ensure (UDisksCrypttabMonitor *monitor)
                                           num_tokens >= 4 ? tokens[3] : NULL);
       if (!have_entry (monitor, entry))
         {
-          monitor->crypttab_entries = g_list_prepend (monitor->crypttab_entries, entry);
+          add_entry (monitor, entry);
         }
       else
         {
@@ -439,10 +479,87 @@ udisks_crypttab_monitor_get_entries (UDisksCrypttabMonitor  *monitor)
 
   g_return_val_if_fail (UDISKS_IS_CRYPTTAB_MONITOR (monitor), NULL);
 
+  g_mutex_lock (&monitor->lock);
   udisks_crypttab_monitor_ensure (monitor);
 
   ret = g_list_copy (monitor->crypttab_entries);
   g_list_foreach (ret, (GFunc) g_object_ref, NULL);
+  g_mutex_unlock (&monitor->lock);
   return ret;
 }
 
+static gint
+compare_positions (gconstpointer a,
+                   gconstpointer b,
+                   gpointer      user_data)
+{
+  GHashTable *entry_positions = user_data;
+  guint pos_a = GPOINTER_TO_UINT (g_hash_table_lookup (entry_positions, a));
+  guint pos_b = GPOINTER_TO_UINT (g_hash_table_lookup (entry_positions, b));
+
+  return pos_a < pos_b ? -1 : (pos_a > pos_b ? 1 : 0);
+}
+
+/**
+ * udisks_crypttab_monitor_lookup_entries:
+ * @monitor: A #UDisksCrypttabMonitor.
+ * @specs: A %NULL-terminated array of device specifications such as
+ *   <literal>UUID=</literal>, <literal>LABEL=</literal>,
+ *   <literal>PARTUUID=</literal> or <literal>PARTLABEL=</literal> followed
+ *   by the value, or device paths.
+ *
+ * Gets the /etc/crypttab entries whose second field matches any of @specs. This
+ * uses an index that is rebuilt whenever /etc/crypttab is reloaded, so the
+ * cost does not depend on the number of entries in the file.
+ *
+ * Returns: (transfer full) (element-type UDisksCrypttabEntry): A list of #UDisksCrypttabEntry objects, in the order they appear in /etc/crypttab, that must be freed with g_list_free() after each element has been freed with g_object_unref().
+ */
+GList *
+udisks_crypttab_monitor_lookup_entries (UDisksCrypttabMonitor  *monitor,
+                                        const gchar * const  *specs)
+{
+  GList *ret = NULL;
+  GList *l;
+  guint n;
+
+  g_return_val_if_fail (UDISKS_IS_CRYPTTAB_MONITOR (monitor), NULL);
+  g_return_val_if_fail (specs != NULL, NULL);
+
+  g_mutex_lock (&monitor->lock);
+  udisks_crypttab_monitor_ensure (monitor);
+
+  for (n = 0; specs[n] != NULL; n++)
+    {
+      for (l = g_hash_table_lookup (monitor->entries_by_spec, specs[n]); l != NULL; l = l->next)
+        {
+          if (g_list_find (ret, l->data) == NULL)
+            ret = g_list_prepend (ret, g_object_ref (l->data));
+        }
+    }
+  ret = g_list_sort_with_data (ret, compare_positions, monitor->entry_positions);
+
+  g_mutex_unlock (&monitor->lock);
+  return ret;
+}
+
+/**
+ * udisks_crypttab_monitor_get_generation:
+ * @monitor: A #UDisksCrypttabMonitor.
+ *
+ * Gets a counter that changes every time /etc/crypttab is reloaded. Values
+ * computed from the entries can be cached for as long as it stays the same.
+ *
+ * Returns: The current generation of the entries.
+ */
+guint64
+udisks_crypttab_monitor_get_generation (UDisksCrypttabMonitor  *monitor)
+{
+  guint64 ret;
+
+  g_return_val_if_fail (UDISKS_IS_CRYPTTAB_MONITOR (monitor), 0);
+
+  g_mutex_lock (&monitor->lock);
+  ret = monitor->generation;
+  g_mutex_unlock (&monitor->lock);
+  return ret;
+}
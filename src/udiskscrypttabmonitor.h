@@ -32,6 +32,9 @@ G_BEGIN_DECLS
 GType                   udisks_crypttab_monitor_get_type    (void) G_GNUC_CONST;
 UDisksCrypttabMonitor  *udisks_crypttab_monitor_new         (void);
 GList                  *udisks_crypttab_monitor_get_entries (UDisksCrypttabMonitor  *monitor);
+guint64                 udisks_crypttab_monitor_get_generation (UDisksCrypttabMonitor  *monitor);
+GList                  *udisks_crypttab_monitor_lookup_entries (UDisksCrypttabMonitor  *monitor,
+                                                                const gchar * const  *specs);
 
 G_END_DECLS
 
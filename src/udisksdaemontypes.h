@@ -48,6 +48,12 @@ typedef struct _UDisksLinuxDrive UDisksLinuxDrive;
 struct _UDisksLinuxDriveAta;
 typedef struct _UDisksLinuxDriveAta UDisksLinuxDriveAta;
 
+struct _UDisksLinuxDriveNVMe;
+typedef struct _UDisksLinuxDriveNVMe UDisksLinuxDriveNVMe;
+
+struct _UDisksLinuxDriveScsi;
+typedef struct _UDisksLinuxDriveScsi UDisksLinuxDriveScsi;
+
 struct _UDisksLinuxMDRaidObject;
 typedef struct _UDisksLinuxMDRaidObject UDisksLinuxMDRaidObject;
 
@@ -111,6 +117,9 @@ typedef struct _UDisksLinuxPartitionTable UDisksLinuxPartitionTable;
 struct UDisksInhibitCookie;
 typedef struct UDisksInhibitCookie UDisksInhibitCookie;
 
+struct _UDisksConfigurationEdit;
+typedef struct _UDisksConfigurationEdit UDisksConfigurationEdit;
+
 struct _UDisksModuleManager;
 typedef struct _UDisksModuleManager UDisksModuleManager;
 
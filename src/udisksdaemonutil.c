@@ -418,9 +418,9 @@ udisks_daemon_util_resolve_links (const gchar *path,
       if (resolved != NULL)
         g_ptr_array_add (p, resolved);
     }
-  g_ptr_array_add (p, NULL);
 
  out:
+  g_ptr_array_add (p, NULL);
   if (dir != NULL)
     g_dir_close (dir);
   g_free (s);
@@ -1292,33 +1292,34 @@ udisks_daemon_util_hexdump_debug (gconstpointer data, gsize len)
 /* ---------------------------------------------------------------------------------------------------- */
 
 /**
- * udisks_daemon_util_file_set_contents:
- * @filename: (type filename): Name of a file to write @contents to, in the GLib file name encoding.
- * @contents: (array length=length) (element-type guint8): String to write to the file.
+ * udisks_daemon_util_file_write_temp:
+ * @filename: (type filename): Name of the file @contents is meant for, in the GLib file name encoding.
+ * @contents: (array length=length) (element-type guint8): String to write.
  * @contents_len: Length of @contents, or -1 if @contents is a NUL-terminated string.
  * @mode_for_new_file: Mode for new file.
  * @error: Return location for a #GError, or %NULL.
  *
- * Like g_file_set_contents() but preserves the mode of the file if it
- * already exists and sets it to @mode_for_new_file otherwise.
+ * Writes @contents to a new temporary file next to @filename, with the
+ * mode of @filename if it already exists and @mode_for_new_file
+ * otherwise, and syncs it to disk. The caller is expected to rename(2)
+ * the temporary file to @filename or to unlink it.
  *
- * Return value: %TRUE on success, %FALSE if an error occurred
+ * Return value: The name of the temporary file (free with g_free()) or
+ * %NULL if an error occurred.
  */
-gboolean
-udisks_daemon_util_file_set_contents (const gchar  *filename,
-                                      const gchar  *contents,
-                                      gssize        contents_len,
-                                      gint          mode_for_new_file,
-                                      GError      **error)
+gchar *
+udisks_daemon_util_file_write_temp (const gchar  *filename,
+                                    const gchar  *contents,
+                                    gssize        contents_len,
+                                    gint          mode_for_new_file,
+                                    GError      **error)
 {
-  gboolean ret;
   struct stat statbuf;
   gint mode;
   gchar *tmpl;
   gint fd;
   FILE *f;
 
-  ret = FALSE;
   tmpl = NULL;
 
   if (stat (filename, &statbuf) != 0)
@@ -1350,7 +1351,7 @@ udisks_daemon_util_file_set_contents (const gchar  *filename,
                    G_IO_ERROR,
                    g_io_error_from_errno (errno),
                    "Error creating temporary file: %m");
-      goto out;
+      goto fail;
     }
 
   f = fdopen (fd, "w");
@@ -1361,7 +1362,7 @@ udisks_daemon_util_file_set_contents (const gchar  *filename,
                    g_io_error_from_errno (errno),
                    "Error calling fdopen: %m");
       g_unlink (tmpl);
-      goto out;
+      goto fail;
     }
 
   if (contents_len < 0 )
@@ -1374,7 +1375,7 @@ udisks_daemon_util_file_set_contents (const gchar  *filename,
                    "Error calling fwrite on temp file: %m");
       fclose (f);
       g_unlink (tmpl);
-      goto out;
+      goto fail;
     }
 
   if (fsync (fileno (f)) != 0)
@@ -1385,10 +1386,47 @@ udisks_daemon_util_file_set_contents (const gchar  *filename,
                    "Error calling fsync on temp file: %m");
       fclose (f);
       g_unlink (tmpl);
-      goto out;
+      goto fail;
     }
   fclose (f);
 
+ out:
+  return tmpl;
+
+ fail:
+  g_free (tmpl);
+  return NULL;
+}
+
+/**
+ * udisks_daemon_util_file_set_contents:
+ * @filename: (type filename): Name of a file to write @contents to, in the GLib file name encoding.
+ * @contents: (array length=length) (element-type guint8): String to write to the file.
+ * @contents_len: Length of @contents, or -1 if @contents is a NUL-terminated string.
+ * @mode_for_new_file: Mode for new file.
+ * @error: Return location for a #GError, or %NULL.
+ *
+ * Like g_file_set_contents() but preserves the mode of the file if it
+ * already exists and sets it to @mode_for_new_file otherwise.
+ *
+ * Return value: %TRUE on success, %FALSE if an error occurred
+ */
+gboolean
+udisks_daemon_util_file_set_contents (const gchar  *filename,
+                                      const gchar  *contents,
+                                      gssize        contents_len,
+                                      gint          mode_for_new_file,
+                                      GError      **error)
+{
+  gboolean ret;
+  gchar *tmpl;
+
+  ret = FALSE;
+
+  tmpl = udisks_daemon_util_file_write_temp (filename, contents, contents_len, mode_for_new_file, error);
+  if (tmpl == NULL)
+    goto out;
+
   if (rename (tmpl, filename) != 0)
     {
       g_set_error (error,
@@ -96,6 +96,11 @@ gchar *udisks_daemon_util_escape_and_quote (const gchar *str);
 gchar *udisks_daemon_util_hexdump (gconstpointer data, gsize len);
 void udisks_daemon_util_hexdump_debug (gconstpointer data, gsize len);
 
+gchar *udisks_daemon_util_file_write_temp (const gchar  *filename,
+                                           const gchar  *contents,
+                                           gssize        contents_len,
+                                           gint          mode_for_new_file,
+                                           GError      **error);
 gboolean udisks_daemon_util_file_set_contents (const gchar  *filename,
                                                const gchar  *contents,
                                                gssize        contents_len,
@@ -57,9 +57,19 @@ struct _UDisksFstabMonitor
 {
   GObject parent_instance;
 
+  /* protects have_data, generation, fstab_entries and the indexes */
+  GMutex lock;
+
   gboolean have_data;
+  /* incremented whenever the entries are reloaded */
+  guint64 generation;
   GList *fstab_entries;
 
+  /* fsname -> GList of entries in file order, not referenced */
+  GHashTable *entries_by_spec;
+  /* entry -> its position in the file, for ordering lookup results */
+  GHashTable *entry_positions;
+
   GFileMonitor *file_monitor;
 };
 
@@ -99,9 +109,14 @@ udisks_fstab_monitor_finalize (GObject *object)
 
   g_object_unref (monitor->file_monitor);
 
+  g_hash_table_unref (monitor->entries_by_spec);
+  g_hash_table_unref (monitor->entry_positions);
+
   g_list_foreach (monitor->fstab_entries, (GFunc) g_object_unref, NULL);
   g_list_free (monitor->fstab_entries);
 
+  g_mutex_clear (&monitor->lock);
+
   if (G_OBJECT_CLASS (udisks_fstab_monitor_parent_class)->finalize != NULL)
     G_OBJECT_CLASS (udisks_fstab_monitor_parent_class)->finalize (object);
 }
@@ -109,7 +124,13 @@ udisks_fstab_monitor_finalize (GObject *object)
 static void
 udisks_fstab_monitor_init (UDisksFstabMonitor *monitor)
 {
+  g_mutex_init (&monitor->lock);
   monitor->fstab_entries = NULL;
+  monitor->entries_by_spec = g_hash_table_new_full (g_str_hash,
+                                                    g_str_equal,
+                                                    NULL,
+                                                    (GDestroyNotify) g_list_free);
+  monitor->entry_positions = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -217,6 +238,8 @@ reload_fstab_entries (UDisksFstabMonitor *monitor)
   GList *removed;
   GList *l;
 
+  g_mutex_lock (&monitor->lock);
+
   udisks_fstab_monitor_ensure (monitor);
 
   old_fstab_entries = g_list_copy (monitor->fstab_entries);
@@ -227,6 +250,8 @@ reload_fstab_entries (UDisksFstabMonitor *monitor)
 
   cur_fstab_entries = g_list_copy (monitor->fstab_entries);
 
+  g_mutex_unlock (&monitor->lock);
+
   old_fstab_entries = g_list_sort (old_fstab_entries, (GCompareFunc) udisks_fstab_entry_compare);
   cur_fstab_entries = g_list_sort (cur_fstab_entries, (GCompareFunc) udisks_fstab_entry_compare);
   diff_sorted_lists (old_fstab_entries, cur_fstab_entries, (GCompareFunc) udisks_fstab_entry_compare, &added, &removed);
@@ -320,6 +345,10 @@ static void
 udisks_fstab_monitor_invalidate (UDisksFstabMonitor *monitor)
 {
   monitor->have_data = FALSE;
+  monitor->generation++;
+
+  g_hash_table_remove_all (monitor->entries_by_spec);
+  g_hash_table_remove_all (monitor->entry_positions);
 
   g_list_foreach (monitor->fstab_entries, (GFunc) g_object_unref, NULL);
   g_list_free (monitor->fstab_entries);
@@ -334,20 +363,31 @@ have_entry (UDisksFstabMonitor *monitor,
             UDisksFstabEntry   *entry)
 {
   GList *l;
-  gboolean ret;
 
-  ret = FALSE;
-  for (l = monitor->fstab_entries; l != NULL; l = l->next)
+  /* only entries for the same device can be equal */
+  for (l = g_hash_table_lookup (monitor->entries_by_spec, udisks_fstab_entry_get_fsname (entry)); l != NULL; l = l->next)
     {
-      UDisksFstabEntry *other_entry = UDISKS_FSTAB_ENTRY (l->data);
-      if (udisks_fstab_entry_compare (entry, other_entry) == 0)
-        {
-          ret = TRUE;
-          goto out;
-        }
+      if (udisks_fstab_entry_compare (entry, UDISKS_FSTAB_ENTRY (l->data)) == 0)
+        return TRUE;
     }
- out:
-  return ret;
+  return FALSE;
+}
+
+static void
+add_entry (UDisksFstabMonitor *monitor,
+           UDisksFstabEntry   *entry)
+{
+  const gchar *spec = udisks_fstab_entry_get_fsname (entry);
+  GList *entries;
+
+  monitor->fstab_entries = g_list_prepend (monitor->fstab_entries, entry);
+
+  /* entries are added in file order so appending keeps the lists sorted */
+  entries = g_hash_table_lookup (monitor->entries_by_spec, spec);
+  g_hash_table_steal (monitor->entries_by_spec, spec);
+  g_hash_table_insert (monitor->entries_by_spec, (gpointer) spec, g_list_append (entries, entry));
+  g_hash_table_insert (monitor->entry_positions, entry,
+                       GUINT_TO_POINTER (g_hash_table_size (monitor->entry_positions)));
 }
 
 static void
@@ -379,7 +419,7 @@ udisks_fstab_monitor_ensure (UDisksFstabMonitor *monitor)
       entry = _udisks_fstab_entry_new (m);
       if (!have_entry (monitor, entry))
         {
-          monitor->fstab_entries = g_list_prepend (monitor->fstab_entries, entry);
+          add_entry (monitor, entry);
         }
       else
         {
@@ -409,10 +449,87 @@ udisks_fstab_monitor_get_entries (UDisksFstabMonitor  *monitor)
 
   g_return_val_if_fail (UDISKS_IS_FSTAB_MONITOR (monitor), NULL);
 
+  g_mutex_lock (&monitor->lock);
   udisks_fstab_monitor_ensure (monitor);
 
   ret = g_list_copy (monitor->fstab_entries);
   g_list_foreach (ret, (GFunc) g_object_ref, NULL);
+  g_mutex_unlock (&monitor->lock);
+  return ret;
+}
+
+static gint
+compare_positions (gconstpointer a,
+                   gconstpointer b,
+                   gpointer      user_data)
+{
+  GHashTable *entry_positions = user_data;
+  guint pos_a = GPOINTER_TO_UINT (g_hash_table_lookup (entry_positions, a));
+  guint pos_b = GPOINTER_TO_UINT (g_hash_table_lookup (entry_positions, b));
+
+  return pos_a < pos_b ? -1 : (pos_a > pos_b ? 1 : 0);
+}
+
+/**
+ * udisks_fstab_monitor_lookup_entries:
+ * @monitor: A #UDisksFstabMonitor.
+ * @specs: A %NULL-terminated array of device specifications such as
+ *   <literal>UUID=</literal>, <literal>LABEL=</literal>,
+ *   <literal>PARTUUID=</literal> or <literal>PARTLABEL=</literal> followed
+ *   by the value, or device paths.
+ *
+ * Gets the /etc/fstab entries whose first field matches any of @specs. This
+ * uses an index that is rebuilt whenever /etc/fstab is reloaded, so the
+ * cost does not depend on the number of entries in the file.
+ *
+ * Returns: (transfer full) (element-type UDisksFstabEntry): A list of #UDisksFstabEntry objects, in the order they appear in /etc/fstab, that must be freed with g_list_free() after each element has been freed with g_object_unref().
+ */
+GList *
+udisks_fstab_monitor_lookup_entries (UDisksFstabMonitor  *monitor,
+                                     const gchar * const  *specs)
+{
+  GList *ret = NULL;
+  GList *l;
+  guint n;
+
+  g_return_val_if_fail (UDISKS_IS_FSTAB_MONITOR (monitor), NULL);
+  g_return_val_if_fail (specs != NULL, NULL);
+
+  g_mutex_lock (&monitor->lock);
+  udisks_fstab_monitor_ensure (monitor);
+
+  for (n = 0; specs[n] != NULL; n++)
+    {
+      for (l = g_hash_table_lookup (monitor->entries_by_spec, specs[n]); l != NULL; l = l->next)
+        {
+          if (g_list_find (ret, l->data) == NULL)
+            ret = g_list_prepend (ret, g_object_ref (l->data));
+        }
+    }
+  ret = g_list_sort_with_data (ret, compare_positions, monitor->entry_positions);
+
+  g_mutex_unlock (&monitor->lock);
   return ret;
 }
 
+/**
+ * udisks_fstab_monitor_get_generation:
+ * @monitor: A #UDisksFstabMonitor.
+ *
+ * Gets a counter that changes every time /etc/fstab is reloaded. Values
+ * computed from the entries can be cached for as long as it stays the same.
+ *
+ * Returns: The current generation of the entries.
+ */
+guint64
+udisks_fstab_monitor_get_generation (UDisksFstabMonitor  *monitor)
+{
+  guint64 ret;
+
+  g_return_val_if_fail (UDISKS_IS_FSTAB_MONITOR (monitor), 0);
+
+  g_mutex_lock (&monitor->lock);
+  ret = monitor->generation;
+  g_mutex_unlock (&monitor->lock);
+  return ret;
+}
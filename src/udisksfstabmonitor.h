@@ -32,6 +32,9 @@ G_BEGIN_DECLS
 GType                udisks_fstab_monitor_get_type    (void) G_GNUC_CONST;
 UDisksFstabMonitor  *udisks_fstab_monitor_new         (void);
 GList               *udisks_fstab_monitor_get_entries (UDisksFstabMonitor  *monitor);
+guint64              udisks_fstab_monitor_get_generation (UDisksFstabMonitor  *monitor);
+GList               *udisks_fstab_monitor_lookup_entries (UDisksFstabMonitor  *monitor,
+                                                          const gchar * const  *specs);
 
 G_END_DECLS
 
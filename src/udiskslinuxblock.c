@@ -26,13 +26,17 @@
 #include <sys/types.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <pwd.h>
 #include <grp.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <mntent.h>
+#include <linux/aio_abi.h>
 
 #include <glib/gstdio.h>
 #include <gio/gunixfdlist.h>
@@ -83,6 +87,12 @@ typedef struct _UDisksLinuxBlockClass   UDisksLinuxBlockClass;
 struct _UDisksLinuxBlock
 {
   UDisksBlockSkeleton parent_instance;
+
+  /* what the Configuration property was last computed from, see update_configuration() */
+  guint64 configuration_fstab_generation;
+  guint64 configuration_crypttab_generation;
+  gchar **configuration_specs;
+  gboolean configuration_valid;
 };
 
 struct _UDisksLinuxBlockClass
@@ -104,9 +114,24 @@ udisks_linux_block_init (UDisksLinuxBlock *block)
                                        G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
 }
 
+static void
+udisks_linux_block_finalize (GObject *object)
+{
+  UDisksLinuxBlock *block = UDISKS_LINUX_BLOCK (object);
+
+  g_strfreev (block->configuration_specs);
+
+  if (G_OBJECT_CLASS (udisks_linux_block_parent_class)->finalize != NULL)
+    G_OBJECT_CLASS (udisks_linux_block_parent_class)->finalize (object);
+}
+
 static void
 udisks_linux_block_class_init (UDisksLinuxBlockClass *klass)
 {
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = udisks_linux_block_finalize;
 }
 
 /**
@@ -125,28 +150,6 @@ udisks_linux_block_new (void)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static gchar *
-get_sysfs_attr (GUdevDevice *device,
-                const gchar *attr)
-{
-  gchar *filename;
-  gchar *value;
-  filename = g_strconcat (g_udev_device_get_sysfs_path (device),
-                          "/",
-                          attr,
-                          NULL);
-  value = NULL;
-  /* don't care about errors */
-  g_file_get_contents (filename,
-                       &value,
-                       NULL,
-                       NULL);
-  g_free (filename);
-  return value;
-}
-
-/* ---------------------------------------------------------------------------------------------------- */
-
 static gchar *
 find_block_device_by_sysfs_path (GDBusObjectManagerServer *object_manager,
                                  const gchar              *sysfs_path)
@@ -434,174 +437,111 @@ update_hints (UDisksLinuxBlock  *block,
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
-static void
-process_device_symlinks (const gchar      *device,
-                         UDisksLinuxBlock *block,
-                         gpointer          object,
-                         GList           **ret)
+
+/**
+ * udisks_linux_block_dup_device_specs:
+ * @block: A #UDisksLinuxBlock.
+ *
+ * Gets all the ways @block may be referred to in /etc/fstab or
+ * /etc/crypttab: its device file and symlinks and, where set,
+ * <literal>UUID=</literal>, <literal>LABEL=</literal>,
+ * <literal>PARTUUID=</literal> and <literal>PARTLABEL=</literal>
+ * specifications.
+ *
+ * Returns: (transfer full): A %NULL-terminated array of strings. Free with g_strfreev().
+ */
+gchar **
+udisks_linux_block_dup_device_specs (UDisksLinuxBlock *block)
 {
+  UDisksLinuxBlockObject *object;
+  GPtrArray *specs;
   const gchar *const *symlinks;
+  const gchar *value;
   guint n;
 
-  if (g_strcmp0 (device, udisks_block_get_device (UDISKS_BLOCK (block))) == 0)
-    *ret = g_list_prepend (*ret, g_object_ref (object));
-  else
-    {
-      symlinks = udisks_block_get_symlinks (UDISKS_BLOCK (block));
-      if (symlinks != NULL)
-        for (n = 0; symlinks[n] != NULL; n++)
-          if (g_strcmp0 (device, symlinks[n]) == 0)
-            *ret = g_list_prepend (*ret, g_object_ref (object));
-    }
-}
+  specs = g_ptr_array_new ();
+  g_ptr_array_add (specs, udisks_block_dup_device (UDISKS_BLOCK (block)));
 
-static GList *
-find_fstab_entries_for_device (UDisksLinuxBlock *block,
-                               UDisksDaemon     *daemon)
-{
-  GList *entries;
-  GList *l;
-  GList *ret;
+  symlinks = udisks_block_get_symlinks (UDISKS_BLOCK (block));
+  for (n = 0; symlinks != NULL && symlinks[n] != NULL; n++)
+    g_ptr_array_add (specs, g_strdup (symlinks[n]));
 
-  ret = NULL;
+  value = udisks_block_get_id_uuid (UDISKS_BLOCK (block));
+  if (value != NULL && *value != '\0')
+    g_ptr_array_add (specs, g_strdup_printf ("UUID=%s", value));
+  value = udisks_block_get_id_label (UDISKS_BLOCK (block));
+  if (value != NULL && *value != '\0')
+    g_ptr_array_add (specs, g_strdup_printf ("LABEL=%s", value));
 
-  /* if this is too slow, we could add lookup methods to UDisksFstabMonitor... */
-  entries = udisks_fstab_monitor_get_entries (udisks_daemon_get_fstab_monitor (daemon));
-  for (l = entries; l != NULL; l = l->next)
+  object = udisks_daemon_util_dup_object (block, NULL);
+  if (object != NULL)
     {
-      UDisksFstabEntry *entry = UDISKS_FSTAB_ENTRY (l->data);
-      const gchar *fsname;
-      const gchar *device = NULL;
-      const gchar *label = NULL;
-      const gchar *uuid = NULL;
-      const gchar *partuuid = NULL;
-      const gchar *partlabel = NULL;
-
-      fsname = udisks_fstab_entry_get_fsname (entry);
-      device = NULL;
-      if (g_str_has_prefix (fsname, "UUID="))
-        {
-          uuid = fsname + 5;
-        }
-      else if (g_str_has_prefix (fsname, "LABEL="))
-        {
-          label = fsname + 6;
-        }
-      else if (g_str_has_prefix (fsname, "PARTUUID="))
-        {
-          partuuid = fsname + 9;
-        }
-      else if (g_str_has_prefix (fsname, "PARTLABEL="))
-        {
-          partlabel = fsname + 10;
-        }
-      else if (g_str_has_prefix (fsname, "/dev"))
-        {
-          device = fsname;
-        }
-      else
-        {
-          /* ignore non-device entries */
-          goto continue_loop;
-        }
-
+      UDisksLinuxDevice *device = udisks_linux_block_object_get_device (object);
       if (device != NULL)
         {
-          process_device_symlinks (device, block, entry, &ret);
-        }
-      else if (label != NULL && g_strcmp0 (label, udisks_block_get_id_label (UDISKS_BLOCK (block))) == 0)
-        {
-          ret = g_list_prepend (ret, g_object_ref (entry));
-        }
-      else if (uuid != NULL && g_strcmp0 (uuid, udisks_block_get_id_uuid (UDISKS_BLOCK (block))) == 0)
-        {
-          ret = g_list_prepend (ret, g_object_ref (entry));
-        }
-      else if (partlabel != NULL || partuuid != NULL)
-        {
-          UDisksLinuxBlockObject *object;
-          GUdevDevice *u_dev = NULL;
-
-          object = udisks_daemon_util_dup_object (block, NULL);
-          if (object == NULL)
-            goto continue_loop;
-          u_dev = udisks_linux_block_object_get_device (object)->udev_device;
-          g_clear_object (&object);
-          if (u_dev == NULL)
-            goto continue_loop;
-          if ((partuuid != NULL && g_strcmp0 (partuuid, g_udev_device_get_property (u_dev, "ID_PART_ENTRY_UUID")) == 0) ||
-              (partlabel != NULL && g_strcmp0 (partlabel, g_udev_device_get_property (u_dev, "ID_PART_ENTRY_NAME")) == 0))
-            ret = g_list_prepend (ret, g_object_ref (entry));
+          value = g_udev_device_get_property (device->udev_device, "ID_PART_ENTRY_UUID");
+          if (value != NULL && *value != '\0')
+            g_ptr_array_add (specs, g_strdup_printf ("PARTUUID=%s", value));
+          value = g_udev_device_get_property (device->udev_device, "ID_PART_ENTRY_NAME");
+          if (value != NULL && *value != '\0')
+            g_ptr_array_add (specs, g_strdup_printf ("PARTLABEL=%s", value));
+          g_object_unref (device);
         }
-
-    continue_loop:
-      ;
+      g_object_unref (object);
     }
 
-  g_list_foreach (entries, (GFunc) g_object_unref, NULL);
-  g_list_free (entries);
-  return ret;
+  g_ptr_array_add (specs, NULL);
+  return (gchar **) g_ptr_array_free (specs, FALSE);
 }
 
-static GList *
-find_crypttab_entries_for_device (UDisksLinuxBlock *block,
-                                  UDisksDaemon     *daemon)
+static gboolean
+device_spec_matches (const gchar *spec,
+                     const gchar *prefix,
+                     const gchar *value)
 {
-  GList *entries;
-  GList *l;
-  GList *ret;
-
-  ret = NULL;
+  return spec != NULL && g_str_has_prefix (spec, prefix) && strcmp (spec + strlen (prefix), value) == 0;
+}
 
-  /* if this is too slow, we could add lookup methods to UDisksCrypttabMonitor... */
-  entries = udisks_crypttab_monitor_get_entries (udisks_daemon_get_crypttab_monitor (daemon));
-  for (l = entries; l != NULL; l = l->next)
-    {
-      UDisksCrypttabEntry *entry = UDISKS_CRYPTTAB_ENTRY (l->data);
-      const gchar *device_in_entry;
-      const gchar *device = NULL;
-      const gchar *label = NULL;
-      const gchar *uuid = NULL;
+/* Checks whether @specs, as returned by udisks_linux_block_dup_device_specs()
+ * for @block earlier, are still current - without allocating anything
+ */
+static gboolean
+device_specs_are_current (UDisksLinuxBlock   *block,
+                          UDisksLinuxDevice  *device,
+                          const gchar *const *specs)
+{
+  const gchar *const *symlinks;
+  const gchar *value;
+  guint n = 0;
+  guint m;
 
-      device_in_entry = udisks_crypttab_entry_get_device (entry);
-      if (g_str_has_prefix (device_in_entry, "UUID="))
-        {
-          uuid = device_in_entry + 5;
-        }
-      else if (g_str_has_prefix (device_in_entry, "LABEL="))
-        {
-          label = device_in_entry + 6;
-        }
-      else if (g_str_has_prefix (device_in_entry, "/dev"))
-        {
-          device = device_in_entry;
-        }
-      else
-        {
-          /* ignore non-device entries */
-          goto continue_loop;
-        }
+  if (specs == NULL)
+    return FALSE;
 
-      if (device != NULL)
-        {
-          process_device_symlinks (device, block, entry, &ret);
-        }
-      else if (label != NULL && g_strcmp0 (label, udisks_block_get_id_label (UDISKS_BLOCK (block))) == 0)
-        {
-          ret = g_list_prepend (ret, g_object_ref (entry));
-        }
-      else if (uuid != NULL && g_strcmp0 (uuid, udisks_block_get_id_uuid (UDISKS_BLOCK (block))) == 0)
-        {
-          ret = g_list_prepend (ret, g_object_ref (entry));
-        }
+  if (g_strcmp0 (specs[n++], udisks_block_get_device (UDISKS_BLOCK (block))) != 0)
+    return FALSE;
 
-    continue_loop:
-      ;
+  symlinks = udisks_block_get_symlinks (UDISKS_BLOCK (block));
+  for (m = 0; symlinks != NULL && symlinks[m] != NULL; m++)
+    {
+      if (g_strcmp0 (specs[n++], symlinks[m]) != 0)
+        return FALSE;
     }
 
-  g_list_foreach (entries, (GFunc) g_object_unref, NULL);
-  g_list_free (entries);
-  return ret;
+  value = udisks_block_get_id_uuid (UDISKS_BLOCK (block));
+  if (value != NULL && *value != '\0' && !device_spec_matches (specs[n++], "UUID=", value))
+    return FALSE;
+  value = udisks_block_get_id_label (UDISKS_BLOCK (block));
+  if (value != NULL && *value != '\0' && !device_spec_matches (specs[n++], "LABEL=", value))
+    return FALSE;
+  value = g_udev_device_get_property (device->udev_device, "ID_PART_ENTRY_UUID");
+  if (value != NULL && *value != '\0' && !device_spec_matches (specs[n++], "PARTUUID=", value))
+    return FALSE;
+  value = g_udev_device_get_property (device->udev_device, "ID_PART_ENTRY_NAME");
+  if (value != NULL && *value != '\0' && !device_spec_matches (specs[n++], "PARTLABEL=", value))
+    return FALSE;
+
+  return specs[n] == NULL;
 }
 
 static void
@@ -690,12 +630,12 @@ add_crypttab_entry (GVariantBuilder       *builder,
   return TRUE;
 }
 
-/* returns a floating GVariant */
+/* returns a floating GVariant, @specs are the device specs of the block */
 static GVariant *
-calculate_configuration (UDisksLinuxBlock  *block,
-                         UDisksDaemon      *daemon,
-                         gboolean           include_secrets,
-                         GError           **error)
+calculate_configuration (const gchar *const *specs,
+                         UDisksDaemon       *daemon,
+                         gboolean            include_secrets,
+                         GError            **error)
 {
   GList *entries;
   GList *l;
@@ -708,14 +648,14 @@ calculate_configuration (UDisksLinuxBlock  *block,
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sa{sv})"));
   /* First the /etc/fstab entries */
-  entries = find_fstab_entries_for_device (block, daemon);
+  entries = udisks_fstab_monitor_lookup_entries (udisks_daemon_get_fstab_monitor (daemon), specs);
   for (l = entries; l != NULL; l = l->next)
     add_fstab_entry (&builder, UDISKS_FSTAB_ENTRY (l->data));
   g_list_foreach (entries, (GFunc) g_object_unref, NULL);
   g_list_free (entries);
 
   /* Then the /etc/crypttab entries */
-  entries = find_crypttab_entries_for_device (block, daemon);
+  entries = udisks_crypttab_monitor_lookup_entries (udisks_daemon_get_crypttab_monitor (daemon), specs);
   for (l = entries; l != NULL; l = l->next)
     {
       if (!add_crypttab_entry (&builder, UDISKS_CRYPTTAB_ENTRY (l->data), include_secrets, error))
@@ -737,13 +677,35 @@ calculate_configuration (UDisksLinuxBlock  *block,
 
 static void
 update_configuration (UDisksLinuxBlock  *block,
+                      UDisksLinuxDevice *device,
                       UDisksDaemon      *daemon)
 {
   GVariant *configuration;
   GError *error;
+  guint64 fstab_generation;
+  guint64 crypttab_generation;
+  gboolean specs_changed = FALSE;
+
+  /* The configuration only depends on the fstab/crypttab contents and on the
+   * identifiers the entries can refer to, so skip the lookup and the
+   * GVariant allocations on uevents that change neither
+   */
+  if (!device_specs_are_current (block, device, (const gchar *const *) block->configuration_specs))
+    {
+      g_strfreev (block->configuration_specs);
+      block->configuration_specs = udisks_linux_block_dup_device_specs (block);
+      specs_changed = TRUE;
+    }
+  fstab_generation = udisks_fstab_monitor_get_generation (udisks_daemon_get_fstab_monitor (daemon));
+  crypttab_generation = udisks_crypttab_monitor_get_generation (udisks_daemon_get_crypttab_monitor (daemon));
+  if (block->configuration_valid && !specs_changed &&
+      block->configuration_fstab_generation == fstab_generation &&
+      block->configuration_crypttab_generation == crypttab_generation)
+    return;
 
   error = NULL;
-  configuration = calculate_configuration (block, daemon, FALSE, &error);
+  configuration = calculate_configuration ((const gchar *const *) block->configuration_specs, daemon, FALSE, &error);
+  block->configuration_valid = (configuration != NULL);
   if (configuration == NULL)
     {
       udisks_warning ("Error loading configuration: %s (%s, %d)",
@@ -751,6 +713,11 @@ update_configuration (UDisksLinuxBlock  *block,
       g_clear_error (&error);
       configuration = g_variant_new ("a(sa{sv})", NULL);
     }
+  else
+    {
+      block->configuration_fstab_generation = fstab_generation;
+      block->configuration_crypttab_generation = crypttab_generation;
+    }
   udisks_block_set_configuration (UDISKS_BLOCK (block), configuration);
 }
 
@@ -941,9 +908,11 @@ udisks_linux_block_update (UDisksLinuxBlock       *block,
   udisks_block_set_crypto_backing_device (iface, "/");
   if (g_str_has_prefix (g_udev_device_get_name (device->udev_device), "dm-"))
     {
-      gchar *dm_uuid;
-      dm_uuid = get_sysfs_attr (device->udev_device, "dm/uuid");
-      if (dm_uuid != NULL && g_str_has_prefix (dm_uuid, "CRYPT-LUKS1"))
+      /* DM_UUID_LEN is 129 */
+      gchar dm_uuid[130];
+      /* don't care about errors */
+      if (udisks_linux_device_read_sysfs_attr (device, "dm/uuid", dm_uuid, sizeof (dm_uuid), NULL) &&
+          g_str_has_prefix (dm_uuid, "CRYPT-LUKS1"))
         {
           gchar **slaves;
           slaves = udisks_daemon_util_resolve_links (g_udev_device_get_sysfs_path (device->udev_device),
@@ -960,7 +929,6 @@ udisks_linux_block_update (UDisksLinuxBlock       *block,
             }
           g_strfreev (slaves);
         }
-      g_free (dm_uuid);
     }
 
   /* Sort out preferred device... this is what UI shells should
@@ -1114,7 +1082,7 @@ udisks_linux_block_update (UDisksLinuxBlock       *block,
   g_free (s);
 
   update_hints (block, device, drive);
-  update_configuration (block, daemon);
+  update_configuration (block, device, daemon);
   update_mdraid (block, device, drive, object_manager);
 
  out:
@@ -1135,6 +1103,7 @@ handle_get_secret_configuration (UDisksBlock           *_block,
   UDisksLinuxBlockObject *object;
   UDisksDaemon *daemon;
   GVariant *configuration;
+  gchar **specs;
   GError *error;
 
   error = NULL;
@@ -1148,7 +1117,9 @@ handle_get_secret_configuration (UDisksBlock           *_block,
   daemon = udisks_linux_block_object_get_daemon (object);
 
   error = NULL;
-  configuration = calculate_configuration (block, daemon, TRUE, &error);
+  specs = udisks_linux_block_dup_device_specs (block);
+  configuration = calculate_configuration ((const gchar *const *) specs, daemon, TRUE, &error);
+  g_strfreev (specs);
   if (configuration == NULL)
     {
       g_dbus_method_invocation_take_error (invocation, error);
@@ -1313,11 +1284,147 @@ track_parents (UDisksBlock *block, const gchar *options)
   return new_options;
 }
 
+/* A pending set of changes to /etc/fstab and /etc/crypttab, see
+ * udisks_configuration_edit_new(). Both files are read lazily the first time
+ * an item of the respective type is applied and only written out, at most
+ * once each, by udisks_configuration_edit_commit().
+ */
+
+/* held for the whole lifetime of an edit, i.e. from reading the files to
+ * renaming the new ones into place, so that concurrent edits (method calls,
+ * FormatMany workers, teardown) can't overwrite each other's changes
+ */
+G_LOCK_DEFINE_STATIC (configuration_edit_lock);
+
+struct _UDisksConfigurationEdit
+{
+  GPtrArray *fstab_lines;       /* element-type gchar*, NULL if fstab is unchanged */
+  GPtrArray *crypttab_lines;    /* element-type gchar*, NULL if crypttab is unchanged */
+  GPtrArray *unlink_paths;      /* passphrase files of removed crypttab entries */
+  GPtrArray *key_files;         /* passphrase files to create... */
+  GPtrArray *key_contents;      /* ...and their contents */
+};
+
+static void
+free_key_contents (gpointer data)
+{
+  gchar *contents = data;
+
+  memset (contents, '\0', strlen (contents));
+  g_free (contents);
+}
+
+/**
+ * udisks_configuration_edit_new:
+ *
+ * Creates a new empty set of changes to the /etc/fstab and /etc/crypttab
+ * files. Use udisks_configuration_edit_apply() to add changes and
+ * udisks_configuration_edit_commit() to write them out in one go.
+ *
+ * Only one edit can exist at a time: this blocks until any other edit
+ * has been freed. Don't do anything that may take long, like waiting
+ * for authorization, before freeing the returned edit.
+ *
+ * Returns: A #UDisksConfigurationEdit. Free with udisks_configuration_edit_free().
+ */
+UDisksConfigurationEdit *
+udisks_configuration_edit_new (void)
+{
+  UDisksConfigurationEdit *edit;
+
+  G_LOCK (configuration_edit_lock);
+  edit = g_new0 (UDisksConfigurationEdit, 1);
+  edit->unlink_paths = g_ptr_array_new_with_free_func (g_free);
+  edit->key_files = g_ptr_array_new_with_free_func (g_free);
+  edit->key_contents = g_ptr_array_new_with_free_func (free_key_contents);
+  return edit;
+}
+
+/**
+ * udisks_configuration_edit_free:
+ * @edit: A #UDisksConfigurationEdit.
+ *
+ * Frees @edit and allows other edits to be created. Changes that have
+ * not been committed are discarded.
+ */
+void
+udisks_configuration_edit_free (UDisksConfigurationEdit *edit)
+{
+  if (edit == NULL)
+    return;
+  if (edit->fstab_lines != NULL)
+    g_ptr_array_unref (edit->fstab_lines);
+  if (edit->crypttab_lines != NULL)
+    g_ptr_array_unref (edit->crypttab_lines);
+  g_ptr_array_unref (edit->unlink_paths);
+  g_ptr_array_unref (edit->key_files);
+  g_ptr_array_unref (edit->key_contents);
+  g_free (edit);
+  G_UNLOCK (configuration_edit_lock);
+}
+
+static GPtrArray *
+configuration_edit_load (const gchar  *path,
+                         GError      **error)
+{
+  GPtrArray *ret = NULL;
+  gchar *contents = NULL;
+  gchar **lines = NULL;
+  guint n;
+
+  if (!g_file_get_contents (path,
+                            &contents,
+                            NULL,
+                            error))
+    goto out;
+
+  lines = g_strsplit (contents, "\n", 0);
+  ret = g_ptr_array_new_with_free_func (g_free);
+  for (n = 0; lines[n] != NULL; n++)
+    {
+      if (strlen (lines[n]) == 0 && lines[n+1] == NULL)
+        break;
+      g_ptr_array_add (ret, g_strdup (lines[n]));
+    }
+
+ out:
+  g_strfreev (lines);
+  g_free (contents);
+  return ret;
+}
+
+/* Writes @lines to a temporary file next to @path, see udisks_configuration_edit_commit() */
+static gchar *
+configuration_edit_write_temp (GPtrArray    *lines,
+                               const gchar  *path,
+                               gint          mode,
+                               GError      **error)
+{
+  GString *str;
+  gchar *ret;
+  guint n;
+
+  str = g_string_new (NULL);
+  for (n = 0; n < lines->len; n++)
+    {
+      g_string_append (str, lines->pdata[n]);
+      g_string_append_c (str, '\n');
+    }
+  ret = udisks_daemon_util_file_write_temp (path,
+                                            str->str,
+                                            -1,
+                                            mode, /* mode to use if non-existant */
+                                            error);
+  g_string_free (str, TRUE);
+  return ret;
+}
+
 static gboolean
-add_remove_fstab_entry (UDisksBlock *block,
-                        GVariant    *remove,
-                        GVariant    *add,
-                        GError     **error)
+fstab_edit_apply (UDisksConfigurationEdit  *edit,
+                  UDisksBlock              *block,
+                  GVariant                 *remove,
+                  GVariant                 *add,
+                  GError                  **error)
 {
   struct mntent mntent_remove;
   struct mntent mntent_add;
@@ -1325,15 +1432,9 @@ add_remove_fstab_entry (UDisksBlock *block,
   gboolean ret;
   gchar *auto_fsname = NULL;
   gchar *auto_opts = NULL;
-  gchar *contents;
-  gchar **lines;
-  GString *str;
   gboolean removed;
   guint n;
 
-  contents = NULL;
-  lines = NULL;
-  str = NULL;
   ret = FALSE;
 
   if (remove != NULL)
@@ -1391,64 +1492,56 @@ add_remove_fstab_entry (UDisksBlock *block,
         }
     }
 
-  if (!g_file_get_contents ("/etc/fstab",
-                            &contents,
-                            NULL,
-                            error))
-    goto out;
-
-  lines = g_strsplit (contents, "\n", 0);
+  if (edit->fstab_lines == NULL)
+    {
+      edit->fstab_lines = configuration_edit_load ("/etc/fstab", error);
+      if (edit->fstab_lines == NULL)
+        goto out;
+    }
 
-  str = g_string_new (NULL);
   removed = FALSE;
-  for (n = 0; lines != NULL && lines[n] != NULL; n++)
+  for (n = 0; remove != NULL && n < edit->fstab_lines->len; n++)
     {
-      const gchar *line = lines[n];
-      if (strlen (line) == 0 && lines[n+1] == NULL)
-        break;
-      if (remove != NULL && !removed)
-        {
-          gchar parsed_fsname[512];
-          gchar parsed_dir[512];
-          gchar parsed_type[512];
-          gchar parsed_opts[512];
-          gint parsed_freq;
-          gint parsed_passno;
-          if (sscanf (line, "%511s %511s %511s %511s %d %d",
-                      parsed_fsname,
-                      parsed_dir,
-                      parsed_type,
-                      parsed_opts,
-                      &parsed_freq,
-                      &parsed_passno) == 6)
+      const gchar *line = edit->fstab_lines->pdata[n];
+      gchar parsed_fsname[512];
+      gchar parsed_dir[512];
+      gchar parsed_type[512];
+      gchar parsed_opts[512];
+      gint parsed_freq;
+      gint parsed_passno;
+      if (sscanf (line, "%511s %511s %511s %511s %d %d",
+                  parsed_fsname,
+                  parsed_dir,
+                  parsed_type,
+                  parsed_opts,
+                  &parsed_freq,
+                  &parsed_passno) == 6)
+        {
+          gchar *unescaped_fsname = unescape_fstab (parsed_fsname);
+          gchar *unescaped_dir = unescape_fstab (parsed_dir);
+          gchar *unescaped_type = unescape_fstab (parsed_type);
+          gchar *unescaped_opts = unescape_fstab (parsed_opts);
+          gboolean matches = FALSE;
+          if (g_strcmp0 (unescaped_fsname,   mntent_remove.mnt_fsname) == 0 &&
+              g_strcmp0 (unescaped_dir,      mntent_remove.mnt_dir) == 0 &&
+              g_strcmp0 (unescaped_type,     mntent_remove.mnt_type) == 0 &&
+              g_strcmp0 (unescaped_opts,     mntent_remove.mnt_opts) == 0 &&
+              parsed_freq ==      mntent_remove.mnt_freq &&
+              parsed_passno ==    mntent_remove.mnt_passno)
             {
-              gchar *unescaped_fsname = unescape_fstab (parsed_fsname);
-              gchar *unescaped_dir = unescape_fstab (parsed_dir);
-              gchar *unescaped_type = unescape_fstab (parsed_type);
-              gchar *unescaped_opts = unescape_fstab (parsed_opts);
-              gboolean matches = FALSE;
-              if (g_strcmp0 (unescaped_fsname,   mntent_remove.mnt_fsname) == 0 &&
-                  g_strcmp0 (unescaped_dir,      mntent_remove.mnt_dir) == 0 &&
-                  g_strcmp0 (unescaped_type,     mntent_remove.mnt_type) == 0 &&
-                  g_strcmp0 (unescaped_opts,     mntent_remove.mnt_opts) == 0 &&
-                  parsed_freq ==      mntent_remove.mnt_freq &&
-                  parsed_passno ==    mntent_remove.mnt_passno)
-                {
-                  matches = TRUE;
-                }
-              g_free (unescaped_fsname);
-              g_free (unescaped_dir);
-              g_free (unescaped_type);
-              g_free (unescaped_opts);
-              if (matches)
-                {
-                  removed = TRUE;
-                  continue;
-                }
+              matches = TRUE;
+            }
+          g_free (unescaped_fsname);
+          g_free (unescaped_dir);
+          g_free (unescaped_type);
+          g_free (unescaped_opts);
+          if (matches)
+            {
+              g_ptr_array_remove_index (edit->fstab_lines, n);
+              removed = TRUE;
+              break;
             }
         }
-      g_string_append (str, line);
-      g_string_append_c (str, '\n');
     }
 
   if (remove != NULL && !removed)
@@ -1466,35 +1559,25 @@ add_remove_fstab_entry (UDisksBlock *block,
       gchar *escaped_dir = escape_fstab (mntent_add.mnt_dir);
       gchar *escaped_type = escape_fstab (mntent_add.mnt_type);
       gchar *escaped_opts = escape_fstab (mntent_add.mnt_opts);
-      g_string_append_printf (str, "%s %s %s %s %d %d\n",
-                              escaped_fsname,
-                              escaped_dir,
-                              escaped_type,
-                              escaped_opts,
-                              mntent_add.mnt_freq,
-                              mntent_add.mnt_passno);
+      g_ptr_array_add (edit->fstab_lines,
+                       g_strdup_printf ("%s %s %s %s %d %d",
+                                        escaped_fsname,
+                                        escaped_dir,
+                                        escaped_type,
+                                        escaped_opts,
+                                        mntent_add.mnt_freq,
+                                        mntent_add.mnt_passno));
       g_free (escaped_fsname);
       g_free (escaped_dir);
       g_free (escaped_type);
       g_free (escaped_opts);
     }
 
-  if (!udisks_daemon_util_file_set_contents ("/etc/fstab",
-                                             str->str,
-                                             -1,
-                                             0644, /* mode to use if non-existant */
-                                             error))
-    goto out;
-
   ret = TRUE;
 
  out:
   g_free (auto_opts);
   g_free (auto_fsname);
-  g_strfreev (lines);
-  g_free (contents);
-  if (str != NULL)
-    g_string_free (str, TRUE);
   return ret;
 }
 
@@ -1523,10 +1606,23 @@ make_block_luksname (UDisksBlock *block, GError **error)
 }
 
 static gboolean
-add_remove_crypttab_entry (UDisksBlock *block,
-                           GVariant    *remove,
-                           GVariant    *add,
-                           GError     **error)
+str_array_contains (GPtrArray   *array,
+                    const gchar *str)
+{
+  guint n;
+
+  for (n = 0; n < array->len; n++)
+    if (g_strcmp0 (array->pdata[n], str) == 0)
+      return TRUE;
+  return FALSE;
+}
+
+static gboolean
+crypttab_edit_apply (UDisksConfigurationEdit  *edit,
+                     UDisksBlock              *block,
+                     GVariant                 *remove,
+                     GVariant                 *add,
+                     GError                  **error)
 {
   const gchar *remove_name = NULL;
   const gchar *remove_device = NULL;
@@ -1543,15 +1639,9 @@ add_remove_crypttab_entry (UDisksBlock *block,
   gchar *auto_device = NULL;
   gchar *auto_passphrase_path = NULL;
   gchar *auto_opts = NULL;
-  gchar *contents;
-  gchar **lines;
-  GString *str;
   gboolean removed;
   guint n;
 
-  contents = NULL;
-  lines = NULL;
-  str = NULL;
   ret = FALSE;
 
   if (remove != NULL)
@@ -1635,67 +1725,50 @@ add_remove_crypttab_entry (UDisksBlock *block,
         }
     }
 
-  if (!g_file_get_contents ("/etc/crypttab",
-                            &contents,
-                            NULL,
-                            error))
-    goto out;
-
-  lines = g_strsplit (contents, "\n", 0);
+  if (edit->crypttab_lines == NULL)
+    {
+      edit->crypttab_lines = configuration_edit_load ("/etc/crypttab", error);
+      if (edit->crypttab_lines == NULL)
+        goto out;
+    }
 
-  str = g_string_new (NULL);
   removed = FALSE;
-  for (n = 0; lines != NULL && lines[n] != NULL; n++)
+  for (n = 0; remove != NULL && n < edit->crypttab_lines->len; n++)
     {
-      const gchar *line = lines[n];
-      if (strlen (line) == 0 && lines[n+1] == NULL)
-        break;
-      if (remove != NULL && !removed)
+      const gchar *line = edit->crypttab_lines->pdata[n];
+      gchar parsed_name[512];
+      gchar parsed_device[512];
+      gchar parsed_passphrase_path[512];
+      gchar parsed_options[512];
+      guint num_parsed;
+
+      num_parsed = sscanf (line, "%511s %511s %511s %511s",
+                           parsed_name, parsed_device, parsed_passphrase_path, parsed_options);
+      if (num_parsed >= 2)
         {
-          gchar parsed_name[512];
-          gchar parsed_device[512];
-          gchar parsed_passphrase_path[512];
-          gchar parsed_options[512];
-          guint num_parsed;
-
-          num_parsed = sscanf (line, "%511s %511s %511s %511s",
-                               parsed_name, parsed_device, parsed_passphrase_path, parsed_options);
-          if (num_parsed >= 2)
+          if (num_parsed < 3 || g_strcmp0 (parsed_passphrase_path, "none") == 0)
+            strcpy (parsed_passphrase_path, "");
+          if (num_parsed < 4)
+            strcpy (parsed_options, "");
+          if (g_strcmp0 (parsed_name,            remove_name) == 0 &&
+              g_strcmp0 (parsed_device,          remove_device) == 0 &&
+              g_strcmp0 (parsed_passphrase_path, remove_passphrase_path) == 0 &&
+              g_strcmp0 (parsed_options,         remove_options) == 0)
             {
-              if (num_parsed < 3 || g_strcmp0 (parsed_passphrase_path, "none") == 0)
-                strcpy (parsed_passphrase_path, "");
-              if (num_parsed < 4)
-                strcpy (parsed_options, "");
-              if (g_strcmp0 (parsed_name,            remove_name) == 0 &&
-                  g_strcmp0 (parsed_device,          remove_device) == 0 &&
-                  g_strcmp0 (parsed_passphrase_path, remove_passphrase_path) == 0 &&
-                  g_strcmp0 (parsed_options,         remove_options) == 0)
-                {
-                  /* Nuke passphrase file */
-                  if (strlen (remove_passphrase_path) > 0 && !g_str_has_prefix (remove_passphrase_path, "/dev"))
-                    {
-                      /* Is this exploitable? No, 1. the user would have to control
-                       * the /etc/crypttab file for us to delete it; and 2. editing the
-                       * /etc/crypttab file requires a polkit authorization that can't
-                       * be retained (e.g. the user is always asked for the password)..
-                       */
-                      if (unlink (remove_passphrase_path) != 0)
-                        {
-                          g_set_error (error,
-                                       UDISKS_ERROR,
-                                       UDISKS_ERROR_FAILED,
-                                       "Error deleting file `%s' with passphrase",
-                                       remove_passphrase_path);
-                          goto out;
-                        }
-                    }
-                  removed = TRUE;
-                  continue;
-                }
+              /* Nuke passphrase file, once the edit is committed
+               *
+               * Is this exploitable? No, 1. the user would have to control
+               * the /etc/crypttab file for us to delete it; and 2. editing the
+               * /etc/crypttab file requires a polkit authorization that can't
+               * be retained (e.g. the user is always asked for the password)..
+               */
+              if (strlen (remove_passphrase_path) > 0 && !g_str_has_prefix (remove_passphrase_path, "/dev"))
+                g_ptr_array_add (edit->unlink_paths, g_strdup (remove_passphrase_path));
+              g_ptr_array_remove_index (edit->crypttab_lines, n);
+              removed = TRUE;
+              break;
             }
         }
-      g_string_append (str, line);
-      g_string_append_c (str, '\n');
     }
 
   if (remove != NULL && !removed)
@@ -1709,7 +1782,7 @@ add_remove_crypttab_entry (UDisksBlock *block,
 
   if (add != NULL)
     {
-      /* First write add_passphrase_content to add_passphrase_path,
+      /* Schedule writing add_passphrase_content to add_passphrase_path,
        * if applicable..
        *
        * Is this exploitable? No, because editing the /etc/crypttab
@@ -1736,21 +1809,15 @@ add_remove_crypttab_entry (UDisksBlock *block,
                                "Crypttab passphrase file can only be created in the /etc/luks-keys directory");
                   goto out;
                 }
-              /* ensure the directory exists */
-              if (g_mkdir_with_parents ("/etc/luks-keys", 0700) != 0)
-                {
-                  g_set_error (error,
-                               UDISKS_ERROR,
-                               UDISKS_ERROR_FAILED,
-                               "Error creating /etc/luks-keys directory: %m");
-                  goto out;
-                }
               /* avoid symlink attacks */
               filename = g_strdup_printf ("/etc/luks-keys/%s", strrchr (add_passphrase_path, '/') + 1);
             }
 
-          /* Bail if the requested file already exists */
-          if (g_file_test (filename, G_FILE_TEST_EXISTS))
+          /* Bail if the requested file already exists (and is not removed
+           * by this edit) or is already going to be created by it
+           */
+          if ((g_file_test (filename, G_FILE_TEST_EXISTS) && !str_array_contains (edit->unlink_paths, filename)) ||
+              str_array_contains (edit->key_files, filename))
             {
                   g_set_error (error,
                                UDISKS_ERROR,
@@ -1761,31 +1828,17 @@ add_remove_crypttab_entry (UDisksBlock *block,
                   goto out;
             }
 
-          if (!udisks_daemon_util_file_set_contents (filename,
-                                                     add_passphrase_contents,
-                                                     -1,
-                                                     0600, /* mode to use if non-existant */
-                                                     error))
-            {
-              g_free (filename);
-              goto out;
-            }
-          g_free (filename);
+          g_ptr_array_add (edit->key_files, filename);
+          g_ptr_array_add (edit->key_contents, g_strdup (add_passphrase_contents));
         }
-      g_string_append_printf (str, "%s %s %s %s\n",
-                              add_name,
-                              add_device,
-                              strlen (add_passphrase_path) > 0 ? add_passphrase_path : "none",
-                              add_options);
+      g_ptr_array_add (edit->crypttab_lines,
+                       g_strdup_printf ("%s %s %s %s",
+                                        add_name,
+                                        add_device,
+                                        strlen (add_passphrase_path) > 0 ? add_passphrase_path : "none",
+                                        add_options));
     }
 
-  if (!udisks_daemon_util_file_set_contents ("/etc/crypttab",
-                                             str->str,
-                                             -1,
-                                             0600, /* mode to use if non-existant */
-                                             error))
-    goto out;
-
   ret = TRUE;
 
  out:
@@ -1793,26 +1846,266 @@ add_remove_crypttab_entry (UDisksBlock *block,
   g_free (auto_name);
   g_free (auto_device);
   g_free (auto_passphrase_path);
-  g_strfreev (lines);
-  g_free (contents);
-  if (str != NULL)
-    g_string_free (str, TRUE);
   return ret;
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
-
-static gboolean
-handle_add_configuration_item (UDisksBlock           *_block,
-                               GDBusMethodInvocation *invocation,
-                               GVariant              *item,
-                               GVariant              *options)
+/**
+ * udisks_configuration_edit_apply:
+ * @edit: A #UDisksConfigurationEdit.
+ * @block: The #UDisksBlock the items refer to or %NULL if only removing items.
+ * @old_item: The configuration item to remove (of type <literal>(sa{sv})</literal>) or %NULL.
+ * @new_item: The configuration item to add (of type <literal>(sa{sv})</literal>) or %NULL.
+ * @error: Return location for error or %NULL.
+ *
+ * Adds the removal of @old_item and/or the addition of @new_item to
+ * @edit. If both are given, @old_item is replaced by @new_item and
+ * they must be of the same type. Nothing is written to disk until
+ * udisks_configuration_edit_commit() is called.
+ *
+ * Returns: %TRUE if the change was added to @edit, %FALSE if @error is set.
+ */
+gboolean
+udisks_configuration_edit_apply (UDisksConfigurationEdit  *edit,
+                                 UDisksBlock              *block,
+                                 GVariant                 *old_item,
+                                 GVariant                 *new_item,
+                                 GError                  **error)
 {
-  UDisksLinuxBlock *block = UDISKS_LINUX_BLOCK (_block);
-  UDisksLinuxBlockObject *object;
-  UDisksDaemon *daemon;
+  const gchar *old_type = NULL;
+  const gchar *new_type = NULL;
   const gchar *type;
-  GVariant *details = NULL;
+  GVariant *old_details = NULL;
+  GVariant *new_details = NULL;
+  gboolean ret = FALSE;
+
+  if (old_item != NULL)
+    g_variant_get (old_item, "(&s@a{sv})", &old_type, &old_details);
+  if (new_item != NULL)
+    g_variant_get (new_item, "(&s@a{sv})", &new_type, &new_details);
+
+  if (old_item != NULL && new_item != NULL && g_strcmp0 (old_type, new_type) != 0)
+    {
+      g_set_error (error,
+                   UDISKS_ERROR,
+                   UDISKS_ERROR_FAILED,
+                   "old and new item are not of the same type");
+      goto out;
+    }
+
+  type = old_type != NULL ? old_type : new_type;
+  if (g_strcmp0 (type, "fstab") == 0)
+    {
+      ret = fstab_edit_apply (edit, block, old_details, new_details, error);
+    }
+  else if (g_strcmp0 (type, "crypttab") == 0)
+    {
+      ret = crypttab_edit_apply (edit, block, old_details, new_details, error);
+    }
+  else
+    {
+      g_set_error (error,
+                   UDISKS_ERROR,
+                   UDISKS_ERROR_FAILED,
+                   "Only fstab or crypttab items can be changed");
+      goto out;
+    }
+
+ out:
+  if (old_details != NULL)
+    g_variant_unref (old_details);
+  if (new_details != NULL)
+    g_variant_unref (new_details);
+  return ret;
+}
+
+/**
+ * udisks_configuration_edit_commit:
+ * @edit: A #UDisksConfigurationEdit.
+ * @error: Return location for error or %NULL.
+ *
+ * Writes out all changes added to @edit: /etc/fstab and /etc/crypttab are
+ * each atomically replaced at most once, so their monitors only reload
+ * once no matter how many items were changed.
+ *
+ * All new contents, including new passphrase files, is first written
+ * to temporary files so a failure to write any of it leaves all files
+ * untouched. Only then the files are renamed into place - passphrase
+ * files before /etc/crypttab referring to them - and passphrase files
+ * no longer used are deleted last.
+ *
+ * Returns: %TRUE on success, %FALSE if @error is set.
+ */
+gboolean
+udisks_configuration_edit_commit (UDisksConfigurationEdit  *edit,
+                                  GError                  **error)
+{
+  GPtrArray *tmp_paths;
+  GPtrArray *paths;
+  guint num_key_files = 0;
+  guint num_renamed = 0;
+  gchar *tmp_path;
+  gboolean ret = FALSE;
+  guint n;
+
+  tmp_paths = g_ptr_array_new_with_free_func (g_free);
+  paths = g_ptr_array_new ();
+
+  /* First write everything to temporary files */
+  if (edit->crypttab_lines != NULL)
+    {
+      if (edit->key_files->len > 0)
+        {
+          /* ensure the directory exists */
+          if (g_mkdir_with_parents ("/etc/luks-keys", 0700) != 0)
+            {
+              g_set_error (error,
+                           UDISKS_ERROR,
+                           UDISKS_ERROR_FAILED,
+                           "Error creating /etc/luks-keys directory: %m");
+              goto out;
+            }
+        }
+      for (n = 0; n < edit->key_files->len; n++)
+        {
+          tmp_path = udisks_daemon_util_file_write_temp (edit->key_files->pdata[n],
+                                                         edit->key_contents->pdata[n],
+                                                         -1,
+                                                         0600, /* mode to use if non-existant */
+                                                         error);
+          if (tmp_path == NULL)
+            goto out;
+          g_ptr_array_add (tmp_paths, tmp_path);
+          g_ptr_array_add (paths, edit->key_files->pdata[n]);
+        }
+      num_key_files = paths->len;
+
+      tmp_path = configuration_edit_write_temp (edit->crypttab_lines, "/etc/crypttab", 0600, error);
+      if (tmp_path == NULL)
+        goto out;
+      g_ptr_array_add (tmp_paths, tmp_path);
+      g_ptr_array_add (paths, "/etc/crypttab");
+    }
+
+  if (edit->fstab_lines != NULL)
+    {
+      tmp_path = configuration_edit_write_temp (edit->fstab_lines, "/etc/fstab", 0644, error);
+      if (tmp_path == NULL)
+        goto out;
+      g_ptr_array_add (tmp_paths, tmp_path);
+      g_ptr_array_add (paths, "/etc/fstab");
+    }
+
+  /* ... then move it into place ... */
+  for (num_renamed = 0; num_renamed < paths->len; num_renamed++)
+    {
+      if (rename (tmp_paths->pdata[num_renamed], paths->pdata[num_renamed]) != 0)
+        {
+          g_set_error (error,
+                       UDISKS_ERROR,
+                       UDISKS_ERROR_FAILED,
+                       "Error renaming temp file to `%s': %m",
+                       (const gchar *) paths->pdata[num_renamed]);
+          goto out;
+        }
+    }
+
+  /* ... and only then delete the passphrase files no longer referenced */
+  for (n = 0; edit->crypttab_lines != NULL && n < edit->unlink_paths->len; n++)
+    {
+      const gchar *path = edit->unlink_paths->pdata[n];
+
+      /* replaced with new contents above */
+      if (str_array_contains (edit->key_files, path))
+        continue;
+
+      if (unlink (path) != 0)
+        udisks_warning ("Error deleting file `%s' with passphrase: %m", path);
+    }
+
+  ret = TRUE;
+
+ out:
+  for (n = num_renamed; n < tmp_paths->len; n++)
+    g_unlink (tmp_paths->pdata[n]);
+
+  /* Passphrase files that didn't exist before are not referenced by
+   * the old /etc/crypttab, remove them again if it wasn't replaced
+   */
+  if (!ret && num_renamed <= num_key_files)
+    {
+      for (n = 0; n < num_renamed; n++)
+        {
+          if (!str_array_contains (edit->unlink_paths, paths->pdata[n]))
+            g_unlink (paths->pdata[n]);
+        }
+    }
+
+  g_ptr_array_unref (paths);
+  g_ptr_array_unref (tmp_paths);
+  return ret;
+}
+
+static gboolean
+add_remove_configuration_item (UDisksBlock  *block,
+                               const gchar  *type,
+                               GVariant     *remove,
+                               GVariant     *add,
+                               GError      **error)
+{
+  UDisksConfigurationEdit *edit;
+  GVariant *old_item = NULL;
+  GVariant *new_item = NULL;
+  gboolean ret = FALSE;
+
+  if (remove != NULL)
+    old_item = g_variant_ref_sink (g_variant_new ("(s@a{sv})", type, remove));
+  if (add != NULL)
+    new_item = g_variant_ref_sink (g_variant_new ("(s@a{sv})", type, add));
+
+  edit = udisks_configuration_edit_new ();
+  if (udisks_configuration_edit_apply (edit, block, old_item, new_item, error) &&
+      udisks_configuration_edit_commit (edit, error))
+    ret = TRUE;
+  udisks_configuration_edit_free (edit);
+
+  if (old_item != NULL)
+    g_variant_unref (old_item);
+  if (new_item != NULL)
+    g_variant_unref (new_item);
+  return ret;
+}
+
+static gboolean
+add_remove_fstab_entry (UDisksBlock *block,
+                        GVariant    *remove,
+                        GVariant    *add,
+                        GError     **error)
+{
+  return add_remove_configuration_item (block, "fstab", remove, add, error);
+}
+
+static gboolean
+add_remove_crypttab_entry (UDisksBlock *block,
+                           GVariant    *remove,
+                           GVariant    *add,
+                           GError     **error)
+{
+  return add_remove_configuration_item (block, "crypttab", remove, add, error);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+handle_add_configuration_item (UDisksBlock           *_block,
+                               GDBusMethodInvocation *invocation,
+                               GVariant              *item,
+                               GVariant              *options)
+{
+  UDisksLinuxBlock *block = UDISKS_LINUX_BLOCK (_block);
+  UDisksLinuxBlockObject *object;
+  UDisksDaemon *daemon;
+  const gchar *type;
+  GVariant *details = NULL;
   GError *error;
 
   error = NULL;
@@ -2075,6 +2368,189 @@ subst_str_and_escape (const gchar *str,
   return ret;
 }
 
+/* Substitutes $DEVICE, $LABEL and $OPTIONS in one of the FSInfo mkfs
+ * templates. The @options string is generated by the daemon and is therefore
+ * not quoted.
+ */
+static gchar *
+build_mkfs_command (const gchar *command_template,
+                    const gchar *device,
+                    const gchar *label,
+                    const gchar *options)
+{
+  gchar *tmp;
+  gchar *tmp2;
+  gchar *ret;
+
+  tmp = subst_str_and_escape (command_template, "$DEVICE", device);
+  tmp2 = subst_str_and_escape (tmp, "$LABEL", label != NULL ? label : "");
+  ret = subst_str (tmp2, "$OPTIONS", options != NULL ? options : "");
+  g_free (tmp2);
+  g_free (tmp);
+  return ret;
+}
+
+/* Appends @option to the mkfs options in @options. mke2fs(8) only honours
+ * the last -E option so extended options are merged into a single one.
+ */
+static void
+append_mkfs_option (GString     *options,
+                    const gchar *option)
+{
+  const gchar *existing;
+  gsize pos;
+
+  if (option == NULL)
+    return;
+
+  if (g_str_has_prefix (option, "-E ") && (existing = strstr (options->str, "-E ")) != NULL)
+    {
+      pos = existing - options->str + 3;
+      while (pos < options->len && options->str[pos] != ' ')
+        pos++;
+      g_string_insert (options, pos, option + 2);
+      options->str[pos] = ',';
+      return;
+    }
+
+  if (options->len > 0)
+    g_string_append_c (options, ' ');
+  g_string_append (options, option);
+}
+
+/* Determines the RAID geometry of @object, either from the md(4) array
+ * itself or from the queue limits that md, LVM and SAN devices report
+ * (and that are stacked through device-mapper).
+ */
+static gboolean
+get_stripe_geometry (UDisksObject *object,
+                     guint64      *out_stripe_unit,
+                     guint64      *out_stripe_count)
+{
+  UDisksLinuxDevice *device;
+  GUdevDevice *udev_device;
+  const gchar *level;
+  guint64 chunk_size;
+  guint64 num_devices;
+  guint64 stripe_unit = 0;
+  guint64 stripe_count = 0;
+
+  device = udisks_linux_block_object_get_device (UDISKS_LINUX_BLOCK_OBJECT (object));
+  if (device == NULL)
+    return FALSE;
+
+  /* partitions have neither md/ nor queue/ attributes, use the ones of the disk */
+  if (g_strcmp0 (g_udev_device_get_devtype (device->udev_device), "partition") == 0)
+    udev_device = g_udev_device_get_parent (device->udev_device);
+  else
+    udev_device = g_object_ref (device->udev_device);
+  g_object_unref (device);
+  if (udev_device == NULL)
+    return FALSE;
+
+  chunk_size = g_udev_device_get_sysfs_attr_as_uint64 (udev_device, "md/chunk_size");
+  level = g_udev_device_get_sysfs_attr (udev_device, "md/level");
+  num_devices = g_udev_device_get_sysfs_attr_as_uint64 (udev_device, "md/raid_disks");
+  if (chunk_size > 0 && level != NULL && num_devices > 0)
+    {
+      stripe_unit = chunk_size;
+      if (g_strcmp0 (level, "raid0") == 0)
+        stripe_count = num_devices;
+      else if (g_strcmp0 (level, "raid4") == 0 || g_strcmp0 (level, "raid5") == 0)
+        stripe_count = num_devices - 1;
+      else if (g_strcmp0 (level, "raid6") == 0 && num_devices > 2)
+        stripe_count = num_devices - 2;
+      else if (g_strcmp0 (level, "raid10") == 0)
+        stripe_count = num_devices / 2;
+    }
+  else
+    {
+      guint64 minimum_io_size;
+      guint64 optimal_io_size;
+      guint64 physical_block_size;
+
+      minimum_io_size = g_udev_device_get_sysfs_attr_as_uint64 (udev_device, "queue/minimum_io_size");
+      optimal_io_size = g_udev_device_get_sysfs_attr_as_uint64 (udev_device, "queue/optimal_io_size");
+      physical_block_size = g_udev_device_get_sysfs_attr_as_uint64 (udev_device, "queue/physical_block_size");
+      if (minimum_io_size > physical_block_size && optimal_io_size > minimum_io_size &&
+          optimal_io_size % minimum_io_size == 0)
+        {
+          stripe_unit = minimum_io_size;
+          stripe_count = optimal_io_size / minimum_io_size;
+        }
+    }
+  g_object_unref (udev_device);
+
+  if (stripe_unit < 4096 || stripe_unit % 4096 != 0 || stripe_count == 0)
+    return FALSE;
+
+  *out_stripe_unit = stripe_unit;
+  *out_stripe_count = stripe_count;
+  return TRUE;
+}
+
+/* block size used for filesystems whose stripe options are given in blocks */
+#define MKFS_STRIDE_BLOCK_SIZE 4096
+
+/* Builds the string substituted for $OPTIONS when creating a @fs_info
+ * filesystem on @object.
+ */
+static gchar *
+build_mkfs_options (const FSInfo *fs_info,
+                    UDisksObject *object,
+                    gboolean      discard,
+                    gboolean      stripe_alignment)
+{
+  GString *options;
+  guint64 stripe_unit;
+  guint64 stripe_count;
+
+  options = g_string_new (NULL);
+  if (discard)
+    append_mkfs_option (options, fs_info->option_no_discard);
+
+  if (stripe_alignment && fs_info->option_stripe != NULL &&
+      get_stripe_geometry (object, &stripe_unit, &stripe_count))
+    {
+      gchar *value;
+      gchar *tmp;
+      gchar *tmp2;
+
+      /* ext stride and stripe_width are in filesystem blocks - mke2fs picks
+       * 1 KiB blocks for small devices so the block size is set explicitly
+       * and a stripe unit smaller than a block can't be expressed at all
+       */
+      if (strstr (fs_info->option_stripe, "$STRIDE") != NULL)
+        {
+          if (stripe_unit < MKFS_STRIDE_BLOCK_SIZE)
+            goto out;
+          append_mkfs_option (options, "-b " G_STRINGIFY (MKFS_STRIDE_BLOCK_SIZE));
+        }
+
+      value = g_strdup_printf ("%" G_GUINT64_FORMAT, stripe_unit / MKFS_STRIDE_BLOCK_SIZE);
+      tmp = subst_str (fs_info->option_stripe, "$STRIDE", value);
+      g_free (value);
+      value = g_strdup_printf ("%" G_GUINT64_FORMAT, stripe_unit / MKFS_STRIDE_BLOCK_SIZE * stripe_count);
+      tmp2 = subst_str (tmp, "$STRIPE_WIDTH", value);
+      g_free (value);
+      g_free (tmp);
+      value = g_strdup_printf ("%" G_GUINT64_FORMAT, stripe_unit);
+      tmp = subst_str (tmp2, "$STRIPE_UNIT", value);
+      g_free (value);
+      g_free (tmp2);
+      value = g_strdup_printf ("%" G_GUINT64_FORMAT, stripe_count);
+      tmp2 = subst_str (tmp, "$STRIPE_COUNT", value);
+      g_free (value);
+      g_free (tmp);
+
+      append_mkfs_option (options, tmp2);
+      g_free (tmp2);
+    }
+
+ out:
+  return g_string_free (options, FALSE);
+}
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 typedef struct
@@ -2243,102 +2719,416 @@ erase_ata_device (UDisksBlock   *block,
 
 #define ERASE_SIZE (1 * 1024*1024)
 
-static gboolean
-erase_device (UDisksBlock   *block,
-              UDisksObject  *object,
-              UDisksDaemon  *daemon,
-              uid_t          caller_uid,
-              const gchar   *erase_type,
-              GError       **error)
+/* Parameters of the asynchronous zeroing engine: the size of every write, how
+ * many of them are kept in flight and the buffer alignment needed for O_DIRECT
+ */
+#define ERASE_AIO_CHUNK_SIZE (4 * 1024*1024)
+#define ERASE_AIO_QUEUE_DEPTH 32
+#define ERASE_AIO_ALIGNMENT 4096
+/* how often to retry, 10 ms apart, when no write can be queued and none is in flight */
+#define ERASE_AIO_MAX_SUBMIT_RETRIES 100
+
+#ifndef BLKDISCARD
+#define BLKDISCARD _IO(0x12,119)
+#endif
+
+typedef struct
 {
-  gboolean ret = FALSE;
-  const gchar *device_file = NULL;
-  UDisksBaseJob *job = NULL;
-  gint fd = -1;
-  guint64 size;
-  guint64 pos;
-  guchar *buf = NULL;
-  gint64 time_of_last_signal;
-  GError *local_error = NULL;
+  UDisksBaseJob *job;
+  const gchar   *device_file;
+  guint64        size;
+  guint64        pos;
+  gint64         time_started;
+  gint64         time_of_last_signal;
+} EraseData;
 
-  if (g_strcmp0 (erase_type, "ata-secure-erase") == 0)
-    {
-      ret = erase_ata_device (block, object, daemon, caller_uid, FALSE, error);
-      goto out;
-    }
-  else if (g_strcmp0 (erase_type, "ata-secure-erase-enhanced") == 0)
-    {
-      ret = erase_ata_device (block, object, daemon, caller_uid, TRUE, error);
-      goto out;
-    }
-  else if (g_strcmp0 (erase_type, "zero") != 0)
+static void
+erase_update_progress (EraseData *data)
+{
+  gint64 now;
+
+  /* only emit D-Bus signal at most once a second */
+  now = g_get_monotonic_time ();
+  if (now - data->time_of_last_signal <= G_USEC_PER_SEC)
+    return;
+
+  udisks_job_set_progress (UDISKS_JOB (data->job), ((gdouble) data->pos) / data->size);
+  /* the job doesn't auto-estimate, report the measured throughput instead */
+  if (now > data->time_started && data->pos > 0)
     {
-      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                   "Unknown or unsupported erase type `%s'",
-                   erase_type);
-      goto out;
+      gdouble bytes_per_usec = ((gdouble) data->pos) / (now - data->time_started);
+
+      udisks_job_set_rate (UDISKS_JOB (data->job), bytes_per_usec * G_USEC_PER_SEC);
+      udisks_job_set_expected_end_time (UDISKS_JOB (data->job),
+                                        g_get_real_time () + (data->size - data->pos) / bytes_per_usec);
     }
+  data->time_of_last_signal = now;
+}
 
-  device_file = udisks_block_get_device (block);
-  fd = open (device_file, O_WRONLY | O_SYNC | O_EXCL);
-  if (fd == -1)
+static gboolean
+erase_check_cancelled (EraseData  *data,
+                       GError    **error)
+{
+  if (g_cancellable_is_cancelled (udisks_base_job_get_cancellable (data->job)))
     {
-      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                   "Error opening device %s: %m", device_file);
-      goto out;
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_CANCELLED,
+                   "Job was canceled");
+      return TRUE;
     }
+  return FALSE;
+}
 
-  job = udisks_daemon_launch_simple_job (daemon, object, "format-erase", caller_uid, NULL);
-  udisks_base_job_set_auto_estimate (UDISKS_BASE_JOB (job), TRUE);
-  udisks_job_set_progress_valid (UDISKS_JOB (job), TRUE);
+/* Writes zeroes one block at a time - used when Linux AIO is not available */
+static gboolean
+erase_zero_sync (gint        fd,
+                 EraseData  *data,
+                 GError    **error)
+{
+  gboolean ret = FALSE;
+  guchar *buf = NULL;
 
-  if (ioctl (fd, BLKGETSIZE64, &size) != 0)
+  if (posix_memalign ((void **) &buf, ERASE_AIO_ALIGNMENT, ERASE_SIZE) != 0)
     {
-      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                   "Error doing BLKGETSIZE64 iotctl on %s: %m", device_file);
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error allocating erase buffer");
       goto out;
     }
+  memset (buf, 0, ERASE_SIZE);
 
-  udisks_job_set_bytes (UDISKS_JOB (job), size);
-
-  buf = g_new0 (guchar, ERASE_SIZE);
-  pos = 0;
-  time_of_last_signal = g_get_monotonic_time ();
-  while (pos < size)
+  while (data->pos < data->size)
     {
       size_t to_write;
       ssize_t num_written;
-      gint64 now;
 
-      to_write = MIN (size - pos, ERASE_SIZE);
+      to_write = MIN (data->size - data->pos, ERASE_SIZE);
     again:
-      num_written = write (fd, buf, to_write);
+      num_written = pwrite (fd, buf, to_write, data->pos);
       if (num_written == -1 || num_written == 0)
         {
           if (errno == EINTR)
             goto again;
-          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
                        "Error writing %d bytes to %s: %m",
-                       (gint) to_write, device_file);
+                       (gint) to_write, data->device_file);
           goto out;
         }
-      pos += num_written;
+      data->pos += num_written;
 
-      if (g_cancellable_is_cancelled (udisks_base_job_get_cancellable (job)))
-        {
-          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_CANCELLED,
-                       "Job was canceled");
-          goto out;
-        }
+      if (erase_check_cancelled (data, error))
+        goto out;
 
-      /* only emit D-Bus signal at most once a second */
-      now = g_get_monotonic_time ();
-      if (now - time_of_last_signal > G_USEC_PER_SEC)
+      erase_update_progress (data);
+    }
+
+  ret = TRUE;
+
+ out:
+  free (buf);
+  return ret;
+}
+
+/* Writes zeroes keeping up to ERASE_AIO_QUEUE_DEPTH writes in flight.
+ *
+ * All requests share a single zero-filled buffer since the kernel only reads
+ * from it. Returns %FALSE and sets @out_unsupported if Linux AIO can't be
+ * used, in which case the caller should fall back to erase_zero_sync().
+ */
+static gboolean
+erase_zero_aio (gint        fd,
+                EraseData  *data,
+                gboolean   *out_unsupported,
+                GError    **error)
+{
+  gboolean ret = FALSE;
+  aio_context_t ctx = 0;
+  struct iocb iocbs[ERASE_AIO_QUEUE_DEPTH];
+  struct iocb *free_iocbs[ERASE_AIO_QUEUE_DEPTH];
+  struct iocb *pending[ERASE_AIO_QUEUE_DEPTH];
+  struct io_event events[ERASE_AIO_QUEUE_DEPTH];
+  guint num_free;
+  guint num_pending = 0;
+  guint num_in_flight = 0;
+  guint num_retries = 0;
+  guint64 submit_pos = 0;
+  guchar *buf = NULL;
+  guint n;
+
+  *out_unsupported = FALSE;
+
+  if (syscall (SYS_io_setup, ERASE_AIO_QUEUE_DEPTH, &ctx) != 0)
+    {
+      udisks_debug ("Linux AIO not available for erasing %s: %m", data->device_file);
+      *out_unsupported = TRUE;
+      ctx = 0;
+      goto out;
+    }
+
+  if (posix_memalign ((void **) &buf, ERASE_AIO_ALIGNMENT, ERASE_AIO_CHUNK_SIZE) != 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error allocating erase buffer");
+      goto out;
+    }
+  memset (buf, 0, ERASE_AIO_CHUNK_SIZE);
+
+  for (n = 0; n < ERASE_AIO_QUEUE_DEPTH; n++)
+    free_iocbs[n] = &iocbs[n];
+  num_free = ERASE_AIO_QUEUE_DEPTH;
+
+  while (data->pos < data->size)
+    {
+      glong num_events;
+
+      /* keep the queue full */
+      while (num_free > 0 && submit_pos < data->size)
+        {
+          struct iocb *cb = free_iocbs[--num_free];
+
+          memset (cb, 0, sizeof (struct iocb));
+          cb->aio_fildes = fd;
+          cb->aio_lio_opcode = IOCB_CMD_PWRITE;
+          cb->aio_buf = (guint64) (guintptr) buf;
+          cb->aio_nbytes = MIN (data->size - submit_pos, ERASE_AIO_CHUNK_SIZE);
+          cb->aio_offset = submit_pos;
+          submit_pos += cb->aio_nbytes;
+          pending[num_pending++] = cb;
+        }
+
+      while (num_pending > 0)
+        {
+          glong rc;
+
+          rc = syscall (SYS_io_submit, ctx, (glong) num_pending, pending);
+          if (rc < 0 && errno == EINTR)
+            continue;
+          if (rc < 0 && errno != EAGAIN)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error submitting writes to %s: %m", data->device_file);
+              goto out;
+            }
+          if (rc <= 0)
+            {
+              /* nothing was queued - reap completed writes to make room,
+               * the rest stays pending until the next round
+               */
+              if (num_in_flight > 0)
+                break;
+              if (++num_retries > ERASE_AIO_MAX_SUBMIT_RETRIES)
+                {
+                  g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                               "Error submitting writes to %s: no write could be queued", data->device_file);
+                  goto out;
+                }
+              g_usleep (G_USEC_PER_SEC / 100);
+              continue;
+            }
+          num_retries = 0;
+          num_in_flight += rc;
+          num_pending -= rc;
+          memmove (pending, pending + rc, num_pending * sizeof (struct iocb *));
+        }
+
+      num_events = syscall (SYS_io_getevents, ctx, 1L, (glong) ERASE_AIO_QUEUE_DEPTH, events, NULL);
+      if (num_events < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error waiting for writes to %s: %m", data->device_file);
+          goto out;
+        }
+
+      for (n = 0; n < (guint) num_events; n++)
         {
-          /* TODO: estimation etc. */
-          udisks_job_set_progress (UDISKS_JOB (job), ((gdouble) pos) / size);
-          time_of_last_signal = now;
+          struct iocb *cb = (struct iocb *) (guintptr) events[n].obj;
+
+          if (events[n].res < 0)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error writing %d bytes to %s: %s",
+                           (gint) cb->aio_nbytes, data->device_file, g_strerror ((gint) -events[n].res));
+              goto out;
+            }
+          if ((guint64) events[n].res != cb->aio_nbytes)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Short write of %d bytes to %s at offset %" G_GUINT64_FORMAT,
+                           (gint) events[n].res, data->device_file, (guint64) cb->aio_offset);
+              goto out;
+            }
+          data->pos += events[n].res;
+          free_iocbs[num_free++] = cb;
+          num_in_flight--;
         }
+
+      if (erase_check_cancelled (data, error))
+        goto out;
+
+      erase_update_progress (data);
+    }
+
+  ret = TRUE;
+
+ out:
+  /* io_destroy() waits for any requests still in flight so the buffer can be freed afterwards */
+  if (ctx != 0)
+    syscall (SYS_io_destroy, ctx);
+  free (buf);
+  return ret;
+}
+
+static gboolean
+erase_device (UDisksBlock   *block,
+              UDisksObject  *object,
+              UDisksDaemon  *daemon,
+              uid_t          caller_uid,
+              const gchar   *erase_type,
+              GError       **error)
+{
+  gboolean ret = FALSE;
+  const gchar *device_file = NULL;
+  UDisksBaseJob *job = NULL;
+  gint fd = -1;
+  gboolean direct = TRUE;
+  gboolean aio_unsupported = FALSE;
+  guint64 size;
+  EraseData data;
+  GError *local_error = NULL;
+
+  if (g_strcmp0 (erase_type, "ata-secure-erase") == 0)
+    {
+      ret = erase_ata_device (block, object, daemon, caller_uid, FALSE, error);
+      goto out;
+    }
+  else if (g_strcmp0 (erase_type, "ata-secure-erase-enhanced") == 0)
+    {
+      ret = erase_ata_device (block, object, daemon, caller_uid, TRUE, error);
+      goto out;
+    }
+  else if (g_strcmp0 (erase_type, "zero") != 0)
+    {
+      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Unknown or unsupported erase type `%s'",
+                   erase_type);
+      goto out;
+    }
+
+  device_file = udisks_block_get_device (block);
+  fd = open (device_file, O_WRONLY | O_DIRECT | O_EXCL);
+  if (fd == -1 && errno == EINVAL)
+    {
+      /* not all devices support O_DIRECT */
+      direct = FALSE;
+      fd = open (device_file, O_WRONLY | O_SYNC | O_EXCL);
+    }
+  if (fd == -1)
+    {
+      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening device %s: %m", device_file);
+      goto out;
+    }
+
+  job = udisks_daemon_launch_simple_job (daemon, object, "format-erase", caller_uid, NULL);
+  /* the rate and expected end time are computed in erase_update_progress() */
+  udisks_base_job_set_auto_estimate (UDISKS_BASE_JOB (job), FALSE);
+  udisks_job_set_progress_valid (UDISKS_JOB (job), TRUE);
+
+  if (ioctl (fd, BLKGETSIZE64, &size) != 0)
+    {
+      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error doing BLKGETSIZE64 iotctl on %s: %m", device_file);
+      goto out;
+    }
+
+  udisks_job_set_bytes (UDISKS_JOB (job), size);
+
+  data.job = job;
+  data.device_file = device_file;
+  data.size = size;
+  data.pos = 0;
+  data.time_started = g_get_monotonic_time ();
+  data.time_of_last_signal = data.time_started;
+
+  /* Without O_DIRECT, Linux AIO degrades to synchronous writes anyway */
+  if (!direct)
+    aio_unsupported = TRUE;
+  else if (!erase_zero_aio (fd, &data, &aio_unsupported, &local_error) && !aio_unsupported)
+    goto out;
+
+  if (aio_unsupported && !erase_zero_sync (fd, &data, &local_error))
+    goto out;
+
+  if (direct && fdatasync (fd) != 0)
+    {
+      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error syncing %s: %m", device_file);
+      goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  if (job != NULL)
+    {
+      if (local_error != NULL)
+        udisks_simple_job_complete (UDISKS_SIMPLE_JOB (job), FALSE, local_error->message);
+      else
+        udisks_simple_job_complete (UDISKS_SIMPLE_JOB (job), TRUE, "");
+    }
+  if (local_error != NULL)
+    g_propagate_error (error, local_error);
+  if (fd != -1)
+    close (fd);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Discards the whole device with a single ranged BLKDISCARD so that mkfs
+ * does not have to do it again (see FSInfo's option_no_discard).
+ */
+static gboolean
+discard_device (UDisksBlock   *block,
+                UDisksObject  *object,
+                UDisksDaemon  *daemon,
+                uid_t          caller_uid,
+                GError       **error)
+{
+  gboolean ret = FALSE;
+  const gchar *device_file = NULL;
+  UDisksBaseJob *job = NULL;
+  gint fd = -1;
+  guint64 range[2];
+  GError *local_error = NULL;
+
+  device_file = udisks_block_get_device (block);
+  fd = open (device_file, O_WRONLY | O_EXCL);
+  if (fd == -1)
+    {
+      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening device %s: %m", device_file);
+      goto out;
+    }
+
+  job = udisks_daemon_launch_simple_job (daemon, object, "format-discard", caller_uid, NULL);
+
+  range[0] = 0;
+  if (ioctl (fd, BLKGETSIZE64, &range[1]) != 0)
+    {
+      g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error doing BLKGETSIZE64 iotctl on %s: %m", device_file);
+      goto out;
+    }
+
+  udisks_job_set_bytes (UDISKS_JOB (job), range[1]);
+
+  if (ioctl (fd, BLKDISCARD, &range) != 0)
+    {
+      g_set_error (&local_error, UDISKS_ERROR,
+                   errno == EOPNOTSUPP ? UDISKS_ERROR_NOT_SUPPORTED : UDISKS_ERROR_FAILED,
+                   "Error discarding %s: %m", device_file);
+      goto out;
     }
 
   ret = TRUE;
@@ -2353,7 +3143,6 @@ erase_device (UDisksBlock   *block,
     }
   if (local_error != NULL)
     g_propagate_error (error, local_error);
-  g_free (buf);
   if (fd != -1)
     close (fd);
   return ret;
@@ -2577,35 +3366,35 @@ gboolean
 udisks_linux_remove_configuration (GVariant  *config,
                                    GError   **error)
 {
+  UDisksConfigurationEdit *edit;
   GVariantIter iter;
-  const gchar *item_type;
-  GVariant *details;
+  GVariant *item;
+  gboolean ret = FALSE;
 
   udisks_debug ("Removing for teardown: %s", g_variant_print (config, FALSE));
 
+  /* All entries go away with a single write of each file */
+  edit = udisks_configuration_edit_new ();
   g_variant_iter_init (&iter, config);
-  while (g_variant_iter_next (&iter, "(&s@a{sv})", &item_type, &details))
+  while ((item = g_variant_iter_next_value (&iter)) != NULL)
     {
-      if (strcmp (item_type, "fstab") == 0)
-        {
-          if (!add_remove_fstab_entry (NULL, details, NULL, error))
-            {
-              g_variant_unref (details);
-              return FALSE;
-            }
-        }
-      else if (strcmp (item_type, "crypttab") == 0)
+      const gchar *item_type;
+
+      g_variant_get (item, "(&s@a{sv})", &item_type, NULL);
+      if ((strcmp (item_type, "fstab") == 0 || strcmp (item_type, "crypttab") == 0) &&
+          !udisks_configuration_edit_apply (edit, NULL, item, NULL, error))
         {
-          if (!add_remove_crypttab_entry (NULL, details, NULL, error))
-            {
-              g_variant_unref (details);
-              return FALSE;
-            }
+          g_variant_unref (item);
+          goto out;
         }
-      g_variant_unref (details);
+      g_variant_unref (item);
     }
 
-  return TRUE;
+  ret = udisks_configuration_edit_commit (edit, error);
+
+ out:
+  udisks_configuration_edit_free (edit);
+  return ret;
 }
 
 struct TeardownData {
@@ -2681,94 +3470,67 @@ handle_format_failure (GDBusMethodInvocation *invocation,
     g_clear_error (&error);
 }
 
-void
-udisks_linux_block_handle_format (UDisksBlock             *block,
-                                  GDBusMethodInvocation   *invocation,
-                                  const gchar             *type,
-                                  GVariant                *options,
-                                  void                   (*complete)(gpointer user_data),
-                                  gpointer                 complete_user_data)
+/* Result of the checks done before formatting @block, see format_check() */
+typedef struct
 {
-  FormatWaitData *wait_data = NULL;
-  UDisksObject *object;
-  UDisksPartition *partition = NULL;
+  const FSInfo    *fs_info;
+  UDisksPartition *partition;
+  const gchar     *partition_type;
+  const gchar     *action_id;
+  const gchar     *message;
+} FormatCheckData;
+
+static void
+format_check_data_clear (FormatCheckData *check)
+{
+  g_clear_object (&check->partition);
+}
+
+static gboolean
+format_check (UDisksBlock      *block,
+              UDisksObject     *object,
+              UDisksDaemon     *daemon,
+              const gchar      *type,
+              GVariant         *options,
+              uid_t             caller_uid,
+              FormatCheckData  *check,
+              GError          **error)
+{
+  gboolean ret = FALSE;
   UDisksPartitionTable *partition_table = NULL;
-  UDisksObject *cleartext_object = NULL;
-  UDisksBlock *cleartext_block = NULL;
-  UDisksLinuxDevice *udev_cleartext_device = NULL;
-  UDisksBlock *block_to_mkfs = NULL;
-  UDisksObject *object_to_mkfs = NULL;
-  UDisksDaemon *daemon;
-  UDisksState *state;
-  const gchar *action_id;
-  const gchar *message;
-  const FSInfo *fs_info;
-  gchar *command = NULL;
-  gchar *tmp;
-  gchar *error_message;
-  GError *error;
-  int status;
-  uid_t caller_uid;
-  gid_t caller_gid;
-  gboolean take_ownership = FALSE;
   GString *encrypt_passphrase = NULL;
   gchar *erase_type = NULL;
-  gchar *mapped_name = NULL;
-  const gchar *label = NULL;
-  gchar *device_name = NULL;
-  gboolean was_partitioned = FALSE;
-  UDisksInhibitCookie *inhibit_cookie = NULL;
-  gboolean no_block = FALSE;
   gboolean update_partition_type = FALSE;
-  gboolean dry_run_first = FALSE;
-  const gchar *partition_type = NULL;
-  GVariant *config_items = NULL;
-  gboolean teardown_flag = FALSE;
-  BDPartTableType part_table_type = BD_PART_TABLE_UNDEF;
-
-  error = NULL;
-  object = udisks_daemon_util_dup_object (block, &error);
-  if (object == NULL)
-    {
-      g_dbus_method_invocation_take_error (invocation, error);
-      goto out;
-    }
+  gboolean discard = FALSE;
 
-  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
-  state = udisks_daemon_get_state (daemon);
-  command = NULL;
-  error_message = NULL;
+  memset (check, 0, sizeof (FormatCheckData));
 
-  g_variant_lookup (options, "take-ownership", "b", &take_ownership);
   udisks_variant_lookup_binary (options, "encrypt.passphrase", &encrypt_passphrase);
   g_variant_lookup (options, "erase", "s", &erase_type);
-  g_variant_lookup (options, "no-block", "b", &no_block);
+  g_variant_lookup (options, "discard", "b", &discard);
   g_variant_lookup (options, "update-partition-type", "b", &update_partition_type);
-  g_variant_lookup (options, "dry-run-first", "b", &dry_run_first);
-  g_variant_lookup (options, "config-items", "@a(sa{sv})", &config_items);
-  g_variant_lookup (options, "tear-down", "b", &teardown_flag);
 
-  partition = udisks_object_get_partition (object);
-  if (partition != NULL)
+  check->partition = udisks_object_get_partition (object);
+  if (check->partition != NULL)
     {
       UDisksObject *partition_table_object;
 
       /* Fail if partition contains a partition table (e.g. Fedora Hybrid ISO).
        * See: https://bugs.freedesktop.org/show_bug.cgi?id=76178
        */
-      if (udisks_partition_get_offset (partition) == 0)
+      if (udisks_partition_get_offset (check->partition) == 0)
         {
-          g_dbus_method_invocation_return_error (invocation,
-                                                 UDISKS_ERROR,
-                                                 UDISKS_ERROR_NOT_SUPPORTED,
-                                                 "This partition cannot be modified because it contains a partition table; please reinitialize layout of the whole device.");
+          g_set_error (error,
+                       UDISKS_ERROR,
+                       UDISKS_ERROR_NOT_SUPPORTED,
+                       "This partition cannot be modified because it contains a partition table; please reinitialize layout of the whole device.");
           goto out;
         }
 
-      partition_table_object = udisks_daemon_find_object (daemon, udisks_partition_get_table (partition));
+      partition_table_object = udisks_daemon_find_object (daemon, udisks_partition_get_table (check->partition));
       if (partition_table_object == NULL)
         {
-          g_clear_object (&partition);
+          g_clear_object (&check->partition);
         }
       else
         {
@@ -2777,17 +3539,18 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
         }
     }
   /* figure out partition type to set, if requested */
-  if (update_partition_type && partition != NULL && partition_table != NULL)
+  if (update_partition_type && check->partition != NULL && partition_table != NULL)
     {
-      partition_type = determine_partition_type_for_id (udisks_partition_table_get_type_ (partition_table),
-                                                        encrypt_passphrase != NULL ? "crypto_LUKS" : type);
+      check->partition_type = determine_partition_type_for_id (udisks_partition_table_get_type_ (partition_table),
+                                                               encrypt_passphrase != NULL ? "crypto_LUKS" : type);
     }
 
-  error = NULL;
-  if (!udisks_daemon_util_get_caller_uid_sync (daemon, invocation, NULL /* GCancellable */, &caller_uid, &caller_gid, NULL, &error))
+  if (discard && erase_type != NULL)
     {
-      g_dbus_method_invocation_return_gerror (invocation, error);
-      g_clear_error (&error);
+      g_set_error (error,
+                   UDISKS_ERROR,
+                   UDISKS_ERROR_FAILED,
+                   "The discard and erase options cannot be used together");
       goto out;
     }
 
@@ -2801,8 +3564,8 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
        * Do not translate $(drive), it's a placeholder and
        * will be replaced by the name of the drive/device in question
        */
-      message = N_("Authentication is required to perform a secure erase of $(drive)");
-      action_id = "org.freedesktop.udisks2.ata-secure-erase";
+      check->message = N_("Authentication is required to perform a secure erase of $(drive)");
+      check->action_id = "org.freedesktop.udisks2.ata-secure-erase";
     }
   else
     {
@@ -2813,17 +3576,17 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
        * Do not translate $(drive), it's a placeholder and will
        * be replaced by the name of the drive/device in question
        */
-      message = N_("Authentication is required to format $(drive)");
-      action_id = "org.freedesktop.udisks2.modify-device";
+      check->message = N_("Authentication is required to format $(drive)");
+      check->action_id = "org.freedesktop.udisks2.modify-device";
       if (!udisks_daemon_util_setup_by_user (daemon, object, caller_uid))
         {
           if (udisks_block_get_hint_system (block))
             {
-              action_id = "org.freedesktop.udisks2.modify-device-system";
+              check->action_id = "org.freedesktop.udisks2.modify-device-system";
             }
           else if (!udisks_daemon_util_on_user_seat (daemon, object, caller_uid))
             {
-              action_id = "org.freedesktop.udisks2.modify-device-other-seat";
+              check->action_id = "org.freedesktop.udisks2.modify-device-other-seat";
             }
         }
     }
@@ -2831,10 +3594,10 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
   /* TODO: Consider just accepting any @type and just running "mkfs -t <type>".
    *       There are some obvious security implications by doing this, though
    */
-  fs_info = get_fs_info (type);
-  if (fs_info == NULL || fs_info->command_create_fs == NULL)
+  check->fs_info = get_fs_info (type);
+  if (check->fs_info == NULL || check->fs_info->command_create_fs == NULL)
     {
-      g_dbus_method_invocation_return_error (invocation,
+      g_set_error (error,
                    UDISKS_ERROR,
                    UDISKS_ERROR_NOT_SUPPORTED,
                    "Creation of file system type %s is not supported",
@@ -2842,22 +3605,77 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
       goto out;
     }
 
-  if (!udisks_daemon_util_check_authorization_sync (daemon,
-                                                    object,
-                                                    action_id,
-                                                    options,
-                                                    message,
-                                                    invocation))
-    goto out;
+  ret = TRUE;
 
-  if ((config_items != NULL || teardown_flag) &&
-      !udisks_daemon_util_check_authorization_sync (daemon,
-                                                    NULL,
-                                                    "org.freedesktop.udisks2.modify-system-configuration",
-                                                    options,
-                                                    N_("Authentication is required to modify the system configuration"),
-                                                    invocation))
-    goto out;
+ out:
+  if (!ret)
+    format_check_data_clear (check);
+  g_free (erase_type);
+  udisks_string_wipe_and_free (encrypt_passphrase);
+  g_clear_object (&partition_table);
+  return ret;
+}
+
+/* Runs the actual format pipeline once all checks and authorization have been
+ * done. If @complete is not %NULL it is called as soon as the method can be
+ * completed early (the no-block option) and @out_completed is set to %TRUE.
+ */
+static gboolean
+format_device (UDisksBlock            *block,
+               UDisksObject           *object,
+               UDisksDaemon           *daemon,
+               GDBusMethodInvocation  *invocation,
+               const gchar            *type,
+               GVariant               *options,
+               FormatCheckData        *check,
+               uid_t                   caller_uid,
+               gid_t                   caller_gid,
+               void                  (*complete)(gpointer user_data),
+               gpointer                complete_user_data,
+               gboolean               *out_completed,
+               GError                **error)
+{
+  gboolean ret = FALSE;
+  FormatWaitData *wait_data = NULL;
+  UDisksObject *cleartext_object = NULL;
+  UDisksBlock *cleartext_block = NULL;
+  UDisksLinuxDevice *udev_cleartext_device = NULL;
+  UDisksBlock *block_to_mkfs = NULL;
+  UDisksObject *object_to_mkfs = NULL;
+  UDisksState *state;
+  const FSInfo *fs_info = check->fs_info;
+  gchar *command = NULL;
+  gchar *error_message = NULL;
+  GError *local_error = NULL;
+  int status;
+  gboolean take_ownership = FALSE;
+  GString *encrypt_passphrase = NULL;
+  gchar *erase_type = NULL;
+  gchar *mapped_name = NULL;
+  const gchar *label = NULL;
+  gchar *device_name = NULL;
+  gboolean was_partitioned = FALSE;
+  UDisksInhibitCookie *inhibit_cookie = NULL;
+  gboolean no_block = FALSE;
+  gboolean dry_run_first = FALSE;
+  GVariant *config_items = NULL;
+  gboolean teardown_flag = FALSE;
+  gboolean discard = FALSE;
+  gboolean no_stripe_alignment = FALSE;
+  gchar *mkfs_options = NULL;
+  BDPartTableType part_table_type = BD_PART_TABLE_UNDEF;
+
+  state = udisks_daemon_get_state (daemon);
+
+  g_variant_lookup (options, "take-ownership", "b", &take_ownership);
+  udisks_variant_lookup_binary (options, "encrypt.passphrase", &encrypt_passphrase);
+  g_variant_lookup (options, "erase", "s", &erase_type);
+  g_variant_lookup (options, "no-block", "b", &no_block);
+  g_variant_lookup (options, "dry-run-first", "b", &dry_run_first);
+  g_variant_lookup (options, "config-items", "@a(sa{sv})", &config_items);
+  g_variant_lookup (options, "tear-down", "b", &teardown_flag);
+  g_variant_lookup (options, "discard", "b", &discard);
+  g_variant_lookup (options, "no-stripe-alignment", "b", &no_stripe_alignment);
 
   inhibit_cookie = udisks_daemon_util_inhibit_system_sync (N_("Formatting Device"));
 
@@ -2865,36 +3683,47 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
 
   if (teardown_flag)
     {
-      if (!udisks_linux_block_teardown (block, invocation, options, &error))
+      if (!udisks_linux_block_teardown (block, invocation, options, &local_error))
+        goto out;
+    }
+
+  device_name = udisks_block_dup_device (block);
+
+  wait_data = g_new0 (FormatWaitData, 1);
+  wait_data->object = object;
+  wait_data->type = "empty";
+
+  /* In discard mode the device is discarded with a single ranged request and
+   * mkfs is told not to discard again below. Discarded blocks are not
+   * guaranteed to read back as zeroes, so the signatures are wiped anyway.
+   */
+  if (discard)
+    {
+      if (!discard_device (block, object, daemon, caller_uid, &local_error))
         {
-          g_dbus_method_invocation_take_error (invocation, error);
+          g_prefix_error (&local_error, "Error discarding device: ");
           goto out;
         }
     }
 
-  device_name = udisks_block_dup_device (block);
-
   /* First wipe the device... */
-  if (! bd_fs_wipe (device_name, TRUE, &error)) {
-    if (g_error_matches (error, BD_FS_ERROR, BD_FS_ERROR_NOFS))
+  if (! bd_fs_wipe (device_name, TRUE, &local_error)) {
+    if (g_error_matches (local_error, BD_FS_ERROR, BD_FS_ERROR_NOFS))
       /* no signature to remove, ignore */
-      g_clear_error (&error);
+      g_clear_error (&local_error);
     else
       {
-        g_dbus_method_invocation_return_error (invocation,
-                                               UDISKS_ERROR,
-                                               UDISKS_ERROR_FAILED,
-                                               "Error wiping device: %s",
-                                               error->message);
-        g_clear_error (&error);
+        GError *wipe_error = local_error;
+        local_error = g_error_new (UDISKS_ERROR,
+                                   UDISKS_ERROR_FAILED,
+                                   "Error wiping device: %s",
+                                   wipe_error->message);
+        g_clear_error (&wipe_error);
         goto out;
       }
   }
 
   /* ...then wait until this change has taken effect */
-  wait_data = g_new0 (FormatWaitData, 1);
-  wait_data->object = object;
-  wait_data->type = "empty";
   udisks_linux_block_object_trigger_uevent (UDISKS_LINUX_BLOCK_OBJECT (object));
   if (was_partitioned)
     udisks_linux_block_object_reread_partition_table (UDISKS_LINUX_BLOCK_OBJECT (object));
@@ -2903,10 +3732,9 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                           wait_data,
                                           NULL,
                                           15,
-                                          &error) == NULL)
+                                          &local_error) == NULL)
     {
-      g_prefix_error (&error, "Error synchronizing after initial wipe: ");
-      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_prefix_error (&local_error, "Error synchronizing after initial wipe: ");
       goto out;
     }
 
@@ -2915,10 +3743,12 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
   */
   if (dry_run_first && fs_info->command_validate_create_fs)
     {
-      tmp = subst_str_and_escape (fs_info->command_validate_create_fs, "$DEVICE",
-                                  udisks_block_get_device (block));
-      command = subst_str_and_escape (tmp, "$LABEL", label != NULL ? label : "");
-      g_free (tmp);
+      mkfs_options = build_mkfs_options (fs_info, object, discard, !no_stripe_alignment);
+      command = build_mkfs_command (fs_info->command_validate_create_fs,
+                                    udisks_block_get_device (block),
+                                    label,
+                                    mkfs_options);
+      g_clear_pointer (&mkfs_options, g_free);
 
       if (!udisks_daemon_launch_spawned_job_sync (daemon,
                                                     object,
@@ -2931,23 +3761,23 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                                     NULL, /* input_string */
                                                     "%s", command))
         {
-          g_dbus_method_invocation_return_error (invocation,
-                                                 UDISKS_ERROR,
-                                                 UDISKS_ERROR_FAILED,
-                                                 "Error creating file system: %s",
-                                                 error_message);
+          g_set_error (&local_error,
+                       UDISKS_ERROR,
+                       UDISKS_ERROR_FAILED,
+                       "Error creating file system: %s",
+                       error_message);
           g_free (error_message);
           goto out;
         }
 
-      g_free (command);
+      g_clear_pointer (&command, g_free);
     }
 
   /* complete early, if requested */
-  if (no_block)
+  if (no_block && complete != NULL)
     {
       complete (complete_user_data);
-      invocation = NULL;
+      *out_completed = TRUE;
     }
 
   /* Erase the device, if requested
@@ -2956,10 +3786,9 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
    */
   if (erase_type != NULL && encrypt_passphrase == NULL)
     {
-      if (!erase_device (block, object, daemon, caller_uid, erase_type, &error))
+      if (!erase_device (block, object, daemon, caller_uid, erase_type, &local_error))
         {
-          g_prefix_error (&error, "Error erasing device: ");
-          handle_format_failure (invocation, error);
+          g_prefix_error (&local_error, "Error erasing device: ");
           goto out;
         }
     }
@@ -2982,11 +3811,12 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                                    &data,
                                                    NULL, /* user_data_free_func */
                                                    NULL, /* cancellable */
-                                                   &error))
+                                                   &local_error))
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "Error creating LUKS device: %s", error->message));
-          g_clear_error (&error);
+          GError *luks_error = local_error;
+          local_error = g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                     "Error creating LUKS device: %s", luks_error->message);
+          g_clear_error (&luks_error);
           goto out;
         }
 
@@ -2996,19 +3826,17 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                               wait_data,
                                               NULL,
                                               30,
-                                              &error) == NULL)
+                                              &local_error) == NULL)
         {
-          g_prefix_error (&error, "Error waiting for LUKS UUID: ");
-          handle_format_failure (invocation, error);
+          g_prefix_error (&local_error, "Error waiting for LUKS UUID: ");
           goto out;
         }
 
       /* Open it */
-      mapped_name = make_block_luksname (block, &error);
+      mapped_name = make_block_luksname (block, &local_error);
       if (!mapped_name)
         {
-          g_prefix_error (&error, "Failed to get LUKS UUID: ");
-          handle_format_failure (invocation, error);
+          g_prefix_error (&local_error, "Failed to get LUKS UUID: ");
           goto out;
         }
 
@@ -3022,11 +3850,12 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                                    &data,
                                                    NULL, /* user_data_free_func */
                                                    NULL, /* cancellable */
-                                                   &error))
+                                                   &local_error))
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "Error opening LUKS device: %s", error->message));
-          g_clear_error (&error);
+          GError *luks_error = local_error;
+          local_error = g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                     "Error opening LUKS device: %s", luks_error->message);
+          g_clear_error (&luks_error);
           goto out;
         }
 
@@ -3036,18 +3865,17 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                                              wait_data,
                                                              NULL,
                                                              30,
-                                                             &error);
+                                                             &local_error);
       if (cleartext_object == NULL)
         {
-          g_prefix_error (&error, "Error waiting for LUKS cleartext device: ");
-          handle_format_failure (invocation, error);
+          g_prefix_error (&local_error, "Error waiting for LUKS cleartext device: ");
           goto out;
         }
       cleartext_block = udisks_object_get_block (cleartext_object);
       if (cleartext_block == NULL)
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "LUKS cleartext device does not have block interface"));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "LUKS cleartext device does not have block interface");
           goto out;
         }
 
@@ -3071,10 +3899,9 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
   /* If using encryption, now erase the cleartext device (if requested) */
   if (encrypt_passphrase != NULL && erase_type != NULL)
     {
-      if (!erase_device (block_to_mkfs, object_to_mkfs, daemon, caller_uid, erase_type, &error))
+      if (!erase_device (block_to_mkfs, object_to_mkfs, daemon, caller_uid, erase_type, &local_error))
         {
-          g_prefix_error (&error, "Error erasing cleartext device: ");
-          handle_format_failure (invocation, error);
+          g_prefix_error (&local_error, "Error erasing cleartext device: ");
           goto out;
         }
     }
@@ -3085,8 +3912,8 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
       /* TODO: return an error if label is too long */
       if (strstr (fs_info->command_create_fs, "$LABEL") == NULL)
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_NOT_SUPPORTED,
-                                 "File system type %s does not support labels", type));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_NOT_SUPPORTED,
+                       "File system type %s does not support labels", type);
           goto out;
         }
     }
@@ -3098,9 +3925,12 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
     if (part_table_type == BD_PART_TABLE_UNDEF)
       {
         /* Build and run mkfs shell command */
-        tmp = subst_str_and_escape (fs_info->command_create_fs, "$DEVICE", udisks_block_get_device (block_to_mkfs));
-        command = subst_str_and_escape (tmp, "$LABEL", label != NULL ? label : "");
-        g_free (tmp);
+        mkfs_options = build_mkfs_options (fs_info, object_to_mkfs, discard, !no_stripe_alignment);
+        command = build_mkfs_command (fs_info->command_create_fs,
+                                      udisks_block_get_device (block_to_mkfs),
+                                      label,
+                                      mkfs_options);
+        g_clear_pointer (&mkfs_options, g_free);
         if (!udisks_daemon_launch_spawned_job_sync (daemon,
                                                       object_to_mkfs,
                                                       "format-mkfs", caller_uid,
@@ -3112,8 +3942,8 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                                       NULL, /* input_string */
                                                       "%s", command))
           {
-            handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                   "Error creating file system: %s", error_message));
+            g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                         "Error creating file system: %s", error_message);
             g_free (error_message);
             goto out;
           }
@@ -3121,11 +3951,8 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
     else
       {
         /* Create the partition table. */
-        if (! bd_part_create_table (device_name, part_table_type, TRUE, &error))
-          {
-            handle_format_failure (invocation, error);
-            goto out;
-          }
+        if (! bd_part_create_table (device_name, part_table_type, TRUE, &local_error))
+          goto out;
       }
 
   /* The mkfs program may not generate all the uevents we need - so explicitly
@@ -3138,12 +3965,11 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
                                           wait_data,
                                           NULL,
                                           30,
-                                          &error) == NULL)
+                                          &local_error) == NULL)
     {
-      g_prefix_error (&error,
+      g_prefix_error (&local_error,
                       "Error synchronizing after formatting with type `%s': ",
                       type);
-      handle_format_failure (invocation, error);
       goto out;
     }
 
@@ -3154,14 +3980,14 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
 
       if (mkdtemp (tos_dir) == NULL)
         {
-            handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                   "Cannot create directory %s: %m", tos_dir));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Cannot create directory %s: %m", tos_dir);
           goto out;
         }
       if (mount (udisks_block_get_device (block_to_mkfs), tos_dir, type, 0, NULL) != 0)
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "Cannot mount %s at %s: %m", udisks_block_get_device (block_to_mkfs), tos_dir));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Cannot mount %s at %s: %m", udisks_block_get_device (block_to_mkfs), tos_dir);
           if (rmdir (tos_dir) != 0)
             {
               udisks_warning ("Error removing directory %s: %m", tos_dir);
@@ -3170,8 +3996,8 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
         }
       if (chown (tos_dir, caller_uid, caller_gid) != 0)
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "Cannot chown %s to uid=%u and gid=%u: %m", tos_dir, caller_uid, caller_gid));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Cannot chown %s to uid=%u and gid=%u: %m", tos_dir, caller_uid, caller_gid);
           if (umount (tos_dir) != 0)
             {
               udisks_warning ("Error unmounting directory %s: %m", tos_dir);
@@ -3185,8 +4011,8 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
         }
       if (chmod (tos_dir, 0700) != 0)
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "Cannot chmod %s to mode 0700: %m", tos_dir));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Cannot chmod %s to mode 0700: %m", tos_dir);
           if (umount (tos_dir) != 0)
             {
               udisks_warning ("Error unmounting directory %s: %m", tos_dir);
@@ -3201,8 +4027,8 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
 
       if (umount (tos_dir) != 0)
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "Cannot unmount %s: %m", tos_dir));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Cannot unmount %s: %m", tos_dir);
           if (rmdir (tos_dir) != 0)
             {
               udisks_warning ("Error removing directory %s: %m", tos_dir);
@@ -3212,65 +4038,65 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
 
       if (rmdir (tos_dir) != 0)
         {
-          handle_format_failure (invocation, g_error_new (UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                                 "Cannot remove directory %s: %m", tos_dir));
+          g_set_error (&local_error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Cannot remove directory %s: %m", tos_dir);
           goto out;
         }
     }
 
   /* Set the partition type, if requested */
-  if (partition_type != NULL && partition != NULL)
+  if (check->partition_type != NULL && check->partition != NULL)
     {
-      if (g_strcmp0 (udisks_partition_get_type_ (partition), partition_type) != 0)
+      if (g_strcmp0 (udisks_partition_get_type_ (check->partition), check->partition_type) != 0)
         {
-          if (!udisks_linux_partition_set_type_sync (UDISKS_LINUX_PARTITION (partition),
-                                                     partition_type,
+          if (!udisks_linux_partition_set_type_sync (UDISKS_LINUX_PARTITION (check->partition),
+                                                     check->partition_type,
                                                      caller_uid,
                                                      NULL, /* cancellable */
-                                                     &error))
+                                                     &local_error))
             {
-              g_prefix_error (&error, "Error setting partition type after formatting: ");
-              handle_format_failure (invocation, error);
+              g_prefix_error (&local_error, "Error setting partition type after formatting: ");
               goto out;
             }
         }
     }
 
-  /* Add configuration items */
+  /* Add configuration items - FormatMany() formats devices in parallel, the
+   * edit makes sure they are added to the files one device after another
+   */
 
   if (config_items)
     {
+      UDisksConfigurationEdit *edit;
       GVariantIter iter;
-      const gchar *item_type;
-      GVariant *details;
+      GVariant *item;
+      gboolean applied = TRUE;
 
+      edit = udisks_configuration_edit_new ();
       g_variant_iter_init (&iter, config_items);
-      while (g_variant_iter_next (&iter, "(&s@a{sv})", &item_type, &details))
+      while (applied && (item = g_variant_iter_next_value (&iter)) != NULL)
         {
+          const gchar *item_type;
+
+          g_variant_get (item, "(&s@a{sv})", &item_type, NULL);
           if (strcmp (item_type, "fstab") == 0)
-            {
-              if (!add_remove_fstab_entry (block_to_mkfs, NULL, details, &error))
-                {
-                  handle_format_failure (invocation, error);
-                  goto out;
-                }
-            }
+            applied = udisks_configuration_edit_apply (edit, block_to_mkfs, NULL, item, &local_error);
           else if (strcmp (item_type, "crypttab") == 0)
-            {
-              if (!add_remove_crypttab_entry (block, NULL, details, &error))
-                {
-                  handle_format_failure (invocation, error);
-                  goto out;
-                }
-            }
-          g_variant_unref (details);
+            applied = udisks_configuration_edit_apply (edit, block, NULL, item, &local_error);
+          g_variant_unref (item);
         }
+      if (applied)
+        applied = udisks_configuration_edit_commit (edit, &local_error);
+      udisks_configuration_edit_free (edit);
+      if (!applied)
+        goto out;
     }
 
-  if (invocation != NULL)
-    complete (complete_user_data);
+  ret = TRUE;
 
  out:
+  if (local_error != NULL)
+    g_propagate_error (error, local_error);
   udisks_daemon_util_uninhibit_system_sync (inhibit_cookie);
   g_free (device_name);
   g_free (mapped_name);
@@ -3283,8 +4109,180 @@ udisks_linux_block_handle_format (UDisksBlock             *block,
   g_clear_object (&cleartext_block);
   g_clear_object (&udev_cleartext_device);
   g_free (wait_data);
-  g_clear_object (&partition_table);
-  g_clear_object (&partition);
+  return ret;
+}
+
+/**
+ * udisks_linux_block_format_check_sync:
+ * @block: A #UDisksBlock.
+ * @type: The type of content to format @block with.
+ * @options: The options for the Format() method.
+ * @caller_uid: The uid of the caller.
+ * @out_action_id: Return location for the polkit action to check.
+ * @out_message: Return location for the (untranslated) authentication message.
+ * @error: Return location for error or %NULL.
+ *
+ * Checks whether @block can be formatted with @type and determines what
+ * authorization is needed for it, without doing any I/O on the device.
+ *
+ * Returns: %TRUE if @block can be formatted, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_block_format_check_sync (UDisksBlock   *block,
+                                      const gchar   *type,
+                                      GVariant      *options,
+                                      uid_t          caller_uid,
+                                      const gchar  **out_action_id,
+                                      const gchar  **out_message,
+                                      GError       **error)
+{
+  UDisksObject *object;
+  UDisksDaemon *daemon;
+  FormatCheckData check;
+
+  object = udisks_daemon_util_dup_object (block, error);
+  if (object == NULL)
+    return FALSE;
+
+  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
+  if (!format_check (block, object, daemon, type, options, caller_uid, &check, error))
+    {
+      g_object_unref (object);
+      return FALSE;
+    }
+
+  *out_action_id = check.action_id;
+  *out_message = check.message;
+  format_check_data_clear (&check);
+  g_object_unref (object);
+  return TRUE;
+}
+
+/**
+ * udisks_linux_block_format_sync:
+ * @block: A #UDisksBlock.
+ * @invocation: The method invocation the request originates from.
+ * @type: The type of content to format @block with.
+ * @options: The options for the Format() method.
+ * @caller_uid: The uid of the caller.
+ * @caller_gid: The gid of the caller.
+ * @error: Return location for error or %NULL.
+ *
+ * Formats @block like the Format() method does, except that the caller
+ * is responsible for checking authorization first, see
+ * udisks_linux_block_format_check_sync(). The <parameter>no-block</parameter>
+ * option is ignored.
+ *
+ * Returns: %TRUE if @block was formatted, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_block_format_sync (UDisksBlock            *block,
+                                GDBusMethodInvocation  *invocation,
+                                const gchar            *type,
+                                GVariant               *options,
+                                uid_t                   caller_uid,
+                                gid_t                   caller_gid,
+                                GError                **error)
+{
+  gboolean ret = FALSE;
+  UDisksObject *object;
+  UDisksDaemon *daemon;
+  FormatCheckData check;
+
+  object = udisks_daemon_util_dup_object (block, error);
+  if (object == NULL)
+    return FALSE;
+
+  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
+  if (format_check (block, object, daemon, type, options, caller_uid, &check, error))
+    {
+      ret = format_device (block, object, daemon, invocation, type, options, &check,
+                           caller_uid, caller_gid, NULL, NULL, NULL, error);
+      format_check_data_clear (&check);
+    }
+
+  g_object_unref (object);
+  return ret;
+}
+
+void
+udisks_linux_block_handle_format (UDisksBlock             *block,
+                                  GDBusMethodInvocation   *invocation,
+                                  const gchar             *type,
+                                  GVariant                *options,
+                                  void                   (*complete)(gpointer user_data),
+                                  gpointer                 complete_user_data)
+{
+  UDisksObject *object;
+  UDisksDaemon *daemon;
+  FormatCheckData check;
+  GError *error;
+  uid_t caller_uid;
+  gid_t caller_gid;
+  GVariant *config_items = NULL;
+  gboolean teardown_flag = FALSE;
+  gboolean completed = FALSE;
+
+  memset (&check, 0, sizeof (FormatCheckData));
+
+  error = NULL;
+  object = udisks_daemon_util_dup_object (block, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
+
+  g_variant_lookup (options, "config-items", "@a(sa{sv})", &config_items);
+  g_variant_lookup (options, "tear-down", "b", &teardown_flag);
+
+  error = NULL;
+  if (!udisks_daemon_util_get_caller_uid_sync (daemon, invocation, NULL /* GCancellable */, &caller_uid, &caller_gid, NULL, &error))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  if (!format_check (block, object, daemon, type, options, caller_uid, &check, &error))
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    object,
+                                                    check.action_id,
+                                                    options,
+                                                    check.message,
+                                                    invocation))
+    goto out;
+
+  if ((config_items != NULL || teardown_flag) &&
+      !udisks_daemon_util_check_authorization_sync (daemon,
+                                                    NULL,
+                                                    "org.freedesktop.udisks2.modify-system-configuration",
+                                                    options,
+                                                    N_("Authentication is required to modify the system configuration"),
+                                                    invocation))
+    goto out;
+
+  if (!format_device (block, object, daemon, invocation, type, options, &check,
+                      caller_uid, caller_gid, complete, complete_user_data, &completed, &error))
+    {
+      handle_format_failure (completed ? NULL : invocation, error);
+      goto out;
+    }
+
+  if (!completed)
+    complete (complete_user_data);
+
+ out:
+  if (config_items)
+    g_variant_unref (config_items);
+  format_check_data_clear (&check);
   g_clear_object (&object);
 }
 
@@ -3519,6 +4517,1000 @@ handle_open_for_benchmark (UDisksBlock           *block,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+#define BENCHMARK_ALIGNMENT 4096
+#define BENCHMARK_CHUNK_SIZE (1 * 1024*1024)
+#define BENCHMARK_RANDOM_BLOCK_SIZE 4096
+#define BENCHMARK_MAX_QUEUE_DEPTH 256
+/* upper bound of latency samples kept per queue depth */
+#define BENCHMARK_MAX_LATENCY_SAMPLES (1024 * 1024)
+
+typedef struct
+{
+  gint          fd;
+  const gchar  *device_file;
+  guint64       size;
+  gboolean      write;
+  guint         num_samples;
+  guint64       sample_size;
+  gdouble       random_duration;
+  GArray       *queue_depths;
+  guint         num_steps;
+  guint         steps_done;
+  /* results */
+  gdouble       read_rate;
+  gdouble       write_rate;
+  GVariantBuilder random_read;
+} BenchmarkData;
+
+static void
+benchmark_step_done (UDisksThreadedJob *job,
+                     BenchmarkData     *data)
+{
+  data->steps_done++;
+  udisks_job_set_progress (UDISKS_JOB (job), ((gdouble) data->steps_done) / data->num_steps);
+}
+
+static guint64
+benchmark_sample_offset (BenchmarkData *data,
+                         guint64        sample_len,
+                         guint          n)
+{
+  guint64 offset = 0;
+
+  /* spread the samples evenly over the whole device */
+  if (data->num_samples > 1)
+    offset = (data->size - sample_len) / (data->num_samples - 1) * n;
+  return offset - (offset % BENCHMARK_ALIGNMENT);
+}
+
+static gboolean
+benchmark_sequential (UDisksThreadedJob  *job,
+                      GCancellable       *cancellable,
+                      BenchmarkData      *data,
+                      gboolean            write,
+                      guchar             *buf,
+                      GError            **error)
+{
+  guint64 sample_len;
+  guint64 total = 0;
+  gint64 usec_total = 0;
+  guint n;
+
+  sample_len = data->sample_size / data->num_samples;
+  sample_len = MIN (sample_len - (sample_len % BENCHMARK_ALIGNMENT), data->size - (data->size % BENCHMARK_ALIGNMENT));
+
+  for (n = 0; n < data->num_samples; n++)
+    {
+      guint64 offset = benchmark_sample_offset (data, sample_len, n);
+      guint64 done = 0;
+
+      while (done < sample_len)
+        {
+          size_t len = MIN (sample_len - done, BENCHMARK_CHUNK_SIZE);
+          gint64 begin;
+          ssize_t num;
+
+          if (write)
+            {
+              /* preserve the data on the device: read it and write it back */
+              if (pread (data->fd, buf, len, offset + done) != (ssize_t) len)
+                {
+                  g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                               "Error reading %d bytes from %s: %m", (gint) len, data->device_file);
+                  return FALSE;
+                }
+              begin = g_get_monotonic_time ();
+              num = pwrite (data->fd, buf, len, offset + done);
+            }
+          else
+            {
+              begin = g_get_monotonic_time ();
+              num = pread (data->fd, buf, len, offset + done);
+            }
+          usec_total += g_get_monotonic_time () - begin;
+
+          if (num != (ssize_t) len)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error %s %d bytes %s %s: %m",
+                           write ? "writing" : "reading", (gint) len,
+                           write ? "to" : "from", data->device_file);
+              return FALSE;
+            }
+          done += len;
+
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            return FALSE;
+        }
+      total += done;
+    }
+
+  if (usec_total > 0)
+    {
+      gdouble rate = ((gdouble) total) * G_USEC_PER_SEC / usec_total;
+      if (write)
+        data->write_rate = rate;
+      else
+        data->read_rate = rate;
+    }
+
+  benchmark_step_done (job, data);
+  return TRUE;
+}
+
+static gint
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 x = *((const gint64 *) a);
+  gint64 y = *((const gint64 *) b);
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static gdouble
+benchmark_percentile (GArray  *latencies,
+                      gdouble  percentile)
+{
+  guint n;
+
+  if (latencies->len == 0)
+    return 0.0;
+  n = (guint) (percentile / 100.0 * (latencies->len - 1) + 0.5);
+  return g_array_index (latencies, gint64, MIN (n, latencies->len - 1));
+}
+
+static void
+benchmark_prepare_random_read (struct iocb   *cb,
+                               BenchmarkData *data,
+                               GRand         *rand,
+                               guchar        *buf)
+{
+  guint64 num_blocks = data->size / BENCHMARK_RANDOM_BLOCK_SIZE;
+
+  memset (cb, 0, sizeof (struct iocb));
+  cb->aio_fildes = data->fd;
+  cb->aio_lio_opcode = IOCB_CMD_PREAD;
+  cb->aio_buf = (guint64) (guintptr) buf;
+  cb->aio_nbytes = BENCHMARK_RANDOM_BLOCK_SIZE;
+  cb->aio_offset = ((guint64) (g_rand_double (rand) * num_blocks)) * BENCHMARK_RANDOM_BLOCK_SIZE;
+}
+
+/* Measures random 4k read IOPS and completion latencies at @queue_depth
+ * using Linux AIO for @data->random_duration seconds.
+ */
+static gboolean
+benchmark_random_read (UDisksThreadedJob  *job,
+                       GCancellable       *cancellable,
+                       BenchmarkData      *data,
+                       guint               queue_depth,
+                       guchar             *bufs,
+                       GError            **error)
+{
+  gboolean ret = FALSE;
+  aio_context_t ctx = 0;
+  struct iocb *iocbs = NULL;
+  struct iocb **batch = NULL;
+  struct io_event *events = NULL;
+  gint64 *submit_times = NULL;
+  GArray *latencies = NULL;
+  GRand *rand = NULL;
+  GVariantBuilder builder;
+  guint64 num_completed = 0;
+  gint64 latency_sum = 0;
+  guint num_inflight = 0;
+  gint64 begin, deadline, end;
+  guint n;
+
+  if (syscall (SYS_io_setup, queue_depth, &ctx) != 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error setting up Linux AIO with queue depth %u: %m", queue_depth);
+      ctx = 0;
+      goto out;
+    }
+
+  iocbs = g_new0 (struct iocb, queue_depth);
+  batch = g_new0 (struct iocb *, queue_depth);
+  events = g_new0 (struct io_event, queue_depth);
+  submit_times = g_new0 (gint64, queue_depth);
+  latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  rand = g_rand_new ();
+
+  begin = g_get_monotonic_time ();
+  deadline = begin + data->random_duration * G_USEC_PER_SEC;
+
+  for (n = 0; n < queue_depth; n++)
+    {
+      benchmark_prepare_random_read (&iocbs[n], data, rand, bufs + n * BENCHMARK_RANDOM_BLOCK_SIZE);
+      iocbs[n].aio_data = n;
+      batch[n] = &iocbs[n];
+    }
+
+  n = queue_depth;
+  while (TRUE)
+    {
+      guint num_submitted = 0;
+      glong num_events;
+      gint64 now;
+      guint m;
+
+      /* (re)submit the requests in @batch */
+      now = g_get_monotonic_time ();
+      for (m = 0; m < n; m++)
+        submit_times[batch[m]->aio_data] = now;
+      while (num_submitted < n)
+        {
+          glong rc = syscall (SYS_io_submit, ctx, (glong) (n - num_submitted), batch + num_submitted);
+          if (rc < 0)
+            {
+              if (errno == EINTR)
+                continue;
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error submitting reads to %s: %m", data->device_file);
+              goto out;
+            }
+          num_submitted += rc;
+        }
+      num_inflight += n;
+
+      if (num_inflight == 0)
+        break;
+
+      num_events = syscall (SYS_io_getevents, ctx, 1L, (glong) queue_depth, events, NULL);
+      if (num_events < 0)
+        {
+          if (errno == EINTR)
+            {
+              n = 0;
+              continue;
+            }
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error waiting for reads from %s: %m", data->device_file);
+          goto out;
+        }
+
+      now = g_get_monotonic_time ();
+      n = 0;
+      for (m = 0; m < (guint) num_events; m++)
+        {
+          struct iocb *cb = (struct iocb *) (guintptr) events[m].obj;
+          gint64 latency;
+
+          if (events[m].res != BENCHMARK_RANDOM_BLOCK_SIZE)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error reading %d bytes from %s at offset %" G_GUINT64_FORMAT ": %s",
+                           BENCHMARK_RANDOM_BLOCK_SIZE, data->device_file, (guint64) cb->aio_offset,
+                           events[m].res < 0 ? g_strerror ((gint) -events[m].res) : "Short read");
+              goto out;
+            }
+
+          latency = now - submit_times[cb->aio_data];
+          latency_sum += latency;
+          if (latencies->len < BENCHMARK_MAX_LATENCY_SAMPLES)
+            g_array_append_val (latencies, latency);
+          num_completed++;
+          num_inflight--;
+
+          /* keep the queue full until the time is up */
+          if (now < deadline)
+            {
+              guint64 index = cb->aio_data;
+              benchmark_prepare_random_read (cb, data, rand, (guchar *) (guintptr) cb->aio_buf);
+              cb->aio_data = index;
+              batch[n++] = cb;
+            }
+        }
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+    }
+  end = g_get_monotonic_time ();
+
+  g_array_sort (latencies, compare_gint64);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "queue-depth", g_variant_new_uint32 (queue_depth));
+  g_variant_builder_add (&builder, "{sv}", "iops",
+                         g_variant_new_double (((gdouble) num_completed) * G_USEC_PER_SEC / MAX (end - begin, 1)));
+  g_variant_builder_add (&builder, "{sv}", "latency-average",
+                         g_variant_new_double (num_completed > 0 ? ((gdouble) latency_sum) / num_completed : 0.0));
+  g_variant_builder_add (&builder, "{sv}", "latency-p50", g_variant_new_double (benchmark_percentile (latencies, 50.0)));
+  g_variant_builder_add (&builder, "{sv}", "latency-p90", g_variant_new_double (benchmark_percentile (latencies, 90.0)));
+  g_variant_builder_add (&builder, "{sv}", "latency-p99", g_variant_new_double (benchmark_percentile (latencies, 99.0)));
+  g_variant_builder_add (&builder, "{sv}", "latency-p999", g_variant_new_double (benchmark_percentile (latencies, 99.9)));
+  g_variant_builder_add (&builder, "{sv}", "latency-max", g_variant_new_double (benchmark_percentile (latencies, 100.0)));
+  g_variant_builder_add_value (&data->random_read, g_variant_builder_end (&builder));
+
+  benchmark_step_done (job, data);
+  ret = TRUE;
+
+ out:
+  /* io_destroy() waits for any requests still in flight */
+  if (ctx != 0)
+    syscall (SYS_io_destroy, ctx);
+  g_free (iocbs);
+  g_free (batch);
+  g_free (events);
+  g_free (submit_times);
+  if (latencies != NULL)
+    g_array_unref (latencies);
+  if (rand != NULL)
+    g_rand_free (rand);
+  return ret;
+}
+
+static gboolean
+benchmark_job_func (UDisksThreadedJob  *job,
+                    GCancellable       *cancellable,
+                    gpointer            user_data,
+                    GError            **error)
+{
+  BenchmarkData *data = user_data;
+  gboolean ret = FALSE;
+  guchar *buf = NULL;
+  guint max_queue_depth = 1;
+  guint n;
+
+  for (n = 0; n < data->queue_depths->len; n++)
+    max_queue_depth = MAX (max_queue_depth, g_array_index (data->queue_depths, guint, n));
+
+  if (posix_memalign ((void **) &buf, BENCHMARK_ALIGNMENT,
+                      MAX (BENCHMARK_CHUNK_SIZE, max_queue_depth * BENCHMARK_RANDOM_BLOCK_SIZE)) != 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error allocating benchmark buffer");
+      buf = NULL;
+      goto out;
+    }
+
+  udisks_job_set_progress_valid (UDISKS_JOB (job), TRUE);
+
+  if (!benchmark_sequential (job, cancellable, data, FALSE, buf, error))
+    goto out;
+
+  if (data->write && !benchmark_sequential (job, cancellable, data, TRUE, buf, error))
+    goto out;
+
+  for (n = 0; n < data->queue_depths->len; n++)
+    {
+      if (!benchmark_random_read (job, cancellable, data, g_array_index (data->queue_depths, guint, n), buf, error))
+        goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  free (buf);
+  return ret;
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+handle_benchmark (UDisksBlock           *block,
+                  GDBusMethodInvocation *invocation,
+                  GVariant              *options)
+{
+  UDisksObject *object;
+  UDisksDaemon *daemon;
+  const gchar *action_id;
+  const gchar *message;
+  BenchmarkData data;
+  GVariant *opt_queue_depths = NULL;
+  GVariantBuilder builder;
+  GVariant *results;
+  uid_t caller_uid;
+  GError *error;
+  gint open_flags;
+  guint n;
+
+  memset (&data, 0, sizeof (BenchmarkData));
+  data.fd = -1;
+  data.num_samples = 16;
+  data.sample_size = 256 * 1024 * 1024;
+  data.random_duration = 2.0;
+  data.queue_depths = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_variant_builder_init (&data.random_read, G_VARIANT_TYPE ("aa{sv}"));
+
+  error = NULL;
+  object = udisks_daemon_util_dup_object (block, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
+
+  if (!udisks_daemon_util_get_caller_uid_sync (daemon, invocation, NULL /* GCancellable */, &caller_uid, NULL, NULL, &error))
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  g_variant_lookup (options, "write", "b", &data.write);
+  g_variant_lookup (options, "num-samples", "u", &data.num_samples);
+  g_variant_lookup (options, "sample-size", "t", &data.sample_size);
+  g_variant_lookup (options, "random-duration", "d", &data.random_duration);
+  if (g_variant_lookup (options, "queue-depths", "@au", &opt_queue_depths))
+    {
+      GVariantIter iter;
+      guint depth;
+
+      g_variant_iter_init (&iter, opt_queue_depths);
+      while (g_variant_iter_next (&iter, "u", &depth))
+        g_array_append_val (data.queue_depths, depth);
+    }
+  else
+    {
+      static const guint default_queue_depths[] = {1, 4, 16, 32};
+      g_array_append_vals (data.queue_depths, default_queue_depths, G_N_ELEMENTS (default_queue_depths));
+    }
+
+  if (data.num_samples == 0 || data.sample_size < data.num_samples * (guint64) BENCHMARK_ALIGNMENT ||
+      data.random_duration <= 0.0 || data.random_duration > 3600.0)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Invalid benchmark parameters");
+      goto out;
+    }
+  for (n = 0; n < data.queue_depths->len; n++)
+    {
+      guint depth = g_array_index (data.queue_depths, guint, n);
+      if (depth == 0 || depth > BENCHMARK_MAX_QUEUE_DEPTH)
+        {
+          g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                 "Queue depth %u is not between 1 and %d",
+                                                 depth, BENCHMARK_MAX_QUEUE_DEPTH);
+          goto out;
+        }
+    }
+
+  if (data.write)
+    {
+      /* Translators: Shown in authentication dialog when an application
+       * wants to run a benchmark including write tests on a device.
+       *
+       * Do not translate $(drive), it's a placeholder and will
+       * be replaced by the name of the drive/device in question
+       */
+      message = N_("Authentication is required to benchmark writing to $(drive)");
+      /* The write test preserves the data (see benchmark_sequential()) but
+       * still writes to the raw device and would revert concurrent writes of
+       * anyone not stopped by O_EXCL. Require the same authorization as for
+       * any other raw modification of the device, chosen like for Format().
+       */
+      action_id = "org.freedesktop.udisks2.modify-device";
+      if (!udisks_daemon_util_setup_by_user (daemon, object, caller_uid))
+        {
+          if (udisks_block_get_hint_system (block))
+            action_id = "org.freedesktop.udisks2.modify-device-system";
+          else if (!udisks_daemon_util_on_user_seat (daemon, object, caller_uid))
+            action_id = "org.freedesktop.udisks2.modify-device-other-seat";
+        }
+    }
+  else
+    {
+      /* Translators: Shown in authentication dialog when an application
+       * wants to benchmark a device.
+       *
+       * Do not translate $(drive), it's a placeholder and will
+       * be replaced by the name of the drive/device in question
+       */
+      message = N_("Authentication is required to benchmark $(drive)");
+      action_id = "org.freedesktop.udisks2.open-device";
+      if (udisks_block_get_hint_system (block))
+        action_id = "org.freedesktop.udisks2.open-device-system";
+    }
+
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    object,
+                                                    action_id,
+                                                    options,
+                                                    message,
+                                                    invocation))
+    goto out;
+
+  /* O_EXCL makes sure write tests are only done on devices not in use */
+  if (data.write)
+    open_flags = O_RDWR | O_EXCL;
+  else
+    open_flags = O_RDONLY;
+  open_flags |= O_DIRECT | O_SYNC | O_CLOEXEC;
+
+  data.device_file = udisks_block_get_device (block);
+  data.fd = open (data.device_file, open_flags);
+  if (data.fd == -1)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR,
+                                             errno == EBUSY ? UDISKS_ERROR_DEVICE_BUSY : UDISKS_ERROR_FAILED,
+                                             "Error opening %s: %m", data.device_file);
+      goto out;
+    }
+
+  if (ioctl (data.fd, BLKGETSIZE64, &data.size) != 0)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Error doing BLKGETSIZE64 iotctl on %s: %m", data.device_file);
+      goto out;
+    }
+  if (data.size < BENCHMARK_CHUNK_SIZE)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_NOT_SUPPORTED,
+                                             "Device %s is too small to benchmark", data.device_file);
+      goto out;
+    }
+
+  data.num_steps = 1 + (data.write ? 1 : 0) + data.queue_depths->len;
+
+  if (!udisks_daemon_launch_threaded_job_sync (daemon,
+                                               object,
+                                               "block-benchmark",
+                                               caller_uid,
+                                               benchmark_job_func,
+                                               &data,
+                                               NULL, /* user_data_free_func */
+                                               NULL, /* cancellable */
+                                               &error))
+    {
+      g_prefix_error (&error, "Error benchmarking %s: ", data.device_file);
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "time", g_variant_new_uint64 (g_get_real_time ()));
+  g_variant_builder_add (&builder, "{sv}", "sequential-read-rate", g_variant_new_double (data.read_rate));
+  if (data.write)
+    g_variant_builder_add (&builder, "{sv}", "sequential-write-rate", g_variant_new_double (data.write_rate));
+  g_variant_builder_add (&builder, "{sv}", "random-read", g_variant_builder_end (&data.random_read));
+  results = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  /* cache the results on the block object */
+  udisks_block_set_benchmark_results (block, results);
+  g_dbus_interface_skeleton_flush (G_DBUS_INTERFACE_SKELETON (block));
+
+  udisks_block_complete_benchmark (block, invocation, results);
+  g_variant_unref (results);
+
+ out:
+  if (data.fd != -1)
+    close (data.fd);
+  g_variant_builder_clear (&data.random_read);
+  g_array_unref (data.queue_depths);
+  if (opt_queue_depths != NULL)
+    g_variant_unref (opt_queue_depths);
+  g_clear_object (&object);
+  return TRUE; /* returning true means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+#define COPY_ALIGNMENT 4096
+#define COPY_CHUNK_SIZE (4 * 1024*1024)
+
+#ifndef BLKZEROOUT
+#define BLKZEROOUT _IO(0x12,127)
+#endif
+
+typedef struct
+{
+  const gchar *source_device;
+  const gchar *target_device;
+  gint source_fd;
+  gint target_fd;
+  /* backing file of a source loop device, used to find holes with SEEK_DATA */
+  gint hole_fd;
+  guint64 hole_offset;
+  guint64 size;
+  gboolean sparse;
+  gboolean punch_hole_unsupported;
+  gboolean zeroout_unsupported;
+  guint64 bytes_skipped;
+} CopyData;
+
+static gboolean
+buffer_is_zero (const guchar *buf,
+                gsize         len)
+{
+  return len == 0 || (buf[0] == 0 && memcmp (buf, buf + 1, len - 1) == 0);
+}
+
+/* Makes sure the range [@pos, @pos + @len) reads back as zeroes on the
+ * target, preferably without writing data. Punching a hole into a block
+ * device discards the range, but only succeeds if the device guarantees
+ * that it reads back as zeroes afterwards. Otherwise BLKZEROOUT lets the
+ * kernel use WRITE ZEROES (which never discards) and only as a last
+ * resort zeroes are written.
+ */
+static gboolean
+copy_zero_range (CopyData  *data,
+                 guchar    *buf,
+                 guint64    pos,
+                 guint64    len,
+                 GError   **error)
+{
+  guint64 range[2];
+  guint64 end = pos + len;
+
+  if (!data->punch_hole_unsupported)
+    {
+      if (fallocate (data->target_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos, len) == 0)
+        return TRUE;
+      if (errno != EOPNOTSUPP && errno != ENOTTY && errno != EINVAL && errno != ENODEV)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error discarding %s: %m", data->target_device);
+          return FALSE;
+        }
+      data->punch_hole_unsupported = TRUE;
+    }
+
+  if (!data->zeroout_unsupported)
+    {
+      range[0] = pos;
+      range[1] = len;
+      if (ioctl (data->target_fd, BLKZEROOUT, range) == 0)
+        return TRUE;
+      if (errno != EOPNOTSUPP && errno != ENOTTY && errno != EINVAL)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error zeroing %s: %m", data->target_device);
+          return FALSE;
+        }
+      data->zeroout_unsupported = TRUE;
+    }
+
+  memset (buf, 0, COPY_CHUNK_SIZE);
+  while (pos < end)
+    {
+      gsize to_write = MIN (COPY_CHUNK_SIZE, end - pos);
+      ssize_t num_written = pwrite (data->target_fd, buf, to_write, pos);
+      if (num_written <= 0)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error writing %" G_GSIZE_FORMAT " bytes to %s at offset %" G_GUINT64_FORMAT ": %m",
+                       to_write, data->target_device, pos);
+          return FALSE;
+        }
+      pos += num_written;
+    }
+  return TRUE;
+}
+
+/* Returns the number of bytes from @pos that are known to be a hole in
+ * the source image file, 0 if @pos is in a data region or unknown.
+ */
+static guint64
+copy_get_hole_length (CopyData *data,
+                      guint64   pos)
+{
+  off_t next_data;
+  guint64 len;
+
+  if (data->hole_fd == -1)
+    return 0;
+
+  next_data = lseek (data->hole_fd, data->hole_offset + pos, SEEK_DATA);
+  if (next_data == -1)
+    len = errno == ENXIO ? data->size - pos : 0;
+  else if ((guint64) next_data > data->hole_offset + pos)
+    len = MIN ((guint64) next_data - data->hole_offset - pos, data->size - pos);
+  else
+    len = 0;
+
+  /* keep all device I/O aligned */
+  if (pos + len < data->size)
+    len -= len % COPY_ALIGNMENT;
+  return len;
+}
+
+static gboolean
+copy_job_func (UDisksThreadedJob  *job,
+               GCancellable       *cancellable,
+               gpointer            user_data,
+               GError            **error)
+{
+  CopyData *data = user_data;
+  gboolean use_copy_file_range = !data->sparse;
+  guchar *buf = NULL;
+  gboolean ret = FALSE;
+  gint64 time_started;
+  guint64 pos = 0;
+
+  if (posix_memalign ((void **) &buf, COPY_ALIGNMENT, COPY_CHUNK_SIZE) != 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error allocating %d bytes", COPY_CHUNK_SIZE);
+      goto out;
+    }
+
+  udisks_job_set_bytes (UDISKS_JOB (job), data->size);
+  udisks_job_set_progress_valid (UDISKS_JOB (job), TRUE);
+  time_started = g_get_monotonic_time ();
+
+  while (pos < data->size)
+    {
+      gsize len = MIN (COPY_CHUNK_SIZE, data->size - pos);
+      guint64 hole_len;
+      gint64 elapsed;
+      gsize done;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      if (data->sparse && (hole_len = copy_get_hole_length (data, pos)) > 0)
+        {
+          if (!copy_zero_range (data, buf, pos, hole_len, error))
+            goto out;
+          data->bytes_skipped += hole_len;
+          pos += hole_len;
+          goto progress;
+        }
+
+      if (use_copy_file_range)
+        {
+          loff_t in_pos = pos;
+          loff_t out_pos = pos;
+          ssize_t num_copied;
+
+          /* block devices are rejected by many kernels, fall back to read/write then */
+          num_copied = copy_file_range (data->source_fd, &in_pos, data->target_fd, &out_pos, len, 0);
+          if (num_copied > 0)
+            {
+              pos += num_copied;
+              goto progress;
+            }
+          if (num_copied == 0 || (errno != EINVAL && errno != EXDEV && errno != EOPNOTSUPP &&
+                                  errno != ENOSYS && errno != EBADF))
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error copying from %s to %s at offset %" G_GUINT64_FORMAT ": %s",
+                           data->source_device, data->target_device, pos,
+                           num_copied == 0 ? "Unexpected end of device" : g_strerror (errno));
+              goto out;
+            }
+          use_copy_file_range = FALSE;
+        }
+
+      for (done = 0; done < len; )
+        {
+          ssize_t num_read = pread (data->source_fd, buf + done, len - done, pos + done);
+          if (num_read <= 0)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error reading %" G_GSIZE_FORMAT " bytes from %s at offset %" G_GUINT64_FORMAT ": %s",
+                           len - done, data->source_device, pos + done,
+                           num_read == 0 ? "Unexpected end of device" : g_strerror (errno));
+              goto out;
+            }
+          done += num_read;
+        }
+
+      if (data->sparse && buffer_is_zero (buf, len))
+        {
+          if (!copy_zero_range (data, buf, pos, len, error))
+            goto out;
+          data->bytes_skipped += len;
+        }
+      else
+        {
+          for (done = 0; done < len; )
+            {
+              ssize_t num_written = pwrite (data->target_fd, buf + done, len - done, pos + done);
+              if (num_written <= 0)
+                {
+                  g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                               "Error writing %" G_GSIZE_FORMAT " bytes to %s at offset %" G_GUINT64_FORMAT ": %m",
+                               len - done, data->target_device, pos + done);
+                  goto out;
+                }
+              done += num_written;
+            }
+        }
+      pos += len;
+
+    progress:
+      udisks_job_set_progress (UDISKS_JOB (job), ((gdouble) pos) / data->size);
+      elapsed = g_get_monotonic_time () - time_started;
+      if (elapsed > 0)
+        udisks_job_set_rate (UDISKS_JOB (job), pos * G_USEC_PER_SEC / elapsed);
+    }
+
+  if (fsync (data->target_fd) != 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error syncing %s: %m", data->target_device);
+      goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  free (buf);
+  return ret;
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+handle_copy_to (UDisksBlock           *block,
+                GDBusMethodInvocation *invocation,
+                const gchar           *target,
+                GVariant              *options)
+{
+  UDisksObject *object = NULL;
+  UDisksObject *target_object = NULL;
+  UDisksBlock *target_block;
+  UDisksLoop *loop;
+  UDisksDaemon *daemon;
+  const gchar *action_id;
+  CopyData data;
+  guint64 target_size;
+  uid_t caller_uid;
+  GError *error = NULL;
+
+  memset (&data, 0, sizeof (CopyData));
+  data.source_fd = -1;
+  data.target_fd = -1;
+  data.hole_fd = -1;
+  data.sparse = TRUE;
+
+  object = udisks_daemon_util_dup_object (block, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
+
+  if (!udisks_daemon_util_get_caller_uid_sync (daemon, invocation, NULL /* GCancellable */, &caller_uid, NULL, NULL, &error))
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  g_variant_lookup (options, "sparse", "b", &data.sparse);
+
+  target_object = udisks_daemon_find_object (daemon, target);
+  target_block = target_object != NULL ? udisks_object_peek_block (target_object) : NULL;
+  if (target_block == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Object path %s is not a block device", target);
+      goto out;
+    }
+  if (target_object == object)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Cannot copy a device onto itself");
+      goto out;
+    }
+
+  action_id = "org.freedesktop.udisks2.open-device";
+  if (udisks_block_get_hint_system (block))
+    action_id = "org.freedesktop.udisks2.open-device-system";
+
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    object,
+                                                    action_id,
+                                                    options,
+                                                    /* Translators: Shown in authentication dialog when
+                                                     * copying a device to another device.
+                                                     *
+                                                     * Do not translate $(drive), it's a placeholder and will
+                                                     * be replaced by the name of the drive/device in question
+                                                     */
+                                                    N_("Authentication is required to open $(drive) for reading"),
+                                                    invocation))
+    goto out;
+
+  action_id = "org.freedesktop.udisks2.modify-device";
+  if (udisks_block_get_hint_system (target_block))
+    action_id = "org.freedesktop.udisks2.modify-device-system";
+
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    target_object,
+                                                    action_id,
+                                                    options,
+                                                    /* Translators: Shown in authentication dialog when
+                                                     * copying a device to another device.
+                                                     *
+                                                     * Do not translate $(drive), it's a placeholder and will
+                                                     * be replaced by the name of the drive/device in question
+                                                     */
+                                                    N_("Authentication is required to overwrite $(drive)"),
+                                                    invocation))
+    goto out;
+
+  data.source_device = udisks_block_get_device (block);
+  data.target_device = udisks_block_get_device (target_block);
+
+  data.source_fd = open (data.source_device, O_RDONLY | O_DIRECT | O_CLOEXEC | O_EXCL);
+  if (data.source_fd == -1)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR,
+                                             errno == EBUSY ? UDISKS_ERROR_DEVICE_BUSY : UDISKS_ERROR_FAILED,
+                                             "Error opening %s: %m", data.source_device);
+      goto out;
+    }
+  data.target_fd = open (data.target_device, O_WRONLY | O_DIRECT | O_CLOEXEC | O_EXCL);
+  if (data.target_fd == -1)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR,
+                                             errno == EBUSY ? UDISKS_ERROR_DEVICE_BUSY : UDISKS_ERROR_FAILED,
+                                             "Error opening %s: %m", data.target_device);
+      goto out;
+    }
+
+  if (ioctl (data.source_fd, BLKGETSIZE64, &data.size) != 0 ||
+      ioctl (data.target_fd, BLKGETSIZE64, &target_size) != 0)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Error doing BLKGETSIZE64 iotctl: %m");
+      goto out;
+    }
+  if (target_size < data.size)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Target device %s (%" G_GUINT64_FORMAT " bytes) is smaller than %s (%" G_GUINT64_FORMAT " bytes)",
+                                             data.target_device, target_size, data.source_device, data.size);
+      goto out;
+    }
+
+  /* for loop devices the backing file tells us where the holes are */
+  loop = udisks_object_peek_loop (object);
+  if (data.sparse && loop != NULL && strlen (udisks_loop_get_backing_file (loop)) > 0)
+    {
+      UDisksLinuxDevice *device = udisks_linux_block_object_get_device (UDISKS_LINUX_BLOCK_OBJECT (object));
+
+      data.hole_fd = open (udisks_loop_get_backing_file (loop), O_RDONLY | O_CLOEXEC);
+      if (device != NULL)
+        {
+          data.hole_offset = g_udev_device_get_sysfs_attr_as_uint64 (device->udev_device, "loop/offset");
+          g_object_unref (device);
+        }
+    }
+
+  if (!udisks_daemon_launch_threaded_job_sync (daemon,
+                                               object,
+                                               "block-copy",
+                                               caller_uid,
+                                               copy_job_func,
+                                               &data,
+                                               NULL, /* user_data_free_func */
+                                               NULL, /* cancellable */
+                                               &error))
+    {
+      g_prefix_error (&error, "Error copying %s to %s: ", data.source_device, data.target_device);
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  udisks_debug ("Copied %s to %s, %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " bytes were zero or unallocated",
+                data.source_device, data.target_device, data.bytes_skipped, data.size);
+
+  /* the target now has new content, make sure we pick it up */
+  close (data.target_fd);
+  data.target_fd = -1;
+  udisks_linux_block_object_trigger_uevent (UDISKS_LINUX_BLOCK_OBJECT (target_object));
+  if (udisks_object_peek_partition (target_object) == NULL)
+    udisks_linux_block_object_reread_partition_table (UDISKS_LINUX_BLOCK_OBJECT (target_object));
+
+  udisks_block_complete_copy_to (block, invocation);
+
+ out:
+  if (data.hole_fd != -1)
+    close (data.hole_fd);
+  if (data.target_fd != -1)
+    close (data.target_fd);
+  if (data.source_fd != -1)
+    close (data.source_fd);
+  g_clear_object (&target_object);
+  g_clear_object (&object);
+  return TRUE; /* returning true means that we handled the method invocation */
+}
+
 static gboolean
 handle_rescan (UDisksBlock           *block,
                GDBusMethodInvocation *invocation,
@@ -3559,6 +5551,9 @@ handle_rescan (UDisksBlock           *block,
 
   device = udisks_linux_block_object_get_device (UDISKS_LINUX_BLOCK_OBJECT (object));
 
+  /* an explicit rescan also re-issues ATA IDENTIFY */
+  udisks_linux_provider_invalidate_ata_identify (udisks_daemon_get_linux_provider (daemon),
+                                                 device->udev_device);
   udisks_linux_block_object_trigger_uevent (UDISKS_LINUX_BLOCK_OBJECT (object));
   if (g_strcmp0 (g_udev_device_get_devtype (device->udev_device), "disk") == 0)
     udisks_linux_block_object_reread_partition_table (UDISKS_LINUX_BLOCK_OBJECT (object));
@@ -3584,5 +5579,7 @@ block_iface_init (UDisksBlockIface *iface)
   iface->handle_open_for_backup           = handle_open_for_backup;
   iface->handle_open_for_restore          = handle_open_for_restore;
   iface->handle_open_for_benchmark        = handle_open_for_benchmark;
+  iface->handle_benchmark                 = handle_benchmark;
+  iface->handle_copy_to                   = handle_copy_to;
   iface->handle_rescan                    = handle_rescan;
 }
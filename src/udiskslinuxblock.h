@@ -33,6 +33,7 @@ GType        udisks_linux_block_get_type (void) G_GNUC_CONST;
 UDisksBlock *udisks_linux_block_new      (void);
 void         udisks_linux_block_update   (UDisksLinuxBlock       *block,
                                           UDisksLinuxBlockObject *object);
+gchar      **udisks_linux_block_dup_device_specs (UDisksLinuxBlock *block);
 
 void         udisks_linux_block_handle_format (UDisksBlock            *block,
                                                GDBusMethodInvocation  *invocation,
@@ -41,6 +42,22 @@ void         udisks_linux_block_handle_format (UDisksBlock            *block,
                                                void                  (*complete)(gpointer user_data),
                                                gpointer                complete_user_data);
 
+gboolean     udisks_linux_block_format_check_sync (UDisksBlock            *block,
+                                                   const gchar            *type,
+                                                   GVariant               *options,
+                                                   uid_t                   caller_uid,
+                                                   const gchar           **out_action_id,
+                                                   const gchar           **out_message,
+                                                   GError                **error);
+
+gboolean     udisks_linux_block_format_sync (UDisksBlock            *block,
+                                             GDBusMethodInvocation  *invocation,
+                                             const gchar            *type,
+                                             GVariant               *options,
+                                             uid_t                   caller_uid,
+                                             gid_t                   caller_gid,
+                                             GError                **error);
+
 gchar       *udisks_linux_get_parent_for_tracking (UDisksDaemon *daemon,
                                                    const gchar    *path,
                                                    const gchar   **uuid_ret);
@@ -51,6 +68,16 @@ GVariant    *udisks_linux_find_child_configuration (UDisksDaemon *daemon,
 gboolean     udisks_linux_remove_configuration (GVariant       *configuration,
                                                 GError        **error);
 
+UDisksConfigurationEdit *udisks_configuration_edit_new    (void);
+void                     udisks_configuration_edit_free   (UDisksConfigurationEdit  *edit);
+gboolean                 udisks_configuration_edit_apply  (UDisksConfigurationEdit  *edit,
+                                                           UDisksBlock              *block,
+                                                           GVariant                 *old_item,
+                                                           GVariant                 *new_item,
+                                                           GError                  **error);
+gboolean                 udisks_configuration_edit_commit (UDisksConfigurationEdit  *edit,
+                                                           GError                  **error);
+
 gboolean     udisks_linux_block_teardown (UDisksBlock            *block,
                                           GDBusMethodInvocation  *invocation,
                                           GVariant               *options,
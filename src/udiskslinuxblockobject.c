@@ -32,11 +32,14 @@
 
 #include <sys/ioctl.h>
 #include <linux/fs.h>
+#include <linux/blkpg.h>
 
 #include <string.h>
 #include <stdlib.h>
 #include <glib/gstdio.h>
 
+#include <blockdev/part.h>
+
 #include "udiskslogging.h"
 #include "udisksdaemon.h"
 #include "udisksdaemonutil.h"
@@ -62,6 +65,10 @@
 
 #include <modules/udisksmoduleifacetypes.h>
 
+#ifndef BLKPG_RESIZE_PARTITION
+#define BLKPG_RESIZE_PARTITION 3
+#endif
+
 /**
  * SECTION:udiskslinuxblockobject
  * @title: UDisksLinuxBlockObject
@@ -96,6 +103,10 @@ struct _UDisksLinuxBlockObject
   UDisksEncrypted *iface_encrypted;
   UDisksLoop *iface_loop;
   GHashTable *module_ifaces;
+
+  /* partitions on this device, in offset order - see udisks_linux_block_object_index_partition() */
+  GMutex partitions_lock;
+  GList *partitions;
 };
 
 struct _UDisksLinuxBlockObjectClass
@@ -118,6 +129,12 @@ enum
   PROP_DEVICE
 };
 
+typedef struct
+{
+  guint64 offset;
+  UDisksLinuxBlockObject *object;
+} PartitionIndexEntry;
+
 G_DEFINE_TYPE (UDisksLinuxBlockObject, udisks_linux_block_object, UDISKS_TYPE_OBJECT_SKELETON);
 
 static void on_mount_monitor_mount_added   (UDisksMountMonitor  *monitor,
@@ -127,6 +144,15 @@ static void on_mount_monitor_mount_removed (UDisksMountMonitor  *monitor,
                                             UDisksMount         *mount,
                                             gpointer             user_data);
 
+static void
+partition_index_entry_free (gpointer data)
+{
+  PartitionIndexEntry *entry = data;
+
+  g_object_unref (entry->object);
+  g_free (entry);
+}
+
 static void
 udisks_linux_block_object_finalize (GObject *_object)
 {
@@ -155,6 +181,9 @@ udisks_linux_block_object_finalize (GObject *_object)
   if (object->module_ifaces != NULL)
     g_hash_table_destroy (object->module_ifaces);
 
+  g_list_free_full (object->partitions, partition_index_entry_free);
+  g_mutex_clear (&object->partitions_lock);
+
   if (G_OBJECT_CLASS (udisks_linux_block_object_parent_class)->finalize != NULL)
     G_OBJECT_CLASS (udisks_linux_block_object_parent_class)->finalize (_object);
 }
@@ -214,6 +243,7 @@ udisks_linux_block_object_set_property (GObject      *__object,
 static void
 udisks_linux_block_object_init (UDisksLinuxBlockObject *object)
 {
+  g_mutex_init (&object->partitions_lock);
 }
 
 static void
@@ -814,6 +844,7 @@ udisks_linux_block_object_uevent (UDisksLinuxBlockObject *object,
   GHashTableIter iter;
   gpointer key;
   ModuleInterfaceEntry *entry;
+  gchar *old_table = NULL;
 
   g_return_if_fail (UDISKS_IS_LINUX_BLOCK_OBJECT (object));
   g_return_if_fail (device == NULL || UDISKS_IS_LINUX_DEVICE (device));
@@ -837,8 +868,28 @@ udisks_linux_block_object_uevent (UDisksLinuxBlockObject *object,
                 UDISKS_TYPE_LINUX_LOOP, &object->iface_loop);
   update_iface (UDISKS_OBJECT (object), action, partition_table_check, partition_table_connect, partition_table_update,
                 UDISKS_TYPE_LINUX_PARTITION_TABLE, &object->iface_partition_table);
+  if (object->iface_partition != NULL)
+    old_table = udisks_partition_dup_table (object->iface_partition);
   update_iface (UDISKS_OBJECT (object), action, partition_check, partition_connect, partition_update,
                 UDISKS_TYPE_LINUX_PARTITION, &object->iface_partition);
+  /* drop the object from the index of the table it is no longer a partition of
+   * (the provider indexes it on the new table, if any)
+   */
+  if (old_table != NULL &&
+      (object->iface_partition == NULL ||
+       g_strcmp0 (udisks_partition_get_table (object->iface_partition), old_table) != 0))
+    {
+      UDisksObject *table_object;
+
+      table_object = udisks_daemon_find_object (object->daemon, old_table);
+      if (table_object != NULL)
+        {
+          if (UDISKS_IS_LINUX_BLOCK_OBJECT (table_object))
+            udisks_linux_block_object_unindex_partition (UDISKS_LINUX_BLOCK_OBJECT (table_object), object);
+          g_object_unref (table_object);
+        }
+    }
+  g_free (old_table);
 
   /* Attach interfaces from modules */
   module_manager = udisks_daemon_get_module_manager (object->daemon);
@@ -921,12 +972,353 @@ udisks_linux_block_object_trigger_uevent (UDisksLinuxBlockObject *object)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gint
+compare_partition_index_entries (gconstpointer a,
+                                 gconstpointer b)
+{
+  const PartitionIndexEntry *entry_a = a;
+  const PartitionIndexEntry *entry_b = b;
+
+  return entry_a->offset < entry_b->offset ? -1 : (entry_a->offset > entry_b->offset ? 1 : 0);
+}
+
+/* called with partitions_lock held */
+static void
+unindex_partition_unlocked (UDisksLinuxBlockObject *object,
+                            UDisksLinuxBlockObject *partition_object)
+{
+  GList *l;
+
+  for (l = object->partitions; l != NULL; l = l->next)
+    {
+      PartitionIndexEntry *entry = l->data;
+      if (entry->object == partition_object)
+        {
+          partition_index_entry_free (entry);
+          object->partitions = g_list_delete_link (object->partitions, l);
+          break;
+        }
+    }
+}
+
+/**
+ * udisks_linux_block_object_index_partition:
+ * @object: A #UDisksLinuxBlockObject for a whole-disk device.
+ * @partition_object: A #UDisksLinuxBlockObject implementing the #UDisksPartition interface.
+ *
+ * Adds @partition_object to the offset-ordered index of partitions on
+ * @object, or moves it to its current position if it is already
+ * indexed. This is called by the provider whenever a partition is
+ * exported or changes.
+ */
+void
+udisks_linux_block_object_index_partition (UDisksLinuxBlockObject *object,
+                                           UDisksLinuxBlockObject *partition_object)
+{
+  PartitionIndexEntry *entry;
+  UDisksPartition *partition;
+
+  g_return_if_fail (UDISKS_IS_LINUX_BLOCK_OBJECT (object));
+  g_return_if_fail (UDISKS_IS_LINUX_BLOCK_OBJECT (partition_object));
+
+  partition = udisks_object_peek_partition (UDISKS_OBJECT (partition_object));
+  g_return_if_fail (partition != NULL);
+
+  entry = g_new0 (PartitionIndexEntry, 1);
+  entry->offset = udisks_partition_get_offset (partition);
+  entry->object = g_object_ref (partition_object);
+
+  g_mutex_lock (&object->partitions_lock);
+  unindex_partition_unlocked (object, partition_object);
+  object->partitions = g_list_insert_sorted (object->partitions, entry, compare_partition_index_entries);
+  g_mutex_unlock (&object->partitions_lock);
+}
+
+/**
+ * udisks_linux_block_object_unindex_partition:
+ * @object: A #UDisksLinuxBlockObject for a whole-disk device.
+ * @partition_object: A #UDisksLinuxBlockObject.
+ *
+ * Removes @partition_object from the index of partitions on @object,
+ * if present. This is called by the provider when a partition is
+ * unexported and on uevents that make @partition_object lose its
+ * #UDisksPartition interface or move to another partition table.
+ */
+void
+udisks_linux_block_object_unindex_partition (UDisksLinuxBlockObject *object,
+                                             UDisksLinuxBlockObject *partition_object)
+{
+  g_return_if_fail (UDISKS_IS_LINUX_BLOCK_OBJECT (object));
+
+  g_mutex_lock (&object->partitions_lock);
+  unindex_partition_unlocked (object, partition_object);
+  g_mutex_unlock (&object->partitions_lock);
+}
+
+/**
+ * udisks_linux_block_object_get_partitions:
+ * @object: A #UDisksLinuxBlockObject for a whole-disk device.
+ *
+ * Gets the partitions on @object ordered by their offset, without
+ * having to look at every object the daemon exports.
+ *
+ * Returns: (transfer full) (element-type UDisksLinuxBlockObject): A list of
+ * #UDisksLinuxBlockObject instances. Free each element with
+ * g_object_unref() and the list with g_list_free().
+ */
+GList *
+udisks_linux_block_object_get_partitions (UDisksLinuxBlockObject *object)
+{
+  GList *ret = NULL;
+  GList *l;
+
+  g_return_val_if_fail (UDISKS_IS_LINUX_BLOCK_OBJECT (object), NULL);
+
+  g_mutex_lock (&object->partitions_lock);
+  for (l = object->partitions; l != NULL; l = l->next)
+    {
+      PartitionIndexEntry *entry = l->data;
+      ret = g_list_prepend (ret, g_object_ref (entry->object));
+    }
+  g_mutex_unlock (&object->partitions_lock);
+
+  return g_list_reverse (ret);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct
+{
+  gint    number;
+  guint64 start;
+  guint64 size;
+} KernelPartition;
+
+/* Returns the partitions the kernel currently knows about for the
+ * whole-disk device at @sysfs_path, keyed by partition number.
+ */
+static GHashTable *
+get_kernel_partitions (const gchar  *sysfs_path,
+                       GError      **error)
+{
+  GHashTable *ret;
+  const gchar *name;
+  GDir *dir;
+
+  dir = g_dir_open (sysfs_path, 0, error);
+  if (dir == NULL)
+    return NULL;
+
+  ret = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *contents[3] = { NULL, NULL, NULL };
+      const gchar *attrs[3] = { "partition", "start", "size" };
+      KernelPartition *part;
+      guint n;
+
+      for (n = 0; n < 3; n++)
+        {
+          gchar *path = g_build_filename (sysfs_path, name, attrs[n], NULL);
+          g_file_get_contents (path, &contents[n], NULL, NULL);
+          g_free (path);
+        }
+
+      if (contents[0] != NULL && contents[1] != NULL && contents[2] != NULL)
+        {
+          part = g_new0 (KernelPartition, 1);
+          part->number = atoi (contents[0]);
+          part->start = g_ascii_strtoull (contents[1], NULL, 10) * 512;
+          part->size = g_ascii_strtoull (contents[2], NULL, 10) * 512;
+          g_hash_table_replace (ret, GINT_TO_POINTER (part->number), part);
+        }
+
+      for (n = 0; n < 3; n++)
+        g_free (contents[n]);
+    }
+  g_dir_close (dir);
+
+  return ret;
+}
+
+/* Extracts the partition number from a partition device file such as
+ * /dev/sda1 or /dev/nvme0n1p1.
+ */
+static gint
+get_partition_number (const gchar *device_file)
+{
+  const gchar *p = device_file + strlen (device_file);
+
+  while (p > device_file && g_ascii_isdigit (*(p - 1)))
+    p--;
+  return atoi (p);
+}
+
+static gboolean
+blkpg_partition (gint          fd,
+                 const gchar  *device_file,
+                 gint          op,
+                 gint          number,
+                 guint64       start,
+                 guint64       size,
+                 GError      **error)
+{
+  struct blkpg_ioctl_arg arg;
+  struct blkpg_partition part;
+  const gchar *op_name;
+
+  memset (&part, 0, sizeof (part));
+  part.pno = number;
+  part.start = start;
+  part.length = size;
+
+  memset (&arg, 0, sizeof (arg));
+  arg.op = op;
+  arg.datalen = sizeof (part);
+  arg.data = &part;
+
+  if (ioctl (fd, BLKPG, &arg) != 0)
+    {
+      op_name = op == BLKPG_ADD_PARTITION ? "add" : (op == BLKPG_DEL_PARTITION ? "remove" : "resize");
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error asking the kernel to %s partition %d of %s: %m",
+                   op_name, number, device_file);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+ * udisks_linux_block_object_update_partitions:
+ * @object: A #UDisksLinuxBlockObject for a whole-disk device.
+ * @error: Return location for error or %NULL.
+ *
+ * Compares the partition table on @object with the partitions known to
+ * the kernel and tells the kernel about each added, removed or resized
+ * partition individually using the <literal>BLKPG</literal> ioctl.
+ *
+ * Unlike <literal>BLKRRPART</literal> this works when other partitions
+ * on the device are in use and only causes uevents for the partitions
+ * that actually changed.
+ *
+ * Returns: %TRUE if the kernel's view is up to date, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_block_object_update_partitions (UDisksLinuxBlockObject  *object,
+                                             GError                 **error)
+{
+  const gchar *device_file;
+  BDPartSpec **parts = NULL;
+  BDPartSpec **p;
+  GHashTable *kernel_parts = NULL;
+  GHashTable *wanted_parts = NULL;
+  GHashTableIter iter;
+  KernelPartition *kpart;
+  KernelPartition *wpart;
+  gboolean ret = FALSE;
+  gint fd = -1;
+
+  g_return_val_if_fail (UDISKS_IS_LINUX_BLOCK_OBJECT (object), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  device_file = g_udev_device_get_device_file (object->device->udev_device);
+
+  parts = bd_part_get_disk_parts (device_file, error);
+  if (parts == NULL)
+    goto out;
+
+  kernel_parts = get_kernel_partitions (g_udev_device_get_sysfs_path (object->device->udev_device), error);
+  if (kernel_parts == NULL)
+    goto out;
+
+  wanted_parts = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  for (p = parts; *p != NULL; p++)
+    {
+      if ((*p)->type & (BD_PART_TYPE_FREESPACE | BD_PART_TYPE_METADATA))
+        continue;
+      wpart = g_new0 (KernelPartition, 1);
+      wpart->number = get_partition_number ((*p)->path);
+      wpart->start = (*p)->start;
+      wpart->size = (*p)->size;
+      /* the kernel only exposes the first 1 KiB of an extended partition */
+      if ((*p)->type & BD_PART_TYPE_EXTENDED)
+        wpart->size = MIN (wpart->size, 1024);
+      g_hash_table_replace (wanted_parts, GINT_TO_POINTER (wpart->number), wpart);
+    }
+
+  fd = open (device_file, O_RDONLY);
+  if (fd == -1)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening %s: %m", device_file);
+      goto out;
+    }
+
+  /* first remove partitions that are gone or have moved, ... */
+  g_hash_table_iter_init (&iter, kernel_parts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &kpart))
+    {
+      wpart = g_hash_table_lookup (wanted_parts, GINT_TO_POINTER (kpart->number));
+      if (wpart != NULL && wpart->start == kpart->start)
+        continue;
+      if (!blkpg_partition (fd, device_file, BLKPG_DEL_PARTITION, kpart->number, 0, 0, error))
+        goto out;
+      g_hash_table_iter_remove (&iter);
+    }
+
+  /* ... then resize the ones whose end changed ... */
+  g_hash_table_iter_init (&iter, kernel_parts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &kpart))
+    {
+      wpart = g_hash_table_lookup (wanted_parts, GINT_TO_POINTER (kpart->number));
+      if (wpart->size == kpart->size)
+        continue;
+      if (!blkpg_partition (fd, device_file, BLKPG_RESIZE_PARTITION,
+                            wpart->number, wpart->start, wpart->size, error))
+        goto out;
+    }
+
+  /* ... and finally add the new ones */
+  g_hash_table_iter_init (&iter, wanted_parts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &wpart))
+    {
+      if (g_hash_table_contains (kernel_parts, GINT_TO_POINTER (wpart->number)))
+        continue;
+      if (!blkpg_partition (fd, device_file, BLKPG_ADD_PARTITION,
+                            wpart->number, wpart->start, wpart->size, error))
+        goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  if (fd >= 0)
+    close (fd);
+  if (parts != NULL)
+    {
+      for (p = parts; *p != NULL; p++)
+        bd_part_spec_free (*p);
+      g_free (parts);
+    }
+  if (kernel_parts != NULL)
+    g_hash_table_destroy (kernel_parts);
+  if (wanted_parts != NULL)
+    g_hash_table_destroy (wanted_parts);
+  return ret;
+}
+
 /**
  * udisks_linux_block_object_reread_partition_table:
  * @object: A #UDisksLinuxBlockObject.
  *
  * Requests the kernel to re-read the partition table for @object.
  *
+ * Changed partitions are first reported to the kernel one by one using
+ * udisks_linux_block_object_update_partitions(). Only if that fails is
+ * the whole partition table re-read using <literal>BLKRRPART</literal>.
+ *
  * The events from any change this may cause will bubble up from the
  * kernel through the udev stack and will eventually be received by
  * the udisks daemon process itself. This method does not wait for the
@@ -936,11 +1328,19 @@ void
 udisks_linux_block_object_reread_partition_table (UDisksLinuxBlockObject *object)
 {
   const gchar *device_file;
+  GError *error = NULL;
   gint fd;
 
   g_return_if_fail (UDISKS_IS_LINUX_BLOCK_OBJECT (object));
 
   device_file = g_udev_device_get_device_file (object->device->udev_device);
+
+  if (udisks_linux_block_object_update_partitions (object, &error))
+    return;
+
+  udisks_debug ("Falling back to BLKRRPART for %s: %s", device_file, error->message);
+  g_clear_error (&error);
+
   fd = open (device_file, O_RDONLY);
   if (fd == -1)
     {
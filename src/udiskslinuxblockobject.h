@@ -42,6 +42,13 @@ gchar                    *udisks_linux_block_object_get_device_file (UDisksLinux
 
 void                      udisks_linux_block_object_trigger_uevent (UDisksLinuxBlockObject  *object);
 void                      udisks_linux_block_object_reread_partition_table (UDisksLinuxBlockObject *object);
+gboolean                  udisks_linux_block_object_update_partitions (UDisksLinuxBlockObject  *object,
+                                                                       GError                 **error);
+void                      udisks_linux_block_object_index_partition (UDisksLinuxBlockObject *object,
+                                                                     UDisksLinuxBlockObject *partition_object);
+void                      udisks_linux_block_object_unindex_partition (UDisksLinuxBlockObject *object,
+                                                                       UDisksLinuxBlockObject *partition_object);
+GList                    *udisks_linux_block_object_get_partitions (UDisksLinuxBlockObject *object);
 
 G_END_DECLS
 
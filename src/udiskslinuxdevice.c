@@ -18,6 +18,8 @@
  *
  */
 
+#define _GNU_SOURCE /* for O_PATH */
+
 #include "config.h"
 #include <glib/gi18n-lib.h>
 
@@ -28,6 +30,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
 #include <fcntl.h>
@@ -65,6 +68,7 @@ G_DEFINE_TYPE (UDisksLinuxDevice, udisks_linux_device, G_TYPE_OBJECT);
 static void
 udisks_linux_device_init (UDisksLinuxDevice *device)
 {
+  device->sysfs_dirfd = -1;
 }
 
 static void
@@ -75,6 +79,8 @@ udisks_linux_device_finalize (GObject *object)
   g_clear_object (&device->udev_device);
   g_free (device->ata_identify_device_data);
   g_free (device->ata_identify_packet_device_data);
+  if (device->sysfs_dirfd != -1)
+    close (device->sysfs_dirfd);
 
   G_OBJECT_CLASS (udisks_linux_device_parent_class)->finalize (object);
 }
@@ -135,6 +141,36 @@ udisks_linux_device_new_sync (GUdevDevice *udev_device)
   return device;
 }
 
+/**
+ * udisks_linux_device_new_with_ata_identify:
+ * @udev_device: A #GUdevDevice.
+ * @ata_identify_device_data: (allow-none): 512 bytes of IDENTIFY DEVICE data or %NULL.
+ * @ata_identify_packet_device_data: (allow-none): 512 bytes of IDENTIFY PACKET DEVICE data or %NULL.
+ *
+ * Creates a new #UDisksLinuxDevice from @udev_device using IDENTIFY
+ * data obtained earlier instead of probing the device.
+ *
+ * Returns: A #UDisksLinuxDevice.
+ */
+UDisksLinuxDevice *
+udisks_linux_device_new_with_ata_identify (GUdevDevice  *udev_device,
+                                           const guchar *ata_identify_device_data,
+                                           const guchar *ata_identify_packet_device_data)
+{
+  UDisksLinuxDevice *device;
+
+  g_return_val_if_fail (G_UDEV_IS_DEVICE (udev_device), NULL);
+
+  device = g_object_new (UDISKS_TYPE_LINUX_DEVICE, NULL);
+  device->udev_device = g_object_ref (udev_device);
+  if (ata_identify_device_data != NULL)
+    device->ata_identify_device_data = g_memdup (ata_identify_device_data, 512);
+  if (ata_identify_packet_device_data != NULL)
+    device->ata_identify_packet_device_data = g_memdup (ata_identify_packet_device_data, 512);
+
+  return device;
+}
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 /**
@@ -255,3 +291,217 @@ probe_ata (UDisksLinuxDevice  *device,
     }
   return ret;
 }
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gint
+get_sysfs_dirfd (UDisksLinuxDevice  *device,
+                 GError            **error)
+{
+  const gchar *sysfs_path;
+  gint fd;
+
+  fd = g_atomic_int_get (&device->sysfs_dirfd);
+  if (fd != -1)
+    goto out;
+
+  sysfs_path = g_udev_device_get_sysfs_path (device->udev_device);
+  fd = open (sysfs_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error opening %s: %m",
+                   sysfs_path);
+      goto out;
+    }
+
+  /* Another thread may have beaten us to it - use its descriptor then */
+  if (!g_atomic_int_compare_and_exchange (&device->sysfs_dirfd, -1, fd))
+    {
+      close (fd);
+      fd = g_atomic_int_get (&device->sysfs_dirfd);
+    }
+
+ out:
+  return fd;
+}
+
+/**
+ * udisks_linux_device_read_sysfs_attr:
+ * @device: A #UDisksLinuxDevice.
+ * @attr: The name of the attribute, relative to the sysfs directory of @device, e.g. <literal>md/sync_action</literal>.
+ * @buf: Return location for the value of @attr.
+ * @buf_size: The size of @buf.
+ * @error: Return location for error or %NULL.
+ *
+ * Reads the current value of the sysfs attribute @attr into @buf,
+ * truncating it to @buf_size - 1 bytes and stripping trailing
+ * whitespace. Unlike g_udev_device_get_sysfs_attr() the value is not
+ * cached so this is suitable for attributes that change over time.
+ *
+ * The sysfs directory of @device is opened only once and kept open
+ * for the lifetime of @device so reading an attribute costs only an
+ * openat(), a pread() and a close() and does not allocate memory.
+ *
+ * Returns: %TRUE if @attr was read, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_device_read_sysfs_attr (UDisksLinuxDevice  *device,
+                                     const gchar        *attr,
+                                     gchar              *buf,
+                                     gsize               buf_size,
+                                     GError            **error)
+{
+  gboolean ret = FALSE;
+  gint dirfd;
+  gint fd = -1;
+  gssize len;
+
+  g_return_val_if_fail (UDISKS_IS_LINUX_DEVICE (device), FALSE);
+  g_return_val_if_fail (attr != NULL, FALSE);
+  g_return_val_if_fail (buf != NULL && buf_size > 0, FALSE);
+
+  buf[0] = '\0';
+
+  dirfd = get_sysfs_dirfd (device, error);
+  if (dirfd == -1)
+    goto out;
+
+  fd = openat (dirfd, attr, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error opening %s/%s: %m",
+                   g_udev_device_get_sysfs_path (device->udev_device), attr);
+      goto out;
+    }
+
+  do
+    len = pread (fd, buf, buf_size - 1, 0);
+  while (len == -1 && errno == EINTR);
+  if (len == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error reading %s/%s: %m",
+                   g_udev_device_get_sysfs_path (device->udev_device), attr);
+      goto out;
+    }
+
+  /* sysfs values are terminated by a newline */
+  while (len > 0 && g_ascii_isspace (buf[len - 1]))
+    len--;
+  buf[len] = '\0';
+
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  return ret;
+}
+
+/**
+ * udisks_linux_device_read_sysfs_attr_as_int:
+ * @device: A #UDisksLinuxDevice.
+ * @attr: The name of the attribute, relative to the sysfs directory of @device.
+ * @error: Return location for error or %NULL.
+ *
+ * Like udisks_linux_device_read_sysfs_attr() but converts the value to an integer.
+ *
+ * Returns: The value of @attr or 0 if @error is set.
+ */
+gint
+udisks_linux_device_read_sysfs_attr_as_int (UDisksLinuxDevice  *device,
+                                            const gchar        *attr,
+                                            GError            **error)
+{
+  gchar buf[32];
+
+  if (!udisks_linux_device_read_sysfs_attr (device, attr, buf, sizeof (buf), error))
+    return 0;
+
+  return atoi (buf);
+}
+
+/**
+ * udisks_linux_device_read_sysfs_attr_as_uint64:
+ * @device: A #UDisksLinuxDevice.
+ * @attr: The name of the attribute, relative to the sysfs directory of @device.
+ * @error: Return location for error or %NULL.
+ *
+ * Like udisks_linux_device_read_sysfs_attr() but converts the value to a #guint64.
+ *
+ * Returns: The value of @attr or 0 if @error is set.
+ */
+guint64
+udisks_linux_device_read_sysfs_attr_as_uint64 (UDisksLinuxDevice  *device,
+                                               const gchar        *attr,
+                                               GError            **error)
+{
+  gchar buf[32];
+
+  if (!udisks_linux_device_read_sysfs_attr (device, attr, buf, sizeof (buf), error))
+    return 0;
+
+  return g_ascii_strtoull (buf, NULL, 10);
+}
+
+/**
+ * udisks_linux_device_write_sysfs_attr:
+ * @device: A #UDisksLinuxDevice.
+ * @attr: The name of the attribute, relative to the sysfs directory of @device.
+ * @value: The value to write.
+ * @error: Return location for error or %NULL.
+ *
+ * Writes @value to the sysfs attribute @attr, using the same cached
+ * directory as udisks_linux_device_read_sysfs_attr().
+ *
+ * Returns: %TRUE if @value was written, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_device_write_sysfs_attr (UDisksLinuxDevice  *device,
+                                      const gchar        *attr,
+                                      const gchar        *value,
+                                      GError            **error)
+{
+  gboolean ret = FALSE;
+  gint dirfd;
+  gint fd = -1;
+  gssize len;
+
+  g_return_val_if_fail (UDISKS_IS_LINUX_DEVICE (device), FALSE);
+  g_return_val_if_fail (attr != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  dirfd = get_sysfs_dirfd (device, error);
+  if (dirfd == -1)
+    goto out;
+
+  fd = openat (dirfd, attr, O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error opening %s/%s: %m",
+                   g_udev_device_get_sysfs_path (device->udev_device), attr);
+      goto out;
+    }
+
+  /* sysfs attributes are written in one go */
+  do
+    len = write (fd, value, strlen (value));
+  while (len == -1 && errno == EINTR);
+  if (len == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error writing `%s' to %s/%s: %m",
+                   value, g_udev_device_get_sysfs_path (device->udev_device), attr);
+      goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  return ret;
+}
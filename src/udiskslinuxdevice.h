@@ -34,6 +34,10 @@ G_BEGIN_DECLS
  * @udev_device: A #GUdevDevice.
  * @ata_identify_device_data: 512-byte array containing the result of the IDENTIY DEVICE command or %NULL.
  * @ata_identify_packet_device_data: 512-byte array containing the result of the IDENTIY PACKET DEVICE command or %NULL.
+ * @probe_pending: %TRUE if probing the device did not finish in time and is still running.
+ * @sysfs_dirfd: An <literal>O_PATH</literal> file descriptor for the sysfs directory of @udev_device
+ *   or -1 if it has not been opened yet. Use udisks_linux_device_read_sysfs_attr() instead of
+ *   accessing this directly.
  *
  * Object containing information about a device on Linux. This is
  * essentially an instance of #GUdevDevice plus additional data - such
@@ -48,13 +52,33 @@ struct _UDisksLinuxDevice
   GUdevDevice *udev_device;
   guchar *ata_identify_device_data;
   guchar *ata_identify_packet_device_data;
+  gboolean probe_pending;
+  gint sysfs_dirfd;
 };
 
 GType              udisks_linux_device_get_type     (void) G_GNUC_CONST;
 UDisksLinuxDevice *udisks_linux_device_new_sync     (GUdevDevice *udev_device);
+UDisksLinuxDevice *udisks_linux_device_new_with_ata_identify (GUdevDevice  *udev_device,
+                                                             const guchar *ata_identify_device_data,
+                                                             const guchar *ata_identify_packet_device_data);
 gboolean           udisks_linux_device_reprobe_sync (UDisksLinuxDevice  *device,
                                                      GCancellable       *cancellable,
                                                      GError            **error);
+gboolean           udisks_linux_device_read_sysfs_attr (UDisksLinuxDevice  *device,
+                                                        const gchar        *attr,
+                                                        gchar              *buf,
+                                                        gsize               buf_size,
+                                                        GError            **error);
+gint               udisks_linux_device_read_sysfs_attr_as_int (UDisksLinuxDevice  *device,
+                                                               const gchar        *attr,
+                                                               GError            **error);
+guint64            udisks_linux_device_read_sysfs_attr_as_uint64 (UDisksLinuxDevice  *device,
+                                                                  const gchar        *attr,
+                                                                  GError            **error);
+gboolean           udisks_linux_device_write_sysfs_attr (UDisksLinuxDevice  *device,
+                                                         const gchar        *attr,
+                                                         const gchar        *value,
+                                                         GError            **error);
 
 G_END_DECLS
 
@@ -603,6 +603,7 @@ set_connection_bus (UDisksDrive       *iface,
     can_power_off = g_udev_device_get_property_as_boolean (device->udev_device, "UDISKS_CAN_POWER_OFF");
   udisks_drive_set_can_power_off (iface, can_power_off);
   udisks_drive_set_sibling_id (iface, sibling_id);
+  udisks_drive_set_probe_pending (iface, device->probe_pending);
   g_free (sibling_id);
 }
 
@@ -45,6 +45,7 @@
 #include "udiskslinuxblockobject.h"
 #include "udisksdaemon.h"
 #include "udisksdaemonutil.h"
+#include "udisksconfigmanager.h"
 #include "udisksbasejob.h"
 #include "udiskssimplejob.h"
 #include "udisksthreadedjob.h"
@@ -62,6 +63,36 @@
 
 typedef struct _UDisksLinuxDriveAtaClass   UDisksLinuxDriveAtaClass;
 
+/* SMART attribute history
+ *
+ * Every refresh of the SMART data appends an entry to a bounded ring
+ * buffer. The oldest entry holds the absolute values of all attributes,
+ * every following entry only the attributes that changed since the entry
+ * before it. Most attributes never change so an entry is usually just a
+ * timestamp and a few deltas (temperature, power-on hours).
+ */
+
+/* a week of samples at the default housekeeping interval of 10 minutes */
+#define SMART_HISTORY_MAX_ENTRIES 1008
+
+/* the history is written out at most this often and when the drive goes away */
+#define SMART_HISTORY_SAVE_INTERVAL (60 * 60)
+
+typedef struct
+{
+  guint8  id;
+  gint16  value;
+  gint16  worst;
+  gint64  pretty;
+} SmartHistoryDelta;
+
+typedef struct
+{
+  guint64            time;
+  guint              num_deltas;
+  SmartHistoryDelta  deltas[];
+} SmartHistoryEntry;
+
 /**
  * UDisksLinuxDriveAta:
  *
@@ -85,6 +116,14 @@ struct _UDisksLinuxDriveAta
 
   GVariant    *smart_attributes;
 
+  GQueue       smart_history;      /* of SmartHistoryEntry, oldest first */
+  GArray      *smart_history_last; /* absolute values of the newest entry */
+  gboolean     smart_history_loaded;
+  gchar       *smart_history_path; /* NULL if the history is not persisted */
+  gboolean     smart_history_dirty;
+  guint64      smart_history_saved;
+  guint64      smart_cache_saved;
+
   UDisksThreadedJob *selftest_job;
 
   gboolean     secure_erase_in_progress;
@@ -106,13 +145,22 @@ G_LOCK_DEFINE_STATIC (object_lock);
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void smart_history_save (UDisksLinuxDriveAta *drive,
+                                gboolean             force);
+
 static void
 udisks_linux_drive_ata_finalize (GObject *object)
 {
   UDisksLinuxDriveAta *drive = UDISKS_LINUX_DRIVE_ATA (object);
 
+  smart_history_save (drive, TRUE);
+  g_free (drive->smart_history_path);
+
   if (drive->smart_attributes != NULL)
     g_variant_unref (drive->smart_attributes);
+  g_queue_foreach (&drive->smart_history, (GFunc) g_free, NULL);
+  g_queue_clear (&drive->smart_history);
+  g_array_unref (drive->smart_history_last);
 
   if (G_OBJECT_CLASS (udisks_linux_drive_ata_parent_class)->finalize != NULL)
     G_OBJECT_CLASS (udisks_linux_drive_ata_parent_class)->finalize (object);
@@ -122,6 +170,8 @@ udisks_linux_drive_ata_finalize (GObject *object)
 static void
 udisks_linux_drive_ata_init (UDisksLinuxDriveAta *drive)
 {
+  g_queue_init (&drive->smart_history);
+  drive->smart_history_last = g_array_new (FALSE, FALSE, sizeof (SmartHistoryDelta));
   g_dbus_interface_skeleton_set_flags (G_DBUS_INTERFACE_SKELETON (drive),
                                        G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
 }
@@ -496,34 +546,359 @@ static gboolean update_io_stats (UDisksLinuxDriveAta *drive, UDisksLinuxDevice *
   return noio;
 }
 
-/**
- * udisks_linux_drive_ata_refresh_smart_sync:
- * @drive: The #UDisksLinuxDriveAta to refresh.
- * @nowakeup: If %TRUE, will not wake up the disk if asleep.
- * @simulate_path: If not %NULL, the path of a file with a libatasmart blob to use.
- * @cancellable: A #GCancellable or %NULL.
- * @error: Return location for error.
- *
- * Synchronously refreshes ATA S.M.A.R.T. data on @drive using one of
- * the physical drives associated with it. The calling thread is
- * blocked until the data has been obtained.
- *
- * If @nowake is %TRUE and the disk is in a sleep state this fails
- * with %UDISKS_ERROR_WOULD_WAKEUP.
- *
- * This may only be called if @drive has been associated with a
- * #UDisksLinuxDriveObject instance.
- *
- * This method may be called from any thread.
- *
- * Returns: %TRUE if the operation succeeded, %FALSE if @error is set.
+/* ---------------------------------------------------------------------------------------------------- */
+
+static SmartHistoryEntry *
+smart_history_entry_new (guint64 time,
+                         GArray *deltas)
+{
+  SmartHistoryEntry *entry;
+
+  entry = g_malloc (sizeof (SmartHistoryEntry) + deltas->len * sizeof (SmartHistoryDelta));
+  entry->time = time;
+  entry->num_deltas = deltas->len;
+  memcpy (entry->deltas, deltas->data, deltas->len * sizeof (SmartHistoryDelta));
+  return entry;
+}
+
+static SmartHistoryDelta *
+smart_history_lookup (GArray *values,
+                      guint8  id)
+{
+  guint n;
+
+  for (n = 0; n < values->len; n++)
+    {
+      SmartHistoryDelta *v = &g_array_index (values, SmartHistoryDelta, n);
+      if (v->id == id)
+        return v;
+    }
+  return NULL;
+}
+
+/* adds the deltas of @entry to the absolute @values */
+static void
+smart_history_apply (GArray                  *values,
+                     const SmartHistoryEntry *entry)
+{
+  guint n;
+
+  for (n = 0; n < entry->num_deltas; n++)
+    {
+      const SmartHistoryDelta *d = &entry->deltas[n];
+      SmartHistoryDelta *v = smart_history_lookup (values, d->id);
+
+      if (v == NULL)
+        {
+          g_array_append_val (values, *d);
+        }
+      else
+        {
+          v->value += d->value;
+          v->worst += d->worst;
+          v->pretty += d->pretty;
+        }
+    }
+}
+
+/* must be called with object_lock held */
+static void
+smart_history_push (UDisksLinuxDriveAta *drive,
+                    SmartHistoryEntry   *entry)
+{
+  smart_history_apply (drive->smart_history_last, entry);
+  g_queue_push_tail (&drive->smart_history, entry);
+
+  /* fold the oldest entry into the next one, which then holds absolute values */
+  if (g_queue_get_length (&drive->smart_history) > SMART_HISTORY_MAX_ENTRIES)
+    {
+      SmartHistoryEntry *oldest = g_queue_pop_head (&drive->smart_history);
+      SmartHistoryEntry *next = g_queue_pop_head (&drive->smart_history);
+      GArray *values = g_array_new (FALSE, FALSE, sizeof (SmartHistoryDelta));
+
+      smart_history_apply (values, oldest);
+      smart_history_apply (values, next);
+      g_queue_push_head (&drive->smart_history, smart_history_entry_new (next->time, values));
+      g_array_unref (values);
+      g_free (next);
+      g_free (oldest);
+    }
+}
+
+/* must be called with object_lock held */
+static void
+smart_history_append (UDisksLinuxDriveAta *drive,
+                      guint64              time,
+                      GVariant            *attributes)
+{
+  GArray *deltas;
+  GVariantIter iter;
+  guint8 id;
+  gint value;
+  gint worst;
+  gint64 pretty;
+
+  /* e.g. data restored from the SMART cache that is already in the history */
+  if (drive->smart_history.tail != NULL &&
+      ((SmartHistoryEntry *) drive->smart_history.tail->data)->time >= time)
+    return;
+
+  deltas = g_array_new (FALSE, FALSE, sizeof (SmartHistoryDelta));
+  g_variant_iter_init (&iter, attributes);
+  while (g_variant_iter_next (&iter, "(y&sqiiixi@a{sv})", &id, NULL, NULL, &value, &worst, NULL, &pretty, NULL, NULL))
+    {
+      SmartHistoryDelta *last = smart_history_lookup (drive->smart_history_last, id);
+      SmartHistoryDelta d;
+
+      d.id = id;
+      d.value = value - (last != NULL ? last->value : 0);
+      d.worst = worst - (last != NULL ? last->worst : 0);
+      d.pretty = pretty - (last != NULL ? last->pretty : 0);
+      if (last == NULL || d.value != 0 || d.worst != 0 || d.pretty != 0)
+        g_array_append_val (deltas, d);
+    }
+
+  smart_history_push (drive, smart_history_entry_new (time, deltas));
+  g_array_unref (deltas);
+  drive->smart_history_dirty = TRUE;
+}
+
+/* returns absolute snapshots taken at or after @since, must be called with object_lock held */
+static GVariant *
+smart_history_to_variant (UDisksLinuxDriveAta *drive,
+                          guint64              since)
+{
+  GVariantBuilder builder;
+  GArray *values;
+  GList *l;
+  guint n;
+
+  values = g_array_new (FALSE, FALSE, sizeof (SmartHistoryDelta));
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ta(yiix))"));
+  for (l = drive->smart_history.head; l != NULL; l = l->next)
+    {
+      SmartHistoryEntry *entry = l->data;
+
+      smart_history_apply (values, entry);
+      if (entry->time < since)
+        continue;
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(ta(yiix))"));
+      g_variant_builder_add (&builder, "t", entry->time);
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(yiix)"));
+      for (n = 0; n < values->len; n++)
+        {
+          SmartHistoryDelta *v = &g_array_index (values, SmartHistoryDelta, n);
+          g_variant_builder_add (&builder, "(yiix)", v->id, (gint) v->value, (gint) v->worst, v->pretty);
+        }
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
+    }
+  g_array_unref (values);
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Returns the file in /var/lib/udisks2 that @name is persisted in for the
+ * drive, keyed by its WWN or, failing that, its vendor/model/serial based
+ * id - or %NULL if the drive cannot be identified across reboots.
  */
-gboolean
-udisks_linux_drive_ata_refresh_smart_sync (UDisksLinuxDriveAta  *drive,
-                                           gboolean              nowakeup,
-                                           const gchar          *simulate_path,
-                                           GCancellable         *cancellable,
-                                           GError              **error)
+static gchar *
+get_persist_path (UDisksLinuxDriveObject *object,
+                  const gchar            *name)
+{
+  UDisksDrive *drive = udisks_object_peek_drive (UDISKS_OBJECT (object));
+  const gchar *key = NULL;
+  gchar *path;
+
+  if (drive == NULL)
+    return NULL;
+  key = udisks_drive_get_wwn (drive);
+  if (key == NULL || strlen (key) == 0)
+    key = udisks_drive_get_id (drive);
+  if (key == NULL || strlen (key) == 0)
+    return NULL;
+
+  path = g_strdup_printf (PACKAGE_LOCALSTATE_DIR "/lib/udisks2/%s-%s", name, key);
+  g_strdelimit (path + strlen (PACKAGE_LOCALSTATE_DIR "/lib/udisks2/"), "/", '_');
+  return path;
+}
+
+/* loads the persisted history on first use, must be called with object_lock held */
+static void
+smart_history_ensure_loaded (UDisksLinuxDriveAta    *drive,
+                             UDisksLinuxDriveObject *object)
+{
+  UDisksDaemon *daemon = udisks_linux_drive_object_get_daemon (object);
+  gchar *path = NULL;
+  gchar *contents = NULL;
+  gsize length;
+  GVariant *value = NULL;
+  GVariantIter iter;
+  GVariantIter *deltas_iter;
+  guint64 time;
+  GError *error = NULL;
+
+  if (drive->smart_history_loaded)
+    goto out;
+  drive->smart_history_loaded = TRUE;
+
+  if (!udisks_config_manager_get_persist_smart_history (udisks_daemon_get_config_manager (daemon)))
+    goto out;
+
+  path = get_persist_path (object, "smart-history");
+  if (path == NULL)
+    goto out;
+  drive->smart_history_path = g_strdup (path);
+
+  if (!g_file_get_contents (path, &contents, &length, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        udisks_warning ("Error loading SMART history from %s: %s", path, error->message);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  value = g_variant_new_from_data (G_VARIANT_TYPE ("a(ta(ynnx))"), contents, length, FALSE, g_free, contents);
+  contents = NULL; /* ownership transfered to the GVariant */
+  g_variant_ref_sink (value);
+
+  g_variant_iter_init (&iter, value);
+  while (g_variant_iter_next (&iter, "(ta(ynnx))", &time, &deltas_iter))
+    {
+      GArray *deltas = g_array_new (FALSE, FALSE, sizeof (SmartHistoryDelta));
+      SmartHistoryDelta d;
+
+      while (g_variant_iter_next (deltas_iter, "(ynnx)", &d.id, &d.value, &d.worst, &d.pretty))
+        g_array_append_val (deltas, d);
+      smart_history_push (drive, smart_history_entry_new (time, deltas));
+      g_array_unref (deltas);
+      g_variant_iter_free (deltas_iter);
+    }
+  udisks_debug ("Loaded %u SMART history entries from %s", g_queue_get_length (&drive->smart_history), path);
+
+ out:
+  if (value != NULL)
+    g_variant_unref (value);
+  g_free (contents);
+  g_free (path);
+}
+
+/* writes the history to disk if it is persisted and has changed since it was
+ * last written at least SMART_HISTORY_SAVE_INTERVAL ago (or if @force is %TRUE)
+ */
+static void
+smart_history_save (UDisksLinuxDriveAta *drive,
+                    gboolean             force)
+{
+  GVariantBuilder builder;
+  GVariant *value = NULL;
+  gchar *path = NULL;
+  GList *l;
+  guint n;
+  GError *error = NULL;
+
+  G_LOCK (object_lock);
+  if (drive->smart_history_path == NULL || !drive->smart_history_dirty)
+    goto out_locked;
+  if (!force && drive->smart_updated < drive->smart_history_saved + SMART_HISTORY_SAVE_INTERVAL)
+    goto out_locked;
+
+  path = g_strdup (drive->smart_history_path);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ta(ynnx))"));
+  for (l = drive->smart_history.head; l != NULL; l = l->next)
+    {
+      SmartHistoryEntry *entry = l->data;
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(ta(ynnx))"));
+      g_variant_builder_add (&builder, "t", entry->time);
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ynnx)"));
+      for (n = 0; n < entry->num_deltas; n++)
+        g_variant_builder_add (&builder, "(ynnx)",
+                               entry->deltas[n].id, entry->deltas[n].value,
+                               entry->deltas[n].worst, entry->deltas[n].pretty);
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
+    }
+  value = g_variant_ref_sink (g_variant_builder_end (&builder));
+  drive->smart_history_dirty = FALSE;
+  drive->smart_history_saved = drive->smart_updated;
+
+ out_locked:
+  G_UNLOCK (object_lock);
+
+  if (value != NULL &&
+      !g_file_set_contents (path, g_variant_get_data (value), g_variant_get_size (value), &error))
+    {
+      udisks_warning ("Error saving SMART history to %s: %s", path, error->message);
+      g_clear_error (&error);
+    }
+
+  if (value != NULL)
+    g_variant_unref (value);
+  g_free (path);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* The last SMART data read from a drive is kept in /var/lib/udisks2 so
+ * the daemon can publish it at start-up instead of waking up every
+ * sleeping drive for a fresh read.
+ */
+
+/* cached data older than this is not used */
+#define SMART_CACHE_MAX_AGE (24 * 60 * 60)
+
+/* don't keep the disk holding /var busy by writing the cache on every refresh */
+#define SMART_CACHE_SAVE_INTERVAL (60 * 60)
+
+static void
+smart_cache_save (UDisksLinuxDriveAta    *drive,
+                  UDisksLinuxDriveObject *object,
+                  SkDisk                 *d)
+{
+  const void *blob;
+  size_t blob_size;
+  gchar *path = NULL;
+  GError *error = NULL;
+
+  if (drive->smart_updated < drive->smart_cache_saved + SMART_CACHE_SAVE_INTERVAL)
+    goto out;
+
+  path = get_persist_path (object, "smart-cache");
+  if (path == NULL)
+    goto out;
+
+  if (sk_disk_get_blob (d, &blob, &blob_size) != 0)
+    {
+      udisks_warning ("Error getting SMART blob for %s: %m", path);
+      goto out;
+    }
+
+  if (!g_file_set_contents (path, blob, blob_size, &error))
+    {
+      udisks_warning ("Error saving SMART data to %s: %s", path, error->message);
+      g_clear_error (&error);
+      goto out;
+    }
+  drive->smart_cache_saved = drive->smart_updated;
+
+ out:
+  g_free (path);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* If @cached_time is not 0, @simulate_path is the SMART cache of the drive
+ * itself, written at @cached_time, rather than simulated data.
+ */
+static gboolean
+refresh_smart (UDisksLinuxDriveAta  *drive,
+               gboolean              nowakeup,
+               const gchar          *simulate_path,
+               guint64               cached_time,
+               GCancellable         *cancellable,
+               GError              **error)
 {
   UDisksLinuxDriveObject *object;
   UDisksLinuxDevice *device = NULL;
@@ -604,15 +979,15 @@ udisks_linux_drive_ata_refresh_smart_sync (UDisksLinuxDriveAta  *drive,
                        "Disk is in sleep mode and the nowakeup option was passed");
           goto out;
         }
-    }
 
-  if (sk_disk_open (g_udev_device_get_device_file (device->udev_device), &d) != 0)
-    {
-      g_set_error (error,
-                   UDISKS_ERROR,
-                   UDISKS_ERROR_FAILED,
-                   "sk_disk_open: %m");
-      goto out;
+      if (sk_disk_open (g_udev_device_get_device_file (device->udev_device), &d) != 0)
+        {
+          g_set_error (error,
+                       UDISKS_ERROR,
+                       UDISKS_ERROR_FAILED,
+                       "sk_disk_open: %m");
+          goto out;
+        }
     }
 
   if (sk_disk_smart_read_data (d) != 0)
@@ -652,8 +1027,8 @@ udisks_linux_drive_ata_refresh_smart_sync (UDisksLinuxDriveAta  *drive,
   sk_disk_smart_parse_attributes (d, parse_attr_cb, &parse_data);
 
   G_LOCK (object_lock);
-  drive->smart_is_from_blob = (simulate_path != NULL);
-  drive->smart_updated = time (NULL);
+  drive->smart_is_from_blob = (simulate_path != NULL && cached_time == 0);
+  drive->smart_updated = cached_time != 0 ? cached_time : (guint64) time (NULL);
   drive->smart_failing = !good;
   drive->smart_temperature = temp_mkelvin / 1000.0;
   drive->smart_power_on_seconds = power_on_msec / 1000.0;
@@ -665,10 +1040,23 @@ udisks_linux_drive_ata_refresh_smart_sync (UDisksLinuxDriveAta  *drive,
   if (drive->smart_attributes != NULL)
     g_variant_unref (drive->smart_attributes);
   drive->smart_attributes = g_variant_ref_sink (g_variant_builder_end (&parse_data.builder));
+  /* simulated data says nothing about the drive's own history, cached data
+   * is usually already in it and then skipped by smart_history_append()
+   */
+  if (!drive->smart_is_from_blob)
+    {
+      smart_history_ensure_loaded (drive, object);
+      smart_history_append (drive, drive->smart_updated, drive->smart_attributes);
+    }
   G_UNLOCK (object_lock);
 
+  smart_history_save (drive, FALSE);
+
   update_smart (drive, device);
 
+  if (simulate_path == NULL)
+    smart_cache_save (drive, object, d);
+
   ret = TRUE;
   /* update stats again to account for the IO we just did to read the SMART info */
   update_io_stats (drive, device);
@@ -681,6 +1069,96 @@ udisks_linux_drive_ata_refresh_smart_sync (UDisksLinuxDriveAta  *drive,
   return ret;
 }
 
+/**
+ * udisks_linux_drive_ata_refresh_smart_sync:
+ * @drive: The #UDisksLinuxDriveAta to refresh.
+ * @nowakeup: If %TRUE, will not wake up the disk if asleep.
+ * @simulate_path: If not %NULL, the path of a file with a libatasmart blob to use.
+ * @cancellable: A #GCancellable or %NULL.
+ * @error: Return location for error.
+ *
+ * Synchronously refreshes ATA S.M.A.R.T. data on @drive using one of
+ * the physical drives associated with it. The calling thread is
+ * blocked until the data has been obtained.
+ *
+ * If @nowake is %TRUE and the disk is in a sleep state this fails
+ * with %UDISKS_ERROR_WOULD_WAKEUP.
+ *
+ * This may only be called if @drive has been associated with a
+ * #UDisksLinuxDriveObject instance.
+ *
+ * This method may be called from any thread.
+ *
+ * Returns: %TRUE if the operation succeeded, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_drive_ata_refresh_smart_sync (UDisksLinuxDriveAta  *drive,
+                                           gboolean              nowakeup,
+                                           const gchar          *simulate_path,
+                                           GCancellable         *cancellable,
+                                           GError              **error)
+{
+  return refresh_smart (drive, nowakeup, simulate_path, 0, cancellable, error);
+}
+
+/**
+ * udisks_linux_drive_ata_restore_smart_cache:
+ * @drive: The #UDisksLinuxDriveAta to restore SMART data for.
+ *
+ * Publishes the SMART data that was last read from @drive, possibly
+ * by a previous instance of the daemon, without any I/O to the drive.
+ * Unlike simulated data it is treated as real data of the drive and
+ * #UDisksDriveAta:smart-updated is the time it was read.
+ *
+ * This may only be called if @drive has been associated with a
+ * #UDisksLinuxDriveObject instance.
+ *
+ * Returns: %TRUE if cached data that is not stale was published.
+ */
+gboolean
+udisks_linux_drive_ata_restore_smart_cache (UDisksLinuxDriveAta *drive)
+{
+  UDisksLinuxDriveObject *object;
+  gchar *path = NULL;
+  GStatBuf statbuf;
+  guint64 now;
+  gboolean ret = FALSE;
+  GError *error = NULL;
+
+  object = udisks_daemon_util_dup_object (drive, NULL);
+  if (object == NULL)
+    goto out;
+
+  path = get_persist_path (object, "smart-cache");
+  if (path == NULL || g_stat (path, &statbuf) != 0)
+    goto out;
+
+  now = time (NULL);
+  if ((guint64) statbuf.st_mtime > now || (guint64) statbuf.st_mtime + SMART_CACHE_MAX_AGE < now)
+    {
+      udisks_debug ("Ignoring stale SMART data in %s", path);
+      goto out;
+    }
+
+  if (!refresh_smart (drive, TRUE, path, statbuf.st_mtime, NULL, &error))
+    {
+      udisks_warning ("Error restoring SMART data from %s: %s", path, error->message);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  G_LOCK (object_lock);
+  drive->smart_cache_saved = statbuf.st_mtime;
+  G_UNLOCK (object_lock);
+
+  ret = TRUE;
+
+ out:
+  g_free (path);
+  g_clear_object (&object);
+  return ret;
+}
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 /**
@@ -905,6 +1383,37 @@ handle_smart_get_attributes (UDisksDriveAta        *_drive,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static gboolean
+handle_smart_get_attribute_history (UDisksDriveAta        *_drive,
+                                    GDBusMethodInvocation *invocation,
+                                    guint64                since,
+                                    GVariant              *options)
+{
+  UDisksLinuxDriveAta *drive = UDISKS_LINUX_DRIVE_ATA (_drive);
+  UDisksLinuxDriveObject *object;
+  GError *error = NULL;
+
+  object = udisks_daemon_util_dup_object (drive, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  /* never touches the drive, the history is only fed by regular SMART updates */
+  G_LOCK (object_lock);
+  smart_history_ensure_loaded (drive, object);
+  udisks_drive_ata_complete_smart_get_attribute_history (UDISKS_DRIVE_ATA (drive), invocation,
+                                                         smart_history_to_variant (drive, since));
+  G_UNLOCK (object_lock);
+
+ out:
+  g_clear_object (&object);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static gboolean
 handle_smart_selftest_abort (UDisksDriveAta        *_drive,
                              GDBusMethodInvocation *invocation,
@@ -1829,6 +2338,10 @@ apply_configuration_thread_func (gpointer user_data)
         }
     }
 
+  /* the settings are part of the IDENTIFY data, make the 'change' uevent probe it again */
+  udisks_linux_provider_invalidate_ata_identify (udisks_daemon_get_linux_provider (udisks_linux_drive_object_get_daemon (data->object)),
+                                                 data->device->udev_device);
+
  out:
   if (fd != -1)
     close (fd);
@@ -2240,6 +2753,11 @@ udisks_linux_drive_ata_secure_erase_sync (UDisksLinuxDriveAta  *drive,
                      local_error->message, g_quark_to_string (local_error->domain), local_error->code);
     }
 
+  /* the security state is part of the IDENTIFY data */
+  if (device != NULL)
+    udisks_linux_provider_invalidate_ata_identify (udisks_daemon_get_linux_provider (daemon),
+                                                   device->udev_device);
+
   if (claimed)
     drive->secure_erase_in_progress = FALSE;
 
@@ -2487,6 +3005,8 @@ handle_smart_set_enabled (UDisksDriveAta        *_drive,
   }
 
   /* Reread new IDENTIFY data */
+  udisks_linux_provider_invalidate_ata_identify (udisks_daemon_get_linux_provider (daemon),
+                                                 device->udev_device);
   if (!udisks_linux_device_reprobe_sync (device, NULL, &error))
     {
       g_prefix_error (&error, "Error reprobing device: ");
@@ -2533,6 +3053,7 @@ drive_ata_iface_init (UDisksDriveAtaIface *iface)
 {
   iface->handle_smart_update = handle_smart_update;
   iface->handle_smart_get_attributes = handle_smart_get_attributes;
+  iface->handle_smart_get_attribute_history = handle_smart_get_attribute_history;
   iface->handle_smart_selftest_abort = handle_smart_selftest_abort;
   iface->handle_smart_selftest_start = handle_smart_selftest_start;
   iface->handle_smart_set_enabled = handle_smart_set_enabled;
@@ -38,6 +38,7 @@ gboolean        udisks_linux_drive_ata_refresh_smart_sync (UDisksLinuxDriveAta
                                                            const gchar             *simulate_path,
                                                            GCancellable            *cancellable,
                                                            GError                 **error);
+gboolean        udisks_linux_drive_ata_restore_smart_cache (UDisksLinuxDriveAta    *drive);
 gboolean        udisks_linux_drive_ata_smart_selftest_sync (UDisksLinuxDriveAta     *drive,
                                                             const gchar             *type,
                                                             GCancellable            *cancellable,
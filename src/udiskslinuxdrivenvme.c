@@ -0,0 +1,815 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The UDisks authors, see the AUTHORS file
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <linux/nvme_ioctl.h>
+
+#include "udiskslogging.h"
+#include "udiskslinuxdriveobject.h"
+#include "udiskslinuxdrivenvme.h"
+#include "udiskslinuxblockobject.h"
+#include "udisksdaemon.h"
+#include "udisksdaemonutil.h"
+#include "udiskslinuxdevice.h"
+#include "udiskslinuxprovider.h"
+
+/**
+ * SECTION:udiskslinuxdrivenvme
+ * @title: UDisksLinuxDriveNVMe
+ * @short_description: Linux implementation of #UDisksDriveNVMe
+ *
+ * This type provides an implementation of the #UDisksDriveNVMe
+ * interface on Linux.
+ */
+
+typedef struct _UDisksLinuxDriveNVMeClass   UDisksLinuxDriveNVMeClass;
+
+/* NVM Express 1.3: 5 Admin Command Set */
+#define NVME_ADMIN_GET_LOG_PAGE   0x02
+#define NVME_ADMIN_IDENTIFY       0x06
+
+#define NVME_LOG_ERROR            0x01
+#define NVME_LOG_SMART            0x02
+
+#define NVME_NSID_ALL             0xffffffff
+#define NVME_IDENTIFY_CNS_CTRL    0x01
+
+#define NVME_IDENTIFY_SIZE        4096
+#define NVME_SMART_LOG_SIZE       512
+#define NVME_ERROR_LOG_ENTRY_SIZE 64
+
+/* the controller may keep up to 256 entries, we only care about the recent ones */
+#define NVME_ERROR_LOG_MAX_ENTRIES 64
+
+#define NVME_ADMIN_TIMEOUT_MSEC   (10 * 1000)
+
+/**
+ * UDisksLinuxDriveNVMe:
+ *
+ * The #UDisksLinuxDriveNVMe structure contains only private data and should
+ * only be accessed using the provided API.
+ */
+struct _UDisksLinuxDriveNVMe
+{
+  UDisksDriveNVMeSkeleton parent_instance;
+
+  gboolean     identify_read;
+  guint16      warning_temperature;  /* WCTEMP, in Kelvin */
+  guint16      critical_temperature; /* CCTEMP, in Kelvin */
+  guint        error_log_entries;    /* ELPE + 1 */
+
+  guint64      smart_updated;
+  guchar       smart_log[NVME_SMART_LOG_SIZE];
+  GVariant    *error_log;
+};
+
+struct _UDisksLinuxDriveNVMeClass
+{
+  UDisksDriveNVMeSkeletonClass parent_class;
+};
+
+static void drive_nvme_iface_init (UDisksDriveNVMeIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UDisksLinuxDriveNVMe, udisks_linux_drive_nvme, UDISKS_TYPE_DRIVE_NVME_SKELETON,
+                         G_IMPLEMENT_INTERFACE (UDISKS_TYPE_DRIVE_NVME, drive_nvme_iface_init));
+
+G_LOCK_DEFINE_STATIC (object_lock);
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+udisks_linux_drive_nvme_finalize (GObject *object)
+{
+  UDisksLinuxDriveNVMe *drive = UDISKS_LINUX_DRIVE_NVME (object);
+
+  if (drive->error_log != NULL)
+    g_variant_unref (drive->error_log);
+
+  if (G_OBJECT_CLASS (udisks_linux_drive_nvme_parent_class)->finalize != NULL)
+    G_OBJECT_CLASS (udisks_linux_drive_nvme_parent_class)->finalize (object);
+}
+
+
+static void
+udisks_linux_drive_nvme_init (UDisksLinuxDriveNVMe *drive)
+{
+  g_dbus_interface_skeleton_set_flags (G_DBUS_INTERFACE_SKELETON (drive),
+                                       G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
+}
+
+static void
+udisks_linux_drive_nvme_class_init (UDisksLinuxDriveNVMeClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = udisks_linux_drive_nvme_finalize;
+}
+
+/**
+ * udisks_linux_drive_nvme_new:
+ *
+ * Creates a new #UDisksLinuxDriveNVMe instance.
+ *
+ * Returns: A new #UDisksLinuxDriveNVMe. Free with g_object_unref().
+ */
+UDisksDriveNVMe *
+udisks_linux_drive_nvme_new (void)
+{
+  return UDISKS_DRIVE_NVME (g_object_new (UDISKS_TYPE_LINUX_DRIVE_NVME,
+                                          NULL));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* all multi-byte fields in NVMe data structures are little-endian */
+
+static guint16
+get_le16 (const guchar *data)
+{
+  return data[0] | (data[1] << 8);
+}
+
+static guint32
+get_le32 (const guchar *data)
+{
+  return get_le16 (data) | ((guint32) get_le16 (data + 2) << 16);
+}
+
+static guint64
+get_le64 (const guchar *data)
+{
+  return get_le32 (data) | ((guint64) get_le32 (data + 4) << 32);
+}
+
+/* the 128-bit counters of the SMART log saturate at G_MAXUINT64 */
+static guint64
+get_le128 (const guchar *data)
+{
+  if (get_le64 (data + 8) != 0)
+    return G_MAXUINT64;
+  return get_le64 (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* may be called from *any* thread when the SMART data has been updated */
+static void
+update_smart (UDisksLinuxDriveNVMe *drive)
+{
+  static const gchar *critical_warnings[] =
+    {
+      "spare",          /* bit 0 */
+      "temperature",    /* bit 1 */
+      "degraded",       /* bit 2 */
+      "readonly",       /* bit 3 */
+      "volatile_mem",   /* bit 4 */
+      "pmr_readonly",   /* bit 5 */
+    };
+  const gchar *warnings[G_N_ELEMENTS (critical_warnings) + 1];
+  guint num_warnings = 0;
+  guint64 updated = 0;
+  guint8 critical_warning = 0;
+  gdouble temperature = 0.0;
+  guint8 available_spare = 0;
+  guint8 spare_threshold = 0;
+  guint8 percent_used = 0;
+  guint64 power_on_hours = 0;
+  guint64 media_errors = 0;
+  guint64 num_error_log_entries = 0;
+  gdouble warning_temperature = 0.0;
+  gdouble critical_temperature = 0.0;
+  guint n;
+
+  /* NVM Express 1.3: 5.14.1.2 SMART / Health Information (Log Identifier 02h) */
+  G_LOCK (object_lock);
+  if (drive->smart_updated > 0)
+    {
+      updated = drive->smart_updated;
+      critical_warning = drive->smart_log[0];
+      temperature = get_le16 (drive->smart_log + 1);
+      available_spare = drive->smart_log[3];
+      spare_threshold = drive->smart_log[4];
+      percent_used = drive->smart_log[5];
+      power_on_hours = get_le128 (drive->smart_log + 128);
+      media_errors = get_le128 (drive->smart_log + 160);
+      num_error_log_entries = get_le128 (drive->smart_log + 176);
+    }
+  warning_temperature = drive->warning_temperature;
+  critical_temperature = drive->critical_temperature;
+  G_UNLOCK (object_lock);
+
+  for (n = 0; n < G_N_ELEMENTS (critical_warnings); n++)
+    {
+      if (critical_warning & (1 << n))
+        warnings[num_warnings++] = critical_warnings[n];
+    }
+  warnings[num_warnings] = NULL;
+
+  g_object_freeze_notify (G_OBJECT (drive));
+  udisks_drive_nvme_set_smart_updated (UDISKS_DRIVE_NVME (drive), updated);
+  udisks_drive_nvme_set_smart_failing (UDISKS_DRIVE_NVME (drive), critical_warning != 0);
+  udisks_drive_nvme_set_smart_critical_warning (UDISKS_DRIVE_NVME (drive), warnings);
+  udisks_drive_nvme_set_smart_power_on_seconds (UDISKS_DRIVE_NVME (drive),
+                                                power_on_hours > G_MAXUINT64 / 3600 ? G_MAXUINT64 : power_on_hours * 3600);
+  udisks_drive_nvme_set_smart_temperature (UDISKS_DRIVE_NVME (drive), temperature);
+  udisks_drive_nvme_set_smart_available_spare (UDISKS_DRIVE_NVME (drive), available_spare);
+  udisks_drive_nvme_set_smart_spare_threshold (UDISKS_DRIVE_NVME (drive), spare_threshold);
+  udisks_drive_nvme_set_smart_percent_used (UDISKS_DRIVE_NVME (drive), percent_used);
+  udisks_drive_nvme_set_smart_media_errors (UDISKS_DRIVE_NVME (drive), media_errors);
+  udisks_drive_nvme_set_smart_num_error_log_entries (UDISKS_DRIVE_NVME (drive), num_error_log_entries);
+  udisks_drive_nvme_set_warning_temperature (UDISKS_DRIVE_NVME (drive), warning_temperature);
+  udisks_drive_nvme_set_critical_temperature (UDISKS_DRIVE_NVME (drive), critical_temperature);
+  g_object_thaw_notify (G_OBJECT (drive));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * udisks_linux_drive_nvme_update:
+ * @drive: A #UDisksLinuxDriveNVMe.
+ * @object: The enclosing #UDisksLinuxDriveObject instance.
+ *
+ * Updates the interface.
+ *
+ * Returns: %TRUE if configuration has changed, %FALSE otherwise.
+ */
+gboolean
+udisks_linux_drive_nvme_update (UDisksLinuxDriveNVMe   *drive,
+                                UDisksLinuxDriveObject *object)
+{
+  update_smart (drive);
+  return FALSE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+nvme_admin_command (gint          fd,
+                    guint8        opcode,
+                    guint32       cdw10,
+                    guint32       cdw11,
+                    guchar       *data,
+                    guint32       data_len,
+                    GError      **error)
+{
+  struct nvme_admin_cmd cmd;
+  gint rc;
+
+  memset (&cmd, 0, sizeof (cmd));
+  cmd.opcode = opcode;
+  cmd.nsid = opcode == NVME_ADMIN_GET_LOG_PAGE ? NVME_NSID_ALL : 0;
+  cmd.addr = (guint64) (gsize) data;
+  cmd.data_len = data_len;
+  cmd.cdw10 = cdw10;
+  cmd.cdw11 = cdw11;
+  cmd.timeout_ms = NVME_ADMIN_TIMEOUT_MSEC;
+
+  rc = ioctl (fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+  if (rc < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "NVME_IOCTL_ADMIN_CMD failed: %m");
+      return FALSE;
+    }
+  else if (rc > 0)
+    {
+      /* the NVMe status field of the completion queue entry */
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Admin command 0x%02x failed with status 0x%04x",
+                   (guint) opcode, (guint) rc);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+nvme_get_log_page (gint      fd,
+                   guint8    log_id,
+                   guchar   *data,
+                   guint32   data_len,
+                   GError  **error)
+{
+  guint32 numd;
+
+  /* NVM Express 1.3: 5.14 Get Log Page command - Figure 93, 94 */
+  numd = data_len / 4 - 1;
+  if (!nvme_admin_command (fd, NVME_ADMIN_GET_LOG_PAGE,
+                           log_id | ((numd & 0xffff) << 16),
+                           numd >> 16,
+                           data, data_len,
+                           error))
+    {
+      g_prefix_error (error, "Error getting log page 0x%02x: ", (guint) log_id);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* must be called with object_lock held */
+static gboolean
+read_identify_controller (UDisksLinuxDriveNVMe *drive,
+                          gint                  fd,
+                          GError              **error)
+{
+  guchar *data;
+  gboolean ret = FALSE;
+
+  data = g_malloc0 (NVME_IDENTIFY_SIZE);
+  if (!nvme_admin_command (fd, NVME_ADMIN_IDENTIFY,
+                           NVME_IDENTIFY_CNS_CTRL, 0,
+                           data, NVME_IDENTIFY_SIZE,
+                           error))
+    {
+      g_prefix_error (error, "Error sending IDENTIFY CONTROLLER: ");
+      goto out;
+    }
+
+  /* NVM Express 1.3: 5.15 Identify command - Figure 109 */
+  drive->error_log_entries = data[262] + 1;
+  drive->warning_temperature = get_le16 (data + 266);
+  drive->critical_temperature = get_le16 (data + 268);
+  drive->identify_read = TRUE;
+  ret = TRUE;
+
+ out:
+  g_free (data);
+  return ret;
+}
+
+static GVariant *
+parse_error_log (const guchar *data,
+                 gsize         num_entries)
+{
+  GVariantBuilder builder;
+  gsize n;
+
+  /* NVM Express 1.3: 5.14.1.1 Error Information (Log Identifier 01h) - Figure 97 */
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+  for (n = 0; n < num_entries; n++)
+    {
+      const guchar *entry = data + n * NVME_ERROR_LOG_ENTRY_SIZE;
+      guint64 error_count;
+
+      /* unused entries have an error count of zero */
+      error_count = get_le64 (entry);
+      if (error_count == 0)
+        continue;
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add (&builder, "{sv}", "error_count", g_variant_new_uint64 (error_count));
+      g_variant_builder_add (&builder, "{sv}", "sqid", g_variant_new_uint16 (get_le16 (entry + 8)));
+      g_variant_builder_add (&builder, "{sv}", "cmdid", g_variant_new_uint16 (get_le16 (entry + 10)));
+      g_variant_builder_add (&builder, "{sv}", "status_field", g_variant_new_uint16 (get_le16 (entry + 12)));
+      g_variant_builder_add (&builder, "{sv}", "parm_error_location", g_variant_new_uint16 (get_le16 (entry + 14)));
+      g_variant_builder_add (&builder, "{sv}", "lba", g_variant_new_uint64 (get_le64 (entry + 16)));
+      g_variant_builder_add (&builder, "{sv}", "nsid", g_variant_new_uint32 (get_le32 (entry + 24)));
+      g_variant_builder_close (&builder);
+    }
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * udisks_linux_drive_nvme_get_controller:
+ * @daemon: A #UDisksDaemon.
+ * @device: A #UDisksLinuxDevice.
+ *
+ * Gets the NVMe controller the namespace @device is attached to.
+ * Namespaces are normally children of their controller. With native
+ * NVMe multipathing they are children of the NVM subsystem instead and
+ * the controllers (paths) are linked from the subsystem in sysfs - a
+ * live one is preferred then.
+ *
+ * Returns: (transfer full): A #GUdevDevice or %NULL if @device is not a NVMe namespace. Free with g_object_unref().
+ */
+GUdevDevice *
+udisks_linux_drive_nvme_get_controller (UDisksDaemon      *daemon,
+                                        UDisksLinuxDevice *device)
+{
+  GUdevClient *client;
+  GUdevDevice *subsystem = NULL;
+  GUdevDevice *ret = NULL;
+  GDir *dir = NULL;
+  const gchar *name;
+
+  ret = g_udev_device_get_parent_with_subsystem (device->udev_device, "nvme", NULL);
+  if (ret != NULL)
+    goto out;
+
+  subsystem = g_udev_device_get_parent_with_subsystem (device->udev_device, "nvme-subsystem", NULL);
+  if (subsystem == NULL)
+    goto out;
+
+  dir = g_dir_open (g_udev_device_get_sysfs_path (subsystem), 0, NULL);
+  if (dir == NULL)
+    goto out;
+
+  client = udisks_linux_provider_get_udev_client (udisks_daemon_get_linux_provider (daemon));
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *resolved;
+      GUdevDevice *controller;
+
+      /* the namespaces are subdirectories, not links */
+      resolved = udisks_daemon_util_resolve_link (g_udev_device_get_sysfs_path (subsystem), name);
+      if (resolved == NULL)
+        continue;
+      controller = g_udev_client_query_by_sysfs_path (client, resolved);
+      g_free (resolved);
+      if (controller == NULL)
+        continue;
+
+      if (g_strcmp0 (g_udev_device_get_subsystem (controller), "nvme") != 0)
+        {
+          g_object_unref (controller);
+          continue;
+        }
+
+      if (g_strcmp0 (g_udev_device_get_sysfs_attr (controller, "state"), "live") == 0)
+        {
+          g_clear_object (&ret);
+          ret = controller;
+          break;
+        }
+      if (ret == NULL)
+        ret = controller;
+      else
+        g_object_unref (controller);
+    }
+
+ out:
+  if (dir != NULL)
+    g_dir_close (dir);
+  g_clear_object (&subsystem);
+  return ret;
+}
+
+/* Whether the controller is runtime suspended - asking it for the
+ * health log would then resume it (the equivalent of waking up an ATA
+ * disk from standby).
+ */
+static gboolean
+is_runtime_suspended (UDisksDaemon      *daemon,
+                      UDisksLinuxDevice *device)
+{
+  GUdevDevice *controller;
+  gchar *path = NULL;
+  gchar *contents = NULL;
+  gboolean ret = FALSE;
+
+  controller = udisks_linux_drive_nvme_get_controller (daemon, device);
+  if (controller == NULL)
+    goto out;
+
+  path = g_build_filename (g_udev_device_get_sysfs_path (controller), "device", "power", "runtime_status", NULL);
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    ret = g_str_has_prefix (contents, "suspended");
+
+ out:
+  g_free (contents);
+  g_free (path);
+  g_clear_object (&controller);
+  return ret;
+}
+
+/**
+ * udisks_linux_drive_nvme_refresh_smart_sync:
+ * @drive: The #UDisksLinuxDriveNVMe to refresh.
+ * @nowakeup: If %TRUE, will not wake up the controller if suspended.
+ * @simulate_path: If not %NULL, the path of a file with a SMART / Health Information log page to use.
+ * @cancellable: A #GCancellable or %NULL.
+ * @error: Return location for error.
+ *
+ * Synchronously reads the SMART / Health Information and Error
+ * Information log pages from the controller @drive is attached to.
+ * The calling thread is blocked until the data has been obtained.
+ *
+ * If @nowakeup is %TRUE and the controller is runtime suspended this
+ * fails with %UDISKS_ERROR_WOULD_WAKEUP.
+ *
+ * If @simulate_path is given, the file must contain the 512 byte
+ * SMART / Health Information log page optionally followed by 64 byte
+ * Error Information log entries and the drive is not accessed at all.
+ *
+ * This may only be called if @drive has been associated with a
+ * #UDisksLinuxDriveObject instance.
+ *
+ * This method may be called from any thread.
+ *
+ * Returns: %TRUE if the operation succeeded, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_drive_nvme_refresh_smart_sync (UDisksLinuxDriveNVMe  *drive,
+                                            gboolean               nowakeup,
+                                            const gchar           *simulate_path,
+                                            GCancellable          *cancellable,
+                                            GError               **error)
+{
+  UDisksLinuxDriveObject *object;
+  UDisksLinuxDevice *device = NULL;
+  guchar smart_log[NVME_SMART_LOG_SIZE];
+  guchar *error_log_data = NULL;
+  gsize error_log_len = 0;
+  gchar *blob = NULL;
+  gsize blob_len;
+  gint fd = -1;
+  gboolean ret = FALSE;
+
+  object = udisks_daemon_util_dup_object (drive, error);
+  if (object == NULL)
+    goto out;
+
+  device = udisks_linux_drive_object_get_device (object, TRUE /* get_hw */);
+  g_assert (device != NULL);
+
+  if (simulate_path != NULL)
+    {
+      if (!g_file_get_contents (simulate_path, &blob, &blob_len, error))
+        goto out;
+
+      if (blob_len < NVME_SMART_LOG_SIZE)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Blob of %" G_GSIZE_FORMAT " bytes is too short for a SMART / Health Information log page",
+                       blob_len);
+          goto out;
+        }
+      memcpy (smart_log, blob, NVME_SMART_LOG_SIZE);
+      error_log_data = (guchar *) blob + NVME_SMART_LOG_SIZE;
+      error_log_len = blob_len - NVME_SMART_LOG_SIZE;
+    }
+  else
+    {
+      guint num_entries;
+
+      /* don't wake up the controller unless specically asked to */
+      if (nowakeup && is_runtime_suspended (udisks_linux_drive_object_get_daemon (object), device))
+        {
+          g_set_error (error,
+                       UDISKS_ERROR,
+                       UDISKS_ERROR_WOULD_WAKEUP,
+                       "Controller is suspended and the nowakeup option was passed");
+          goto out;
+        }
+
+      fd = open (g_udev_device_get_device_file (device->udev_device), O_RDONLY|O_NONBLOCK);
+      if (fd == -1)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error opening device file %s: %m",
+                       g_udev_device_get_device_file (device->udev_device));
+          goto out;
+        }
+
+      G_LOCK (object_lock);
+      if (!drive->identify_read && !read_identify_controller (drive, fd, error))
+        {
+          G_UNLOCK (object_lock);
+          goto out;
+        }
+      num_entries = MIN (drive->error_log_entries, NVME_ERROR_LOG_MAX_ENTRIES);
+      G_UNLOCK (object_lock);
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      if (!nvme_get_log_page (fd, NVME_LOG_SMART, smart_log, sizeof (smart_log), error))
+        goto out;
+
+      /* the error log is only worth reading if there is something in it */
+      if (get_le128 (smart_log + 176) > 0)
+        {
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            goto out;
+
+          error_log_len = num_entries * NVME_ERROR_LOG_ENTRY_SIZE;
+          error_log_data = g_malloc0 (error_log_len);
+          if (!nvme_get_log_page (fd, NVME_LOG_ERROR, error_log_data, error_log_len, error))
+            goto out;
+        }
+    }
+
+  G_LOCK (object_lock);
+  drive->smart_updated = time (NULL);
+  memcpy (drive->smart_log, smart_log, sizeof (smart_log));
+  if (drive->error_log != NULL)
+    g_variant_unref (drive->error_log);
+  drive->error_log = parse_error_log (error_log_data, error_log_len / NVME_ERROR_LOG_ENTRY_SIZE);
+  G_UNLOCK (object_lock);
+
+  update_smart (drive);
+
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  if (blob == NULL)
+    g_free (error_log_data);
+  g_free (blob);
+  g_clear_object (&device);
+  g_clear_object (&object);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+handle_smart_update (UDisksDriveNVMe       *_drive,
+                     GDBusMethodInvocation *invocation,
+                     GVariant              *options)
+{
+  UDisksLinuxDriveNVMe *drive = UDISKS_LINUX_DRIVE_NVME (_drive);
+  UDisksLinuxDriveObject *object;
+  UDisksLinuxBlockObject *block_object = NULL;
+  UDisksDaemon *daemon;
+  gboolean nowakeup = FALSE;
+  const gchar *nvme_smart_blob = NULL;
+  GError *error;
+  const gchar *message;
+  const gchar *action_id;
+
+  error = NULL;
+  object = udisks_daemon_util_dup_object (drive, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_drive_object_get_daemon (object);
+  block_object = udisks_linux_drive_object_get_block (object, TRUE);
+  if (block_object == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             UDISKS_ERROR,
+                                             UDISKS_ERROR_FAILED,
+                                             "Unable to find physical block device for drive");
+      goto out;
+    }
+
+  g_variant_lookup (options, "nowakeup", "b", &nowakeup);
+  g_variant_lookup (options, "nvme_smart_blob", "s", &nvme_smart_blob);
+
+  /* the SMART actions are not specific to ATA despite their names */
+  message = N_("Authentication is required to update SMART data from $(drive)");
+  action_id = "org.freedesktop.udisks2.ata-smart-update";
+  if (nvme_smart_blob != NULL)
+    {
+      message = N_("Authentication is required to set SMART data from a blob on $(drive)");
+      action_id = "org.freedesktop.udisks2.ata-smart-simulate";
+    }
+
+  /* Check that the user is authorized */
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    UDISKS_OBJECT (block_object),
+                                                    action_id,
+                                                    options,
+                                                    message,
+                                                    invocation))
+    goto out;
+
+  error = NULL;
+  if (!udisks_linux_drive_nvme_refresh_smart_sync (drive,
+                                                   nowakeup,
+                                                   nvme_smart_blob,
+                                                   NULL, /* cancellable */
+                                                   &error))
+    {
+      udisks_debug ("Error updating NVMe health information for %s: %s (%s, %d)",
+                    g_dbus_object_get_object_path (G_DBUS_OBJECT (object)),
+                    error->message, g_quark_to_string (error->domain), error->code);
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  udisks_drive_nvme_complete_smart_update (UDISKS_DRIVE_NVME (drive), invocation);
+
+ out:
+  g_clear_object (&block_object);
+  g_clear_object (&object);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+handle_smart_get_attributes (UDisksDriveNVMe       *_drive,
+                             GDBusMethodInvocation *invocation,
+                             GVariant              *options)
+{
+  UDisksLinuxDriveNVMe *drive = UDISKS_LINUX_DRIVE_NVME (_drive);
+  GVariantBuilder builder;
+  GVariantBuilder sensors;
+  const guchar *log;
+  guint n;
+
+  G_LOCK (object_lock);
+  if (drive->smart_updated == 0)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             UDISKS_ERROR,
+                                             UDISKS_ERROR_FAILED,
+                                             "SMART data not collected");
+      goto out;
+    }
+
+  /* NVM Express 1.3: 5.14.1.2 SMART / Health Information (Log Identifier 02h) - Figure 98 */
+  log = drive->smart_log;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "critical_warning", g_variant_new_byte (log[0]));
+  g_variant_builder_add (&builder, "{sv}", "temperature", g_variant_new_double (get_le16 (log + 1)));
+  g_variant_builder_add (&builder, "{sv}", "avail_spare", g_variant_new_byte (log[3]));
+  g_variant_builder_add (&builder, "{sv}", "spare_thresh", g_variant_new_byte (log[4]));
+  g_variant_builder_add (&builder, "{sv}", "percent_used", g_variant_new_byte (log[5]));
+  g_variant_builder_add (&builder, "{sv}", "data_units_read", g_variant_new_uint64 (get_le128 (log + 32)));
+  g_variant_builder_add (&builder, "{sv}", "data_units_written", g_variant_new_uint64 (get_le128 (log + 48)));
+  g_variant_builder_add (&builder, "{sv}", "host_read_commands", g_variant_new_uint64 (get_le128 (log + 64)));
+  g_variant_builder_add (&builder, "{sv}", "host_write_commands", g_variant_new_uint64 (get_le128 (log + 80)));
+  g_variant_builder_add (&builder, "{sv}", "ctrl_busy_time", g_variant_new_uint64 (get_le128 (log + 96)));
+  g_variant_builder_add (&builder, "{sv}", "power_cycles", g_variant_new_uint64 (get_le128 (log + 112)));
+  g_variant_builder_add (&builder, "{sv}", "power_on_hours", g_variant_new_uint64 (get_le128 (log + 128)));
+  g_variant_builder_add (&builder, "{sv}", "unsafe_shutdowns", g_variant_new_uint64 (get_le128 (log + 144)));
+  g_variant_builder_add (&builder, "{sv}", "media_errors", g_variant_new_uint64 (get_le128 (log + 160)));
+  g_variant_builder_add (&builder, "{sv}", "num_err_log_entries", g_variant_new_uint64 (get_le128 (log + 176)));
+  g_variant_builder_add (&builder, "{sv}", "warning_temp_time", g_variant_new_uint32 (get_le32 (log + 192)));
+  g_variant_builder_add (&builder, "{sv}", "critical_temp_time", g_variant_new_uint32 (get_le32 (log + 196)));
+  g_variant_builder_init (&sensors, G_VARIANT_TYPE ("ad"));
+  for (n = 0; n < 8; n++)
+    g_variant_builder_add (&sensors, "d", (gdouble) get_le16 (log + 200 + 2 * n));
+  g_variant_builder_add (&builder, "{sv}", "temp_sensors", g_variant_builder_end (&sensors));
+
+  udisks_drive_nvme_complete_smart_get_attributes (UDISKS_DRIVE_NVME (drive), invocation,
+                                                   g_variant_builder_end (&builder));
+
+ out:
+  G_UNLOCK (object_lock);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+handle_smart_get_error_log (UDisksDriveNVMe       *_drive,
+                            GDBusMethodInvocation *invocation,
+                            GVariant              *options)
+{
+  UDisksLinuxDriveNVMe *drive = UDISKS_LINUX_DRIVE_NVME (_drive);
+
+  G_LOCK (object_lock);
+  if (drive->error_log == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             UDISKS_ERROR,
+                                             UDISKS_ERROR_FAILED,
+                                             "SMART data not collected");
+    }
+  else
+    {
+      udisks_drive_nvme_complete_smart_get_error_log (UDISKS_DRIVE_NVME (drive), invocation,
+                                                      drive->error_log);
+    }
+  G_UNLOCK (object_lock);
+
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+drive_nvme_iface_init (UDisksDriveNVMeIface *iface)
+{
+  iface->handle_smart_update = handle_smart_update;
+  iface->handle_smart_get_attributes = handle_smart_get_attributes;
+  iface->handle_smart_get_error_log = handle_smart_get_error_log;
+}
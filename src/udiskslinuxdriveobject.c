@@ -32,6 +32,8 @@
 #include "udiskslinuxdriveobject.h"
 #include "udiskslinuxdrive.h"
 #include "udiskslinuxdriveata.h"
+#include "udiskslinuxdrivenvme.h"
+#include "udiskslinuxdrivescsi.h"
 #include "udiskslinuxblockobject.h"
 #include "udiskslinuxdevice.h"
 #include "udisksmodulemanager.h"
@@ -67,6 +69,8 @@ struct _UDisksLinuxDriveObject
   /* interfaces */
   UDisksDrive *iface_drive;
   UDisksDriveAta *iface_drive_ata;
+  UDisksDriveNVMe *iface_drive_nvme;
+  UDisksDriveScsi *iface_drive_scsi;
   GHashTable *module_ifaces;
 };
 
@@ -105,6 +109,10 @@ udisks_linux_drive_object_finalize (GObject *_object)
     g_object_unref (object->iface_drive);
   if (object->iface_drive_ata != NULL)
     g_object_unref (object->iface_drive_ata);
+  if (object->iface_drive_nvme != NULL)
+    g_object_unref (object->iface_drive_nvme);
+  if (object->iface_drive_scsi != NULL)
+    g_object_unref (object->iface_drive_scsi);
   if (object->module_ifaces != NULL)
     g_hash_table_destroy (object->module_ifaces);
 
@@ -629,6 +637,99 @@ drive_ata_update (UDisksObject   *object,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static gboolean
+drive_nvme_check (UDisksObject *object)
+{
+  UDisksLinuxDriveObject *drive_object = UDISKS_LINUX_DRIVE_OBJECT (object);
+  gboolean ret;
+  UDisksLinuxDevice *device;
+  GUdevDevice *controller;
+
+  ret = FALSE;
+  if (drive_object->devices == NULL)
+    goto out;
+
+  device = drive_object->devices->data;
+  controller = udisks_linux_drive_nvme_get_controller (drive_object->daemon, device);
+  if (controller != NULL)
+    {
+      ret = TRUE;
+      g_object_unref (controller);
+    }
+
+ out:
+  return ret;
+}
+
+static void
+drive_nvme_connect (UDisksObject *object)
+{
+
+}
+
+static gboolean
+drive_nvme_update (UDisksObject   *object,
+                   const gchar    *uevent_action,
+                   GDBusInterface *_iface)
+{
+  UDisksLinuxDriveObject *drive_object = UDISKS_LINUX_DRIVE_OBJECT (object);
+
+  return udisks_linux_drive_nvme_update (UDISKS_LINUX_DRIVE_NVME (drive_object->iface_drive_nvme), drive_object);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+drive_scsi_check (UDisksObject *object)
+{
+  UDisksLinuxDriveObject *drive_object = UDISKS_LINUX_DRIVE_OBJECT (object);
+  gboolean ret;
+  UDisksLinuxDevice *device;
+  GUdevDevice *scsi_device;
+
+  ret = FALSE;
+  if (drive_object->devices == NULL)
+    goto out;
+
+  /* ATA disks behind a SCSI translation layer are handled by Drive.Ata
+   * and USB bridges rarely implement the log pages
+   */
+  device = drive_object->devices->data;
+  if (device->ata_identify_device_data != NULL || device->ata_identify_packet_device_data != NULL)
+    goto out;
+  if (g_strcmp0 (g_udev_device_get_property (device->udev_device, "ID_BUS"), "scsi") != 0)
+    goto out;
+
+  /* only direct-access block devices (TYPE_DISK) */
+  scsi_device = g_udev_device_get_parent_with_subsystem (device->udev_device, "scsi", "scsi_device");
+  if (scsi_device != NULL)
+    {
+      ret = g_udev_device_get_sysfs_attr_as_int (scsi_device, "type") == 0;
+      g_object_unref (scsi_device);
+    }
+
+ out:
+  return ret;
+}
+
+static void
+drive_scsi_connect (UDisksObject *object)
+{
+
+}
+
+static gboolean
+drive_scsi_update (UDisksObject   *object,
+                   const gchar    *uevent_action,
+                   GDBusInterface *_iface)
+{
+  UDisksLinuxDriveObject *drive_object = UDISKS_LINUX_DRIVE_OBJECT (object);
+
+  return udisks_linux_drive_scsi_update (UDISKS_LINUX_DRIVE_SCSI (drive_object->iface_drive_scsi), drive_object);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void apply_configuration (UDisksLinuxDriveObject *object);
 
 static GList *
@@ -743,6 +844,10 @@ udisks_linux_drive_object_uevent (UDisksLinuxDriveObject *object,
                                 UDISKS_TYPE_LINUX_DRIVE, &object->iface_drive);
   conf_changed |= update_iface (UDISKS_OBJECT (object), action, drive_ata_check, drive_ata_connect, drive_ata_update,
                                 UDISKS_TYPE_LINUX_DRIVE_ATA, &object->iface_drive_ata);
+  conf_changed |= update_iface (UDISKS_OBJECT (object), action, drive_nvme_check, drive_nvme_connect, drive_nvme_update,
+                                UDISKS_TYPE_LINUX_DRIVE_NVME, &object->iface_drive_nvme);
+  conf_changed |= update_iface (UDISKS_OBJECT (object), action, drive_scsi_check, drive_scsi_connect, drive_scsi_update,
+                                UDISKS_TYPE_LINUX_DRIVE_SCSI, &object->iface_drive_scsi);
 
   /* Attach interfaces from modules */
   module_manager = udisks_daemon_get_module_manager (object->daemon);
@@ -973,6 +1078,94 @@ udisks_linux_drive_object_should_include_device (GUdevClient        *client,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+typedef gboolean (*RefreshSmartFunc) (UDisksLinuxDriveObject  *object,
+                                      gboolean                 nowakeup,
+                                      GCancellable            *cancellable,
+                                      GError                 **error);
+
+static gboolean
+refresh_ata_smart (UDisksLinuxDriveObject  *object,
+                   gboolean                 nowakeup,
+                   GCancellable            *cancellable,
+                   GError                 **error)
+{
+  return udisks_linux_drive_ata_refresh_smart_sync (UDISKS_LINUX_DRIVE_ATA (object->iface_drive_ata),
+                                                    nowakeup,
+                                                    NULL, /* simulate_path */
+                                                    cancellable,
+                                                    error);
+}
+
+static gboolean
+refresh_nvme_smart (UDisksLinuxDriveObject  *object,
+                    gboolean                 nowakeup,
+                    GCancellable            *cancellable,
+                    GError                 **error)
+{
+  return udisks_linux_drive_nvme_refresh_smart_sync (UDISKS_LINUX_DRIVE_NVME (object->iface_drive_nvme),
+                                                     nowakeup,
+                                                     NULL, /* simulate_path */
+                                                     cancellable,
+                                                     error);
+}
+
+static gboolean
+refresh_scsi_smart (UDisksLinuxDriveObject  *object,
+                    gboolean                 nowakeup,
+                    GCancellable            *cancellable,
+                    GError                 **error)
+{
+  return udisks_linux_drive_scsi_refresh_smart_sync (UDISKS_LINUX_DRIVE_SCSI (object->iface_drive_scsi),
+                                                     nowakeup,
+                                                     NULL, /* simulate_path */
+                                                     cancellable,
+                                                     error);
+}
+
+/* Refreshes SMART data using @refresh_func - drives that are asleep or
+ * busy are skipped since this is not worth waking them up for.
+ */
+static gboolean
+housekeeping_refresh_smart (UDisksLinuxDriveObject  *object,
+                            gboolean                 nowakeup,
+                            RefreshSmartFunc         refresh_func,
+                            GCancellable            *cancellable,
+                            GError                 **error)
+{
+  GError *local_error;
+
+  udisks_info ("Refreshing SMART data on %s (nowakeup=%d)",
+               g_dbus_object_get_object_path (G_DBUS_OBJECT (object)),
+               nowakeup);
+
+  local_error = NULL;
+  if (!refresh_func (object, nowakeup, cancellable, &local_error))
+    {
+      if (nowakeup && (local_error->domain == UDISKS_ERROR &&
+                       local_error->code == UDISKS_ERROR_WOULD_WAKEUP))
+        {
+          udisks_info ("Drive %s is in a sleep state",
+                       g_dbus_object_get_object_path (G_DBUS_OBJECT (object)));
+          g_clear_error (&local_error);
+        }
+      else if (nowakeup && (local_error->domain == UDISKS_ERROR &&
+                            local_error->code == UDISKS_ERROR_DEVICE_BUSY))
+        {
+          /* typically because a "secure erase" operation is pending */
+          udisks_info ("Drive %s is busy",
+                       g_dbus_object_get_object_path (G_DBUS_OBJECT (object)));
+          g_clear_error (&local_error);
+        }
+      else
+        {
+          g_propagate_prefixed_error (error, local_error, "Error updating SMART data: ");
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
 /**
  * udisks_linux_drive_object_housekeeping:
  * @object: A #UDisksLinuxDriveObject.
@@ -981,7 +1174,8 @@ udisks_linux_drive_object_should_include_device (GUdevClient        *client,
  * @error: Return location for error or %NULL.
  *
  * Called periodically (every ten minutes or so) to perform
- * housekeeping tasks such as refreshing ATA SMART data.
+ * housekeeping tasks such as refreshing ATA SMART data, NVMe health
+ * information or SCSI log pages.
  *
  * The function runs in a dedicated thread and is allowed to perform
  * blocking I/O.
@@ -998,6 +1192,7 @@ udisks_linux_drive_object_housekeeping (UDisksLinuxDriveObject  *object,
                                         GError                 **error)
 {
   gboolean ret;
+  gboolean nowakeup;
 
   ret = FALSE;
 
@@ -1005,46 +1200,34 @@ udisks_linux_drive_object_housekeeping (UDisksLinuxDriveObject  *object,
       udisks_drive_ata_get_smart_supported (object->iface_drive_ata) &&
       udisks_drive_ata_get_smart_enabled (object->iface_drive_ata))
     {
-      GError *local_error;
-      gboolean nowakeup;
-
-      /* Wake-up only on start-up */
+      /* Wake-up only on start-up and only if there is no recent SMART
+       * data from the last run - in that case just publish it and only
+       * read from drives that are active anyway.
+       */
       nowakeup = TRUE;
-      if (secs_since_last == 0)
+      if (secs_since_last == 0 &&
+          !udisks_linux_drive_ata_restore_smart_cache (UDISKS_LINUX_DRIVE_ATA (object->iface_drive_ata)))
         nowakeup = FALSE;
 
-      udisks_info ("Refreshing SMART data on %s (nowakeup=%d)",
-                   g_dbus_object_get_object_path (G_DBUS_OBJECT (object)),
-                   nowakeup);
+      if (!housekeeping_refresh_smart (object, nowakeup, refresh_ata_smart, cancellable, error))
+        goto out;
+    }
 
-      local_error = NULL;
-      if (!udisks_linux_drive_ata_refresh_smart_sync (UDISKS_LINUX_DRIVE_ATA (object->iface_drive_ata),
-                                                      nowakeup,
-                                                      NULL, /* simulate_path */
-                                                      cancellable,
-                                                      &local_error))
-        {
-          if (nowakeup && (local_error->domain == UDISKS_ERROR &&
-                           local_error->code == UDISKS_ERROR_WOULD_WAKEUP))
-            {
-              udisks_info ("Drive %s is in a sleep state",
-                           g_dbus_object_get_object_path (G_DBUS_OBJECT (object)));
-              g_clear_error (&local_error);
-            }
-          else if (nowakeup && (local_error->domain == UDISKS_ERROR &&
-                                local_error->code == UDISKS_ERROR_DEVICE_BUSY))
-            {
-              /* typically because a "secure erase" operation is pending */
-              udisks_info ("Drive %s is busy",
-                           g_dbus_object_get_object_path (G_DBUS_OBJECT (object)));
-              g_clear_error (&local_error);
-            }
-          else
-            {
-              g_propagate_prefixed_error (error, local_error, "Error updating SMART data: ");
-              goto out;
-            }
-        }
+  if (object->iface_drive_nvme != NULL)
+    {
+      /* Same as above except there is no cached data to publish */
+      nowakeup = secs_since_last > 0;
+
+      if (!housekeeping_refresh_smart (object, nowakeup, refresh_nvme_smart, cancellable, error))
+        goto out;
+    }
+
+  if (object->iface_drive_scsi != NULL)
+    {
+      nowakeup = secs_since_last > 0;
+
+      if (!housekeeping_refresh_smart (object, nowakeup, refresh_scsi_smart, cancellable, error))
+        goto out;
     }
 
   ret = TRUE;
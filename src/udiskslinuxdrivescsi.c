@@ -0,0 +1,560 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "udiskslogging.h"
+#include "udiskslinuxdriveobject.h"
+#include "udiskslinuxdrivescsi.h"
+#include "udiskslinuxblockobject.h"
+#include "udisksdaemon.h"
+#include "udisksdaemonutil.h"
+#include "udisksscsi.h"
+#include "udiskslinuxdevice.h"
+
+/**
+ * SECTION:udiskslinuxdrivescsi
+ * @title: UDisksLinuxDriveScsi
+ * @short_description: Linux implementation of #UDisksDriveScsi
+ *
+ * This type provides an implementation of the #UDisksDriveScsi
+ * interface on Linux.
+ */
+
+typedef struct _UDisksLinuxDriveScsiClass   UDisksLinuxDriveScsiClass;
+
+/* SPC-4: 7.3 Log parameters - Table 349 Log page codes */
+#define LOG_PAGE_SUPPORTED          0x00
+#define LOG_PAGE_WRITE_ERRORS       0x02
+#define LOG_PAGE_READ_ERRORS        0x03
+#define LOG_PAGE_VERIFY_ERRORS      0x05
+#define LOG_PAGE_TEMPERATURE        0x0d
+#define LOG_PAGE_START_STOP_CYCLES  0x0e
+#define LOG_PAGE_IE                 0x2f
+
+/* all the pages we read are a few dozen bytes */
+#define LOG_PAGE_MAX_SIZE           512
+
+/* SPC-4: Table D.2 - FAILURE PREDICTION THRESHOLD EXCEEDED */
+#define ASC_FAILURE_PREDICTION      0x5d
+
+typedef enum
+{
+  ERROR_COUNTER_WRITE,
+  ERROR_COUNTER_READ,
+  ERROR_COUNTER_VERIFY,
+  NUM_ERROR_COUNTERS
+} ErrorCounter;
+
+typedef struct
+{
+  guint16  informational_exception;
+  gdouble  temperature;
+  gdouble  trip_temperature;
+  guint32  start_stop_cycles;
+  guint32  start_stop_cycles_specified;
+  guint32  load_unload_cycles;
+  guint64  errors_corrected[NUM_ERROR_COUNTERS];
+  guint64  errors_uncorrected[NUM_ERROR_COUNTERS];
+} ScsiHealth;
+
+/**
+ * UDisksLinuxDriveScsi:
+ *
+ * The #UDisksLinuxDriveScsi structure contains only private data and should
+ * only be accessed using the provided API.
+ */
+struct _UDisksLinuxDriveScsi
+{
+  UDisksDriveScsiSkeleton parent_instance;
+
+  guint64      smart_updated;
+  ScsiHealth   smart_health;
+};
+
+struct _UDisksLinuxDriveScsiClass
+{
+  UDisksDriveScsiSkeletonClass parent_class;
+};
+
+static void drive_scsi_iface_init (UDisksDriveScsiIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UDisksLinuxDriveScsi, udisks_linux_drive_scsi, UDISKS_TYPE_DRIVE_SCSI_SKELETON,
+                         G_IMPLEMENT_INTERFACE (UDISKS_TYPE_DRIVE_SCSI, drive_scsi_iface_init));
+
+G_LOCK_DEFINE_STATIC (object_lock);
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+udisks_linux_drive_scsi_init (UDisksLinuxDriveScsi *drive)
+{
+  g_dbus_interface_skeleton_set_flags (G_DBUS_INTERFACE_SKELETON (drive),
+                                       G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
+}
+
+static void
+udisks_linux_drive_scsi_class_init (UDisksLinuxDriveScsiClass *klass)
+{
+}
+
+/**
+ * udisks_linux_drive_scsi_new:
+ *
+ * Creates a new #UDisksLinuxDriveScsi instance.
+ *
+ * Returns: A new #UDisksLinuxDriveScsi. Free with g_object_unref().
+ */
+UDisksDriveScsi *
+udisks_linux_drive_scsi_new (void)
+{
+  return UDISKS_DRIVE_SCSI (g_object_new (UDISKS_TYPE_LINUX_DRIVE_SCSI,
+                                          NULL));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* may be called from *any* thread when the SMART data has been updated */
+static void
+update_smart (UDisksLinuxDriveScsi *drive)
+{
+  ScsiHealth health;
+  guint64 updated;
+
+  G_LOCK (object_lock);
+  updated = drive->smart_updated;
+  health = drive->smart_health;
+  G_UNLOCK (object_lock);
+
+  /* emit a single PropertiesChanged signal for the whole refresh */
+  g_object_freeze_notify (G_OBJECT (drive));
+  udisks_drive_scsi_set_smart_updated (UDISKS_DRIVE_SCSI (drive), updated);
+  udisks_drive_scsi_set_smart_failing (UDISKS_DRIVE_SCSI (drive),
+                                       (health.informational_exception >> 8) == ASC_FAILURE_PREDICTION);
+  udisks_drive_scsi_set_smart_informational_exception (UDISKS_DRIVE_SCSI (drive), health.informational_exception);
+  udisks_drive_scsi_set_smart_temperature (UDISKS_DRIVE_SCSI (drive), health.temperature);
+  udisks_drive_scsi_set_smart_trip_temperature (UDISKS_DRIVE_SCSI (drive), health.trip_temperature);
+  udisks_drive_scsi_set_smart_start_stop_cycles (UDISKS_DRIVE_SCSI (drive), health.start_stop_cycles);
+  udisks_drive_scsi_set_smart_start_stop_cycles_specified (UDISKS_DRIVE_SCSI (drive), health.start_stop_cycles_specified);
+  udisks_drive_scsi_set_smart_load_unload_cycles (UDISKS_DRIVE_SCSI (drive), health.load_unload_cycles);
+  udisks_drive_scsi_set_smart_read_errors_corrected (UDISKS_DRIVE_SCSI (drive), health.errors_corrected[ERROR_COUNTER_READ]);
+  udisks_drive_scsi_set_smart_read_errors_uncorrected (UDISKS_DRIVE_SCSI (drive), health.errors_uncorrected[ERROR_COUNTER_READ]);
+  udisks_drive_scsi_set_smart_write_errors_corrected (UDISKS_DRIVE_SCSI (drive), health.errors_corrected[ERROR_COUNTER_WRITE]);
+  udisks_drive_scsi_set_smart_write_errors_uncorrected (UDISKS_DRIVE_SCSI (drive), health.errors_uncorrected[ERROR_COUNTER_WRITE]);
+  udisks_drive_scsi_set_smart_verify_errors_corrected (UDISKS_DRIVE_SCSI (drive), health.errors_corrected[ERROR_COUNTER_VERIFY]);
+  udisks_drive_scsi_set_smart_verify_errors_uncorrected (UDISKS_DRIVE_SCSI (drive), health.errors_uncorrected[ERROR_COUNTER_VERIFY]);
+  g_object_thaw_notify (G_OBJECT (drive));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * udisks_linux_drive_scsi_update:
+ * @drive: A #UDisksLinuxDriveScsi.
+ * @object: The enclosing #UDisksLinuxDriveObject instance.
+ *
+ * Updates the interface.
+ *
+ * Returns: %TRUE if configuration has changed, %FALSE otherwise.
+ */
+gboolean
+udisks_linux_drive_scsi_update (UDisksLinuxDriveScsi   *drive,
+                                UDisksLinuxDriveObject *object)
+{
+  update_smart (drive);
+  return FALSE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gdouble
+celsius_to_kelvin (const guchar *value,
+                   gsize         length,
+                   gsize         offset)
+{
+  /* 0xff means no valid temperature */
+  if (value == NULL || length <= offset || value[offset] == 0xff)
+    return 0.0;
+  return value[offset] + 273.15;
+}
+
+static void
+parse_log_page (ScsiHealth   *health,
+                const guchar *page,
+                gsize         length)
+{
+  const guchar *value;
+  gsize value_length = 0;
+  guint8 page_code = page[0] & 0x3f;
+  ErrorCounter counter;
+
+  switch (page_code)
+    {
+    case LOG_PAGE_WRITE_ERRORS:
+    case LOG_PAGE_READ_ERRORS:
+    case LOG_PAGE_VERIFY_ERRORS:
+      /* SBC-3: 6.4.4 Error counter log pages - TOTAL ERRORS CORRECTED, TOTAL UNCORRECTED ERRORS */
+      counter = page_code == LOG_PAGE_WRITE_ERRORS ? ERROR_COUNTER_WRITE :
+                page_code == LOG_PAGE_READ_ERRORS ? ERROR_COUNTER_READ : ERROR_COUNTER_VERIFY;
+      health->errors_corrected[counter] = udisks_scsi_log_page_get_parameter (page, length, 0x0003, 0);
+      health->errors_uncorrected[counter] = udisks_scsi_log_page_get_parameter (page, length, 0x0006, 0);
+      break;
+
+    case LOG_PAGE_TEMPERATURE:
+      /* SPC-4: 7.3.21 Temperature log page - TEMPERATURE, REFERENCE TEMPERATURE */
+      value = udisks_scsi_log_page_find_parameter (page, length, 0x0000, &value_length);
+      health->temperature = celsius_to_kelvin (value, value_length, 1);
+      value = udisks_scsi_log_page_find_parameter (page, length, 0x0001, &value_length);
+      health->trip_temperature = celsius_to_kelvin (value, value_length, 1);
+      break;
+
+    case LOG_PAGE_START_STOP_CYCLES:
+      /* SPC-4: 7.3.19 Start-Stop Cycle Counter log page */
+      health->start_stop_cycles_specified = udisks_scsi_log_page_get_parameter (page, length, 0x0003, 0);
+      health->start_stop_cycles = udisks_scsi_log_page_get_parameter (page, length, 0x0004, 0);
+      health->load_unload_cycles = udisks_scsi_log_page_get_parameter (page, length, 0x0006, 0);
+      break;
+
+    case LOG_PAGE_IE:
+      /* SPC-4: 7.3.8 Informational Exceptions log page - ASC, ASCQ, MOST RECENT TEMPERATURE READING */
+      value = udisks_scsi_log_page_find_parameter (page, length, 0x0000, &value_length);
+      if (value != NULL && value_length >= 2)
+        health->informational_exception = (value[0] << 8) | value[1];
+      /* only for drives without the temperature log page */
+      if (health->temperature == 0.0)
+        health->temperature = celsius_to_kelvin (value, value_length, 2);
+      break;
+
+    default:
+      break;
+    }
+}
+
+static gboolean
+parse_log_blob (ScsiHealth    *health,
+                const guchar  *blob,
+                gsize          blob_length,
+                GError       **error)
+{
+  gsize offset = 0;
+
+  while (offset < blob_length)
+    {
+      gsize length;
+
+      if (offset + 4 > blob_length)
+        goto truncated;
+      length = ((blob[offset + 2] << 8) | blob[offset + 3]) + 4;
+      if (offset + length > blob_length)
+        goto truncated;
+
+      parse_log_page (health, blob + offset, length);
+      offset += length;
+    }
+  return TRUE;
+
+ truncated:
+  g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+               "Truncated log page at offset %" G_GSIZE_FORMAT, offset);
+  return FALSE;
+}
+
+/* Whether the disk is runtime suspended - reading the log pages may
+ * then spin it up again.
+ */
+static gboolean
+is_runtime_suspended (UDisksLinuxDevice *device)
+{
+  GUdevDevice *scsi_device;
+  gchar *path = NULL;
+  gchar *contents = NULL;
+  gboolean ret = FALSE;
+
+  scsi_device = g_udev_device_get_parent_with_subsystem (device->udev_device, "scsi", "scsi_device");
+  if (scsi_device == NULL)
+    goto out;
+
+  path = g_build_filename (g_udev_device_get_sysfs_path (scsi_device), "power", "runtime_status", NULL);
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    ret = g_str_has_prefix (contents, "suspended");
+
+ out:
+  g_free (contents);
+  g_free (path);
+  g_clear_object (&scsi_device);
+  return ret;
+}
+
+static gboolean
+read_log_pages (ScsiHealth         *health,
+                UDisksLinuxDevice  *device,
+                GError            **error)
+{
+  static const guint8 wanted_pages[] =
+    {
+      LOG_PAGE_WRITE_ERRORS,
+      LOG_PAGE_READ_ERRORS,
+      LOG_PAGE_VERIFY_ERRORS,
+      LOG_PAGE_TEMPERATURE,
+      LOG_PAGE_START_STOP_CYCLES,
+      LOG_PAGE_IE,
+    };
+  const gchar *device_file;
+  guchar supported[LOG_PAGE_MAX_SIZE];
+  guchar page[LOG_PAGE_MAX_SIZE];
+  gsize supported_length = 0;
+  gsize length;
+  GError *local_error = NULL;
+  gboolean ret = FALSE;
+  gint fd;
+  guint n;
+
+  device_file = g_udev_device_get_device_file (device->udev_device);
+  fd = open (device_file, O_RDONLY|O_NONBLOCK);
+  if (fd == -1)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening device file %s: %m", device_file);
+      goto out;
+    }
+
+  /* SPC-4: 7.3.18 Supported Log Pages log page */
+  if (!udisks_scsi_log_sense_sync (fd, -1, LOG_PAGE_SUPPORTED, supported, sizeof (supported),
+                                   &supported_length, &local_error))
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+        {
+          g_propagate_prefixed_error (error, local_error, "Error reading supported log pages of %s: ", device_file);
+          goto out;
+        }
+      /* no log pages at all, typically a virtual disk */
+      udisks_debug ("No log pages on %s: %s", device_file, local_error->message);
+      g_clear_error (&local_error);
+      supported_length = 0;
+    }
+
+  for (n = 0; n < G_N_ELEMENTS (wanted_pages); n++)
+    {
+      if (supported_length < 4 || memchr (supported + 4, wanted_pages[n], supported_length - 4) == NULL)
+        continue;
+
+      if (!udisks_scsi_log_sense_sync (fd, -1, wanted_pages[n], page, sizeof (page), &length, &local_error))
+        {
+          /* don't let a single broken page hide all the others */
+          udisks_warning ("Error reading log page 0x%02x of %s: %s",
+                          (guint) wanted_pages[n], device_file, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+      parse_log_page (health, page, length);
+    }
+
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  return ret;
+}
+
+/**
+ * udisks_linux_drive_scsi_refresh_smart_sync:
+ * @drive: The #UDisksLinuxDriveScsi to refresh.
+ * @nowakeup: If %TRUE, will not wake up the disk if suspended.
+ * @simulate_path: If not %NULL, the path of a file with recorded log pages to use.
+ * @cancellable: A #GCancellable or %NULL.
+ * @error: Return location for error.
+ *
+ * Synchronously reads the health related log pages from @drive. The
+ * calling thread is blocked until the data has been obtained.
+ *
+ * If @nowakeup is %TRUE and the disk is runtime suspended this fails
+ * with %UDISKS_ERROR_WOULD_WAKEUP.
+ *
+ * If @simulate_path is given, the file must contain LOG SENSE
+ * responses one after another and the drive is not accessed at all.
+ *
+ * This may only be called if @drive has been associated with a
+ * #UDisksLinuxDriveObject instance.
+ *
+ * This method may be called from any thread.
+ *
+ * Returns: %TRUE if the operation succeeded, %FALSE if @error is set.
+ */
+gboolean
+udisks_linux_drive_scsi_refresh_smart_sync (UDisksLinuxDriveScsi  *drive,
+                                            gboolean               nowakeup,
+                                            const gchar           *simulate_path,
+                                            GCancellable          *cancellable,
+                                            GError               **error)
+{
+  UDisksLinuxDriveObject *object;
+  UDisksLinuxDevice *device = NULL;
+  ScsiHealth health;
+  gchar *blob = NULL;
+  gsize blob_length;
+  gboolean ret = FALSE;
+
+  object = udisks_daemon_util_dup_object (drive, error);
+  if (object == NULL)
+    goto out;
+
+  device = udisks_linux_drive_object_get_device (object, TRUE /* get_hw */);
+  g_assert (device != NULL);
+
+  /* TODO: use cancellable */
+
+  memset (&health, 0, sizeof (health));
+  if (simulate_path != NULL)
+    {
+      if (!g_file_get_contents (simulate_path, &blob, &blob_length, error))
+        goto out;
+      if (!parse_log_blob (&health, (const guchar *) blob, blob_length, error))
+        goto out;
+    }
+  else
+    {
+      /* don't wake up disk unless specically asked to */
+      if (nowakeup && is_runtime_suspended (device))
+        {
+          g_set_error (error,
+                       UDISKS_ERROR,
+                       UDISKS_ERROR_WOULD_WAKEUP,
+                       "Disk is suspended and the nowakeup option was passed");
+          goto out;
+        }
+
+      if (!read_log_pages (&health, device, error))
+        goto out;
+    }
+
+  G_LOCK (object_lock);
+  drive->smart_updated = time (NULL);
+  drive->smart_health = health;
+  G_UNLOCK (object_lock);
+
+  update_smart (drive);
+
+  ret = TRUE;
+
+ out:
+  g_free (blob);
+  g_clear_object (&device);
+  g_clear_object (&object);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+handle_smart_update (UDisksDriveScsi       *_drive,
+                     GDBusMethodInvocation *invocation,
+                     GVariant              *options)
+{
+  UDisksLinuxDriveScsi *drive = UDISKS_LINUX_DRIVE_SCSI (_drive);
+  UDisksLinuxDriveObject *object;
+  UDisksLinuxBlockObject *block_object = NULL;
+  UDisksDaemon *daemon;
+  gboolean nowakeup = FALSE;
+  const gchar *scsi_log_blob = NULL;
+  GError *error;
+  const gchar *message;
+  const gchar *action_id;
+
+  error = NULL;
+  object = udisks_daemon_util_dup_object (drive, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_drive_object_get_daemon (object);
+  block_object = udisks_linux_drive_object_get_block (object, TRUE);
+  if (block_object == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             UDISKS_ERROR,
+                                             UDISKS_ERROR_FAILED,
+                                             "Unable to find physical block device for drive");
+      goto out;
+    }
+
+  g_variant_lookup (options, "nowakeup", "b", &nowakeup);
+  g_variant_lookup (options, "scsi_log_blob", "s", &scsi_log_blob);
+
+  /* the SMART actions are not specific to ATA despite their names */
+  message = N_("Authentication is required to update SMART data from $(drive)");
+  action_id = "org.freedesktop.udisks2.ata-smart-update";
+  if (scsi_log_blob != NULL)
+    {
+      message = N_("Authentication is required to set SMART data from a blob on $(drive)");
+      action_id = "org.freedesktop.udisks2.ata-smart-simulate";
+    }
+
+  /* Check that the user is authorized */
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    UDISKS_OBJECT (block_object),
+                                                    action_id,
+                                                    options,
+                                                    message,
+                                                    invocation))
+    goto out;
+
+  error = NULL;
+  if (!udisks_linux_drive_scsi_refresh_smart_sync (drive,
+                                                   nowakeup,
+                                                   scsi_log_blob,
+                                                   NULL, /* cancellable */
+                                                   &error))
+    {
+      udisks_debug ("Error reading SCSI log pages for %s: %s (%s, %d)",
+                    g_dbus_object_get_object_path (G_DBUS_OBJECT (object)),
+                    error->message, g_quark_to_string (error->domain), error->code);
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  udisks_drive_scsi_complete_smart_update (UDISKS_DRIVE_SCSI (drive), invocation);
+
+ out:
+  g_clear_object (&block_object);
+  g_clear_object (&object);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+drive_scsi_iface_init (UDisksDriveScsiIface *iface)
+{
+  iface->handle_smart_update = handle_smart_update;
+}
@@ -34,6 +34,10 @@
 #include <sys/acl.h>
 #endif
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <blockdev/fs.h>
 #include <blockdev/utils.h>
 
@@ -50,6 +54,7 @@
 #include "udisksmount.h"
 #include "udiskslinuxdevice.h"
 #include "udiskssimplejob.h"
+#include "udisksthreadedjob.h"
 
 /**
  * SECTION:udiskslinuxfilesystem
@@ -1983,10 +1988,432 @@ handle_set_label (UDisksFilesystem      *filesystem,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* default size of the range passed to a single FITRIM ioctl */
+#define TRIM_DEFAULT_RANGE_SIZE (G_GUINT64_CONSTANT (4) * 1024 * 1024 * 1024)
+
+/* Drives (or devices, for filesystems not backed by a drive) that
+ * currently have a trim job running. Only one filesystem per drive is
+ * trimmed at a time.
+ */
+G_LOCK_DEFINE_STATIC (trim_lock);
+static GCond trim_cond;
+static GHashTable *trim_busy_drives = NULL;
+
+typedef struct
+{
+  gchar   *mount_point;
+  gchar   *drive_key;
+  guint64  size;
+  guint64  range_size;
+  guint64  minimum_extent;
+  guint64  trimmed;
+} TrimData;
+
+static void
+trim_data_free (TrimData *data)
+{
+  g_free (data->mount_point);
+  g_free (data->drive_key);
+  g_free (data);
+}
+
+static gboolean
+trim_acquire_drive (const gchar   *drive_key,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  gboolean ret = FALSE;
+
+  G_LOCK (trim_lock);
+  if (trim_busy_drives == NULL)
+    trim_busy_drives = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  while (g_hash_table_contains (trim_busy_drives, drive_key))
+    {
+      /* wake up now and then to check for cancellation */
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+      g_cond_wait_until (&trim_cond, &G_LOCK_NAME (trim_lock),
+                         g_get_monotonic_time () + G_TIME_SPAN_SECOND);
+    }
+  g_hash_table_add (trim_busy_drives, g_strdup (drive_key));
+  ret = TRUE;
+
+ out:
+  G_UNLOCK (trim_lock);
+  return ret;
+}
+
+static void
+trim_release_drive (const gchar *drive_key)
+{
+  G_LOCK (trim_lock);
+  g_hash_table_remove (trim_busy_drives, drive_key);
+  g_cond_broadcast (&trim_cond);
+  G_UNLOCK (trim_lock);
+}
+
+/* runs in a dedicated thread */
+static gboolean
+trim_job_func (UDisksThreadedJob  *job,
+               GCancellable       *cancellable,
+               gpointer            user_data,
+               GError            **error)
+{
+  TrimData *data = user_data;
+  gboolean ret = FALSE;
+  guint64 start;
+  gint64 time_started;
+  gint fd = -1;
+
+  if (!trim_acquire_drive (data->drive_key, cancellable, error))
+    return FALSE;
+
+  fd = open (data->mount_point, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening %s: %m", data->mount_point);
+      goto out;
+    }
+
+  udisks_job_set_bytes (UDISKS_JOB (job), data->size);
+  udisks_job_set_progress_valid (UDISKS_JOB (job), TRUE);
+  time_started = g_get_monotonic_time ();
+
+  /* Trim in bounded ranges so a single ioctl never keeps the device
+   * busy for long and the job can be cancelled in between. The ranges
+   * are in the filesystem's address space which is only roughly the size
+   * of the device: the last range is open-ended for filesystems addressing
+   * past it (btrfs) and smaller filesystems (ext4, xfs) reject ranges
+   * starting past their end with EINVAL.
+   */
+  for (start = 0; start < data->size; start += data->range_size)
+    {
+      struct fstrim_range range;
+      gboolean last;
+      guint64 end;
+      gint64 elapsed;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      last = (data->size - start <= data->range_size);
+      end = last ? data->size : start + data->range_size;
+
+      memset (&range, 0, sizeof (range));
+      range.start = start;
+      range.len = last ? G_MAXUINT64 : data->range_size;
+      range.minlen = data->minimum_extent;
+      if (ioctl (fd, FITRIM, &range) != 0)
+        {
+          if (errno == EINVAL && start > 0)
+            break; /* past the end of the filesystem */
+          if (errno == EOPNOTSUPP || errno == ENOTTY)
+            g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_NOT_SUPPORTED,
+                         "Filesystem mounted at %s does not support trimming", data->mount_point);
+          else
+            g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                         "Error trimming filesystem mounted at %s: %m", data->mount_point);
+          goto out;
+        }
+      /* the kernel reports the number of bytes trimmed in len */
+      data->trimmed += range.len;
+
+      udisks_job_set_progress (UDISKS_JOB (job),
+                               ((gdouble) end) / data->size);
+      elapsed = g_get_monotonic_time () - time_started;
+      if (elapsed > 0)
+        udisks_job_set_rate (UDISKS_JOB (job),
+                             end * G_USEC_PER_SEC / elapsed);
+      if (last)
+        break;
+    }
+
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  trim_release_drive (data->drive_key);
+  return ret;
+}
+
+/* Returns the object path of the drive backing @object. Stacked devices (dm-crypt,
+ * LVM, MD RAID) have no drive of their own so the slaves are walked down to the
+ * first one that has - if none has, the device file of @object is returned.
+ */
+static gchar *
+trim_dup_drive_key (UDisksDaemon *daemon,
+                    UDisksObject *object,
+                    guint         depth)
+{
+  UDisksBlock *block;
+  UDisksLinuxDevice *device;
+  const gchar *drive;
+  gchar **slaves;
+  gchar *ret = NULL;
+  guint n;
+
+  block = udisks_object_peek_block (object);
+  if (block == NULL)
+    return NULL;
+
+  drive = udisks_block_get_drive (block);
+  if (g_strcmp0 (drive, "/") != 0)
+    return g_strdup (drive);
+
+  /* dm and md devices are never stacked very deep, this just guards against loops */
+  device = udisks_linux_block_object_get_device (UDISKS_LINUX_BLOCK_OBJECT (object));
+  if (device != NULL && depth < 8)
+    {
+      slaves = udisks_daemon_util_resolve_links (g_udev_device_get_sysfs_path (device->udev_device), "slaves");
+      for (n = 0; slaves[n] != NULL && ret == NULL; n++)
+        {
+          UDisksObject *slave_object;
+
+          slave_object = udisks_daemon_find_block_by_sysfs_path (daemon, slaves[n]);
+          if (slave_object == NULL)
+            continue;
+          ret = trim_dup_drive_key (daemon, slave_object, depth + 1);
+          g_object_unref (slave_object);
+        }
+      g_strfreev (slaves);
+    }
+  g_clear_object (&device);
+
+  if (ret == NULL && depth == 0)
+    ret = g_strdup (udisks_block_get_device (block));
+  return ret;
+}
+
+/* Returns a new TrimData for the filesystem on @object or %NULL if it isn't mounted. */
+static TrimData *
+trim_data_new (UDisksObject *object,
+               GVariant     *options)
+{
+  UDisksBlock *block;
+  UDisksFilesystem *filesystem;
+  const gchar *const *mount_points;
+  TrimData *data;
+
+  block = udisks_object_peek_block (object);
+  filesystem = udisks_object_peek_filesystem (object);
+  if (block == NULL || filesystem == NULL)
+    return NULL;
+
+  mount_points = udisks_filesystem_get_mount_points (filesystem);
+  if (mount_points == NULL || mount_points[0] == NULL)
+    return NULL;
+
+  data = g_new0 (TrimData, 1);
+  data->mount_point = g_strdup (mount_points[0]);
+  data->drive_key = trim_dup_drive_key (udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object)),
+                                        object, 0);
+  data->size = udisks_block_get_size (block);
+  data->range_size = TRIM_DEFAULT_RANGE_SIZE;
+  if (options != NULL)
+    {
+      g_variant_lookup (options, "range-size", "t", &data->range_size);
+      g_variant_lookup (options, "minimum-extent", "t", &data->minimum_extent);
+    }
+  if (data->range_size == 0)
+    data->range_size = TRIM_DEFAULT_RANGE_SIZE;
+
+  return data;
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+handle_trim (UDisksFilesystem      *filesystem,
+             GDBusMethodInvocation *invocation,
+             GVariant              *options)
+{
+  UDisksBlock *block;
+  UDisksObject *object;
+  UDisksDaemon *daemon;
+  const gchar *action_id;
+  const gchar *message;
+  TrimData *data = NULL;
+  uid_t caller_uid;
+  gid_t caller_gid;
+  GError *error = NULL;
+
+  object = udisks_daemon_util_dup_object (filesystem, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
+  block = udisks_object_peek_block (object);
+
+  if (!udisks_daemon_util_get_caller_uid_sync (daemon,
+                                               invocation,
+                                               NULL /* GCancellable */,
+                                               &caller_uid,
+                                               &caller_gid,
+                                               NULL,
+                                               &error))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  action_id = "org.freedesktop.udisks2.modify-device";
+  /* Translators: Shown in authentication dialog when the user
+   * requests trimming a filesystem.
+   *
+   * Do not translate $(drive), it's a placeholder and
+   * will be replaced by the name of the drive/device in question
+   */
+  message = N_("Authentication is required to trim the filesystem on $(drive)");
+  if (!udisks_daemon_util_setup_by_user (daemon, object, caller_uid))
+    {
+      if (udisks_block_get_hint_system (block))
+        {
+          action_id = "org.freedesktop.udisks2.modify-device-system";
+        }
+      else if (!udisks_daemon_util_on_user_seat (daemon, UDISKS_OBJECT (object), caller_uid))
+        {
+          action_id = "org.freedesktop.udisks2.modify-device-other-seat";
+        }
+    }
+
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    object,
+                                                    action_id,
+                                                    options,
+                                                    message,
+                                                    invocation))
+    goto out;
+
+  data = trim_data_new (object, options);
+  if (data == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             UDISKS_ERROR,
+                                             UDISKS_ERROR_NOT_MOUNTED,
+                                             "Filesystem on %s is not mounted",
+                                             udisks_block_get_device (block));
+      goto out;
+    }
+
+  if (!udisks_daemon_launch_threaded_job_sync (daemon,
+                                               object,
+                                               "filesystem-trim",
+                                               caller_uid,
+                                               trim_job_func,
+                                               data,
+                                               NULL, /* user_data_free_func */
+                                               NULL, /* cancellable */
+                                               &error))
+    {
+      g_prefix_error (&error, "Error trimming filesystem on %s: ", udisks_block_get_device (block));
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  udisks_filesystem_complete_trim (filesystem, invocation, data->trimmed);
+
+ out:
+  if (data != NULL)
+    trim_data_free (data);
+  g_clear_object (&object);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* Checks whether the device backing @object accepts discard requests. */
+static gboolean
+supports_discard (UDisksObject *object)
+{
+  UDisksLinuxDevice *device;
+  GUdevDevice *udev_device;
+  gboolean ret = FALSE;
+
+  device = udisks_linux_block_object_get_device (UDISKS_LINUX_BLOCK_OBJECT (object));
+  if (device == NULL)
+    return FALSE;
+
+  /* partitions don't have queue/ attributes, use the ones of the disk */
+  if (g_strcmp0 (g_udev_device_get_devtype (device->udev_device), "partition") == 0)
+    udev_device = g_udev_device_get_parent (device->udev_device);
+  else
+    udev_device = g_object_ref (device->udev_device);
+
+  if (udev_device != NULL)
+    {
+      ret = g_udev_device_get_sysfs_attr_as_uint64 (udev_device, "queue/discard_max_bytes") > 0;
+      g_object_unref (udev_device);
+    }
+  g_object_unref (device);
+  return ret;
+}
+
+static void
+on_trim_job_completed (UDisksJob   *job,
+                       gboolean     success,
+                       const gchar *message,
+                       gpointer     user_data)
+{
+  gchar *mount_point = user_data;
+
+  if (!success)
+    udisks_warning ("Scheduled trim of %s failed: %s", mount_point, message);
+}
+
+/**
+ * udisks_linux_filesystem_trim_all:
+ * @daemon: A #UDisksDaemon.
+ *
+ * Starts a <literal>filesystem-trim</literal> job for every mounted
+ * filesystem on a device that supports discard requests. The jobs
+ * run in the background; filesystems on the same drive are trimmed
+ * one after another while different drives are trimmed in parallel.
+ */
+void
+udisks_linux_filesystem_trim_all (UDisksDaemon *daemon)
+{
+  GList *objects, *l;
+
+  objects = udisks_daemon_get_objects (daemon);
+  for (l = objects; l != NULL; l = l->next)
+    {
+      UDisksObject *object = UDISKS_OBJECT (l->data);
+      UDisksBaseJob *job;
+      TrimData *data;
+
+      if (!UDISKS_IS_LINUX_BLOCK_OBJECT (object) || !supports_discard (object))
+        continue;
+
+      data = trim_data_new (object, NULL);
+      if (data == NULL)
+        continue;
+
+      udisks_info ("Scheduling trim of %s", data->mount_point);
+      job = udisks_daemon_launch_threaded_job (daemon,
+                                               object,
+                                               "filesystem-trim",
+                                               0,
+                                               trim_job_func,
+                                               data,
+                                               (GDestroyNotify) trim_data_free,
+                                               NULL /* cancellable */);
+      g_signal_connect_data (job, "completed", G_CALLBACK (on_trim_job_completed),
+                             g_strdup (data->mount_point), (GClosureNotify) g_free, 0);
+      udisks_threaded_job_start (UDISKS_THREADED_JOB (job));
+    }
+  g_list_free_full (objects, g_object_unref);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 filesystem_iface_init (UDisksFilesystemIface *iface)
 {
   iface->handle_mount     = handle_mount;
   iface->handle_unmount   = handle_unmount;
   iface->handle_set_label = handle_set_label;
+  iface->handle_trim      = handle_trim;
 }
@@ -33,6 +33,7 @@ GType             udisks_linux_filesystem_get_type (void) G_GNUC_CONST;
 UDisksFilesystem *udisks_linux_filesystem_new      (void);
 void              udisks_linux_filesystem_update   (UDisksLinuxFilesystem  *filesystem,
                                                     UDisksLinuxBlockObject *object);
+void              udisks_linux_filesystem_trim_all (UDisksDaemon           *daemon);
 
 G_END_DECLS
 
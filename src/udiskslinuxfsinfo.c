@@ -70,8 +70,10 @@ const FSInfo _fs_info[] =
       NULL,
       TRUE,  /* supports_online_label_rename */
       TRUE,  /* supports_owners */
-      "mkfs.ext2 -F -L $LABEL $DEVICE",
-      "mkfs.ext2 -n -F -L $LABEL $DEVICE",
+      "mkfs.ext2 -F -L $LABEL $OPTIONS $DEVICE",
+      "mkfs.ext2 -n -F -L $LABEL $OPTIONS $DEVICE",
+      "-E nodiscard", /* option_no_discard */
+      "-E stride=$STRIDE,stripe_width=$STRIPE_WIDTH", /* option_stripe */
     },
     {
       FS_EXT3,
@@ -79,8 +81,10 @@ const FSInfo _fs_info[] =
       NULL,
       TRUE,  /* supports_online_label_rename */
       TRUE,  /* supports_owners */
-      "mkfs.ext3 -F -L $LABEL $DEVICE",
-      "mkfs.ext3 -n -F -L $LABEL $DEVICE",
+      "mkfs.ext3 -F -L $LABEL $OPTIONS $DEVICE",
+      "mkfs.ext3 -n -F -L $LABEL $OPTIONS $DEVICE",
+      "-E nodiscard", /* option_no_discard */
+      "-E stride=$STRIDE,stripe_width=$STRIPE_WIDTH", /* option_stripe */
     },
     {
       FS_EXT4,
@@ -88,8 +92,10 @@ const FSInfo _fs_info[] =
       NULL,
       TRUE,  /* supports_online_label_rename */
       TRUE,  /* supports_owners */
-      "mkfs.ext4 -F -L $LABEL $DEVICE",
-      "mkfs.ext4 -n -F -L $LABEL $DEVICE",
+      "mkfs.ext4 -F -L $LABEL $OPTIONS $DEVICE",
+      "mkfs.ext4 -n -F -L $LABEL $OPTIONS $DEVICE",
+      "-E nodiscard", /* option_no_discard */
+      "-E stride=$STRIDE,stripe_width=$STRIPE_WIDTH", /* option_stripe */
     },
     {
       FS_VFAT,
@@ -99,6 +105,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "mkfs.vfat -I -n $LABEL $DEVICE",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_NTFS,
@@ -108,6 +116,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "mkntfs -f -F -L $LABEL $DEVICE",
       "mkntfs -n -f -F -L $LABEL $DEVICE",
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_EXFAT,
@@ -117,6 +127,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "mkexfatfs -n $LABEL $DEVICE",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_XFS,
@@ -124,8 +136,10 @@ const FSInfo _fs_info[] =
       "xfs_admin -L -- $DEVICE",
       FALSE, /* supports_online_label_rename */
       TRUE,  /* supports_owners */
-      "mkfs.xfs -f -L $LABEL $DEVICE",
-      "mkfs.xfs -N -f -L $LABEL $DEVICE"
+      "mkfs.xfs -f -L $LABEL $OPTIONS $DEVICE",
+      "mkfs.xfs -N -f -L $LABEL $OPTIONS $DEVICE",
+      "-K", /* option_no_discard */
+      "-d su=$STRIPE_UNIT,sw=$STRIPE_COUNT", /* option_stripe */
     },
     {
       FS_REISERFS,
@@ -135,6 +149,8 @@ const FSInfo _fs_info[] =
       TRUE,  /* supports_owners */
       "mkfs.reiserfs -q -l $LABEL $DEVICE",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_NILFS2,
@@ -142,8 +158,10 @@ const FSInfo _fs_info[] =
       NULL,
       FALSE, /* supports_online_label_rename */
       TRUE,  /* supports_owners */
-      "mkfs.nilfs2 -L $LABEL $DEVICE",
+      "mkfs.nilfs2 -L $LABEL $OPTIONS $DEVICE",
       NULL,
+      "-K", /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_BTRFS,
@@ -151,8 +169,10 @@ const FSInfo _fs_info[] =
       NULL,
       FALSE, /* supports_online_label_rename */
       TRUE,  /* supports_owners */
-      "mkfs.btrfs -L $LABEL $DEVICE",
+      "mkfs.btrfs -L $LABEL $OPTIONS $DEVICE",
       NULL,
+      "--nodiscard", /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_MINIX,
@@ -162,6 +182,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "mkfs.minix $DEVICE",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_UDF,
@@ -171,6 +193,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "mkudffs --vid $LABEL $DEVICE",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       FS_F2FS,
@@ -178,8 +202,10 @@ const FSInfo _fs_info[] =
       NULL,
       FALSE, /* supports_online_label_rename */
       TRUE,  /* supports_owners */
-      "mkfs.f2fs -l $LABEL $DEVICE",
+      "mkfs.f2fs -l $LABEL $OPTIONS $DEVICE",
       NULL,
+      "-t 0", /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     /* swap space */
     {
@@ -190,6 +216,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "mkswap -L $LABEL $DEVICE",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     /* partition tables */
     {
@@ -200,6 +228,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "parted --script $DEVICE mktable msdos",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     {
       PT_GPT,
@@ -209,6 +239,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "parted --script $DEVICE mktable gpt",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
     /* empty */
     {
@@ -219,6 +251,8 @@ const FSInfo _fs_info[] =
       FALSE, /* supports_owners */
       "wipefs --all $DEVICE",
       NULL,
+      NULL,  /* option_no_discard */
+      NULL,  /* option_stripe */
     },
   };
 
@@ -33,8 +33,10 @@ typedef struct
   /* TODO: use flags or bitfields */
   gboolean     supports_online_label_rename;
   gboolean     supports_owners;
-  const gchar *command_create_fs;  /* should have $DEVICE and $LABEL */
-  const gchar *command_validate_create_fs;  /* should have $DEVICE and $LABEL */
+  const gchar *command_create_fs;  /* should have $DEVICE and $LABEL, may have $OPTIONS */
+  const gchar *command_validate_create_fs;  /* should have $DEVICE and $LABEL, may have $OPTIONS */
+  const gchar *option_no_discard;  /* mkfs option substituted for $OPTIONS to skip discarding the device */
+  const gchar *option_stripe;  /* mkfs option for RAID geometry, may have $STRIDE, $STRIPE_WIDTH (in 4 KiB blocks, -b 4096 is passed along), $STRIPE_UNIT (in bytes) and $STRIPE_COUNT */
 } FSInfo;
 
 const FSInfo  *get_fs_info (const gchar *fstype);
@@ -43,6 +43,7 @@
 #include "udisksdaemonutil.h"
 #include "udisksstate.h"
 #include "udiskslinuxblockobject.h"
+#include "udiskslinuxblock.h"
 #include "udiskslinuxdevice.h"
 #include "udisksmodulemanager.h"
 #include "udiskslinuxfsinfo.h"
@@ -832,6 +833,349 @@ handle_mdraid_create (UDisksManager         *_object,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Default for the max-concurrent option of FormatMany() */
+#define FORMAT_MANY_DEFAULT_MAX_CONCURRENT 8
+
+typedef struct
+{
+  GDBusMethodInvocation *invocation;
+  UDisksBlock           *block;
+  gchar                 *object_path;
+  const gchar           *type;
+  GVariant              *options;
+  uid_t                  caller_uid;
+  gid_t                  caller_gid;
+  UDisksBaseJob         *job;
+  gchar                 *job_path;
+  gboolean               success;
+  gchar                 *message;
+} FormatManyItem;
+
+static void
+format_many_item_free (FormatManyItem *item)
+{
+  g_clear_object (&item->block);
+  g_free (item->object_path);
+  if (item->options != NULL)
+    g_variant_unref (item->options);
+  g_free (item->job_path);
+  g_free (item->message);
+  g_free (item);
+}
+
+/* runs in a thread from the pool created in handle_format_many() */
+static void
+format_many_worker (gpointer data,
+                    gpointer user_data)
+{
+  FormatManyItem *item = data;
+  GError *error = NULL;
+
+  item->success = udisks_linux_block_format_sync (item->block,
+                                                  item->invocation,
+                                                  item->type,
+                                                  item->options,
+                                                  item->caller_uid,
+                                                  item->caller_gid,
+                                                  &error);
+  if (!item->success)
+    {
+      udisks_warning ("Error formatting %s: %s", item->object_path, error->message);
+      item->message = g_strdup (error->message);
+      g_clear_error (&error);
+    }
+
+  udisks_simple_job_complete (UDISKS_SIMPLE_JOB (item->job),
+                              item->success,
+                              item->message != NULL ? item->message : "");
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+handle_format_many (UDisksManager         *_object,
+                    GDBusMethodInvocation *invocation,
+                    GVariant              *arg_devices,
+                    GVariant              *arg_options)
+{
+  UDisksLinuxManager *manager = UDISKS_LINUX_MANAGER (_object);
+  GPtrArray *items = NULL;
+  GHashTable *checked_actions = NULL;
+  GThreadPool *pool = NULL;
+  GVariantBuilder builder;
+  GVariantIter iter;
+  const gchar *object_path;
+  const gchar *type;
+  GVariant *device_options;
+  gboolean needs_config_auth = FALSE;
+  guint max_concurrent = FORMAT_MANY_DEFAULT_MAX_CONCURRENT;
+  uid_t caller_uid;
+  gid_t caller_gid;
+  GError *error = NULL;
+  guint n;
+
+  if (!udisks_daemon_util_get_caller_uid_sync (manager->daemon,
+                                               invocation,
+                                               NULL /* GCancellable */,
+                                               &caller_uid,
+                                               &caller_gid,
+                                               NULL,
+                                               &error))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  g_variant_lookup (arg_options, "max-concurrent", "u", &max_concurrent);
+  if (max_concurrent == 0)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "The max-concurrent option must be greater than zero");
+      goto out;
+    }
+
+  items = g_ptr_array_new_with_free_func ((GDestroyNotify) format_many_item_free);
+  checked_actions = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* First validate every device and check authorization - each distinct
+   * polkit action is only checked once for the whole batch
+   */
+  g_variant_iter_init (&iter, arg_devices);
+  while (g_variant_iter_next (&iter, "(&o&s@a{sv})", &object_path, &type, &device_options))
+    {
+      FormatManyItem *item;
+      UDisksObject *object;
+      const gchar *action_id;
+      const gchar *message;
+      gboolean teardown_flag = FALSE;
+
+      item = g_new0 (FormatManyItem, 1);
+      item->invocation = invocation;
+      item->object_path = g_strdup (object_path);
+      item->type = type;
+      item->options = device_options;
+      item->caller_uid = caller_uid;
+      item->caller_gid = caller_gid;
+      g_ptr_array_add (items, item);
+
+      for (n = 0; n < items->len - 1; n++)
+        {
+          if (g_strcmp0 (((FormatManyItem *) items->pdata[n])->object_path, object_path) == 0)
+            {
+              g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                     "Block device %s is listed more than once", object_path);
+              goto out;
+            }
+        }
+
+      object = udisks_daemon_find_object (manager->daemon, object_path);
+      if (object == NULL || (item->block = udisks_object_get_block (object)) == NULL)
+        {
+          g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                 "Invalid object path %s", object_path);
+          g_clear_object (&object);
+          goto out;
+        }
+
+      if (!udisks_linux_block_format_check_sync (item->block, type, device_options, caller_uid,
+                                                 &action_id, &message, &error))
+        {
+          g_prefix_error (&error, "%s: ", object_path);
+          g_dbus_method_invocation_take_error (invocation, error);
+          g_object_unref (object);
+          goto out;
+        }
+
+      if (!g_hash_table_contains (checked_actions, action_id))
+        {
+          if (!udisks_daemon_util_check_authorization_sync (manager->daemon,
+                                                            object,
+                                                            action_id,
+                                                            arg_options,
+                                                            message,
+                                                            invocation))
+            {
+              g_object_unref (object);
+              goto out;
+            }
+          g_hash_table_add (checked_actions, (gpointer) action_id);
+        }
+      g_object_unref (object);
+
+      g_variant_lookup (device_options, "tear-down", "b", &teardown_flag);
+      if (teardown_flag || g_variant_lookup (device_options, "config-items", "@a(sa{sv})", NULL))
+        needs_config_auth = TRUE;
+    }
+
+  if (needs_config_auth &&
+      !udisks_daemon_util_check_authorization_sync (manager->daemon,
+                                                    NULL,
+                                                    "org.freedesktop.udisks2.modify-system-configuration",
+                                                    arg_options,
+                                                    N_("Authentication is required to modify the system configuration"),
+                                                    invocation))
+    goto out;
+
+  /* Then run the per-device pipelines concurrently */
+  pool = g_thread_pool_new (format_many_worker,
+                            NULL,
+                            (gint) MIN (max_concurrent, MAX (items->len, 1)),
+                            FALSE, /* exclusive */
+                            NULL);
+  for (n = 0; n < items->len; n++)
+    {
+      FormatManyItem *item = items->pdata[n];
+      UDisksObject *object;
+
+      object = UDISKS_OBJECT (g_dbus_interface_get_object (G_DBUS_INTERFACE (item->block)));
+      item->job = udisks_daemon_launch_simple_job (manager->daemon,
+                                                   object,
+                                                   "format-device",
+                                                   caller_uid,
+                                                   NULL);
+      item->job_path = g_strdup (g_dbus_object_get_object_path (g_dbus_interface_get_object (G_DBUS_INTERFACE (item->job))));
+      g_thread_pool_push (pool, item, NULL);
+    }
+  /* wait for all devices to finish */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(oobs)"));
+  for (n = 0; n < items->len; n++)
+    {
+      FormatManyItem *item = items->pdata[n];
+      g_variant_builder_add (&builder, "(oobs)",
+                             item->object_path,
+                             item->job_path,
+                             item->success,
+                             item->message != NULL ? item->message : "");
+    }
+  udisks_manager_complete_format_many (_object, invocation, g_variant_builder_end (&builder));
+
+ out:
+  if (checked_actions != NULL)
+    g_hash_table_unref (checked_actions);
+  if (items != NULL)
+    g_ptr_array_unref (items);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+handle_change_configuration_items (UDisksManager         *_object,
+                                   GDBusMethodInvocation *invocation,
+                                   GVariant              *arg_changes,
+                                   GVariant              *arg_options)
+{
+  UDisksLinuxManager *manager = UDISKS_LINUX_MANAGER (_object);
+  UDisksConfigurationEdit *edit = NULL;
+  GVariantIter iter;
+  const gchar *object_path;
+  const gchar *action;
+  GVariant *items;
+  GError *error = NULL;
+  guint n = 0;
+
+  if (!udisks_daemon_util_check_authorization_sync (manager->daemon,
+                                                    NULL,
+                                                    "org.freedesktop.udisks2.modify-system-configuration",
+                                                    arg_options,
+                                                    /* Translators: shown in authentication dialog - do not translate /etc/fstab and /etc/crypttab */
+                                                    N_("Authentication is required to modify the /etc/fstab and /etc/crypttab files"),
+                                                    invocation))
+    goto out;
+
+  /* Apply all changes in memory first so that nothing is written if any of them fails */
+  edit = udisks_configuration_edit_new ();
+  g_variant_iter_init (&iter, arg_changes);
+  while (g_variant_iter_next (&iter, "(&o&s@a(sa{sv}))", &object_path, &action, &items))
+    {
+      UDisksObject *object = NULL;
+      UDisksBlock *block = NULL;
+      GVariant *old_item = NULL;
+      GVariant *new_item = NULL;
+      gsize num_items;
+      gsize num_expected;
+      gboolean applied = FALSE;
+
+      if (g_strcmp0 (action, "add") == 0 || g_strcmp0 (action, "remove") == 0)
+        num_expected = 1;
+      else if (g_strcmp0 (action, "update") == 0)
+        num_expected = 2;
+      else
+        num_expected = 0;
+
+      num_items = g_variant_n_children (items);
+      if (num_expected == 0 || num_items != num_expected)
+        {
+          g_set_error (&error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Invalid action `%s' with %u items", action, (guint) num_items);
+          goto next;
+        }
+
+      if (g_strcmp0 (object_path, "/") != 0)
+        {
+          object = udisks_daemon_find_object (manager->daemon, object_path);
+          if (object == NULL || (block = udisks_object_get_block (object)) == NULL)
+            {
+              g_set_error (&error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Invalid object path %s", object_path);
+              goto next;
+            }
+        }
+      else if (g_strcmp0 (action, "remove") != 0)
+        {
+          g_set_error (&error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "A block device is required to %s configuration items", action);
+          goto next;
+        }
+
+      if (g_strcmp0 (action, "add") == 0)
+        {
+          new_item = g_variant_get_child_value (items, 0);
+        }
+      else
+        {
+          old_item = g_variant_get_child_value (items, 0);
+          if (num_items > 1)
+            new_item = g_variant_get_child_value (items, 1);
+        }
+
+      applied = udisks_configuration_edit_apply (edit, block, old_item, new_item, &error);
+
+    next:
+      if (old_item != NULL)
+        g_variant_unref (old_item);
+      if (new_item != NULL)
+        g_variant_unref (new_item);
+      g_clear_object (&block);
+      g_clear_object (&object);
+      g_variant_unref (items);
+      if (!applied)
+        {
+          g_prefix_error (&error, "Change %u: ", n);
+          g_dbus_method_invocation_take_error (invocation, error);
+          goto out;
+        }
+      n++;
+    }
+
+  if (!udisks_configuration_edit_commit (edit, &error))
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  udisks_manager_complete_change_configuration_items (_object, invocation);
+
+ out:
+  udisks_configuration_edit_free (edit);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 load_modules (UDisksDaemon *daemon)
 {
@@ -874,5 +1218,7 @@ manager_iface_init (UDisksManagerIface *iface)
 {
   iface->handle_loop_setup = handle_loop_setup;
   iface->handle_mdraid_create = handle_mdraid_create;
+  iface->handle_format_many = handle_format_many;
+  iface->handle_change_configuration_items = handle_change_configuration_items;
   iface->handle_enable_modules = handle_enable_modules;
 }
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <mntent.h>
+#include <time.h>
 
 #include <glib/gstdio.h>
 
@@ -45,6 +46,7 @@
 #include "udiskslinuxdevice.h"
 #include "udiskslinuxblock.h"
 #include "udiskssimplejob.h"
+#include "udisksconfigmanager.h"
 
 /**
  * SECTION:udiskslinuxmdraid
@@ -68,6 +70,19 @@ struct _UDisksLinuxMDRaid
   UDisksMDRaidSkeleton parent_instance;
 
   guint polling_timeout;
+  guint polling_interval;
+
+  /* checks of the array, see update_scrub() - only used from the main thread */
+  gboolean scrub_loaded;
+  gboolean scrub_checking;
+  gboolean scrub_scheduled;
+  gboolean scrub_pausing;
+  gboolean scrub_paused;
+  gboolean scrub_throttled;
+  guint64 scrub_running_since;
+  guint64 scrub_elapsed;
+  guint64 scrub_mismatches;
+  guint64 scrub_resume_position;
 };
 
 struct _UDisksLinuxMDRaidClass
@@ -76,7 +91,7 @@ struct _UDisksLinuxMDRaidClass
 };
 
 static void ensure_polling (UDisksLinuxMDRaid  *mdraid,
-                            gboolean            polling_on);
+                            guint               interval);
 
 static void mdraid_iface_init (UDisksMDRaidIface *iface);
 
@@ -90,7 +105,7 @@ udisks_linux_mdraid_finalize (GObject *object)
 {
   UDisksLinuxMDRaid *mdraid = UDISKS_LINUX_MDRAID (object);
 
-  ensure_polling (mdraid, FALSE);
+  ensure_polling (mdraid, 0);
 
   if (G_OBJECT_CLASS (udisks_linux_mdraid_parent_class)->finalize != NULL)
     G_OBJECT_CLASS (udisks_linux_mdraid_parent_class)->finalize (object);
@@ -128,68 +143,435 @@ udisks_linux_mdraid_new (void)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static const gchar *
+read_sysfs_attr (UDisksLinuxDevice *device,
+                 const gchar       *attr,
+                 gchar             *buf,
+                 gsize              buf_size)
+{
+  GError *error = NULL;
+
+  if (!udisks_linux_device_read_sysfs_attr (device, attr, buf, buf_size, &error))
+    {
+      udisks_warning ("Error reading sysfs attr `%s': %s (%s, %d)",
+                      attr, error->message, g_quark_to_string (error->domain), error->code);
+      g_clear_error (&error);
+      return NULL;
+    }
+
+  return buf;
+}
+
+static gint
+read_sysfs_attr_as_int (UDisksLinuxDevice *device,
+                        const gchar       *attr)
+{
+  gchar buf[32];
+
+  if (read_sysfs_attr (device, attr, buf, sizeof (buf)) == NULL)
+    return 0;
+
+  return atoi (buf);
+}
+
+static guint64
+read_sysfs_attr_as_uint64 (UDisksLinuxDevice *device,
+                           const gchar       *attr)
+{
+  gchar buf[32];
+
+  if (read_sysfs_attr (device, attr, buf, sizeof (buf)) == NULL)
+    return 0;
+
+  return atoll (buf);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct {
+  const gchar *asv_key;
+  const gchar *group;
+  const gchar *key;
+  const gchar *attr;
+} VariantKeyfileMapping;
+
+/* All values are of type 'i'. The bitmap chunk size can't simply be
+ * written to sysfs, see apply_bitmap_chunk_size().
+ */
+static const VariantKeyfileMapping mdraid_configuration_mapping[6] = {
+  {"md-stripe-cache-size", "MDRaid", "StripeCacheSize",  "md/stripe_cache_size"},
+  {"md-sync-speed-min",    "MDRaid", "SyncSpeedMin",     "md/sync_speed_min"},
+  {"md-sync-speed-max",    "MDRaid", "SyncSpeedMax",     "md/sync_speed_max"},
+  {"md-group-thread-cnt",  "MDRaid", "GroupThreadCount", "md/group_thread_cnt"},
+  {"md-bitmap-chunk-size", "MDRaid", "BitmapChunkSize",  NULL},
+  /* used by the scrub scheduler, not applied to the array */
+  {"md-scrub-interval",    "MDRaid", "ScrubInterval",    NULL},
+};
+
 static gchar *
-read_sysfs_attr (GUdevDevice *device,
-                 const gchar *attr)
+configuration_get_path (const gchar *uuid)
+{
+  gchar *path = NULL;
+
+  if (uuid == NULL || strlen (uuid) == 0)
+    goto out;
+
+  /* if prefix is specified directories may not exist */
+  if (!g_file_test (PACKAGE_SYSCONF_DIR "/udisks2", G_FILE_TEST_IS_DIR))
+    {
+      if (g_mkdir_with_parents (PACKAGE_SYSCONF_DIR "/udisks2", 0700) != 0)
+        {
+          udisks_critical ("Error creating directory %s: %m", PACKAGE_SYSCONF_DIR "/udisks2");
+        }
+    }
+
+  path = g_strdup_printf (PACKAGE_SYSCONF_DIR "/udisks2/mdraid-%s.conf", uuid);
+
+ out:
+  return path;
+}
+
+/* returns TRUE if configuration changed */
+static gboolean
+update_configuration (UDisksLinuxMDRaid *mdraid,
+                      const gchar       *uuid)
 {
-  gchar *ret = NULL;
+  GKeyFile *key_file = NULL;
+  gboolean ret = FALSE;
   gchar *path = NULL;
   GError *error = NULL;
+  GVariant *value = NULL;
+  GVariantBuilder builder;
+  GVariant *old_value;
+  guint n;
 
-  g_return_val_if_fail (G_UDEV_IS_DEVICE (device), NULL);
+  path = configuration_get_path (uuid);
+  if (path == NULL)
+    goto out;
 
-  path = g_strdup_printf ("%s/%s", g_udev_device_get_sysfs_path (device), attr);
-  if (!g_file_get_contents (path, &ret, NULL /* size */, &error))
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file,
+                                  path,
+                                  G_KEY_FILE_NONE,
+                                  &error))
     {
-      udisks_warning ("Error reading sysfs attr `%s': %s (%s, %d)",
-                      path, error->message, g_quark_to_string (error->domain), error->code);
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          udisks_critical ("Error loading RAID config file: %s (%s, %d)",
+                           error->message, g_quark_to_string (error->domain), error->code);
+        }
       g_clear_error (&error);
       goto out;
     }
 
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  for (n = 0; n < G_N_ELEMENTS (mdraid_configuration_mapping); n++)
+    {
+      const VariantKeyfileMapping *mapping = &mdraid_configuration_mapping[n];
+      gint32 int_value;
+
+      if (!g_key_file_has_key (key_file, mapping->group, mapping->key, NULL))
+        continue;
+
+      int_value = g_key_file_get_integer (key_file, mapping->group, mapping->key, &error);
+      if (error != NULL)
+        {
+          udisks_critical ("Error parsing int32 key %s in group %s in RAID config file %s: %s (%s, %d)",
+                           mapping->key, mapping->group, path,
+                           error->message, g_quark_to_string (error->domain), error->code);
+          g_clear_error (&error);
+        }
+      else
+        {
+          g_variant_builder_add (&builder, "{sv}", mapping->asv_key, g_variant_new_int32 (int_value));
+        }
+    }
+
+  value = g_variant_ref_sink (g_variant_builder_end (&builder));
+
  out:
   g_free (path);
+
+  old_value = udisks_mdraid_get_configuration (UDISKS_MDRAID (mdraid));
+  if (old_value == NULL || value == NULL)
+    ret = old_value != value;
+  else
+    ret = !g_variant_equal (old_value, value);
+  udisks_mdraid_set_configuration (UDISKS_MDRAID (mdraid), value);
+
+  if (key_file != NULL)
+    g_key_file_unref (key_file);
+  if (value != NULL)
+    g_variant_unref (value);
+
   return ret;
 }
 
-static gint
-read_sysfs_attr_as_int (GUdevDevice *device,
-                        const gchar *attr)
+typedef struct
 {
-  gint ret = 0;
-  gchar *str = NULL;
+  UDisksLinuxMDRaidObject *object;
+  UDisksLinuxDevice *raid_device;
+  GVariant *configuration;
+  gchar *uuid;
+} ApplyConfData;
 
-  str = read_sysfs_attr (device, attr);
-  if (str == NULL)
+static void
+apply_conf_data_free (ApplyConfData *data)
+{
+  g_clear_object (&data->object);
+  g_clear_object (&data->raid_device);
+  g_variant_unref (data->configuration);
+  g_free (data->uuid);
+  g_free (data);
+}
+
+/* The kernel only accepts a new chunk size while there is no bitmap
+ * so an existing internal bitmap is removed and added again - this is
+ * what mdadm(8) documents for changing it.
+ */
+static void
+apply_bitmap_chunk_size (ApplyConfData *data,
+                         const gchar   *device_file,
+                         gint32         chunk_size)
+{
+  UDisksDaemon *daemon;
+  gchar location[64];
+  guint64 current_chunk_size;
+  gchar *escaped_device = NULL;
+  gchar *error_message = NULL;
+
+  if (!udisks_linux_device_read_sysfs_attr (data->raid_device, "md/bitmap/location",
+                                            location, sizeof (location), NULL) ||
+      g_strcmp0 (location, "none") == 0)
+    goto out;
+
+  current_chunk_size = read_sysfs_attr_as_uint64 (data->raid_device, "md/bitmap/chunksize");
+  if (current_chunk_size == (guint64) chunk_size)
     goto out;
 
-  ret = atoi (str);
-  g_free (str);
+  if (location[0] != '+' && location[0] != '-')
+    {
+      udisks_warning ("Not changing the bitmap chunk size on %s: only internal bitmaps are supported",
+                      device_file);
+      goto out;
+    }
+
+  daemon = udisks_linux_mdraid_object_get_daemon (data->object);
+  escaped_device = udisks_daemon_util_escape_and_quote (device_file);
+
+  if (!udisks_daemon_launch_spawned_job_sync (daemon,
+                                              UDISKS_OBJECT (data->object),
+                                              "md-raid-set-bitmap", 0,
+                                              NULL, /* GCancellable */
+                                              0,    /* uid_t run_as_uid */
+                                              0,    /* uid_t run_as_euid */
+                                              NULL, /* gint *out_status */
+                                              &error_message,
+                                              NULL, /* input_string */
+                                              "mdadm --grow %s --bitmap=none",
+                                              escaped_device) ||
+      !udisks_daemon_launch_spawned_job_sync (daemon,
+                                              UDISKS_OBJECT (data->object),
+                                              "md-raid-set-bitmap", 0,
+                                              NULL, /* GCancellable */
+                                              0,    /* uid_t run_as_uid */
+                                              0,    /* uid_t run_as_euid */
+                                              NULL, /* gint *out_status */
+                                              &error_message,
+                                              NULL, /* input_string */
+                                              "mdadm --grow %s --bitmap=internal --bitmap-chunk=%d",
+                                              escaped_device, chunk_size / 1024))
+    {
+      udisks_critical ("Error changing the bitmap chunk size on %s: %s",
+                       device_file, error_message);
+      goto out;
+    }
+
+  udisks_notice ("Set bitmap chunk size to %d on %s [%s]",
+                 chunk_size, device_file, data->uuid);
 
  out:
-  return ret;
+  g_free (escaped_device);
+  g_free (error_message);
 }
 
-static guint64
-read_sysfs_attr_as_uint64 (GUdevDevice *device,
-                           const gchar *attr)
+static gboolean
+apply_configuration_done (gpointer user_data)
 {
-  guint64 ret = 0;
-  gchar *str = NULL;
+  ApplyConfData *data = user_data;
+
+  UDisksLinuxDevice *raid_device;
+
+  /* none of the attributes are notified by the kernel, synthesize uevent */
+  raid_device = udisks_linux_mdraid_object_get_device (data->object);
+  if (raid_device != NULL)
+    {
+      udisks_linux_mdraid_object_uevent (data->object, "change", raid_device, FALSE);
+      g_object_unref (raid_device);
+    }
+
+  apply_conf_data_free (data);
+  return FALSE; /* remove source */
+}
+
+static gpointer
+apply_configuration_thread_func (gpointer user_data)
+{
+  ApplyConfData *data = user_data;
+  const gchar *device_file = NULL;
+  GError *error = NULL;
+  guint n;
 
-  str = read_sysfs_attr (device, attr);
-  if (str == NULL)
+  device_file = g_udev_device_get_device_file (data->raid_device->udev_device);
+
+  udisks_notice ("Applying configuration from %s/udisks2/mdraid-%s.conf to %s",
+                 PACKAGE_SYSCONF_DIR, data->uuid, device_file);
+
+  for (n = 0; n < G_N_ELEMENTS (mdraid_configuration_mapping); n++)
+    {
+      const VariantKeyfileMapping *mapping = &mdraid_configuration_mapping[n];
+      gint32 value;
+      gchar buf[32];
+
+      if (!g_variant_lookup (data->configuration, mapping->asv_key, "i", &value))
+        continue;
+
+      if (g_strcmp0 (mapping->asv_key, "md-bitmap-chunk-size") == 0)
+        {
+          apply_bitmap_chunk_size (data, device_file, value);
+          continue;
+        }
+      else if (mapping->attr == NULL)
+        {
+          continue;
+        }
+
+      g_snprintf (buf, sizeof (buf), "%d", value);
+      if (!udisks_linux_device_write_sysfs_attr (data->raid_device, mapping->attr, buf, &error))
+        {
+          udisks_warning ("Error setting %s on %s: %s (%s, %d)",
+                          mapping->key, device_file,
+                          error->message, g_quark_to_string (error->domain), error->code);
+          g_clear_error (&error);
+        }
+      else
+        {
+          udisks_notice ("Set %s to %d on %s [%s]",
+                         mapping->key, value, device_file, data->uuid);
+        }
+    }
+
+  g_idle_add (apply_configuration_done, data);
+  return NULL;
+}
+
+/**
+ * udisks_linux_mdraid_apply_configuration:
+ * @mdraid: A #UDisksLinuxMDRaid.
+ * @raid_device: The #UDisksLinuxDevice for the running array.
+ *
+ * Spawns a thread to apply the #UDisksMDRaid:configuration of
+ * @mdraid to @raid_device, if any. Does not wait for the thread to
+ * terminate.
+ */
+void
+udisks_linux_mdraid_apply_configuration (UDisksLinuxMDRaid *mdraid,
+                                         UDisksLinuxDevice *raid_device)
+{
+  ApplyConfData *data = NULL;
+  GVariant *configuration;
+
+  g_return_if_fail (UDISKS_IS_LINUX_MDRAID (mdraid));
+  g_return_if_fail (UDISKS_IS_LINUX_DEVICE (raid_device));
+
+  /* don't do anything if none of the configuration is set */
+  configuration = udisks_mdraid_get_configuration (UDISKS_MDRAID (mdraid));
+  if (configuration == NULL || g_variant_n_children (configuration) == 0)
     goto out;
 
-  ret = atoll (str);
-  g_free (str);
+  data = g_new0 (ApplyConfData, 1);
+  data->raid_device = g_object_ref (raid_device);
+  data->configuration = g_variant_ref (configuration);
+  data->uuid = udisks_mdraid_dup_uuid (UDISKS_MDRAID (mdraid));
+
+  data->object = udisks_daemon_util_dup_object (mdraid, NULL);
+  if (data->object == NULL)
+    goto out;
+
+  /* changing the bitmap chunk size may take a while */
+  g_thread_new ("apply-conf-thread",
+                apply_configuration_thread_func,
+                data);
+
+  data = NULL; /* don't free data below */
 
  out:
-  return ret;
+  if (data != NULL)
+    apply_conf_data_free (data);
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Updates the sync progress from md/sync_completed and md/sync_speed.
+ *
+ * Changes of md/sync_action are notified by the kernel (see
+ * udiskslinuxmdraidobject.c) but the progress is not so it has to be
+ * sampled while a sync operation is running.
+ */
+static void
+update_sync_progress (UDisksLinuxMDRaid       *mdraid,
+                      UDisksLinuxMDRaidObject *object,
+                      UDisksLinuxDevice       *raid_device)
+{
+  UDisksMDRaid *iface = UDISKS_MDRAID (mdraid);
+  gchar sync_completed_buf[64];
+  const gchar *sync_completed = NULL;
+  gdouble sync_completed_val = 0.0;
+  guint64 sync_rate = 0;
+  guint64 sync_remaining_time = 0;
+  UDisksBaseJob *job = NULL;
+
+  if (raid_device != NULL)
+    sync_completed = read_sysfs_attr (raid_device, "md/sync_completed",
+                                      sync_completed_buf, sizeof (sync_completed_buf));
+
+  if (sync_completed != NULL && g_strcmp0 (sync_completed, "none") != 0)
+    {
+      guint64 completed_sectors = 0;
+      guint64 num_sectors = 1;
+      if (sscanf (sync_completed, "%" G_GUINT64_FORMAT " / %" G_GUINT64_FORMAT,
+                  &completed_sectors, &num_sectors) == 2)
+        {
+          if (num_sectors != 0)
+            sync_completed_val = ((gdouble) completed_sectors) / ((gdouble) num_sectors);
+        }
+
+      /* this is KiB/s (see drivers/md/md.c:sync_speed_show() */
+      sync_rate = read_sysfs_attr_as_uint64 (raid_device, "md/sync_speed") * 1024;
+      if (sync_rate > 0)
+        {
+          guint64 num_bytes_remaining = (num_sectors - completed_sectors) * 512ULL;
+          sync_remaining_time = ((guint64) G_USEC_PER_SEC) * num_bytes_remaining / sync_rate;
+        }
+    }
+
+  /* Update the job's interface */
+  job = udisks_linux_mdraid_object_get_sync_job (object);
+  if (job != NULL)
+    {
+      udisks_job_set_progress (UDISKS_JOB (job), sync_completed_val);
+      udisks_job_set_progress_valid (UDISKS_JOB (job), TRUE);
+      udisks_job_set_rate (UDISKS_JOB (job), sync_rate);
+
+      udisks_job_set_expected_end_time (UDISKS_JOB (job),
+                                        g_get_real_time () + sync_remaining_time);
+    }
+
+  udisks_mdraid_set_sync_completed (iface, sync_completed_val);
+  udisks_mdraid_set_sync_rate (iface, sync_rate);
+  udisks_mdraid_set_sync_remaining_time (iface, sync_remaining_time);
+}
+
 static gboolean
 on_polling_timout (gpointer user_data)
 {
@@ -203,11 +585,11 @@ on_polling_timout (gpointer user_data)
   if (object == NULL)
     goto out;
 
-  /* synthesize uevent */
+  /* only the progress - state changes are handled by the sysfs watches */
   raid_device = udisks_linux_mdraid_object_get_device (object);
   if (raid_device != NULL)
     {
-      udisks_linux_mdraid_object_uevent (object, "change", raid_device, FALSE);
+      update_sync_progress (mdraid, object, raid_device);
       g_object_unref (raid_device);
     }
 
@@ -216,27 +598,306 @@ on_polling_timout (gpointer user_data)
   return TRUE; /* keep timeout around */
 }
 
-static void
-ensure_polling (UDisksLinuxMDRaid  *mdraid,
-                gboolean            polling_on)
-{
-  if (polling_on)
-    {
-      if (mdraid->polling_timeout == 0)
+static void
+ensure_polling (UDisksLinuxMDRaid  *mdraid,
+                guint               interval)
+{
+  if (mdraid->polling_timeout != 0 && interval != mdraid->polling_interval)
+    {
+      g_source_remove (mdraid->polling_timeout);
+      mdraid->polling_timeout = 0;
+    }
+
+  if (interval > 0 && mdraid->polling_timeout == 0)
+    {
+      mdraid->polling_timeout = g_timeout_add_seconds (interval,
+                                                       on_polling_timout,
+                                                       mdraid);
+    }
+  mdraid->polling_interval = interval;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Checks ("scrubs") of the array are tracked no matter who started
+ * them: when md/sync_action changes from "check" to something else,
+ * md/sync_min tells whether the check ran to completion (the kernel
+ * resets it to 0) or was interrupted (it is set to the position the
+ * check got to). The latter is how scheduled checks are paused at the
+ * end of the time window, see udisks_linux_mdraid_scrub_all().
+ */
+
+static gchar *
+scrub_get_persist_path (const gchar *uuid)
+{
+  return g_strdup_printf (PACKAGE_LOCALSTATE_DIR "/lib/udisks2/mdraid-scrub-%s", uuid);
+}
+
+static void
+scrub_update_state (UDisksLinuxMDRaid *mdraid)
+{
+  const gchar *state = "idle";
+
+  if (mdraid->scrub_checking)
+    state = "running";
+  else if (mdraid->scrub_paused)
+    state = "paused";
+  udisks_mdraid_set_scrub_state (UDISKS_MDRAID (mdraid), state);
+}
+
+static void
+scrub_ensure_loaded (UDisksLinuxMDRaid *mdraid,
+                     const gchar       *uuid)
+{
+  UDisksMDRaid *iface = UDISKS_MDRAID (mdraid);
+  gchar *path = NULL;
+  gchar *contents = NULL;
+  gsize length;
+  GVariant *value = NULL;
+  guint64 last_completed = 0;
+  guint64 last_duration = 0;
+  guint64 last_mismatch_count = 0;
+  GError *error = NULL;
+
+  if (mdraid->scrub_loaded)
+    goto out;
+  mdraid->scrub_loaded = TRUE;
+
+  path = scrub_get_persist_path (uuid);
+  if (!g_file_get_contents (path, &contents, &length, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        udisks_warning ("Error loading RAID check results from %s: %s", path, error->message);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  value = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT, contents, length, FALSE, g_free, contents);
+  contents = NULL; /* ownership transfered to the GVariant */
+  g_variant_ref_sink (value);
+
+  g_variant_lookup (value, "last-completed", "t", &last_completed);
+  g_variant_lookup (value, "last-duration", "t", &last_duration);
+  g_variant_lookup (value, "last-mismatch-count", "t", &last_mismatch_count);
+  g_variant_lookup (value, "scheduled", "b", &mdraid->scrub_scheduled);
+  g_variant_lookup (value, "paused", "b", &mdraid->scrub_paused);
+  g_variant_lookup (value, "elapsed", "t", &mdraid->scrub_elapsed);
+  g_variant_lookup (value, "mismatches", "t", &mdraid->scrub_mismatches);
+  g_variant_lookup (value, "resume-position", "t", &mdraid->scrub_resume_position);
+
+  udisks_mdraid_set_scrub_last_completed (iface, last_completed);
+  udisks_mdraid_set_scrub_last_duration (iface, last_duration);
+  udisks_mdraid_set_scrub_last_mismatch_count (iface, last_mismatch_count);
+
+ out:
+  scrub_update_state (mdraid);
+  if (value != NULL)
+    g_variant_unref (value);
+  g_free (contents);
+  g_free (path);
+}
+
+static void
+scrub_save (UDisksLinuxMDRaid *mdraid)
+{
+  UDisksMDRaid *iface = UDISKS_MDRAID (mdraid);
+  GVariantBuilder builder;
+  GVariant *value;
+  const gchar *uuid;
+  gchar *path;
+  GError *error = NULL;
+
+  uuid = udisks_mdraid_get_uuid (iface);
+  if (uuid == NULL || strlen (uuid) == 0)
+    return;
+
+  scrub_update_state (mdraid);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "last-completed",
+                         g_variant_new_uint64 (udisks_mdraid_get_scrub_last_completed (iface)));
+  g_variant_builder_add (&builder, "{sv}", "last-duration",
+                         g_variant_new_uint64 (udisks_mdraid_get_scrub_last_duration (iface)));
+  g_variant_builder_add (&builder, "{sv}", "last-mismatch-count",
+                         g_variant_new_uint64 (udisks_mdraid_get_scrub_last_mismatch_count (iface)));
+  g_variant_builder_add (&builder, "{sv}", "scheduled", g_variant_new_boolean (mdraid->scrub_scheduled));
+  g_variant_builder_add (&builder, "{sv}", "paused", g_variant_new_boolean (mdraid->scrub_paused));
+  g_variant_builder_add (&builder, "{sv}", "elapsed", g_variant_new_uint64 (mdraid->scrub_elapsed));
+  g_variant_builder_add (&builder, "{sv}", "mismatches", g_variant_new_uint64 (mdraid->scrub_mismatches));
+  g_variant_builder_add (&builder, "{sv}", "resume-position", g_variant_new_uint64 (mdraid->scrub_resume_position));
+  value = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  path = scrub_get_persist_path (uuid);
+  if (!g_file_set_contents (path,
+                            g_variant_get_data (value),
+                            g_variant_get_size (value),
+                            &error))
+    {
+      udisks_warning ("Error saving RAID check results to %s: %s", path, error->message);
+      g_clear_error (&error);
+    }
+
+  g_free (path);
+  g_variant_unref (value);
+}
+
+/* Lowers md/sync_speed_max to mdraid_scrub_speed_max while a check
+ * runs and restores the configured value (or the system-wide default)
+ * afterwards. Returns %TRUE if md/sync_speed_max was written.
+ */
+static gboolean
+scrub_throttle (UDisksLinuxMDRaid *mdraid,
+                UDisksDaemon      *daemon,
+                UDisksLinuxDevice *raid_device,
+                gboolean           throttle)
+{
+  UDisksConfigManager *config_manager = udisks_daemon_get_config_manager (daemon);
+  GVariant *configuration;
+  gint32 configured_speed_max = 0;
+  guint speed_max;
+  gchar buf[32];
+  GError *error = NULL;
+
+  configuration = udisks_mdraid_get_configuration (UDISKS_MDRAID (mdraid));
+  if (configuration != NULL)
+    g_variant_lookup (configuration, "md-sync-speed-max", "i", &configured_speed_max);
+
+  if (throttle)
+    {
+      speed_max = udisks_config_manager_get_mdraid_scrub_speed_max (config_manager);
+      if (mdraid->scrub_throttled || speed_max == 0 ||
+          (configured_speed_max > 0 && (guint) configured_speed_max <= speed_max))
+        return FALSE;
+      g_snprintf (buf, sizeof (buf), "%u", speed_max);
+    }
+  else
+    {
+      if (!mdraid->scrub_throttled)
+        return FALSE;
+      if (configured_speed_max > 0)
+        g_snprintf (buf, sizeof (buf), "%d", configured_speed_max);
+      else
+        g_strlcpy (buf, "system", sizeof (buf));
+    }
+
+  mdraid->scrub_throttled = throttle;
+  if (!udisks_linux_device_write_sysfs_attr (raid_device, "md/sync_speed_max", buf, &error))
+    {
+      udisks_warning ("Error setting md/sync_speed_max to %s on %s: %s (%s, %d)",
+                      buf, g_udev_device_get_device_file (raid_device->udev_device),
+                      error->message, g_quark_to_string (error->domain), error->code);
+      g_clear_error (&error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Called from udisks_linux_mdraid_update() with the current md/sync_action
+ * (%NULL if the array is not running or has no redundancy). Returns
+ * %TRUE if md/sync_speed_max was changed.
+ */
+static gboolean
+update_scrub (UDisksLinuxMDRaid *mdraid,
+              UDisksDaemon      *daemon,
+              UDisksLinuxDevice *raid_device,
+              const gchar       *uuid,
+              const gchar       *sync_action)
+{
+  UDisksMDRaid *iface = UDISKS_MDRAID (mdraid);
+  gboolean checking = g_strcmp0 (sync_action, "check") == 0;
+  gboolean ret = FALSE;
+  guint64 now;
+
+  if (uuid == NULL || strlen (uuid) == 0)
+    goto out;
+
+  scrub_ensure_loaded (mdraid, uuid);
+
+  now = time (NULL);
+  if (checking && !mdraid->scrub_checking)
+    {
+      /* a check started - unless we resumed it, start counting from scratch */
+      if (!mdraid->scrub_scheduled)
+        {
+          mdraid->scrub_elapsed = 0;
+          mdraid->scrub_mismatches = 0;
+        }
+      mdraid->scrub_checking = TRUE;
+      mdraid->scrub_running_since = now;
+      ret = scrub_throttle (mdraid, daemon, raid_device, TRUE);
+      scrub_save (mdraid);
+    }
+  else if (!checking && mdraid->scrub_checking)
+    {
+      mdraid->scrub_checking = FALSE;
+      if (now > mdraid->scrub_running_since)
+        mdraid->scrub_elapsed += now - mdraid->scrub_running_since;
+
+      if (raid_device == NULL)
+        {
+          /* the array was stopped, the kernel doesn't keep the position */
+          udisks_info ("Check of RAID array %s interrupted by stopping the array", uuid);
+          mdraid->scrub_scheduled = FALSE;
+          mdraid->scrub_paused = FALSE;
+        }
+      else
+        {
+          guint64 mismatch_cnt = read_sysfs_attr_as_uint64 (raid_device, "md/mismatch_cnt");
+          guint64 sync_min = read_sysfs_attr_as_uint64 (raid_device, "md/sync_min");
+
+          ret = scrub_throttle (mdraid, daemon, raid_device, FALSE);
+
+          /* an interruption at the very start can't be told from
+           * completion by md/sync_min alone, see scrub_pause()
+           */
+          if (mdraid->scrub_pausing && (sync_min > 0 || mdraid->scrub_resume_position == 0))
+            {
+              mdraid->scrub_paused = TRUE;
+              mdraid->scrub_resume_position = sync_min;
+              mdraid->scrub_mismatches += mismatch_cnt;
+              udisks_notice ("Paused check of RAID array %s at sector %" G_GUINT64_FORMAT,
+                             uuid, sync_min);
+            }
+          else if (sync_min == 0)
+            {
+              mdraid->scrub_mismatches += mismatch_cnt;
+              udisks_mdraid_set_scrub_last_completed (iface, now);
+              udisks_mdraid_set_scrub_last_duration (iface, mdraid->scrub_elapsed);
+              udisks_mdraid_set_scrub_last_mismatch_count (iface, mdraid->scrub_mismatches);
+              udisks_notice ("Completed check of RAID array %s in %" G_GUINT64_FORMAT " seconds, "
+                             "%" G_GUINT64_FORMAT " mismatched sectors",
+                             uuid, mdraid->scrub_elapsed, mdraid->scrub_mismatches);
+              mdraid->scrub_scheduled = FALSE;
+              mdraid->scrub_paused = FALSE;
+            }
+          else
+            {
+              udisks_info ("Check of RAID array %s interrupted at sector %" G_GUINT64_FORMAT,
+                           uuid, sync_min);
+              mdraid->scrub_scheduled = FALSE;
+              mdraid->scrub_paused = FALSE;
+            }
+        }
+
+      if (!mdraid->scrub_paused)
         {
-          mdraid->polling_timeout = g_timeout_add_seconds (1,
-                                                           on_polling_timout,
-                                                           mdraid);
+          mdraid->scrub_elapsed = 0;
+          mdraid->scrub_mismatches = 0;
+          mdraid->scrub_resume_position = 0;
         }
+      mdraid->scrub_pausing = FALSE;
+      scrub_save (mdraid);
     }
-  else
+  else if (!checking && mdraid->scrub_scheduled && !mdraid->scrub_paused)
     {
-      if (mdraid->polling_timeout != 0)
-        {
-          g_source_remove (mdraid->polling_timeout);
-          mdraid->polling_timeout = 0;
-        }
+      /* the check we started finished while the daemon wasn't running */
+      mdraid->scrub_scheduled = FALSE;
+      scrub_save (mdraid);
     }
+
+ out:
+  return ret;
 }
 
 static gint
@@ -296,14 +957,17 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
   const gchar *level = NULL;
   const gchar *uuid = NULL;
   const gchar *name = NULL;
-  gchar *sync_action = NULL;
-  gchar *sync_completed = NULL;
-  gchar *bitmap_location = NULL;
+  gchar sync_action_buf[32];
+  gchar bitmap_location_buf[64];
+  const gchar *sync_action = NULL;
+  const gchar *bitmap_location = NULL;
   guint degraded = 0;
   guint64 chunk_size = 0;
-  gdouble sync_completed_val = 0.0;
-  guint64 sync_rate = 0;
-  guint64 sync_remaining_time = 0;
+  guint stripe_cache_size = 0;
+  guint sync_speed_min = 0;
+  guint sync_speed_max = 0;
+  guint group_thread_cnt = 0;
+  guint64 bitmap_chunk_size = 0;
   GVariantBuilder builder;
   UDisksDaemon *daemon = NULL;
   gboolean has_redundancy = FALSE;
@@ -396,47 +1060,44 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
       if (has_redundancy)
         {
           /* Can't use GUdevDevice methods as they cache the result and these variables vary */
-          degraded = read_sysfs_attr_as_int (raid_device->udev_device, "md/degraded");
-          sync_action = read_sysfs_attr (raid_device->udev_device, "md/sync_action");
-          if (sync_action != NULL)
-            g_strstrip (sync_action);
-          sync_completed = read_sysfs_attr (raid_device->udev_device, "md/sync_completed");
-          if (sync_completed != NULL)
-            g_strstrip (sync_completed);
-          bitmap_location = read_sysfs_attr (raid_device->udev_device, "md/bitmap/location");
-          if (bitmap_location != NULL)
-            g_strstrip (bitmap_location);
+          degraded = read_sysfs_attr_as_int (raid_device, "md/degraded");
+          sync_action = read_sysfs_attr (raid_device, "md/sync_action",
+                                         sync_action_buf, sizeof (sync_action_buf));
+          bitmap_location = read_sysfs_attr (raid_device, "md/bitmap/location",
+                                             bitmap_location_buf, sizeof (bitmap_location_buf));
+          if (bitmap_location != NULL && g_strcmp0 (bitmap_location, "none") != 0)
+            bitmap_chunk_size = read_sysfs_attr_as_uint64 (raid_device, "md/bitmap/chunksize");
+          sync_speed_min = read_sysfs_attr_as_uint64 (raid_device, "md/sync_speed_min");
+          sync_speed_max = read_sysfs_attr_as_uint64 (raid_device, "md/sync_speed_max");
         }
 
       if (has_stripes)
         {
-          chunk_size = read_sysfs_attr_as_uint64 (raid_device->udev_device, "md/chunk_size");
+          chunk_size = read_sysfs_attr_as_uint64 (raid_device, "md/chunk_size");
+        }
+
+      /* only the raid456 personality has a stripe cache */
+      if (g_strcmp0 (level, "raid4") == 0 ||
+          g_strcmp0 (level, "raid5") == 0 ||
+          g_strcmp0 (level, "raid6") == 0)
+        {
+          stripe_cache_size = read_sysfs_attr_as_uint64 (raid_device, "md/stripe_cache_size");
+          /* not available in older kernels */
+          group_thread_cnt = udisks_linux_device_read_sysfs_attr_as_uint64 (raid_device, "md/group_thread_cnt", NULL);
         }
     }
+  if (update_scrub (mdraid, daemon, has_redundancy ? raid_device : NULL, uuid, sync_action))
+    sync_speed_max = read_sysfs_attr_as_uint64 (raid_device, "md/sync_speed_max");
+
   udisks_mdraid_set_degraded (iface, degraded);
   udisks_mdraid_set_sync_action (iface, sync_action);
   udisks_mdraid_set_bitmap_location (iface, bitmap_location);
   udisks_mdraid_set_chunk_size (iface, chunk_size);
-
-  if (sync_completed != NULL && g_strcmp0 (sync_completed, "none") != 0)
-    {
-      guint64 completed_sectors = 0;
-      guint64 num_sectors = 1;
-      if (sscanf (sync_completed, "%" G_GUINT64_FORMAT " / %" G_GUINT64_FORMAT,
-                  &completed_sectors, &num_sectors) == 2)
-        {
-          if (num_sectors != 0)
-            sync_completed_val = ((gdouble) completed_sectors) / ((gdouble) num_sectors);
-        }
-
-      /* this is KiB/s (see drivers/md/md.c:sync_speed_show() */
-      sync_rate = read_sysfs_attr_as_uint64 (raid_device->udev_device, "md/sync_speed") * 1024;
-      if (sync_rate > 0)
-        {
-          guint64 num_bytes_remaining = (num_sectors - completed_sectors) * 512ULL;
-          sync_remaining_time = ((guint64) G_USEC_PER_SEC) * num_bytes_remaining / sync_rate;
-        }
-    }
+  udisks_mdraid_set_stripe_cache_size (iface, stripe_cache_size);
+  udisks_mdraid_set_sync_speed_min (iface, sync_speed_min);
+  udisks_mdraid_set_sync_speed_max (iface, sync_speed_max);
+  udisks_mdraid_set_group_thread_count (iface, group_thread_cnt);
+  udisks_mdraid_set_bitmap_chunk_size (iface, bitmap_chunk_size);
 
   if (sync_action)
     {
@@ -455,16 +1116,6 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
               udisks_job_set_cancelable (UDISKS_JOB (job), FALSE);
               udisks_linux_mdraid_object_set_sync_job (object, job);
             }
-          else
-            job = udisks_linux_mdraid_object_get_sync_job (object);
-
-          /* Update the job's interface */
-          udisks_job_set_progress (UDISKS_JOB (job), sync_completed_val);
-          udisks_job_set_progress_valid (UDISKS_JOB (job), TRUE);
-          udisks_job_set_rate (UDISKS_JOB (job), sync_rate);
-
-          udisks_job_set_expected_end_time (UDISKS_JOB (job),
-                                            g_get_real_time () + sync_remaining_time);
         }
       else
         {
@@ -477,21 +1128,20 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
             }
         }
     }
-  udisks_mdraid_set_sync_completed (iface, sync_completed_val);
-  udisks_mdraid_set_sync_rate (iface, sync_rate);
-  udisks_mdraid_set_sync_remaining_time (iface, sync_remaining_time);
+  update_sync_progress (mdraid, object, has_redundancy ? raid_device : NULL);
 
-  /* ensure we poll, exactly when we need to */
+  /* ensure we sample the progress, exactly when we need to */
   if (g_strcmp0 (sync_action, "resync") == 0 ||
       g_strcmp0 (sync_action, "recover") == 0 ||
       g_strcmp0 (sync_action, "check") == 0 ||
       g_strcmp0 (sync_action, "repair") == 0)
     {
-      ensure_polling (mdraid, TRUE);
+      UDisksConfigManager *config_manager = udisks_daemon_get_config_manager (daemon);
+      ensure_polling (mdraid, udisks_config_manager_get_mdraid_sync_progress_interval (config_manager));
     }
   else
     {
-      ensure_polling (mdraid, FALSE);
+      ensure_polling (mdraid, 0);
     }
 
   /* figure out active devices */
@@ -520,9 +1170,11 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
             {
               gchar *block_sysfs_path = NULL;
               UDisksObject *member_object = NULL;
-              gchar *member_state = NULL;
+              gchar member_state_buf[128];
+              const gchar *member_state = NULL;
               gchar **member_state_elements = NULL;
-              gchar *member_slot = NULL;
+              gchar member_slot_buf[32];
+              const gchar *member_slot = NULL;
               gint member_slot_as_int = -1;
               guint64 member_errors = 0;
 
@@ -546,10 +1198,10 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
                 }
 
               snprintf (buf, sizeof (buf), "md/%s/state", file_name);
-              member_state = read_sysfs_attr (raid_device->udev_device, buf);
+              member_state = read_sysfs_attr (raid_device, buf,
+                                              member_state_buf, sizeof (member_state_buf));
               if (member_state != NULL)
                 {
-                  g_strstrip (member_state);
                   member_state_elements = g_strsplit (member_state, ",", 0);
                 }
               else
@@ -560,16 +1212,16 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
                 }
 
               snprintf (buf, sizeof (buf), "md/%s/slot", file_name);
-              member_slot = read_sysfs_attr (raid_device->udev_device, buf);
+              member_slot = read_sysfs_attr (raid_device, buf,
+                                             member_slot_buf, sizeof (member_slot_buf));
               if (member_slot != NULL)
                 {
-                  g_strstrip (member_slot);
                   if (g_strcmp0 (member_slot, "none") != 0)
                     member_slot_as_int = atoi (member_slot);
                 }
 
               snprintf (buf, sizeof (buf), "md/%s/errors", file_name);
-              member_errors = read_sysfs_attr_as_uint64 (raid_device->udev_device, buf);
+              member_errors = read_sysfs_attr_as_uint64 (raid_device, buf);
 
               g_ptr_array_add (p,
                                g_variant_new ("(oi^asta{sv})",
@@ -580,8 +1232,6 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
                                               NULL)); /* expansion, unused for now */
 
             member_done:
-              g_free (member_slot);
-              g_free (member_state);
               g_strfreev (member_state_elements);
               g_clear_object (&member_object);
               g_free (block_sysfs_path);
@@ -607,10 +1257,9 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
                                          udisks_linux_find_child_configuration (daemon,
                                                                                 uuid));
 
+  ret = update_configuration (mdraid, uuid);
+
  out:
-  g_free (sync_completed);
-  g_free (sync_action);
-  g_free (bitmap_location);
   g_list_free_full (member_devices, g_object_unref);
   g_clear_object (&raid_device);
   return ret;
@@ -618,6 +1267,291 @@ udisks_linux_mdraid_update (UDisksLinuxMDRaid       *mdraid,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* returns the drives (or, if not on a drive, the block devices) the members are on */
+static GPtrArray *
+scrub_get_drives (UDisksDaemon            *daemon,
+                  UDisksLinuxMDRaidObject *object)
+{
+  GPtrArray *drives;
+  GList *member_devices, *l;
+
+  drives = g_ptr_array_new_with_free_func (g_free);
+  member_devices = udisks_linux_mdraid_object_get_members (object);
+  for (l = member_devices; l != NULL; l = l->next)
+    {
+      UDisksLinuxDevice *device = UDISKS_LINUX_DEVICE (l->data);
+      UDisksObject *member_object;
+      UDisksBlock *block;
+      const gchar *drive = NULL;
+      guint n;
+
+      member_object = udisks_daemon_find_block_by_sysfs_path (daemon,
+                                                              g_udev_device_get_sysfs_path (device->udev_device));
+      if (member_object == NULL)
+        continue;
+
+      block = udisks_object_peek_block (member_object);
+      if (block != NULL)
+        drive = udisks_block_get_drive (block);
+      if (drive == NULL || g_strcmp0 (drive, "/") == 0)
+        drive = g_dbus_object_get_object_path (G_DBUS_OBJECT (member_object));
+
+      for (n = 0; n < drives->len; n++)
+        if (g_strcmp0 (drives->pdata[n], drive) == 0)
+          break;
+      if (n == drives->len)
+        g_ptr_array_add (drives, g_strdup (drive));
+
+      g_object_unref (member_object);
+    }
+  g_list_free_full (member_devices, g_object_unref);
+
+  return drives;
+}
+
+static void
+scrub_drives_add (GHashTable *busy_drives,
+                  GPtrArray  *drives)
+{
+  guint n;
+
+  for (n = 0; n < drives->len; n++)
+    {
+      guint count = GPOINTER_TO_UINT (g_hash_table_lookup (busy_drives, drives->pdata[n]));
+      g_hash_table_insert (busy_drives, g_strdup (drives->pdata[n]), GUINT_TO_POINTER (count + 1));
+    }
+}
+
+static gboolean
+scrub_drives_available (GHashTable *busy_drives,
+                        GPtrArray  *drives,
+                        guint       max_per_drive)
+{
+  guint n;
+
+  for (n = 0; n < drives->len; n++)
+    {
+      if (GPOINTER_TO_UINT (g_hash_table_lookup (busy_drives, drives->pdata[n])) >= max_per_drive)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+scrub_in_window (UDisksConfigManager *config_manager,
+                 time_t               now)
+{
+  struct tm tm;
+  guint start, end, minute;
+
+  if (!udisks_config_manager_get_mdraid_scrub_window (config_manager, &start, &end))
+    return TRUE;
+
+  localtime_r (&now, &tm);
+  minute = tm.tm_hour * 60 + tm.tm_min;
+  if (start < end)
+    return minute >= start && minute < end;
+  else
+    return minute >= start || minute < end; /* wraps around midnight */
+}
+
+static gboolean
+scrub_is_due (UDisksLinuxMDRaid   *mdraid,
+              UDisksConfigManager *config_manager,
+              time_t               now)
+{
+  UDisksMDRaid *iface = UDISKS_MDRAID (mdraid);
+  GVariant *configuration;
+  gint32 configured_interval;
+  guint64 interval;
+
+  interval = udisks_config_manager_get_mdraid_scrub_interval (config_manager);
+  configuration = udisks_mdraid_get_configuration (iface);
+  if (configuration != NULL &&
+      g_variant_lookup (configuration, "md-scrub-interval", "i", &configured_interval))
+    interval = configured_interval;
+
+  if (interval == 0 || udisks_mdraid_get_degraded (iface) > 0)
+    return FALSE;
+
+  if (mdraid->scrub_paused)
+    return TRUE;
+
+  return udisks_mdraid_get_scrub_last_completed (iface) + interval * 24 * 60 * 60 <= (guint64) now;
+}
+
+static gboolean
+scrub_start (UDisksLinuxMDRaid       *mdraid,
+             UDisksLinuxMDRaidObject *object)
+{
+  UDisksLinuxDevice *raid_device;
+  const gchar *uuid = udisks_mdraid_get_uuid (UDISKS_MDRAID (mdraid));
+  gchar buf[32];
+  GError *error = NULL;
+  gboolean ret = FALSE;
+
+  raid_device = udisks_linux_mdraid_object_get_device (object);
+  if (raid_device == NULL)
+    goto out;
+
+  /* a check interrupted by someone else leaves md/sync_min behind */
+  g_snprintf (buf, sizeof (buf), "%" G_GUINT64_FORMAT,
+              mdraid->scrub_paused ? mdraid->scrub_resume_position : 0);
+  if (!udisks_linux_device_write_sysfs_attr (raid_device, "md/sync_min", buf, &error) ||
+      !udisks_linux_device_write_sysfs_attr (raid_device, "md/sync_action", "check", &error))
+    {
+      udisks_warning ("Error starting scheduled check of RAID array %s: %s (%s, %d)",
+                      uuid, error->message, g_quark_to_string (error->domain), error->code);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  udisks_notice ("%s scheduled check of RAID array %s",
+                 mdraid->scrub_paused ? "Resumed" : "Started", uuid);
+
+  if (!mdraid->scrub_paused)
+    {
+      mdraid->scrub_elapsed = 0;
+      mdraid->scrub_mismatches = 0;
+    }
+  mdraid->scrub_scheduled = TRUE;
+  mdraid->scrub_paused = FALSE;
+  ret = TRUE;
+
+ out:
+  g_clear_object (&raid_device);
+  return ret;
+}
+
+static void
+scrub_pause (UDisksLinuxMDRaid       *mdraid,
+             UDisksLinuxMDRaidObject *object)
+{
+  UDisksLinuxDevice *raid_device;
+  const gchar *uuid = udisks_mdraid_get_uuid (UDISKS_MDRAID (mdraid));
+  gchar sync_completed[64];
+  guint64 completed_sectors = 0;
+  GError *error = NULL;
+
+  raid_device = udisks_linux_mdraid_object_get_device (object);
+  if (raid_device == NULL)
+    goto out;
+
+  /* see update_scrub() */
+  if (read_sysfs_attr (raid_device, "md/sync_completed", sync_completed, sizeof (sync_completed)) != NULL)
+    sscanf (sync_completed, "%" G_GUINT64_FORMAT, &completed_sectors);
+  mdraid->scrub_resume_position = completed_sectors;
+
+  /* the kernel remembers the position in md/sync_min */
+  if (!udisks_linux_device_write_sysfs_attr (raid_device, "md/sync_action", "idle", &error))
+    {
+      udisks_warning ("Error pausing scheduled check of RAID array %s: %s (%s, %d)",
+                      uuid, error->message, g_quark_to_string (error->domain), error->code);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  mdraid->scrub_pausing = TRUE;
+
+ out:
+  g_clear_object (&raid_device);
+}
+
+static gboolean
+scrub_all_in_idle (gpointer user_data)
+{
+  UDisksDaemon *daemon = UDISKS_DAEMON (user_data);
+  UDisksConfigManager *config_manager = udisks_daemon_get_config_manager (daemon);
+  GHashTable *busy_drives;
+  GList *objects, *l;
+  GList *due = NULL;
+  gboolean in_window;
+  guint max_per_drive;
+  time_t now;
+
+  now = time (NULL);
+  in_window = scrub_in_window (config_manager, now);
+  max_per_drive = udisks_config_manager_get_mdraid_scrub_max_per_drive (config_manager);
+  busy_drives = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* first count the sync operations already reading from each drive */
+  objects = udisks_daemon_get_objects (daemon);
+  for (l = objects; l != NULL; l = l->next)
+    {
+      UDisksMDRaid *iface;
+      UDisksLinuxMDRaid *mdraid;
+      const gchar *sync_action;
+
+      if (!UDISKS_IS_LINUX_MDRAID_OBJECT (l->data))
+        continue;
+
+      iface = udisks_object_peek_mdraid (UDISKS_OBJECT (l->data));
+      if (iface == NULL)
+        continue;
+      mdraid = UDISKS_LINUX_MDRAID (iface);
+
+      /* empty if not running or without redundancy */
+      sync_action = udisks_mdraid_get_sync_action (iface);
+      if (sync_action == NULL || strlen (sync_action) == 0)
+        continue;
+
+      if (g_strcmp0 (sync_action, "idle") != 0)
+        {
+          GPtrArray *drives = scrub_get_drives (daemon, l->data);
+          scrub_drives_add (busy_drives, drives);
+          g_ptr_array_unref (drives);
+
+          if (!in_window && mdraid->scrub_checking && mdraid->scrub_scheduled && !mdraid->scrub_pausing)
+            scrub_pause (mdraid, l->data);
+        }
+      else if (in_window && scrub_is_due (mdraid, config_manager, now))
+        {
+          due = g_list_prepend (due, g_object_ref (l->data));
+        }
+    }
+  g_list_free_full (objects, g_object_unref);
+
+  /* ... then start as many of the due checks as the limit allows */
+  due = g_list_reverse (due);
+  for (l = due; l != NULL; l = l->next)
+    {
+      UDisksLinuxMDRaid *mdraid = UDISKS_LINUX_MDRAID (udisks_object_peek_mdraid (UDISKS_OBJECT (l->data)));
+      GPtrArray *drives = scrub_get_drives (daemon, l->data);
+
+      if (scrub_drives_available (busy_drives, drives, max_per_drive) &&
+          scrub_start (mdraid, l->data))
+        scrub_drives_add (busy_drives, drives);
+
+      g_ptr_array_unref (drives);
+    }
+  g_list_free_full (due, g_object_unref);
+
+  g_hash_table_unref (busy_drives);
+  g_object_unref (daemon);
+  return FALSE; /* remove source */
+}
+
+/**
+ * udisks_linux_mdraid_scrub_all:
+ * @daemon: A #UDisksDaemon.
+ *
+ * Starts the scheduled checks of RAID arrays that are due and pauses
+ * those running outside of the <literal>mdraid_scrub_window</literal>
+ * configured in <filename>udisks2.conf</filename>. Can be called from
+ * any thread, the work is done in the main loop where the state of the
+ * checks is tracked.
+ */
+void
+udisks_linux_mdraid_scrub_all (UDisksDaemon *daemon)
+{
+  g_return_if_fail (UDISKS_IS_DAEMON (daemon));
+
+  g_idle_add (scrub_all_in_idle, g_object_ref (daemon));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static UDisksObject *
 wait_for_md_block_object (UDisksDaemon *daemon,
                           gpointer      user_data)
@@ -1431,6 +2365,10 @@ handle_set_bitmap_location (UDisksMDRaid           *_mdraid,
   udisks_mdraid_complete_add_device (_mdraid, invocation);
   udisks_linux_mdraid_update (mdraid, object);
 
+  /* a new bitmap gets the default chunk size */
+  if (g_strcmp0 (value, "internal") == 0)
+    udisks_linux_mdraid_apply_configuration (mdraid, raid_device);
+
  out:
   g_clear_object (&raid_device);
   g_clear_object (&object);
@@ -1559,6 +2497,140 @@ handle_request_sync_action (UDisksMDRaid           *_mdraid,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static gboolean
+handle_set_configuration (UDisksMDRaid           *_mdraid,
+                          GDBusMethodInvocation  *invocation,
+                          GVariant               *configuration,
+                          GVariant               *options)
+{
+  UDisksLinuxMDRaid *mdraid = UDISKS_LINUX_MDRAID (_mdraid);
+  UDisksDaemon *daemon;
+  UDisksLinuxMDRaidObject *object;
+  UDisksLinuxDevice *raid_device = NULL;
+  const gchar *action_id;
+  const gchar *message;
+  const gchar *uuid;
+  GKeyFile *key_file = NULL;
+  GError *error = NULL;
+  gchar *path = NULL;
+  gchar *data = NULL;
+  gsize data_len;
+  guint n;
+
+  object = udisks_daemon_util_dup_object (mdraid, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_mdraid_object_get_daemon (object);
+
+  /* Translators: Shown in authentication dialog when the user
+   * changes the settings of a RAID array.
+   */
+  message = N_("Authentication is required to configure settings for a RAID array");
+  action_id = "org.freedesktop.udisks2.manage-md-raid";
+
+  /* Check that the user is actually authorized */
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    UDISKS_OBJECT (object),
+                                                    action_id,
+                                                    options,
+                                                    message,
+                                                    invocation))
+    goto out;
+
+  for (n = 0; n < G_N_ELEMENTS (mdraid_configuration_mapping); n++)
+    {
+      const VariantKeyfileMapping *mapping = &mdraid_configuration_mapping[n];
+      gint32 value;
+
+      if (!g_variant_lookup (configuration, mapping->asv_key, "i", &value))
+        continue;
+
+      if (value < 0 ||
+          (g_strcmp0 (mapping->asv_key, "md-bitmap-chunk-size") == 0 &&
+           (value < 4096 || (value & (value - 1)) != 0)))
+        {
+          g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                 "Invalid value %d for %s",
+                                                 value, mapping->asv_key);
+          goto out;
+        }
+    }
+
+  uuid = udisks_mdraid_get_uuid (_mdraid);
+  path = configuration_get_path (uuid);
+  if (path == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "RAID array has no UUID");
+      goto out;
+    }
+
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file,
+                                  path,
+                                  G_KEY_FILE_KEEP_COMMENTS | G_KEY_FILE_KEEP_TRANSLATIONS,
+                                  &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          g_dbus_method_invocation_take_error (invocation, error);
+          goto out;
+        }
+      /* not a problem, just create a new file */
+      g_key_file_set_comment (key_file,
+                              NULL, /* group_name */
+                              NULL, /* key */
+                              " See udisks(8) for the format of this file.",
+                              NULL);
+      g_clear_error (&error);
+    }
+
+  for (n = 0; n < G_N_ELEMENTS (mdraid_configuration_mapping); n++)
+    {
+      const VariantKeyfileMapping *mapping = &mdraid_configuration_mapping[n];
+      gint32 value;
+
+      if (g_variant_lookup (configuration, mapping->asv_key, "i", &value))
+        g_key_file_set_integer (key_file, mapping->group, mapping->key, value);
+      else
+        g_key_file_remove_key (key_file, mapping->group, mapping->key, NULL);
+    }
+
+  data = g_key_file_to_data (key_file, &data_len, NULL);
+
+  if (!udisks_daemon_util_file_set_contents (path,
+                                             data,
+                                             data_len,
+                                             0600, /* mode to use if non-existant */
+                                             &error))
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  /* Don't wait for the file monitor to pick up the change */
+  raid_device = udisks_linux_mdraid_object_get_device (object);
+  if (update_configuration (mdraid, uuid) && raid_device != NULL)
+    udisks_linux_mdraid_apply_configuration (mdraid, raid_device);
+
+  udisks_mdraid_complete_set_configuration (_mdraid, invocation);
+
+ out:
+  if (key_file != NULL)
+    g_key_file_unref (key_file);
+  g_free (data);
+  g_free (path);
+  g_clear_object (&raid_device);
+  g_clear_object (&object);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static gboolean
 udisks_linux_mdraid_delete (UDisksMDRaid           *mdraid,
                             GDBusMethodInvocation  *invocation,
@@ -1731,5 +2803,6 @@ mdraid_iface_init (UDisksMDRaidIface *iface)
   iface->handle_add_device = handle_add_device;
   iface->handle_set_bitmap_location = handle_set_bitmap_location;
   iface->handle_request_sync_action = handle_request_sync_action;
+  iface->handle_set_configuration = handle_set_configuration;
   iface->handle_delete = handle_delete;
 }
@@ -33,6 +33,9 @@ GType         udisks_linux_mdraid_get_type  (void) G_GNUC_CONST;
 UDisksMDRaid *udisks_linux_mdraid_new       (void);
 gboolean      udisks_linux_mdraid_update    (UDisksLinuxMDRaid       *mdraid,
                                              UDisksLinuxMDRaidObject *object);
+void          udisks_linux_mdraid_apply_configuration (UDisksLinuxMDRaid *mdraid,
+                                                       UDisksLinuxDevice *raid_device);
+void          udisks_linux_mdraid_scrub_all (UDisksDaemon *daemon);
 
 G_END_DECLS
 
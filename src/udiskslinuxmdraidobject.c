@@ -72,6 +72,10 @@ struct _UDisksLinuxMDRaidObject
   /* watches for sysfs attr changes */
   GSource *sync_action_source;
   GSource *degraded_source;
+  GSource *array_state_source;
+
+  /* last seen value of md/array_state, see array_state_changed() */
+  gchar *array_state;
 
   /* sync job */
   UDisksBaseJob *sync_job;
@@ -104,6 +108,12 @@ remove_watches (UDisksLinuxMDRaidObject *object)
       g_source_destroy (object->degraded_source);
       object->degraded_source = NULL;
     }
+  if (object->array_state_source != NULL)
+    {
+      g_source_destroy (object->array_state_source);
+      object->array_state_source = NULL;
+    }
+  g_clear_pointer (&object->array_state, g_free);
 }
 
 G_DEFINE_TYPE (UDisksLinuxMDRaidObject, udisks_linux_mdraid_object, UDISKS_TYPE_OBJECT_SKELETON);
@@ -474,7 +484,8 @@ watch_attr (UDisksLinuxDevice *device,
   channel = g_io_channel_new_file (path, "r", &error);
   if (channel != NULL)
     {
-      ret = g_io_create_watch (channel, G_IO_ERR);
+      /* sysfs_notify() wakes up pollers with POLLERR|POLLPRI */
+      ret = g_io_create_watch (channel, G_IO_PRI | G_IO_ERR);
       g_source_set_callback (ret, callback, user_data, NULL);
       g_source_attach (ret, g_main_context_get_thread_default ());
       g_source_unref (ret);
@@ -493,26 +504,20 @@ watch_attr (UDisksLinuxDevice *device,
 
 /* ----------------------------------------------------------------------------------------------------  */
 
-static gboolean
-attr_changed (GIOChannel   *channel,
-              GIOCondition  cond,
-              gpointer      user_data)
+/* Rereads the attribute behind @channel - this is needed to get notified again */
+static gchar *
+reread_attr (UDisksLinuxMDRaidObject *object,
+             GIOChannel              *channel)
 {
-  UDisksLinuxMDRaidObject *object = UDISKS_LINUX_MDRAID_OBJECT (user_data);
-  gboolean bail = FALSE;
   GError *error = NULL;
   gchar *str = NULL;
   gsize len = 0;
 
-  if (cond & ~G_IO_ERR)
-    goto out;
-
   if (g_io_channel_seek_position (channel, 0, G_SEEK_SET, &error) != G_IO_STATUS_NORMAL)
     {
       udisks_debug ("Error seeking in channel (uuid %s): %s (%s, %d)",
                     object->uuid, error->message, g_quark_to_string (error->domain), error->code);
       g_clear_error (&error);
-      bail = TRUE;
       goto out;
     }
 
@@ -521,19 +526,86 @@ attr_changed (GIOChannel   *channel,
       udisks_debug ("Error reading (uuid %s): %s (%s, %d)",
                     object->uuid, error->message, g_quark_to_string (error->domain), error->code);
       g_clear_error (&error);
-      bail = TRUE;
       goto out;
     }
 
-  g_free (str);
+  g_strstrip (str);
+
+ out:
+  return str;
+}
+
+static gboolean
+attr_changed (GIOChannel   *channel,
+              GIOCondition  cond,
+              gpointer      user_data)
+{
+  UDisksLinuxMDRaidObject *object = UDISKS_LINUX_MDRAID_OBJECT (user_data);
+  gchar *str = NULL;
+
+  if (cond & ~(G_IO_PRI | G_IO_ERR))
+    goto out;
+
+  str = reread_attr (object, channel);
+  if (str == NULL)
+    {
+      remove_watches (object);
+      goto out;
+    }
 
   /* synthesize uevent */
   if (object->raid_device != NULL)
     udisks_linux_mdraid_object_uevent (object, "change", object->raid_device, FALSE);
 
  out:
-  if (bail)
-    remove_watches (object);
+  g_free (str);
+  return TRUE; /* keep event source around */
+}
+
+/* The array flips between "active" and "clean" (or "write-pending",
+ * "active-idle") on every burst of writes - none of these matter to us
+ * so only transitions from and to other states cause an update.
+ */
+static gboolean
+array_state_is_running (const gchar *array_state)
+{
+  return (g_strcmp0 (array_state, "clean") == 0 ||
+          g_strcmp0 (array_state, "active") == 0 ||
+          g_strcmp0 (array_state, "write-pending") == 0 ||
+          g_strcmp0 (array_state, "active-idle") == 0);
+}
+
+static gboolean
+array_state_changed (GIOChannel   *channel,
+                     GIOCondition  cond,
+                     gpointer      user_data)
+{
+  UDisksLinuxMDRaidObject *object = UDISKS_LINUX_MDRAID_OBJECT (user_data);
+  gchar *str = NULL;
+  gboolean changed;
+
+  if (cond & ~(G_IO_PRI | G_IO_ERR))
+    goto out;
+
+  str = reread_attr (object, channel);
+  if (str == NULL)
+    {
+      remove_watches (object);
+      goto out;
+    }
+
+  changed = !(array_state_is_running (str) && array_state_is_running (object->array_state)) &&
+            g_strcmp0 (str, object->array_state) != 0;
+  g_free (object->array_state);
+  object->array_state = str;
+  str = NULL;
+
+  /* synthesize uevent */
+  if (changed && object->raid_device != NULL)
+    udisks_linux_mdraid_object_uevent (object, "change", object->raid_device, FALSE);
+
+ out:
+  g_free (str);
   return TRUE; /* keep event source around */
 }
 
@@ -552,8 +624,11 @@ static void
 raid_device_added (UDisksLinuxMDRaidObject *object,
                    UDisksLinuxDevice       *device)
 {
+  gchar array_state[32];
+
   g_assert (object->sync_action_source == NULL);
   g_assert (object->degraded_source == NULL);
+  g_assert (object->array_state_source == NULL);
 
   /* udisks_debug ("start watching %s", g_udev_device_get_sysfs_path (device->udev_device)); */
   object->sync_action_source = watch_attr (device,
@@ -564,6 +639,12 @@ raid_device_added (UDisksLinuxMDRaidObject *object,
                                         "md/degraded",
                                         (GSourceFunc) attr_changed,
                                         object);
+  object->array_state_source = watch_attr (device,
+                                           "md/array_state",
+                                           (GSourceFunc) array_state_changed,
+                                           object);
+  if (udisks_linux_device_read_sysfs_attr (device, "md/array_state", array_state, sizeof (array_state), NULL))
+    object->array_state = g_strdup (array_state);
 }
 
 static void
@@ -592,9 +673,10 @@ udisks_linux_mdraid_object_uevent (UDisksLinuxMDRaidObject *object,
                                    gboolean                 is_member)
 {
   gboolean conf_changed = FALSE;
+  gboolean assembled = FALSE;
 
   g_return_if_fail (UDISKS_IS_LINUX_MDRAID_OBJECT (object));
-  g_return_if_fail (UDISKS_IS_LINUX_DEVICE (device));
+  g_return_if_fail (device == NULL || UDISKS_IS_LINUX_DEVICE (device));
 
   /* udisks_debug ("is_member=%d for uuid %s and device %s", is_member, object->uuid, g_udev_device_get_device_file (device->udev_device)); */
 
@@ -638,7 +720,7 @@ udisks_linux_mdraid_object_uevent (UDisksLinuxMDRaidObject *object,
             }
         }
     }
-  else
+  else if (device != NULL)
     {
       /* Skip partitions of raid devices */
       if (g_strcmp0 (g_udev_device_get_devtype (device->udev_device), "disk") != 0)
@@ -673,6 +755,7 @@ udisks_linux_mdraid_object_uevent (UDisksLinuxMDRaidObject *object,
             {
               object->raid_device = g_object_ref (device);
               raid_device_added (object, object->raid_device);
+              assembled = TRUE;
             }
           else
             {
@@ -691,6 +774,14 @@ udisks_linux_mdraid_object_uevent (UDisksLinuxMDRaidObject *object,
       conf_changed = FALSE;
       conf_changed |= update_iface (object, action, mdraid_check, mdraid_connect, mdraid_update,
                                     UDISKS_TYPE_LINUX_MDRAID, &object->iface_mdraid);
+
+      if (g_strcmp0 (action, "reconfigure") == 0)
+        conf_changed = TRUE;
+
+      /* (re-)apply the configuration whenever the array is assembled */
+      if ((conf_changed || assembled) && object->raid_device != NULL && object->iface_mdraid != NULL)
+        udisks_linux_mdraid_apply_configuration (UDISKS_LINUX_MDRAID (object->iface_mdraid),
+                                                 object->raid_device);
     }
  out:
   ;
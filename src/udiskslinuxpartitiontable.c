@@ -146,40 +146,177 @@ wait_for_partition (UDisksDaemon *daemon,
   UDisksObject *ret = NULL;
   GList *objects, *l;
 
-  objects = udisks_daemon_get_objects (daemon);
+  /* the index is ordered by offset so we can stop at the first partition past the position */
+  objects = udisks_linux_block_object_get_partitions (UDISKS_LINUX_BLOCK_OBJECT (data->partition_table_object));
   for (l = objects; l != NULL; l = l->next)
     {
       UDisksObject *object = UDISKS_OBJECT (l->data);
-      UDisksPartition *partition = udisks_object_get_partition (object);
-      if (partition != NULL)
+      UDisksPartition *partition = udisks_object_peek_partition (object);
+      guint64 offset;
+      guint64 size;
+
+      if (partition == NULL)
+        continue;
+
+      offset = udisks_partition_get_offset (partition);
+      size = udisks_partition_get_size (partition);
+      if (offset > data->pos_to_wait_for)
+        break;
+
+      if (data->pos_to_wait_for < offset + size &&
+          !(udisks_partition_get_is_container (partition) && data->ignore_container))
         {
-          if (g_strcmp0 (udisks_partition_get_table (partition),
-                         g_dbus_object_get_object_path (G_DBUS_OBJECT (data->partition_table_object))) == 0)
-            {
-              guint64 offset = udisks_partition_get_offset (partition);
-              guint64 size = udisks_partition_get_size (partition);
-
-              if (data->pos_to_wait_for >= offset && data->pos_to_wait_for < offset + size)
-                {
-                  if (!(udisks_partition_get_is_container (partition) && data->ignore_container))
-                    {
-                      g_object_unref (partition);
-                      ret = g_object_ref (object);
-                      goto out;
-                    }
-                }
-            }
-          g_object_unref (partition);
+          ret = g_object_ref (object);
+          break;
         }
     }
 
- out:
   g_list_free_full (objects, g_object_unref);
   return ret;
 }
 
 #define MIB_SIZE (1048576L)
 
+static guint64
+gcd (guint64 a,
+     guint64 b)
+{
+  while (b != 0)
+    {
+      guint64 t = a % b;
+      a = b;
+      b = t;
+    }
+  return a;
+}
+
+/* The largest grain derived from the I/O topology - some USB bridges
+ * and RAID HBAs report bogus optimal I/O sizes like 33553920 bytes
+ */
+#define MAX_ALIGNMENT_GRAIN (16 * MIB_SIZE)
+
+/* Returns whether @io_size reported by the device can be trusted */
+static gboolean
+io_size_is_sane (guint64 io_size,
+                 guint64 physical_block_size,
+                 guint64 minimum_io_size)
+{
+  if (io_size == 0)
+    return FALSE;
+  if (physical_block_size > 0 && io_size % physical_block_size != 0)
+    return FALSE;
+  if (minimum_io_size > 0 && io_size % minimum_io_size != 0)
+    return FALSE;
+  return TRUE;
+}
+
+/* Determines the alignment for new partitions on @object: the start of
+ * each partition is placed at a multiple of @out_grain plus
+ * @out_offset bytes. The grain is a multiple of both 1 MiB and the
+ * device's preferred I/O size (e.g. the full stripe width of a RAID
+ * array) and the offset is the device's alignment_offset, unless the
+ * caller overrides it with the "alignment" option. Preferred I/O sizes
+ * that don't add up or would result in a grain larger than
+ * MAX_ALIGNMENT_GRAIN (or 1/16 of the device) are ignored.
+ */
+static gboolean
+get_partition_alignment (UDisksObject  *object,
+                         GVariant      *options,
+                         guint64       *out_grain,
+                         guint64       *out_offset,
+                         GError       **error)
+{
+  UDisksLinuxDevice *device;
+  guint64 alignment = 0;
+  guint64 logical_block_size = 0;
+  guint64 physical_block_size = 0;
+  guint64 minimum_io_size = 0;
+  guint64 io_size = 0;
+  guint64 max_grain;
+  guint64 grain;
+  gint alignment_offset = 0;
+  gboolean ret = TRUE;
+
+  *out_grain = MIB_SIZE;
+  *out_offset = 0;
+
+  device = udisks_linux_block_object_get_device (UDISKS_LINUX_BLOCK_OBJECT (object));
+  if (device != NULL)
+    {
+      logical_block_size = g_udev_device_get_sysfs_attr_as_uint64 (device->udev_device, "queue/logical_block_size");
+      physical_block_size = g_udev_device_get_sysfs_attr_as_uint64 (device->udev_device, "queue/physical_block_size");
+      minimum_io_size = g_udev_device_get_sysfs_attr_as_uint64 (device->udev_device, "queue/minimum_io_size");
+    }
+  if (logical_block_size == 0)
+    logical_block_size = 512;
+
+  if (g_variant_lookup (options, "alignment", "t", &alignment) && alignment > 0)
+    {
+      if (alignment % logical_block_size != 0)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Alignment %" G_GUINT64_FORMAT " is not a multiple of the logical block size %" G_GUINT64_FORMAT,
+                       alignment, logical_block_size);
+          ret = FALSE;
+          goto out;
+        }
+      *out_grain = alignment;
+      goto out;
+    }
+
+  if (device == NULL)
+    goto out;
+
+  max_grain = MIN (MAX_ALIGNMENT_GRAIN,
+                   512 * g_udev_device_get_sysfs_attr_as_uint64 (device->udev_device, "size") / 16);
+
+  io_size = g_udev_device_get_sysfs_attr_as_uint64 (device->udev_device, "queue/optimal_io_size");
+  if (!io_size_is_sane (io_size, physical_block_size, minimum_io_size))
+    io_size = minimum_io_size;
+  if (io_size_is_sane (io_size, physical_block_size, minimum_io_size))
+    {
+      grain = MIB_SIZE / gcd (MIB_SIZE, io_size) * io_size;
+      if (grain <= max_grain)
+        *out_grain = grain;
+      else
+        udisks_warning ("Ignoring I/O size %" G_GUINT64_FORMAT " of %s for partition alignment",
+                        io_size, g_udev_device_get_device_file (device->udev_device));
+    }
+
+  /* negative if the device cannot be aligned at all */
+  alignment_offset = g_udev_device_get_sysfs_attr_as_int (device->udev_device, "alignment_offset");
+  if (alignment_offset > 0)
+    *out_offset = (guint64) alignment_offset % *out_grain;
+
+ out:
+  g_clear_object (&device);
+  return ret;
+}
+
+/* Moves @offset up and the end of the partition down to the next aligned
+ * position. A @size of 0 (use all available space) is left untouched.
+ */
+static void
+align_partition (guint64   grain,
+                 guint64   grain_offset,
+                 guint64  *offset,
+                 guint64  *size)
+{
+  guint64 start = MAX (*offset, 1);
+  guint64 end;
+
+  start = ((start + grain - 1 - grain_offset) / grain) * grain + grain_offset;
+  if (*size > 0)
+    {
+      end = *offset + *size;
+      if (end > grain_offset)
+        end = ((end - grain_offset) / grain) * grain + grain_offset;
+      if (end > start)
+        *size = end - start;
+    }
+  *offset = start;
+}
+
 static UDisksObject *
 udisks_linux_partition_table_handle_create_partition (UDisksPartitionTable   *table,
                                                       GDBusMethodInvocation  *invocation,
@@ -202,6 +339,8 @@ udisks_linux_partition_table_handle_create_partition (UDisksPartitionTable   *ta
   BDPartSpec *overlapping_part = NULL;
   BDPartTypeReq part_type = 0;
   const gchar *table_type;
+  guint64 grain;
+  guint64 grain_offset;
   uid_t caller_uid;
   gid_t caller_gid;
   GError *error = NULL;
@@ -351,8 +490,16 @@ udisks_linux_partition_table_handle_create_partition (UDisksPartitionTable   *ta
         }
     }
 
+  if (!get_partition_alignment (object, options, &grain, &grain_offset, &error))
+    {
+      udisks_simple_job_complete (UDISKS_SIMPLE_JOB (job), FALSE, error->message);
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+  align_partition (grain, grain_offset, &offset, &size);
+
   part_spec = bd_part_create_part (device_name, part_type, offset,
-                                   size, BD_PART_ALIGN_OPTIMAL, &error);
+                                   size, BD_PART_ALIGN_NONE, &error);
   if (!part_spec)
     {
       g_dbus_method_invocation_return_error (invocation,
@@ -597,9 +744,394 @@ handle_create_partition_and_format (UDisksPartitionTable   *table,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Returns a list of the partition objects currently known for @table_object. */
+static GList *
+get_partition_objects (UDisksObject *table_object)
+{
+  GList *ret = NULL;
+  GList *objects, *l;
+  const gchar *table_object_path;
+
+  table_object_path = g_dbus_object_get_object_path (G_DBUS_OBJECT (table_object));
+  objects = udisks_linux_block_object_get_partitions (UDISKS_LINUX_BLOCK_OBJECT (table_object));
+  for (l = objects; l != NULL; l = l->next)
+    {
+      UDisksObject *object = UDISKS_OBJECT (l->data);
+      UDisksPartition *partition = udisks_object_peek_partition (object);
+      if (partition != NULL &&
+          g_strcmp0 (udisks_partition_get_table (partition), table_object_path) == 0)
+        ret = g_list_prepend (ret, g_object_ref (object));
+    }
+  g_list_free_full (objects, g_object_unref);
+  return ret;
+}
+
+static gint
+compare_partition_numbers (gconstpointer a,
+                           gconstpointer b)
+{
+  guint number_a = udisks_partition_get_number (udisks_object_peek_partition (UDISKS_OBJECT (a)));
+  guint number_b = udisks_partition_get_number (udisks_object_peek_partition (UDISKS_OBJECT (b)));
+
+  return number_a < number_b ? -1 : (number_a > number_b ? 1 : 0);
+}
+
+typedef struct
+{
+  UDisksObject *partition_table_object;
+  GHashTable   *old_numbers;
+  guint         num_partitions;
+  GList        *partition_objects;
+} WaitForPartitionsData;
+
+static UDisksObject *
+wait_for_partitions (UDisksDaemon *daemon,
+                     gpointer      user_data)
+{
+  WaitForPartitionsData *data = user_data;
+  GList *objects, *l;
+  GList *new_objects = NULL;
+  guint num_new = 0;
+
+  objects = get_partition_objects (data->partition_table_object);
+  for (l = objects; l != NULL; l = l->next)
+    {
+      UDisksPartition *partition = udisks_object_peek_partition (UDISKS_OBJECT (l->data));
+      guint number = udisks_partition_get_number (partition);
+
+      if (!g_hash_table_contains (data->old_numbers, GUINT_TO_POINTER (number)))
+        {
+          new_objects = g_list_prepend (new_objects, g_object_ref (l->data));
+          num_new++;
+        }
+    }
+  g_list_free_full (objects, g_object_unref);
+
+  if (num_new < data->num_partitions)
+    {
+      g_list_free_full (new_objects, g_object_unref);
+      return NULL;
+    }
+
+  g_list_free_full (data->partition_objects, g_object_unref);
+  data->partition_objects = g_list_sort (new_objects, compare_partition_numbers);
+  return g_object_ref (data->partition_table_object);
+}
+
+/* Builds the sfdisk(8) script creating the partitions in @partitions
+ * (of type a(ttss)), one line per partition.
+ */
+static gchar *
+build_sfdisk_script (GVariant     *partitions,
+                     const gchar  *table_type,
+                     guint64       sector_size,
+                     guint64       grain,
+                     guint64       grain_offset,
+                     GError      **error)
+{
+  GString *script;
+  GVariantIter iter;
+  guint64 offset;
+  guint64 size;
+  const gchar *type;
+  const gchar *name;
+  guint n = 0;
+
+  script = g_string_new (NULL);
+  g_variant_iter_init (&iter, partitions);
+  while (g_variant_iter_next (&iter, "(tt&s&s)", &offset, &size, &type, &name))
+    {
+      if (g_strcmp0 (table_type, "dos") == 0)
+        {
+          char *endp;
+          gint type_as_int;
+
+          if (strlen (name) > 0)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Partition %u: MBR partition table does not support names", n);
+              goto fail;
+            }
+          type_as_int = strtol (type, &endp, 0);
+          if (type[0] != '\0' && *endp == '\0' &&
+              (type_as_int == 0x05 || type_as_int == 0x0f || type_as_int == 0x85))
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_NOT_SUPPORTED,
+                           "Partition %u: Extended partitions cannot be created in bulk", n);
+              goto fail;
+            }
+          if (g_str_has_prefix (type, "0x") || g_str_has_prefix (type, "0X"))
+            type += 2;
+        }
+      if (strchr (name, '"') != NULL || strchr (name, '\n') != NULL ||
+          strchr (type, ',') != NULL || strchr (type, '\n') != NULL)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Partition %u: Invalid characters in type or name", n);
+          goto fail;
+        }
+
+      if (offset > 0)
+        align_partition (grain, grain_offset, &offset, &size);
+      if (offset > 0)
+        g_string_append_printf (script, "start=%" G_GUINT64_FORMAT ", ",
+                                (offset + sector_size - 1) / sector_size);
+      if (size > 0)
+        g_string_append_printf (script, "size=%" G_GUINT64_FORMAT, size / sector_size);
+      else
+        g_string_append (script, "size=+");
+      if (strlen (type) > 0)
+        g_string_append_printf (script, ", type=%s", type);
+      if (strlen (name) > 0)
+        g_string_append_printf (script, ", name=\"%s\"", name);
+      g_string_append_c (script, '\n');
+      n++;
+    }
+
+  if (n == 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "No partitions to create");
+      goto fail;
+    }
+
+  return g_string_free (script, FALSE);
+
+ fail:
+  g_string_free (script, TRUE);
+  return NULL;
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+handle_create_partitions (UDisksPartitionTable   *table,
+                          GDBusMethodInvocation  *invocation,
+                          GVariant               *partitions,
+                          GVariant               *options)
+{
+  const gchar *action_id = NULL;
+  const gchar *message = NULL;
+  UDisksBlock *block = NULL;
+  UDisksObject *object = NULL;
+  UDisksDaemon *daemon = NULL;
+  UDisksLinuxDevice *device = NULL;
+  UDisksObject *waited_object = NULL;
+  WaitForPartitionsData wait_data = { NULL, NULL, 0, NULL };
+  GList *old_partitions = NULL;
+  GList *l;
+  const gchar *table_type;
+  guint64 sector_size = 0;
+  guint64 grain;
+  guint64 grain_offset;
+  gchar *script = NULL;
+  gchar *escaped_device = NULL;
+  gchar *error_message = NULL;
+  GPtrArray *object_paths = NULL;
+  gint status;
+  uid_t caller_uid;
+  gid_t caller_gid;
+  GError *error = NULL;
+  int fd = -1;
+
+  object = udisks_daemon_util_dup_object (table, &error);
+  if (object == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  daemon = udisks_linux_block_object_get_daemon (UDISKS_LINUX_BLOCK_OBJECT (object));
+  block = udisks_object_get_block (object);
+  if (block == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Partition table object is not a block device");
+      goto out;
+    }
+
+  if (!udisks_daemon_util_get_caller_uid_sync (daemon,
+                                               invocation,
+                                               NULL /* GCancellable */,
+                                               &caller_uid,
+                                               &caller_gid,
+                                               NULL,
+                                               &error))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  action_id = "org.freedesktop.udisks2.modify-device";
+  /* Translators: Shown in authentication dialog when the user
+   * requests creating new partitions.
+   *
+   * Do not translate $(drive), it's a placeholder and
+   * will be replaced by the name of the drive/device in question
+   */
+  message = N_("Authentication is required to create partitions on $(drive)");
+  if (!udisks_daemon_util_setup_by_user (daemon, object, caller_uid))
+    {
+      if (udisks_block_get_hint_system (block))
+        {
+          action_id = "org.freedesktop.udisks2.modify-device-system";
+        }
+      else if (!udisks_daemon_util_on_user_seat (daemon, object, caller_uid))
+        {
+          action_id = "org.freedesktop.udisks2.modify-device-other-seat";
+        }
+    }
+
+  if (!udisks_daemon_util_check_authorization_sync (daemon,
+                                                    object,
+                                                    action_id,
+                                                    options,
+                                                    message,
+                                                    invocation))
+    goto out;
+
+  table_type = udisks_partition_table_get_type_ (table);
+  if (g_strcmp0 (table_type, "dos") != 0 && g_strcmp0 (table_type, "gpt") != 0)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Don't know how to create partitions this partition table of type `%s'",
+                                             table_type);
+      goto out;
+    }
+
+  device = udisks_linux_block_object_get_device (UDISKS_LINUX_BLOCK_OBJECT (object));
+  if (device != NULL)
+    sector_size = g_udev_device_get_sysfs_attr_as_uint64 (device->udev_device, "queue/logical_block_size");
+  if (sector_size == 0)
+    sector_size = 512;
+
+  if (!get_partition_alignment (object, options, &grain, &grain_offset, &error))
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+  script = build_sfdisk_script (partitions, table_type, sector_size, grain, grain_offset, &error);
+  if (script == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  /* See handle_create_partition for a motivation of taking the lock. */
+  fd = flock_block_dev (table);
+
+  /* Remember the partitions that already exist so the new ones can be told apart */
+  wait_data.old_numbers = g_hash_table_new (g_direct_hash, g_direct_equal);
+  old_partitions = get_partition_objects (object);
+  for (l = old_partitions; l != NULL; l = l->next)
+    {
+      UDisksPartition *partition = udisks_object_peek_partition (UDISKS_OBJECT (l->data));
+      g_hash_table_add (wait_data.old_numbers,
+                        GUINT_TO_POINTER (udisks_partition_get_number (partition)));
+    }
+
+  /* Write all the partitions in one go and don't let sfdisk(8) tell
+   * the kernel about them one by one - we do that once below.
+   */
+  escaped_device = udisks_daemon_util_escape_and_quote (udisks_block_get_device (block));
+  if (!udisks_daemon_launch_spawned_job_sync (daemon,
+                                              object,
+                                              "partition-create", caller_uid,
+                                              NULL, /* cancellable */
+                                              0,    /* uid_t run_as_uid */
+                                              0,    /* uid_t run_as_euid */
+                                              &status,
+                                              &error_message,
+                                              script, /* input_string */
+                                              "sfdisk --append --no-reread --no-tell-kernel %s",
+                                              escaped_device))
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Error creating partitions on %s: %s",
+                                             udisks_block_get_device (block),
+                                             error_message);
+      goto out;
+    }
+
+  udisks_linux_block_object_reread_partition_table (UDISKS_LINUX_BLOCK_OBJECT (object));
+
+  /* sit and wait for all the partitions to show up */
+  wait_data.partition_table_object = object;
+  wait_data.num_partitions = g_variant_n_children (partitions);
+  waited_object = udisks_daemon_wait_for_object_sync (daemon,
+                                                      wait_for_partitions,
+                                                      &wait_data,
+                                                      NULL,
+                                                      30,
+                                                      &error);
+  if (waited_object == NULL)
+    {
+      g_prefix_error (&error, "Error waiting for partitions to appear: ");
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  /* wipe the newly created partitions */
+  object_paths = g_ptr_array_new ();
+  for (l = wait_data.partition_objects; l != NULL; l = l->next)
+    {
+      UDisksObject *partition_object = UDISKS_OBJECT (l->data);
+      UDisksBlock *partition_block = udisks_object_peek_block (partition_object);
+
+      if (partition_block == NULL)
+        {
+          g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                 "Partition object is not a block device");
+          goto out;
+        }
+      if (!bd_fs_wipe (udisks_block_get_device (partition_block), TRUE, &error))
+        {
+          if (g_error_matches (error, BD_FS_ERROR, BD_FS_ERROR_NOFS))
+            g_clear_error (&error);
+          else
+            {
+              g_dbus_method_invocation_return_error (invocation,
+                                                     UDISKS_ERROR,
+                                                     UDISKS_ERROR_FAILED,
+                                                     "Error wiping newly created partition %s: %s",
+                                                     udisks_block_get_device (partition_block),
+                                                     error->message);
+              goto out;
+            }
+        }
+      udisks_linux_block_object_trigger_uevent (UDISKS_LINUX_BLOCK_OBJECT (partition_object));
+      g_ptr_array_add (object_paths, (gpointer) g_dbus_object_get_object_path (G_DBUS_OBJECT (partition_object)));
+    }
+  g_ptr_array_add (object_paths, NULL);
+
+  udisks_partition_table_complete_create_partitions (table, invocation,
+                                                     (const gchar * const *) object_paths->pdata);
+
+ out:
+  unflock_block_dev (fd);
+  if (object_paths != NULL)
+    g_ptr_array_free (object_paths, TRUE);
+  if (wait_data.old_numbers != NULL)
+    g_hash_table_destroy (wait_data.old_numbers);
+  g_list_free_full (wait_data.partition_objects, g_object_unref);
+  g_list_free_full (old_partitions, g_object_unref);
+  g_clear_error (&error);
+  g_clear_object (&waited_object);
+  g_clear_object (&device);
+  g_free (error_message);
+  g_free (escaped_device);
+  g_free (script);
+  g_clear_object (&object);
+  g_clear_object (&block);
+  return TRUE; /* returning TRUE means that we handled the method invocation */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 partition_table_iface_init (UDisksPartitionTableIface *iface)
 {
   iface->handle_create_partition = handle_create_partition;
   iface->handle_create_partition_and_format = handle_create_partition_and_format;
+  iface->handle_create_partitions = handle_create_partitions;
 }
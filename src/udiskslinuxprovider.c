@@ -28,12 +28,18 @@
 #include "udisksprovider.h"
 #include "udiskslinuxprovider.h"
 #include "udiskslinuxblockobject.h"
+#include "udiskslinuxblock.h"
+#include "udiskslinuxfilesystem.h"
 #include "udiskslinuxdriveobject.h"
 #include "udiskslinuxmdraidobject.h"
+#include "udiskslinuxmdraid.h"
 #include "udiskslinuxmanager.h"
 #include "udisksstate.h"
 #include "udiskslinuxdevice.h"
 #include "udisksmodulemanager.h"
+#include "udisksconfigmanager.h"
+#include "udisksfstabentry.h"
+#include "udiskscrypttabentry.h"
 
 #include <modules/udisksmoduleifacetypes.h>
 #include <modules/udisksmoduleobject.h>
@@ -93,9 +99,26 @@ struct _UDisksLinuxProvider
   guint housekeeping_timeout;
   guint64 housekeeping_last;
   gboolean housekeeping_running;
+
+  /* time of the last scheduled trim, see housekeeping_trim() */
+  guint64 trim_last;
+
+  /* device specifications of changed fstab/crypttab entries, see queue_configuration_update() */
+  GHashTable *pending_config_specs;
+  guint config_update_source_id;
+
+  /* maps from ATA identity (WWN, serial, firmware) to AtaIdentifyData, see probe_device() */
+  GHashTable *ata_identify_cache;
+
+  /* sysfs paths of devices whose probe overran its deadline, see probe_with_deadline() */
+  GHashTable *quarantined_probes;
+  guint64 num_probes;
+  guint64 num_probes_timed_out;
+  gint64 probe_time_max;
 };
 
 G_LOCK_DEFINE_STATIC (provider_lock);
+G_LOCK_DEFINE_STATIC (ata_identify_cache_lock);
 
 struct _UDisksLinuxProviderClass
 {
@@ -173,6 +196,12 @@ udisks_linux_provider_finalize (GObject *object)
   if (provider->housekeeping_timeout > 0)
     g_source_remove (provider->housekeeping_timeout);
 
+  if (provider->config_update_source_id > 0)
+    g_source_remove (provider->config_update_source_id);
+  g_hash_table_unref (provider->pending_config_specs);
+  g_hash_table_unref (provider->ata_identify_cache);
+  g_hash_table_unref (provider->quarantined_probes);
+
   g_signal_handlers_disconnect_by_func (udisks_daemon_get_fstab_monitor (daemon),
                                         G_CALLBACK (fstab_monitor_on_entry_added),
                                         provider);
@@ -192,6 +221,366 @@ udisks_linux_provider_finalize (GObject *object)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+typedef struct
+{
+  guchar *device_data;
+  guchar *packet_device_data;
+} AtaIdentifyData;
+
+static void
+ata_identify_data_free (AtaIdentifyData *data)
+{
+  g_free (data->device_data);
+  g_free (data->packet_device_data);
+  g_slice_free (AtaIdentifyData, data);
+}
+
+/* Returns the key identifying the ATA drive behind @udev_device in the
+ * IDENTIFY cache or %NULL if @udev_device is not an ATA disk with a serial
+ * number. The firmware revision is part of the key since IDENTIFY data
+ * changes with firmware updates.
+ */
+static gchar *
+get_ata_identify_cache_key (GUdevDevice *udev_device)
+{
+  const gchar *wwn;
+  const gchar *serial;
+  const gchar *revision;
+
+  if (g_strcmp0 (g_udev_device_get_subsystem (udev_device), "block") != 0 ||
+      g_strcmp0 (g_udev_device_get_devtype (udev_device), "disk") != 0 ||
+      !g_udev_device_get_property_as_boolean (udev_device, "ID_ATA"))
+    return NULL;
+
+  serial = g_udev_device_get_property (udev_device, "ID_SERIAL_SHORT");
+  if (serial == NULL || strlen (serial) == 0)
+    serial = g_udev_device_get_property (udev_device, "ID_SERIAL");
+  if (serial == NULL || strlen (serial) == 0)
+    return NULL;
+
+  wwn = g_udev_device_get_property (udev_device, "ID_WWN_WITH_EXTENSION");
+  if (wwn == NULL || strlen (wwn) == 0)
+    wwn = g_udev_device_get_property (udev_device, "ID_WWN");
+  revision = g_udev_device_get_property (udev_device, "ID_REVISION");
+
+  return g_strdup_printf ("%s\t%s\t%s", wwn != NULL ? wwn : "", serial, revision != NULL ? revision : "");
+}
+
+/* IDENTIFY on a dying disk, e.g. behind a SATA port multiplier, can hang
+ * for minutes - never hold up the probing thread longer than this
+ */
+#define PROBE_TIMEOUT_SECONDS 10
+
+typedef struct
+{
+  volatile gint ref_count;
+  UDisksLinuxProvider *provider;
+  GUdevDevice *udev_device;
+  gchar *cache_key;
+  UDisksLinuxDevice *device;
+  gboolean done;
+  gboolean quarantined;
+} ProbeTask;
+
+/* protects ProbeTask and the probe statistics */
+static GMutex probe_mutex;
+static GCond probe_cond;
+
+static ProbeTask *
+probe_task_ref (ProbeTask *task)
+{
+  g_atomic_int_inc (&task->ref_count);
+  return task;
+}
+
+static void
+probe_task_unref (ProbeTask *task)
+{
+  if (g_atomic_int_dec_and_test (&task->ref_count))
+    {
+      g_object_unref (task->provider);
+      g_object_unref (task->udev_device);
+      g_clear_object (&task->device);
+      g_free (task->cache_key);
+      g_slice_free (ProbeTask, task);
+    }
+}
+
+static void
+update_probe_statistics (UDisksLinuxProvider *provider)
+{
+  UDisksManager *manager;
+  GVariantBuilder builder;
+
+  manager = udisks_object_peek_manager (UDISKS_OBJECT (provider->manager_object));
+  if (manager == NULL)
+    return;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_mutex_lock (&probe_mutex);
+  g_variant_builder_add (&builder, "{sv}", "probes", g_variant_new_uint64 (provider->num_probes));
+  g_variant_builder_add (&builder, "{sv}", "probes-timed-out", g_variant_new_uint64 (provider->num_probes_timed_out));
+  g_variant_builder_add (&builder, "{sv}", "probes-pending",
+                         g_variant_new_uint32 (g_hash_table_size (provider->quarantined_probes)));
+  g_variant_builder_add (&builder, "{sv}", "probe-time-max", g_variant_new_uint64 (provider->probe_time_max));
+  g_mutex_unlock (&probe_mutex);
+
+  udisks_manager_set_probe_statistics (manager, g_variant_builder_end (&builder));
+}
+
+static gboolean
+on_idle_update_probe_statistics (gpointer user_data)
+{
+  UDisksLinuxProvider *provider = UDISKS_LINUX_PROVIDER (user_data);
+  update_probe_statistics (provider);
+  g_object_unref (provider);
+  return FALSE; /* remove source */
+}
+
+/* called in main thread when a quarantined probe finally finished */
+static gboolean
+on_idle_quarantined_probe_done (gpointer user_data)
+{
+  ProbeTask *task = user_data;
+  UDisksLinuxProvider *provider = task->provider;
+  const gchar *sysfs_path = g_udev_device_get_sysfs_path (task->udev_device);
+  GUdevDevice *udev_device = NULL;
+  UDisksLinuxDevice *device;
+  AtaIdentifyData *data;
+
+  g_mutex_lock (&probe_mutex);
+  g_hash_table_remove (provider->quarantined_probes, sysfs_path);
+  g_mutex_unlock (&probe_mutex);
+  update_probe_statistics (provider);
+
+  if (task->device->ata_identify_device_data == NULL && task->device->ata_identify_packet_device_data == NULL)
+    {
+      /* still republish below, the device is no longer pending */
+      udisks_warning ("Quarantined probe of %s finished without IDENTIFY data", sysfs_path);
+    }
+  else
+    {
+      udisks_notice ("Quarantined probe of %s finished", sysfs_path);
+
+      data = g_slice_new0 (AtaIdentifyData);
+      if (task->device->ata_identify_device_data != NULL)
+        data->device_data = g_memdup (task->device->ata_identify_device_data, 512);
+      if (task->device->ata_identify_packet_device_data != NULL)
+        data->packet_device_data = g_memdup (task->device->ata_identify_packet_device_data, 512);
+      G_LOCK (ata_identify_cache_lock);
+      g_hash_table_insert (provider->ata_identify_cache, g_strdup (task->cache_key), data);
+      G_UNLOCK (ata_identify_cache_lock);
+    }
+
+  /* publish the result using the current udev state of the device, if it is
+   * still around - the new device has probe_pending unset either way
+   */
+  udev_device = g_udev_client_query_by_sysfs_path (provider->gudev_client, sysfs_path);
+  if (udev_device == NULL)
+    goto out;
+  device = udisks_linux_device_new_with_ata_identify (udev_device,
+                                                      task->device->ata_identify_device_data,
+                                                      task->device->ata_identify_packet_device_data);
+  udisks_linux_provider_handle_uevent (provider, "change", device);
+  g_object_unref (device);
+
+ out:
+  g_clear_object (&udev_device);
+  probe_task_unref (task);
+  return FALSE; /* remove source */
+}
+
+static gpointer
+probe_task_thread_func (gpointer user_data)
+{
+  ProbeTask *task = user_data;
+  UDisksLinuxDevice *device;
+  gboolean quarantined;
+
+  device = udisks_linux_device_new_sync (task->udev_device);
+
+  g_mutex_lock (&probe_mutex);
+  task->device = device;
+  task->done = TRUE;
+  quarantined = task->quarantined;
+  g_cond_broadcast (&probe_cond);
+  g_mutex_unlock (&probe_mutex);
+
+  if (quarantined)
+    g_idle_add (on_idle_quarantined_probe_done, probe_task_ref (task));
+
+  probe_task_unref (task);
+  return NULL;
+}
+
+/* Probes @udev_device in a separate thread and waits at most
+ * PROBE_TIMEOUT_SECONDS for it. If the probe overruns, it is left to
+ * finish in quarantine (see on_idle_quarantined_probe_done()) and a
+ * device without IDENTIFY data and with probe_pending set is returned
+ * right away so uevents of other devices keep flowing. Until the probe
+ * returns, further probes of the same device are not attempted.
+ */
+static UDisksLinuxDevice *
+probe_with_deadline (UDisksLinuxProvider *provider,
+                     GUdevDevice         *udev_device,
+                     const gchar         *cache_key)
+{
+  const gchar *sysfs_path = g_udev_device_get_sysfs_path (udev_device);
+  UDisksLinuxDevice *device = NULL;
+  ProbeTask *task;
+  GThread *thread;
+  gint64 started;
+  gint64 deadline;
+  gint64 elapsed;
+
+  g_mutex_lock (&probe_mutex);
+  if (g_hash_table_contains (provider->quarantined_probes, sysfs_path))
+    {
+      g_mutex_unlock (&probe_mutex);
+      device = udisks_linux_device_new_with_ata_identify (udev_device, NULL, NULL);
+      device->probe_pending = TRUE;
+      goto out;
+    }
+  g_mutex_unlock (&probe_mutex);
+
+  task = g_slice_new0 (ProbeTask);
+  task->ref_count = 2; /* one for us, one for the thread */
+  task->provider = g_object_ref (provider);
+  task->udev_device = g_object_ref (udev_device);
+  task->cache_key = g_strdup (cache_key);
+
+  started = g_get_monotonic_time ();
+  deadline = started + PROBE_TIMEOUT_SECONDS * G_TIME_SPAN_SECOND;
+  thread = g_thread_new ("probe-device", probe_task_thread_func, task);
+  g_thread_unref (thread);
+
+  g_mutex_lock (&probe_mutex);
+  while (!task->done)
+    {
+      if (!g_cond_wait_until (&probe_cond, &probe_mutex, deadline))
+        break;
+    }
+  elapsed = g_get_monotonic_time () - started;
+  provider->num_probes++;
+  provider->probe_time_max = MAX (provider->probe_time_max, elapsed);
+  if (task->done)
+    {
+      device = g_object_ref (task->device);
+    }
+  else
+    {
+      task->quarantined = TRUE;
+      provider->num_probes_timed_out++;
+      g_hash_table_add (provider->quarantined_probes, g_strdup (sysfs_path));
+    }
+  g_mutex_unlock (&probe_mutex);
+
+  if (device == NULL)
+    {
+      udisks_warning ("Probing %s did not finish within %d seconds, quarantining it",
+                      g_udev_device_get_device_file (udev_device), PROBE_TIMEOUT_SECONDS);
+      device = udisks_linux_device_new_with_ata_identify (udev_device, NULL, NULL);
+      device->probe_pending = TRUE;
+    }
+  g_idle_add (on_idle_update_probe_statistics, g_object_ref (provider));
+  probe_task_unref (task);
+
+ out:
+  return device;
+}
+
+/* Creates a #UDisksLinuxDevice for @udev_device. For ATA disks the IDENTIFY
+ * data is cached so "change" uevents - a single partition table write
+ * causes several of them - don't cost any ATA command round-trips. The
+ * cache entry is dropped on "add" and "remove" uevents (the drive may
+ * have been replaced) and through
+ * udisks_linux_provider_invalidate_ata_identify().
+ */
+static UDisksLinuxDevice *
+probe_device (UDisksLinuxProvider *provider,
+              GUdevDevice         *udev_device)
+{
+  const gchar *action = g_udev_device_get_action (udev_device);
+  UDisksLinuxDevice *device = NULL;
+  AtaIdentifyData *data;
+  gchar *key;
+
+  key = get_ata_identify_cache_key (udev_device);
+  if (key == NULL)
+    return udisks_linux_device_new_sync (udev_device);
+
+  G_LOCK (ata_identify_cache_lock);
+  if (g_strcmp0 (action, "change") == 0)
+    {
+      data = g_hash_table_lookup (provider->ata_identify_cache, key);
+      if (data != NULL)
+        device = udisks_linux_device_new_with_ata_identify (udev_device,
+                                                            data->device_data,
+                                                            data->packet_device_data);
+    }
+  else
+    {
+      g_hash_table_remove (provider->ata_identify_cache, key);
+    }
+  G_UNLOCK (ata_identify_cache_lock);
+
+  if (device != NULL)
+    goto out;
+
+  /* no point in probing on remove events */
+  if (g_strcmp0 (action, "remove") == 0)
+    device = udisks_linux_device_new_sync (udev_device);
+  else
+    device = probe_with_deadline (provider, udev_device, key);
+  if (device->ata_identify_device_data != NULL || device->ata_identify_packet_device_data != NULL)
+    {
+      data = g_slice_new0 (AtaIdentifyData);
+      if (device->ata_identify_device_data != NULL)
+        data->device_data = g_memdup (device->ata_identify_device_data, 512);
+      if (device->ata_identify_packet_device_data != NULL)
+        data->packet_device_data = g_memdup (device->ata_identify_packet_device_data, 512);
+
+      G_LOCK (ata_identify_cache_lock);
+      g_hash_table_insert (provider->ata_identify_cache, key, data);
+      G_UNLOCK (ata_identify_cache_lock);
+      key = NULL; /* owned by the cache now */
+    }
+
+ out:
+  g_free (key);
+  return device;
+}
+
+/**
+ * udisks_linux_provider_invalidate_ata_identify:
+ * @provider: A #UDisksLinuxProvider.
+ * @udev_device: A #GUdevDevice for an ATA disk.
+ *
+ * Drops the cached IDENTIFY data for @udev_device so it is probed again
+ * on the next uevent. This must be called whenever something is done
+ * that changes the IDENTIFY data, e.g. changing drive settings.
+ */
+void
+udisks_linux_provider_invalidate_ata_identify (UDisksLinuxProvider *provider,
+                                               GUdevDevice         *udev_device)
+{
+  gchar *key;
+
+  g_return_if_fail (UDISKS_IS_LINUX_PROVIDER (provider));
+  g_return_if_fail (G_UDEV_IS_DEVICE (udev_device));
+
+  key = get_ata_identify_cache_key (udev_device);
+  if (key == NULL)
+    return;
+
+  G_LOCK (ata_identify_cache_lock);
+  g_hash_table_remove (provider->ata_identify_cache, key);
+  G_UNLOCK (ata_identify_cache_lock);
+  g_free (key);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 typedef struct
 {
   UDisksLinuxProvider *provider;
@@ -241,7 +630,7 @@ probe_request_thread_func (gpointer user_data)
         goto out;
 
       /* probe the device - this may take a while */
-      request->udisks_device = udisks_linux_device_new_sync (request->udev_device);
+      request->udisks_device = probe_device (provider, request->udev_device);
 
       /* now that we've probed the device, post the request back to the main thread */
       g_idle_add (on_idle_with_probed_uevent, request);
@@ -288,6 +677,11 @@ udisks_linux_provider_init (UDisksLinuxProvider *provider)
                     G_CALLBACK (on_uevent),
                     provider);
 
+  provider->ata_identify_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                       (GDestroyNotify) ata_identify_data_free);
+
+  provider->quarantined_probes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
   provider->probe_request_queue = g_async_queue_new ();
   provider->probe_request_thread = g_thread_new ("probing-thread",
                                                  probe_request_thread_func,
@@ -315,6 +709,8 @@ udisks_linux_provider_init (UDisksLinuxProvider *provider)
   g_object_unref (file);
 
   provider->module_ifaces = NULL;
+
+  provider->pending_config_specs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
@@ -324,6 +720,19 @@ synthesize_uevent_for_id (UDisksLinuxProvider *provider,
 {
   GHashTableIter iter;
   UDisksLinuxDriveObject *drive_object;
+  UDisksLinuxMDRaidObject *mdraid_object;
+
+  /* configuration of RAID arrays, see udiskslinuxmdraid.c */
+  if (g_str_has_prefix (id, "mdraid-"))
+    {
+      mdraid_object = g_hash_table_lookup (provider->uuid_to_mdraid, id + strlen ("mdraid-"));
+      if (mdraid_object != NULL)
+        {
+          udisks_debug ("synthesizing %s event on RAID array with UUID %s", action, id + strlen ("mdraid-"));
+          udisks_linux_mdraid_object_uevent (mdraid_object, action, NULL, FALSE);
+        }
+      return;
+    }
 
   /* TODO: could have a GHashTable from id to UDisksLinuxDriveObject */
   g_hash_table_iter_init (&iter, provider->sysfs_path_to_drive);
@@ -433,7 +842,7 @@ get_udisks_devices (UDisksLinuxProvider *provider)
       GUdevDevice *device = G_UDEV_DEVICE (l->data);
       if (!g_udev_device_get_is_initialized (device))
         continue;
-      udisks_devices = g_list_prepend (udisks_devices, udisks_linux_device_new_sync (device));
+      udisks_devices = g_list_prepend (udisks_devices, probe_device (provider, device));
     }
   udisks_devices = g_list_reverse (udisks_devices);
   g_list_free_full (devices, g_object_unref);
@@ -638,6 +1047,7 @@ udisks_linux_provider_start (UDisksProvider *_provider)
   manager = udisks_linux_manager_new (daemon);
   udisks_object_skeleton_set_manager (provider->manager_object, manager);
   g_object_unref (manager);
+  update_probe_statistics (provider);
 
   module_manager = udisks_daemon_get_module_manager (daemon);
   g_signal_connect_swapped (module_manager, "notify::modules-ready", G_CALLBACK (ensure_modules), provider);
@@ -1026,6 +1436,33 @@ handle_block_uevent_for_drive (UDisksLinuxProvider *provider,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* called with lock held */
+static void
+update_partition_index (UDisksDaemon           *daemon,
+                        UDisksLinuxBlockObject *object,
+                        gboolean                removed)
+{
+  UDisksPartition *partition;
+  UDisksObject *table_object;
+
+  partition = udisks_object_peek_partition (UDISKS_OBJECT (object));
+  if (partition == NULL)
+    return;
+
+  table_object = udisks_daemon_find_object (daemon, udisks_partition_get_table (partition));
+  if (table_object == NULL)
+    return;
+
+  if (UDISKS_IS_LINUX_BLOCK_OBJECT (table_object))
+    {
+      if (removed)
+        udisks_linux_block_object_unindex_partition (UDISKS_LINUX_BLOCK_OBJECT (table_object), object);
+      else
+        udisks_linux_block_object_index_partition (UDISKS_LINUX_BLOCK_OBJECT (table_object), object);
+    }
+  g_object_unref (table_object);
+}
+
 /* called with lock held */
 static void
 handle_block_uevent_for_block (UDisksLinuxProvider *provider,
@@ -1044,6 +1481,7 @@ handle_block_uevent_for_block (UDisksLinuxProvider *provider,
       object = g_hash_table_lookup (provider->sysfs_to_block, sysfs_path);
       if (object != NULL)
         {
+          update_partition_index (daemon, object, TRUE);
           g_dbus_object_manager_server_unexport (udisks_daemon_get_object_manager (daemon),
                                                  g_dbus_object_get_object_path (G_DBUS_OBJECT (object)));
           g_warn_if_fail (g_hash_table_remove (provider->sysfs_to_block, sysfs_path));
@@ -1063,6 +1501,8 @@ handle_block_uevent_for_block (UDisksLinuxProvider *provider,
                                                         G_DBUS_OBJECT_SKELETON (object));
           g_hash_table_insert (provider->sysfs_to_block, g_strdup (sysfs_path), object);
         }
+      /* also on change since the partition may have moved */
+      update_partition_index (daemon, object, FALSE);
     }
 }
 
@@ -1370,6 +1810,41 @@ housekeeping_all_modules (UDisksLinuxProvider *provider,
   g_list_free (objects);
 }
 
+/* Runs in housekeeping thread - called without lock held */
+static void
+housekeeping_trim (UDisksLinuxProvider *provider,
+                   guint64              now)
+{
+  UDisksDaemon *daemon;
+  guint interval;
+
+  daemon = udisks_provider_get_daemon (UDISKS_PROVIDER (provider));
+  interval = udisks_config_manager_get_trim_interval (udisks_daemon_get_config_manager (daemon));
+  if (interval == 0)
+    return;
+
+  /* don't add to the load right after start-up, wait for a full interval */
+  if (provider->trim_last == 0)
+    {
+      provider->trim_last = now;
+      return;
+    }
+
+  if (now - provider->trim_last < (guint64) interval * 60 * 60)
+    return;
+  provider->trim_last = now;
+
+  udisks_linux_filesystem_trim_all (daemon);
+}
+
+/* Runs in housekeeping thread - called without lock held */
+static void
+housekeeping_mdraid_scrub (UDisksLinuxProvider *provider)
+{
+  /* arrays can enable checks in their own configuration so always look */
+  udisks_linux_mdraid_scrub_all (udisks_provider_get_daemon (UDISKS_PROVIDER (provider)));
+}
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 static void
@@ -1394,6 +1869,8 @@ housekeeping_thread_func (GTask           *task,
 
   housekeeping_all_drives (provider, secs_since_last);
   housekeeping_all_modules (provider, secs_since_last);
+  housekeeping_trim (provider, now);
+  housekeeping_mdraid_scrub (provider);
 
   udisks_info ("Housekeeping complete");
   G_LOCK (provider_lock);
@@ -1425,25 +1902,82 @@ on_housekeeping_timeout (gpointer user_data)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static void
-update_all_block_objects (UDisksLinuxProvider *provider)
+/* called in the main thread, once all fstab/crypttab entry changes of a reload have been queued */
+static gboolean
+on_configuration_update_idle (gpointer user_data)
 {
+  UDisksLinuxProvider *provider = UDISKS_LINUX_PROVIDER (user_data);
   GList *objects;
   GList *l;
 
+  provider->config_update_source_id = 0;
+
   G_LOCK (provider_lock);
   objects = g_hash_table_get_values (provider->sysfs_to_block);
   g_list_foreach (objects, (GFunc) g_object_ref, NULL);
   G_UNLOCK (provider_lock);
 
+  /* Only update the block objects that any of the changed entries refer to */
   for (l = objects; l != NULL; l = l->next)
     {
       UDisksLinuxBlockObject *object = UDISKS_LINUX_BLOCK_OBJECT (l->data);
-      udisks_linux_block_object_uevent (object, "change", NULL);
+      UDisksBlock *block;
+      gchar **specs;
+      guint n;
+
+      block = udisks_object_peek_block (UDISKS_OBJECT (object));
+      if (block == NULL)
+        continue;
+
+      specs = udisks_linux_block_dup_device_specs (UDISKS_LINUX_BLOCK (block));
+      for (n = 0; specs[n] != NULL; n++)
+        {
+          if (g_hash_table_contains (provider->pending_config_specs, specs[n]))
+            {
+              udisks_linux_block_object_uevent (object, "change", NULL);
+              break;
+            }
+        }
+      g_strfreev (specs);
     }
 
+  g_hash_table_remove_all (provider->pending_config_specs);
+
   g_list_foreach (objects, (GFunc) g_object_unref, NULL);
   g_list_free (objects);
+
+  return FALSE; /* remove source */
+}
+
+/* Records that the fstab/crypttab entry for @spec with @options was added or
+ * removed. Block objects matching @spec, and the parents tracked with
+ * x-parent= in @options, are updated in a single pass once the monitor has
+ * reported all changes.
+ */
+static void
+queue_configuration_update (UDisksLinuxProvider *provider,
+                            const gchar         *spec,
+                            const gchar         *options)
+{
+  gchar **tokens;
+  guint n;
+
+  g_hash_table_add (provider->pending_config_specs, g_strdup (spec));
+
+  if (options != NULL)
+    {
+      tokens = g_strsplit (options, ",", -1);
+      for (n = 0; tokens[n] != NULL; n++)
+        {
+          if (g_str_has_prefix (tokens[n], "x-parent="))
+            g_hash_table_add (provider->pending_config_specs,
+                              g_strdup_printf ("UUID=%s", tokens[n] + strlen ("x-parent=")));
+        }
+      g_strfreev (tokens);
+    }
+
+  if (provider->config_update_source_id == 0)
+    provider->config_update_source_id = g_idle_add (on_configuration_update_idle, provider);
 }
 
 static void
@@ -1452,7 +1986,9 @@ fstab_monitor_on_entry_added (UDisksFstabMonitor *monitor,
                               gpointer            user_data)
 {
   UDisksLinuxProvider *provider = UDISKS_LINUX_PROVIDER (user_data);
-  update_all_block_objects (provider);
+  queue_configuration_update (provider,
+                              udisks_fstab_entry_get_fsname (entry),
+                              udisks_fstab_entry_get_opts (entry));
 }
 
 static void
@@ -1461,7 +1997,9 @@ fstab_monitor_on_entry_removed (UDisksFstabMonitor *monitor,
                                 gpointer            user_data)
 {
   UDisksLinuxProvider *provider = UDISKS_LINUX_PROVIDER (user_data);
-  update_all_block_objects (provider);
+  queue_configuration_update (provider,
+                              udisks_fstab_entry_get_fsname (entry),
+                              udisks_fstab_entry_get_opts (entry));
 }
 
 static void
@@ -1470,7 +2008,9 @@ crypttab_monitor_on_entry_added (UDisksCrypttabMonitor *monitor,
                                  gpointer               user_data)
 {
   UDisksLinuxProvider *provider = UDISKS_LINUX_PROVIDER (user_data);
-  update_all_block_objects (provider);
+  queue_configuration_update (provider,
+                              udisks_crypttab_entry_get_device (entry),
+                              udisks_crypttab_entry_get_options (entry));
 }
 
 static void
@@ -1479,5 +2019,7 @@ crypttab_monitor_on_entry_removed (UDisksCrypttabMonitor *monitor,
                                    gpointer               user_data)
 {
   UDisksLinuxProvider *provider = UDISKS_LINUX_PROVIDER (user_data);
-  update_all_block_objects (provider);
+  queue_configuration_update (provider,
+                              udisks_crypttab_entry_get_device (entry),
+                              udisks_crypttab_entry_get_options (entry));
 }
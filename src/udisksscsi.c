@@ -0,0 +1,294 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008 David Zeuthen <zeuthen@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <scsi/scsi.h>
+#include <scsi/sg.h>
+
+#include <stdint.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "udisksscsi.h"
+#include "udisksprivate.h"
+#include "udiskslogging.h"
+#include "udisksdaemonutil.h"
+
+#define UDISKS_SCSI_DEFAULT_COMMAND_TIMEOUT_MSEC (5 * 1000)
+
+/**
+ * SECTION:udisksscsi
+ * @title: SCSI commands
+ * @short_description: Helper routines for SCSI commands
+ *
+ * Helper routines for sending SCSI commands to a device and parsing
+ * the returned data.
+ */
+
+/* SPC-4: 4.5 Sense data - returns the sense key, ASC and ASCQ in either format */
+static gboolean
+decode_sense (const guint8 *sense,
+              gsize         sense_len,
+              guint8       *sense_key,
+              guint8       *asc,
+              guint8       *ascq)
+{
+  switch (sense[0] & 0x7f)
+    {
+    case 0x70:
+    case 0x71:
+      /* fixed format */
+      if (sense_len < 14)
+        return FALSE;
+      *sense_key = sense[2] & 0x0f;
+      *asc = sense[12];
+      *ascq = sense[13];
+      return TRUE;
+
+    case 0x72:
+    case 0x73:
+      /* descriptor format */
+      if (sense_len < 4)
+        return FALSE;
+      *sense_key = sense[1] & 0x0f;
+      *asc = sense[2];
+      *ascq = sense[3];
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
+/**
+ * udisks_scsi_log_sense_sync:
+ * @fd: A file descriptor for a SCSI device.
+ * @timeout_msec: Timeout in milli-seconds for the command. Use -1 for the default (5 seconds) timeout.
+ * @page_code: The log page to read.
+ * @buffer: Return location for the log page, including the 4 byte page header.
+ * @buffer_size: Size of @buffer. Must be at least 4 and less than 65536.
+ * @out_length: (allow-none): Return location for the number of valid bytes in @buffer or %NULL.
+ * @error: Return location for error or %NULL.
+ *
+ * Sends a LOG SENSE command for the cumulative values of @page_code to
+ * a SCSI device. Blocks the calling thread while the command is
+ * pending. If the page does not fit into @buffer, it is truncated.
+ *
+ * Returns: %TRUE if the command succeded, %FALSE if @error is set.
+ */
+gboolean
+udisks_scsi_log_sense_sync (gint      fd,
+                            gint      timeout_msec,
+                            guint8    page_code,
+                            guchar   *buffer,
+                            gsize     buffer_size,
+                            gsize    *out_length,
+                            GError  **error)
+{
+  struct sg_io_hdr io_hdr;
+  uint8_t cdb[10];
+  uint8_t sense[32];
+  guint8 sense_key = 0, asc = 0, ascq = 0;
+  gsize length;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (fd != -1, FALSE);
+  g_return_val_if_fail (timeout_msec == -1 || timeout_msec > 0, FALSE);
+  g_return_val_if_fail (page_code <= 0x3f, FALSE);
+  g_return_val_if_fail (buffer != NULL, FALSE);
+  g_return_val_if_fail (buffer_size >= 4 && buffer_size <= 0xffff, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (timeout_msec == -1)
+    timeout_msec = UDISKS_SCSI_DEFAULT_COMMAND_TIMEOUT_MSEC;
+
+  /* zero outputs, even if returning an error */
+  memset (buffer, 0, buffer_size);
+  if (out_length != NULL)
+    *out_length = 0;
+
+  /* SPC-4: 6.6 LOG SENSE command */
+  memset (cdb, 0, sizeof (cdb));
+  cdb[0] = 0x4d;                            /* OPERATION CODE: LOG SENSE */
+  cdb[2] = (0x01 << 6) | page_code;         /* PC: cumulative values, PAGE CODE */
+  cdb[7] = (buffer_size >> 8) & 0xff;       /* ALLOCATION LENGTH */
+  cdb[8] = (buffer_size >> 0) & 0xff;
+
+  /* See http://sg.danny.cz/sg/sg_io.html and http://www.tldp.org/HOWTO/SCSI-Generic-HOWTO/index.html
+   * for detailed information about how the SG_IO ioctl work
+   */
+  memset (sense, 0, sizeof (sense));
+  memset (&io_hdr, 0, sizeof (struct sg_io_hdr));
+  io_hdr.interface_id = 'S';
+  io_hdr.cmdp = (unsigned char*) cdb;
+  io_hdr.cmd_len = sizeof (cdb);
+  io_hdr.dxferp = buffer;
+  io_hdr.dxfer_len = buffer_size;
+  io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+  io_hdr.sbp = sense;
+  io_hdr.mx_sb_len = sizeof (sense);
+  io_hdr.timeout = timeout_msec;
+
+  if (ioctl (fd, SG_IO, &io_hdr) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "SGIO v3 ioctl failed: %m");
+      goto out;
+    }
+
+  if (io_hdr.host_status != 0 || (io_hdr.driver_status & 0x0f & ~DRIVER_SENSE) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "LOG SENSE for page 0x%02x failed: host_status=0x%02x driver_status=0x%02x",
+                   (guint) page_code, (guint) io_hdr.host_status, (guint) io_hdr.driver_status);
+      goto out;
+    }
+
+  if (io_hdr.status != 0)
+    {
+      if (io_hdr.sb_len_wr > 0 && decode_sense (sense, io_hdr.sb_len_wr, &sense_key, &asc, &ascq))
+        {
+          /* ILLEGAL REQUEST, INVALID FIELD IN CDB - the page is not supported */
+          g_set_error (error, G_IO_ERROR,
+                       (sense_key == 0x05 && asc == 0x24) ? G_IO_ERROR_NOT_SUPPORTED : G_IO_ERROR_FAILED,
+                       "LOG SENSE for page 0x%02x failed: sense_key=0x%02x asc=0x%02x ascq=0x%02x",
+                       (guint) page_code, (guint) sense_key, (guint) asc, (guint) ascq);
+        }
+      else
+        {
+          gchar *s = udisks_daemon_util_hexdump (sense, sizeof (sense));
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "LOG SENSE for page 0x%02x failed with status 0x%02x, sense data:\n%s",
+                       (guint) page_code, (guint) io_hdr.status, s);
+          g_free (s);
+        }
+      goto out;
+    }
+
+  /* SPC-4: 7.3.1 Log page structure - the PAGE LENGTH excludes the header */
+  length = ((buffer[2] << 8) | buffer[3]) + 4;
+  if ((buffer[0] & 0x3f) != page_code)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "LOG SENSE for page 0x%02x returned page 0x%02x",
+                   (guint) page_code, (guint) (buffer[0] & 0x3f));
+      goto out;
+    }
+
+  if (out_length != NULL)
+    *out_length = MIN (length, buffer_size - (gsize) io_hdr.resid);
+
+  ret = TRUE;
+
+ out:
+  return ret;
+}
+
+/**
+ * udisks_scsi_log_page_find_parameter:
+ * @page: A log page, including the 4 byte page header.
+ * @page_length: The length of @page.
+ * @parameter_code: The parameter to look for.
+ * @out_length: Return location for the length of the parameter value.
+ *
+ * Looks up a log parameter in a log page as returned by
+ * udisks_scsi_log_sense_sync().
+ *
+ * Returns: A pointer to the value of the parameter within @page or
+ * %NULL if the page does not contain the parameter.
+ */
+const guchar *
+udisks_scsi_log_page_find_parameter (const guchar *page,
+                                     gsize         page_length,
+                                     guint16       parameter_code,
+                                     gsize        *out_length)
+{
+  gsize offset;
+
+  g_return_val_if_fail (out_length != NULL, NULL);
+
+  if (page_length < 4)
+    return NULL;
+  page_length = MIN (page_length, ((gsize) ((page[2] << 8) | page[3])) + 4);
+
+  /* SPC-4: 7.3.2 Log parameter structure */
+  offset = 4;
+  while (offset + 4 <= page_length)
+    {
+      guint16 code = (page[offset] << 8) | page[offset + 1];
+      gsize length = page[offset + 3];
+
+      if (offset + 4 + length > page_length)
+        break;
+
+      if (code == parameter_code)
+        {
+          *out_length = length;
+          return page + offset + 4;
+        }
+      offset += 4 + length;
+    }
+  return NULL;
+}
+
+/**
+ * udisks_scsi_log_page_get_parameter:
+ * @page: A log page, including the 4 byte page header.
+ * @page_length: The length of @page.
+ * @parameter_code: The parameter to look for.
+ * @default_value: The value to return if the parameter is not available.
+ *
+ * Gets the value of a counter log parameter in a log page as returned
+ * by udisks_scsi_log_sense_sync(). Values wider than 64 bits are
+ * truncated to the least significant 64 bits.
+ *
+ * Returns: The value or @default_value.
+ */
+guint64
+udisks_scsi_log_page_get_parameter (const guchar *page,
+                                    gsize         page_length,
+                                    guint16       parameter_code,
+                                    guint64       default_value)
+{
+  const guchar *value;
+  gsize length = 0;
+  guint64 ret = 0;
+  gsize n;
+
+  value = udisks_scsi_log_page_find_parameter (page, page_length, parameter_code, &length);
+  if (value == NULL || length == 0)
+    return default_value;
+
+  /* big-endian, of any length */
+  for (n = length > 8 ? length - 8 : 0; n < length; n++)
+    ret = (ret << 8) | value[n];
+  return ret;
+}
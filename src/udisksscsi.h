@@ -0,0 +1,48 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2010 David Zeuthen <zeuthen@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __UDISKS_SCSI_H__
+#define __UDISKS_SCSI_H__
+
+#include "udisksdaemontypes.h"
+
+G_BEGIN_DECLS
+
+gboolean udisks_scsi_log_sense_sync (gint      fd,
+                                     gint      timeout_msec,
+                                     guint8    page_code,
+                                     guchar   *buffer,
+                                     gsize     buffer_size,
+                                     gsize    *out_length,
+                                     GError  **error);
+
+const guchar *udisks_scsi_log_page_find_parameter (const guchar *page,
+                                                   gsize         page_length,
+                                                   guint16       parameter_code,
+                                                   gsize        *out_length);
+
+guint64  udisks_scsi_log_page_get_parameter (const guchar *page,
+                                             gsize         page_length,
+                                             guint16       parameter_code,
+                                             guint64       default_value);
+
+G_END_DECLS
+
+#endif /* __UDISKS_SCSI_H__ */
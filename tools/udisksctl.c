@@ -1842,6 +1842,8 @@ handle_command_smart_simulate (gint        *argc,
   GList *objects;
   UDisksObject *object;
   UDisksDriveAta *ata;
+  UDisksDriveNVMe *nvme;
+  UDisksDriveScsi *scsi;
   guint n;
   GVariant *options;
   GVariantBuilder builder;
@@ -1924,7 +1926,9 @@ handle_command_smart_simulate (gint        *argc,
             {
               object = UDISKS_OBJECT (l->data);
               ata = udisks_object_peek_drive_ata (object);
-              if (ata != NULL)
+              nvme = udisks_object_peek_drive_nvme (object);
+              scsi = udisks_object_peek_drive_scsi (object);
+              if (ata != NULL || nvme != NULL || scsi != NULL)
                 {
                   object_path = g_dbus_object_get_object_path (G_DBUS_OBJECT (object));
                   g_assert (g_str_has_prefix (object_path, "/org/freedesktop/UDisks2/"));
@@ -1942,7 +1946,9 @@ handle_command_smart_simulate (gint        *argc,
             {
               object = UDISKS_OBJECT (l->data);
               ata = udisks_object_peek_drive_ata (object);
-              if (ata != NULL)
+              nvme = udisks_object_peek_drive_nvme (object);
+              scsi = udisks_object_peek_drive_scsi (object);
+              if (ata != NULL || nvme != NULL || scsi != NULL)
                 {
                   const gchar * const *symlinks;
                   UDisksBlock *block;
@@ -1967,19 +1973,6 @@ handle_command_smart_simulate (gint        *argc,
       goto out;
     }
 
-  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
-  if (opt_smart_simulate_no_user_interaction)
-    {
-      g_variant_builder_add (&builder,
-                             "{sv}",
-                             "auth.no_user_interaction", g_variant_new_boolean (TRUE));
-    }
-  g_variant_builder_add (&builder,
-                         "{sv}",
-                         "atasmart_blob", g_variant_new_string (opt_smart_simulate_file));
-  options = g_variant_builder_end (&builder);
-  g_variant_ref_sink (options);
-
   if (opt_smart_simulate_object_path != NULL)
     {
       object = lookup_object_by_path (opt_smart_simulate_object_path);
@@ -2011,20 +2004,47 @@ handle_command_smart_simulate (gint        *argc,
       goto out;
     }
 
-  if (udisks_object_peek_drive_ata (object) == NULL)
+  ata = udisks_object_peek_drive_ata (object);
+  nvme = udisks_object_peek_drive_nvme (object);
+  scsi = udisks_object_peek_drive_scsi (object);
+  if (ata == NULL && nvme == NULL && scsi == NULL)
     {
-      g_printerr ("Device %s is not an ATA device\n",
+      g_printerr ("Device %s is not an ATA, NVMe or SCSI device\n",
                   udisks_block_get_device (udisks_object_peek_block (object)));
       g_object_unref (object);
       goto out;
     }
 
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  if (opt_smart_simulate_no_user_interaction)
+    {
+      g_variant_builder_add (&builder,
+                             "{sv}",
+                             "auth.no_user_interaction", g_variant_new_boolean (TRUE));
+    }
+  g_variant_builder_add (&builder,
+                         "{sv}",
+                         ata != NULL ? "atasmart_blob" : nvme != NULL ? "nvme_smart_blob" : "scsi_log_blob",
+                         g_variant_new_string (opt_smart_simulate_file));
+  options = g_variant_builder_end (&builder);
+  g_variant_ref_sink (options);
+
  try_again:
   error = NULL;
-  if (!udisks_drive_ata_call_smart_update_sync (udisks_object_peek_drive_ata (object),
-                                                options,
-                                                NULL,                       /* GCancellable */
-                                                &error))
+  if (!(ata != NULL ?
+        udisks_drive_ata_call_smart_update_sync (ata,
+                                                 options,
+                                                 NULL,                       /* GCancellable */
+                                                 &error) :
+        nvme != NULL ?
+        udisks_drive_nvme_call_smart_update_sync (nvme,
+                                                  options,
+                                                  NULL,                       /* GCancellable */
+                                                  &error) :
+        udisks_drive_scsi_call_smart_update_sync (scsi,
+                                                  options,
+                                                  NULL,                       /* GCancellable */
+                                                  &error)))
     {
       if (error->domain == UDISKS_ERROR &&
           error->code == UDISKS_ERROR_NOT_AUTHORIZED_CAN_OBTAIN &&